@@ -0,0 +1,115 @@
+#version 460 core
+
+// Tests world space bounds of every shape against the camera frustum and appends draw commands of the visible ones to
+// the indirect buffer consumed by the multi draw indirect count call.
+
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct DrawCommand
+{
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+struct ShapeBounds
+{
+    vec4 local_center;
+    vec4 local_extent;
+};
+
+struct Instance
+{
+    mat4 model_matrix;
+    mat4 normal_matrix;
+};
+
+layout(std140, binding = 0) uniform CullingData
+{
+    vec4 frustum_planes[6];
+    uint shape_count;
+    // When zero every shape keeps its slot and hidden ones get zero instances, used when draw count can't be read
+    // from a buffer.
+    uint compact_commands;
+};
+
+layout(std430, binding = 1) restrict readonly buffer Shapes
+{
+    ShapeBounds shapes[];
+};
+
+layout(std430, binding = 2) restrict readonly buffer Instances
+{
+    Instance instances[];
+};
+
+layout(std430, binding = 3) restrict readonly buffer AllCommands
+{
+    DrawCommand all_commands[];
+};
+
+layout(std430, binding = 4) restrict writeonly buffer ModelIndices
+{
+    uint model_indices[];
+};
+
+layout(std430, binding = 5) restrict writeonly buffer VisibleCommands
+{
+    DrawCommand visible_commands[];
+};
+
+layout(std430, binding = 6) restrict buffer DrawCount
+{
+    uint draw_count;
+};
+
+bool IsVisible(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 plane = frustum_planes[i];
+        float distance = dot(plane.xyz, center) + plane.w;
+        float radius = dot(abs(plane.xyz), extent);
+        if (distance + radius < 0.0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void main()
+{
+    uint shape_index = gl_GlobalInvocationID.x;
+    if (shape_index >= shape_count)
+    {
+        return;
+    }
+
+    mat4 model_matrix = instances[shape_index].model_matrix;
+    vec3 local_center = shapes[shape_index].local_center.xyz;
+    vec3 local_extent = shapes[shape_index].local_extent.xyz;
+    vec3 center = (model_matrix * vec4(local_center, 1.0)).xyz;
+    vec3 extent = abs(model_matrix[0].xyz) * local_extent.x + abs(model_matrix[1].xyz) * local_extent.y +
+                  abs(model_matrix[2].xyz) * local_extent.z;
+    // Shapes without instances are drawn by other passes, like the transparent ones.
+    bool is_visible = all_commands[shape_index].instance_count != 0u && IsVisible(center, extent);
+
+    if (compact_commands == 0)
+    {
+        DrawCommand command = all_commands[shape_index];
+        command.instance_count = is_visible ? 1u : 0u;
+        visible_commands[shape_index] = command;
+        model_indices[shape_index] = shape_index;
+        return;
+    }
+
+    if (is_visible)
+    {
+        uint slot = atomicAdd(draw_count, 1u);
+        visible_commands[slot] = all_commands[shape_index];
+        model_indices[slot] = shape_index;
+    }
+}
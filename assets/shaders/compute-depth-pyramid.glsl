@@ -0,0 +1,47 @@
+#version 460 core
+
+// Builds one level of the depth pyramid. Each texel stores the farthest depth of the 2x2 texels below it so a box that is
+// behind it is guaranteed to be hidden. First level is built from the depth buffer, the rest from the previous level.
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(std140, binding = 0) uniform PyramidLevel
+{
+    uint src_offset;
+    uint src_width;
+    uint src_height;
+    uint dst_offset;
+    uint dst_width;
+    uint dst_height;
+    uint read_depth_texture;
+};
+
+layout(binding = 0) uniform sampler2D depth_texture;
+
+layout(std430, binding = 1) restrict buffer DepthPyramid
+{
+    float depth_pyramid[];
+};
+
+float LoadDepth(ivec2 texel)
+{
+    texel = min(texel, ivec2(src_width - 1, src_height - 1));
+    if (read_depth_texture != 0)
+    {
+        return texelFetch(depth_texture, texel, 0).r;
+    }
+    return depth_pyramid[src_offset + texel.y * src_width + texel.x];
+}
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    if (dst.x >= dst_width || dst.y >= dst_height)
+    {
+        return;
+    }
+
+    ivec2 src = 2 * dst;
+    float depth = max(max(LoadDepth(src), LoadDepth(src + ivec2(1, 0))), max(LoadDepth(src + ivec2(0, 1)), LoadDepth(src + ivec2(1, 1))));
+    depth_pyramid[dst_offset + dst.y * dst_width + dst.x] = depth;
+}
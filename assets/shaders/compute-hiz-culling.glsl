@@ -0,0 +1,215 @@
+#version 460 core
+
+// Two phase occlusion culling. Phase zero appends shapes that are in the frustum and were visible last frame. Phase one
+// tests all shapes in the frustum against the depth pyramid built from the phase zero draws, appends the ones that became
+// visible and stores the visibility of every shape for the next frame.
+
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct DrawCommand
+{
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+struct ShapeBounds
+{
+    vec4 local_center;
+    vec4 local_extent;
+};
+
+struct Instance
+{
+    mat4 model_matrix;
+    mat4 normal_matrix;
+};
+
+const uint k_max_pyramid_levels = 16;
+
+layout(std140, binding = 0) uniform CullingData
+{
+    mat4 clip_from_world;
+    vec4 frustum_planes[6];
+    uint shape_count;
+    uint compact_commands;
+    uint phase;
+    uint pyramid_level_count;
+    uint screen_width;
+    uint screen_height;
+    // Offset, width and height of each pyramid level in the DepthPyramid buffer.
+    uvec4 pyramid_levels[k_max_pyramid_levels];
+};
+
+layout(std430, binding = 1) restrict readonly buffer Shapes
+{
+    ShapeBounds shapes[];
+};
+
+layout(std430, binding = 2) restrict readonly buffer Instances
+{
+    Instance instances[];
+};
+
+layout(std430, binding = 3) restrict readonly buffer AllCommands
+{
+    DrawCommand all_commands[];
+};
+
+layout(std430, binding = 4) restrict writeonly buffer ModelIndices
+{
+    uint model_indices[];
+};
+
+layout(std430, binding = 5) restrict writeonly buffer VisibleCommands
+{
+    DrawCommand visible_commands[];
+};
+
+layout(std430, binding = 6) restrict buffer DrawCount
+{
+    uint draw_count;
+};
+
+// One bit per shape, set if the shape was visible in the previous frame.
+layout(std430, binding = 7) restrict buffer Visibility
+{
+    uint visibility_bits[];
+};
+
+layout(std430, binding = 8) restrict readonly buffer DepthPyramid
+{
+    float depth_pyramid[];
+};
+
+bool IsInFrustum(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 plane = frustum_planes[i];
+        float distance = dot(plane.xyz, center) + plane.w;
+        float radius = dot(abs(plane.xyz), extent);
+        if (distance + radius < 0.0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+float LoadPyramidDepth(uint level, ivec2 texel)
+{
+    uvec4 desc = pyramid_levels[level];
+    texel = clamp(texel, ivec2(0), ivec2(desc.y - 1, desc.z - 1));
+    return depth_pyramid[desc.x + texel.y * desc.y + texel.x];
+}
+
+bool IsOccluded(vec3 center, vec3 extent)
+{
+    vec2 min_pixel = vec2(1e30);
+    vec2 max_pixel = vec2(-1e30);
+    float min_depth = 1.0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3 offset = vec3((corner & 1) != 0 ? 1.0 : -1.0, (corner & 2) != 0 ? 1.0 : -1.0, (corner & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = clip_from_world * vec4(center + offset * extent, 1.0);
+        if (clip.w <= 1e-3)
+        {
+            // The box crosses the camera plane so it can't be hidden.
+            return false;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 pixel = (ndc.xy * 0.5 + 0.5) * vec2(screen_width, screen_height);
+        min_pixel = min(min_pixel, pixel);
+        max_pixel = max(max_pixel, pixel);
+        min_depth = min(min_depth, ndc.z * 0.5 + 0.5);
+    }
+
+    ivec2 first_pixel = max(ivec2(floor(min_pixel)), ivec2(0));
+    ivec2 last_pixel = min(ivec2(floor(max_pixel)), ivec2(screen_width - 1, screen_height - 1));
+    if (any(greaterThan(first_pixel, last_pixel)))
+    {
+        return false;
+    }
+
+    // Level zero texel covers 2x2 pixels, pick the level where the box covers at most 2x2 texels.
+    ivec2 size = last_pixel - first_pixel + 1;
+    uint level = uint(max(0.0, ceil(log2(float(max(size.x, size.y)))) - 1.0));
+    level = min(level, pyramid_level_count - 1);
+    int shift = int(level) + 1;
+    ivec2 first_texel = first_pixel >> shift;
+    ivec2 last_texel = last_pixel >> shift;
+
+    float max_depth = 0.0;
+    for (int y = first_texel.y; y <= last_texel.y; y++)
+    {
+        for (int x = first_texel.x; x <= last_texel.x; x++)
+        {
+            max_depth = max(max_depth, LoadPyramidDepth(level, ivec2(x, y)));
+        }
+    }
+    return min_depth > max_depth;
+}
+
+void AppendCommand(uint shape_index, bool is_drawn)
+{
+    if (compact_commands == 0)
+    {
+        DrawCommand command = all_commands[shape_index];
+        command.instance_count = is_drawn ? 1u : 0u;
+        visible_commands[shape_index] = command;
+        model_indices[shape_index] = shape_index;
+        return;
+    }
+    if (is_drawn)
+    {
+        uint slot = atomicAdd(draw_count, 1u);
+        visible_commands[slot] = all_commands[shape_index];
+        model_indices[slot] = shape_index;
+    }
+}
+
+void main()
+{
+    uint shape_index = gl_GlobalInvocationID.x;
+    if (shape_index >= shape_count)
+    {
+        return;
+    }
+
+    mat4 model_matrix = instances[shape_index].model_matrix;
+    vec3 local_center = shapes[shape_index].local_center.xyz;
+    vec3 local_extent = shapes[shape_index].local_extent.xyz;
+    vec3 center = (model_matrix * vec4(local_center, 1.0)).xyz;
+    vec3 extent = abs(model_matrix[0].xyz) * local_extent.x + abs(model_matrix[1].xyz) * local_extent.y +
+                  abs(model_matrix[2].xyz) * local_extent.z;
+
+    uint word = shape_index >> 5;
+    uint bit = 1u << (shape_index & 31u);
+    bool was_visible = (visibility_bits[word] & bit) != 0;
+    // Shapes without instances are drawn by other passes, like the transparent ones.
+    bool is_in_frustum = all_commands[shape_index].instance_count != 0u && IsInFrustum(center, extent);
+
+    if (phase == 0)
+    {
+        AppendCommand(shape_index, is_in_frustum && was_visible);
+        return;
+    }
+
+    bool is_visible = is_in_frustum && !IsOccluded(center, extent);
+    // Shapes drawn in the first phase are already on the screen.
+    AppendCommand(shape_index, is_visible && !was_visible);
+    if (is_visible != was_visible)
+    {
+        if (is_visible)
+        {
+            atomicOr(visibility_bits[word], bit);
+        }
+        else
+        {
+            atomicAnd(visibility_bits[word], ~bit);
+        }
+    }
+}
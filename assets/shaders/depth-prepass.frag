@@ -0,0 +1,34 @@
+#version 460
+
+#extension GL_ARB_bindless_texture : require
+#extension GL_ARB_gpu_shader_int64 : enable
+
+// Fills the depth buffer ahead of the shading pass. Opaque shapes need no fragment work, alpha tested shapes only run the
+// alpha test so that the shading pass never has to discard.
+
+#ifdef USE_ALPHA_TEST
+#include "material-data.glsl"
+
+layout(std430, binding = 3) restrict readonly buffer Materials
+{
+    MaterialData in_materials[];
+};
+
+layout (location = 1) in vec2 in_tex_coords;
+layout (location = 3) in flat uint in_material_index;
+
+#include "alpha-test.glsl"
+#endif
+
+void main()
+{
+#ifdef USE_ALPHA_TEST
+    MaterialData mtl = in_materials[in_material_index];
+    float alpha = mtl.albedo_color.a;
+    if (mtl.albedo_map > 0)
+    {
+        alpha = texture(sampler2D(unpackUint2x32(mtl.albedo_map)), in_tex_coords).a;
+    }
+    RunAlphaTest(alpha, mtl.alpha_test);
+#endif
+}
@@ -16,6 +16,53 @@ layout(std430, binding = 3) restrict readonly buffer Materials
     MaterialData in_materials[];
 };
 
+#ifdef USE_MATERIAL_FEATURES
+// Program is compiled for one feature mask and only drawn with materials that have exactly these features, so the checks
+// are constant and the unused branches are compiled out. See ShaderPermutations::GetMaterialFeatures.
+#ifdef HAS_ALBEDO_MAP
+#define HasAlbedoMap(mtl) true
+#else
+#define HasAlbedoMap(mtl) false
+#endif
+#ifdef HAS_NORMAL_MAP
+#define HasNormalMap(mtl) true
+#else
+#define HasNormalMap(mtl) false
+#endif
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
+#define HasMetallicRoughnessMap(mtl) true
+#else
+#define HasMetallicRoughnessMap(mtl) false
+#endif
+#ifdef HAS_AMBIENT_OCCLUSION_MAP
+#define HasAmbientOcclusionMap(mtl) true
+#else
+#define HasAmbientOcclusionMap(mtl) false
+#endif
+#ifdef HAS_EMISSIVE_MAP
+#define HasEmissiveMap(mtl) true
+#else
+#define HasEmissiveMap(mtl) false
+#endif
+#ifdef HAS_ALPHA_TEST
+#define HasAlphaTest(mtl) true
+#else
+#define HasAlphaTest(mtl) false
+#endif
+#else
+#define HasAlbedoMap(mtl) (mtl.albedo_map > 0)
+#define HasNormalMap(mtl) (mtl.normal_map > 0)
+#define HasMetallicRoughnessMap(mtl) (mtl.metallic_roughness_map > 0)
+#define HasAmbientOcclusionMap(mtl) (mtl.ambient_occlusion_map > 0)
+#define HasEmissiveMap(mtl) (mtl.emissive_map > 0)
+#define HasAlphaTest(mtl) (mtl.alpha_test > 0.0)
+#endif
+
+#ifdef USE_DEPTH_PREPASS
+// Visibility is already resolved by the depth prepass so fragments can be rejected before shading
+layout(early_fragment_tests) in;
+#endif
+
 layout (location = 0) in vec3 in_normal_world;
 layout (location = 1) in vec2 in_tex_coords;
 layout (location = 2) in vec3 in_position_world;
@@ -37,23 +84,35 @@ void main()
 
     // Figure out albedo color
     vec4 albedo = mtl.albedo_color;
-    if (mtl.albedo_map > 0)
+    if (HasAlbedoMap(mtl))
     {
         albedo = texture(sampler2D(unpackUint2x32(mtl.albedo_map)), in_tex_coords);
     }
 
     // Figute out the normal
     vec3 normal_sample = vec3(0.0, 0.0, 0.0);
-    if (mtl.normal_map > 0)
+    if (HasNormalMap(mtl))
     {
         normal_sample = texture(sampler2D(unpackUint2x32(mtl.normal_map)), in_tex_coords).xyz;
     }
 
+    #ifdef USE_TRANSPARENCY
+    // Blended surfaces are drawn in their own pass and use the transparency factor instead of the alpha test
+    float alpha = albedo.a * mtl.transparency_factor;
+    #elif defined(USE_DEPTH_PREPASS)
+    // Alpha test already ran in the depth prepass, discarding here would turn off early depth testing
+    float alpha = albedo.a;
+    #else
     // If alpha test fails, discard the fragment
-    RunAlphaTest(albedo.a, mtl.alpha_test);
+    if (HasAlphaTest(mtl))
+    {
+        RunAlphaTest(albedo.a, mtl.alpha_test);
+    }
+    float alpha = albedo.a;
+    #endif
 
     vec3 normal_world = normalize(in_normal_world);
-    if (length(normal_sample) > 0.5)
+    if (HasNormalMap(mtl) && length(normal_sample) > 0.5)
     {
         normal_world = PerturbNormal(normal_world, normalize(camera_position_world - in_position_world), normal_sample, in_tex_coords);
     }
@@ -61,7 +120,7 @@ void main()
     #ifdef USE_PBR
     vec4 metal_roughness_sample = mtl.roughness;
     metal_roughness_sample.b = mtl.metallic_factor;
-    if (mtl.metallic_roughness_map > 0)
+    if (HasMetallicRoughnessMap(mtl))
     {
         metal_roughness_sample = texture(sampler2D(unpackUint2x32(mtl.metallic_roughness_map)), in_tex_coords);
     }
@@ -70,7 +129,7 @@ void main()
     #ifdef USE_AO
     // Ambient occlusion factor
     vec4 kao = vec4(0.0, 0.0, 0.0, 0.0);
-    if (mtl.ambient_occlusion_map > 0)
+    if (HasAmbientOcclusionMap(mtl))
     {
         kao = texture(sampler2D(unpackUint2x32(mtl.ambient_occlusion_map)), in_tex_coords);
     }
@@ -79,7 +138,7 @@ void main()
     #ifdef USE_EMISSIVE
     // Emissive color factor
     vec4 ke  = mtl.emissive_color;
-    if (mtl.emissive_map > 0)
+    if (HasEmissiveMap(mtl))
     {
         ke = texture(sampler2D(unpackUint2x32(mtl.emissive_map)), in_tex_coords);
     }
@@ -109,5 +168,5 @@ void main()
     color = pow(ke.rgb + color, vec3(1.0 / 2.2));
     #endif
 
-    out_frag_color = vec4(color, albedo.a);
+    out_frag_color = vec4(color, alpha);
 }
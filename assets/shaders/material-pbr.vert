@@ -31,6 +31,44 @@ layout(std430, binding = 2) restrict readonly buffer Instances
     Instance instances[];
 };
 
+#if defined(USE_INSTANCE_DATA)
+// Shapes sharing mesh and material are merged into one instanced draw, instances of a draw start at its base instance
+struct InstanceData
+{
+    uint model_index;
+    uint material_index;
+};
+
+layout(std430, binding = 4) restrict readonly buffer InstanceDataBuffer
+{
+    InstanceData instance_data[];
+};
+#elif defined(USE_INSTANCE_TRANSFORMS)
+// Each instance set is one instanced draw, transforms of its visible instances start at its base instance
+struct InstanceTransform
+{
+    vec3 position;
+    float scale;
+    vec4 rotation;
+};
+
+layout(std430, binding = 4) restrict readonly buffer InstanceTransforms
+{
+    InstanceTransform instance_transforms[];
+};
+
+layout(std430, binding = 5) restrict readonly buffer InstanceSetMaterials
+{
+    uint instance_set_materials[];
+};
+#else
+// Draw commands are compacted by culling so each draw looks up its instance
+layout(std430, binding = 4) restrict readonly buffer ModelIndices
+{
+    uint model_indices[];
+};
+#endif
+
 vec3 GetPosition(int i)
 {
     return vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
@@ -46,6 +84,17 @@ vec2 GetTexCoord(int i)
     return vec2(vertices[i].tex_coord[0], vertices[i].tex_coord[1]);
 }
 
+// Same rotation matrix as Scene::ToMatrix, quaternion is stored as (x, y, z, w)
+mat3 QuaternionToMatrix(vec4 q)
+{
+    return mat3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y),
+                2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x),
+                2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+}
+
+// Depth prepass and shading pass must produce bit identical depth for the depth-equal test to pass
+invariant gl_Position;
+
 layout (location = 0) out vec3 out_normal_world;
 layout (location = 1) out vec2 out_tex_coords;
 layout (location = 2) out vec3 out_position_world;
@@ -53,15 +102,35 @@ layout (location = 3) out flat uint out_material_index;
 
 void main()
 {
-    mat4 model_matrix = instances[gl_DrawID].model_matrix;
-    mat3 normal_matrix = mat3(instances[gl_DrawID].normal_matrix);
+#if defined(USE_INSTANCE_TRANSFORMS)
+    InstanceTransform instance = instance_transforms[gl_BaseInstance + gl_InstanceID];
+    uint material_index = instance_set_materials[gl_DrawID];
+    mat3 rotation = QuaternionToMatrix(instance.rotation);
+    mat4 model_matrix = mat4(vec4(rotation[0] * instance.scale, 0.0), vec4(rotation[1] * instance.scale, 0.0),
+                             vec4(rotation[2] * instance.scale, 0.0), vec4(instance.position, 1.0));
+    // Scale is uniform so the rotation alone transforms the normals
+    mat3 normal_matrix = rotation;
+#else
+#if defined(USE_INSTANCE_DATA)
+    InstanceData instance = instance_data[gl_BaseInstance + gl_InstanceID];
+    uint model_index = instance.model_index;
+    uint material_index = instance.material_index;
+#else
+    uint model_index = model_indices[gl_DrawID];
+    uint material_index = gl_BaseInstance;
+#endif
+    mat4 model_matrix = instances[model_index].model_matrix;
+    mat3 normal_matrix = mat3(instances[model_index].normal_matrix);
+#endif
 
     mat4 mvp = view_projection_transform * model_matrix;
     vec3 pos = GetPosition(gl_VertexID);
     gl_Position = mvp * vec4(pos, 1.0);
 
+#ifndef DEPTH_ONLY
     out_normal_world = normal_matrix * GetNormal(gl_VertexID);
     out_tex_coords = GetTexCoord(gl_VertexID);
     out_position_world = (model_matrix * vec4(pos, 1.0)).xyz;
-    out_material_index = gl_BaseInstance;
+    out_material_index = material_index;
+#endif
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 //
 #version 460 core
 
+#extension GL_ARB_bindless_texture : require
+#extension GL_ARB_gpu_shader_int64 : enable
+
 layout(std140, binding = 0) uniform PerFrameData
 {
     mat4 clip_from_world;
@@ -18,10 +21,22 @@ struct PerVertex
 };
 
 layout (location=0) in PerVertex vtx;
+layout (location=3) in flat uint in_draw_index;
+
+struct DrawData
+{
+    mat4 world_from_model;
+    uint64_t albedo_texture;
+    uint64_t padding;
+};
+
+layout(std430, binding = 2) restrict readonly buffer DrawDataBuffer
+{
+    DrawData in_draws[];
+};
 
 layout (location=0) out vec4 out_frag_color;
 
-layout (binding = 0) uniform sampler2D albedo_texture;
 layout (binding = 1) uniform sampler2D shadow_texture;
 
 // Percentage Closer Filtering
@@ -78,6 +93,7 @@ float LightFactor(vec3 world_position)
 
 void main()
 {
+    sampler2D albedo_texture = sampler2D(unpackUint2x32(in_draws[in_draw_index].albedo_texture));
     vec3 albedo = texture(albedo_texture, vtx.uv).xyz;
     out_frag_color = vec4(albedo * ShadowFactor(vtx.shadow_coord) * LightFactor(vtx.vertex_world_position), 1.0);
 }
@@ -1,6 +1,8 @@
 //
 #version 460 core
 
+#extension GL_ARB_gpu_shader_int64 : enable
+
 struct Vertex
 {
     float p[3];
@@ -13,9 +15,17 @@ layout(std430, binding = 1) restrict readonly buffer Vertices
     Vertex in_vertices[];
 };
 
-layout(std430, binding = 2) restrict readonly buffer Matrices
+// Written once per frame and shared with the shadow pass, each draw finds its data by its base instance
+struct DrawData
+{
+    mat4 world_from_model;
+    uint64_t albedo_texture;
+    uint64_t padding;
+};
+
+layout(std430, binding = 2) restrict readonly buffer DrawDataBuffer
 {
-    mat4 in_model_matrices[];
+    DrawData in_draws[];
 };
 
 layout(std140, binding = 0) uniform PerFrameData
@@ -45,6 +55,7 @@ struct PerVertex
 };
 
 layout (location=0) out PerVertex vtx;
+layout (location=3) out flat uint out_draw_index;
 
 // OpenGL's Z is in -1..1
 const mat4 scale_bias = mat4(
@@ -55,7 +66,7 @@ const mat4 scale_bias = mat4(
 
 void main()
 {
-    mat4 world_from_model = in_model_matrices[gl_BaseInstance];
+    mat4 world_from_model = in_draws[gl_BaseInstance].world_from_model;
     mat4 clip_from_model = clip_from_world * world_from_model;
 
     vec3 model_position = GetPosition(gl_VertexID);
@@ -67,4 +78,5 @@ void main()
     // that we need to scale it by 0.5 and add 0.5.
     vtx.shadow_coord = scale_bias * light_clip_from_world * world_from_model * vec4(model_position, 1.0);
     vtx.vertex_world_position = (world_from_model * vec4(model_position, 1.0)).xyz;
+    out_draw_index = gl_BaseInstance;
 }
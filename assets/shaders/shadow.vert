@@ -1,6 +1,8 @@
 //
 #version 460 core
 
+#extension GL_ARB_gpu_shader_int64 : enable
+
 struct Vertex
 {
     float p[3];
@@ -13,9 +15,17 @@ layout(std430, binding = 1) restrict readonly buffer Vertices
     Vertex in_vertices[];
 };
 
-layout(std430, binding = 2) restrict readonly buffer Matrices
+// Written once per frame and shared with the scene pass, each draw finds its data by its base instance
+struct DrawData
+{
+    mat4 world_from_model;
+    uint64_t albedo_texture;
+    uint64_t padding;
+};
+
+layout(std430, binding = 2) restrict readonly buffer DrawDataBuffer
 {
-    mat4 in_model_matrices[];
+    DrawData in_draws[];
 };
 
 layout(std140, binding = 0) uniform PerFrameData
@@ -32,7 +42,7 @@ layout (location=0) out vec4 out_model_position;
 
 void main()
 {
-    mat4 mvp = projection_view * in_model_matrices[0];
+    mat4 mvp = projection_view * in_draws[gl_BaseInstance].world_from_model;
     out_model_position = vec4(GetPosition(gl_VertexID), 1.0);
     gl_Position = mvp * vec4(GetPosition(gl_VertexID), 1.0);
 }
@@ -1,4 +1,12 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <numbers>
+#include <random>
+#include <thread>
 
 #include <gli/gli.hpp>
 
@@ -10,23 +18,246 @@
 #include "rndr/frames-per-second-counter.h"
 #include "rndr/input-layout-builder.h"
 #include "rndr/input.h"
+#include "rndr/log.h"
 #include "rndr/render-api.h"
 #include "rndr/renderer-base.h"
 #include "rndr/rndr.h"
 #include "rndr/trace.h"
 #include "rndr/window.h"
 
+#include "baked-draws.h"
+#include "bvh.h"
 #include "cube-map.h"
+#include "culling.h"
+#include "draw-keys.h"
+#include "draw-recording.h"
+#include "gpu-culling.h"
+#include "hiz-culling.h"
+#include "indirect-command-buffer.h"
+#include "loose-octree.h"
+#include "model-data.h"
+#include "occlusion-culling.h"
+#include "pipeline-statistics.h"
+#include "raycast.h"
+#include "ring-buffer.h"
 #include "scene.h"
+#include "shader-permutations.h"
+#include "visibility-cache.h"
 
-void Run();
+/**
+ * Options of the scene renderer set from the command line.
+ */
+struct SceneRendererOptions
+{
+    /** Cull and build draw commands of the opaque shapes in a compute shader instead of on the CPU. Transparent shapes are
+     * still culled and sorted on the CPU. */
+    bool use_gpu_culling = false;
+    /** Read the GPU culling output back every frame and compare it with the CPU frustum culling. */
+    bool validate_gpu_culling = false;
+    /** Draw last frame's visible shapes first and test the rest against the depth pyramid built from them. */
+    bool use_hiz_culling = false;
+    /** Reuse frustum culling results of the previous frames for shapes far from the frustum planes. */
+    bool use_visibility_cache = false;
+    /** Rasterize the largest static shapes on the CPU and drop the frustum culled shapes hidden behind them. Only used with
+     * CPU culling. */
+    bool use_occlusion_culling = false;
+    /** Merge visible shapes sharing mesh, LOD and material into instanced draws. Only used with CPU culling. */
+    bool use_instancing = false;
+    /** Sort visible draws by material, mesh and depth before submitting them. Only used with CPU culling. */
+    bool sort_draws = false;
+    /** Lay down depth before shading so that each visible pixel is shaded once. Only used with CPU culling. */
+    bool use_depth_prepass = false;
+    /** Keep draw commands of all shapes in a GPU buffer and upload only the ones that changed. Only used with CPU culling. */
+    bool use_indirect_buffer = false;
+    /** Periodically log the fragment shader invocations of the scene passes. */
+    bool report_pipeline_statistics = false;
+    /** Record sorted draws into this many command lists, prepared in parallel. Zero draws them without command lists. Implies
+     * sorting. */
+    u32 record_worker_count = 0;
+    /** Store the draw data derived from the scene in the scene file, so that the next start can skip deriving it. */
+    bool bake_draws = false;
+    /** Scatter this many instances of a few scene meshes as instance sets, drawn after the opaque shapes. Instances are
+     * always culled on the CPU, also with GPU culling. */
+    u32 instance_count = 0;
+    /** Draw each material with a fragment shader compiled for the features it uses instead of one shader that checks them
+     * per fragment. Implies sorting, so that draws are grouped by shader. */
+    bool use_shader_permutations = false;
+    /** Move this many shape nodes up and down every frame. Every other node is flagged as dynamic and goes to the loose
+     * octree, the rest stay in the BVH and are refitted. */
+    u32 animated_node_count = 0;
+};
 
-int main()
+bool ValidateOptions(const SceneRendererOptions& options);
+void Run(const SceneRendererOptions& options);
+void RunNormalTransformBenchmark();
+void RunLooseOctreeBenchmark();
+void RunDrawRecordingBenchmark();
+void RunRaycastBenchmark();
+bool RunGpuCullingTest();
+
+int main(int argc, char* argv[])
 {
     Rndr::Init({.enable_input_system = true, .enable_cpu_tracer = true});
-    Run();
+    i32 exit_code = 0;
+    if (argc > 1 && strcmp(argv[1], "--benchmark-normals") == 0)
+    {
+        RunNormalTransformBenchmark();
+    }
+    else if (argc > 1 && strcmp(argv[1], "--benchmark-octree") == 0)
+    {
+        RunLooseOctreeBenchmark();
+    }
+    else if (argc > 1 && strcmp(argv[1], "--benchmark-recording") == 0)
+    {
+        RunDrawRecordingBenchmark();
+    }
+    else if (argc > 1 && strcmp(argv[1], "--benchmark-raycast") == 0)
+    {
+        RunRaycastBenchmark();
+    }
+    else if (argc > 1 && strcmp(argv[1], "--test-gpu-culling") == 0)
+    {
+        exit_code = RunGpuCullingTest() ? 0 : 1;
+    }
+    else
+    {
+        SceneRendererOptions options;
+        for (i32 i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--gpu-culling") == 0)
+            {
+                options.use_gpu_culling = true;
+            }
+            else if (strcmp(argv[i], "--validate-gpu-culling") == 0)
+            {
+                options.use_gpu_culling = true;
+                options.validate_gpu_culling = true;
+            }
+            else if (strcmp(argv[i], "--visibility-cache") == 0)
+            {
+                options.use_visibility_cache = true;
+            }
+            else if (strcmp(argv[i], "--occlusion-culling") == 0)
+            {
+                options.use_occlusion_culling = true;
+            }
+            else if (strcmp(argv[i], "--hiz-culling") == 0)
+            {
+                options.use_gpu_culling = true;
+                options.use_hiz_culling = true;
+            }
+            else if (strcmp(argv[i], "--instancing") == 0)
+            {
+                options.use_instancing = true;
+            }
+            else if (strcmp(argv[i], "--sort-draws") == 0)
+            {
+                options.sort_draws = true;
+            }
+            else if (strcmp(argv[i], "--depth-prepass") == 0)
+            {
+                options.use_depth_prepass = true;
+            }
+            else if (strcmp(argv[i], "--indirect-buffer") == 0)
+            {
+                options.use_indirect_buffer = true;
+            }
+            else if (strcmp(argv[i], "--pipeline-statistics") == 0)
+            {
+                options.report_pipeline_statistics = true;
+            }
+            else if (strcmp(argv[i], "--record-workers") == 0 && i + 1 < argc)
+            {
+                options.record_worker_count = static_cast<u32>(std::max(atoi(argv[++i]), 1));
+                options.sort_draws = true;
+            }
+            else if (strcmp(argv[i], "--bake-draws") == 0)
+            {
+                options.bake_draws = true;
+            }
+            else if (strcmp(argv[i], "--shader-permutations") == 0)
+            {
+                options.use_shader_permutations = true;
+                options.sort_draws = true;
+            }
+            else if (strcmp(argv[i], "--instance-sets") == 0 && i + 1 < argc)
+            {
+                options.instance_count = static_cast<u32>(std::max(atoi(argv[++i]), 0));
+            }
+            else if (strcmp(argv[i], "--animate-nodes") == 0 && i + 1 < argc)
+            {
+                options.animated_node_count = static_cast<u32>(std::max(atoi(argv[++i]), 0));
+            }
+        }
+        if (ValidateOptions(options))
+        {
+            Run(options);
+        }
+        else
+        {
+            exit_code = 1;
+        }
+    }
     Rndr::Destroy();
-    return 0;
+    return exit_code;
+}
+
+/**
+ * Checks that the command line options can be used together. Each pass supports only some of the options, so combinations
+ * that would have a pass silently skip an option are rejected instead.
+ * @param options Options parsed from the command line.
+ * @return True if the options are compatible, false otherwise.
+ */
+bool ValidateOptions(const SceneRendererOptions& options)
+{
+    bool is_valid = true;
+    if (options.use_gpu_culling)
+    {
+        if (options.use_occlusion_culling)
+        {
+            RNDR_LOG_ERROR("--occlusion-culling requires CPU culling, it can't be combined with --gpu-culling or --hiz-culling");
+            is_valid = false;
+        }
+        if (options.use_instancing)
+        {
+            RNDR_LOG_ERROR("--instancing requires CPU culling, it can't be combined with --gpu-culling or --hiz-culling");
+            is_valid = false;
+        }
+        if (options.use_depth_prepass)
+        {
+            RNDR_LOG_ERROR("--depth-prepass requires CPU culling, it can't be combined with --gpu-culling or --hiz-culling");
+            is_valid = false;
+        }
+        if (options.sort_draws)
+        {
+            RNDR_LOG_ERROR("--sort-draws, --record-workers and --shader-permutations require CPU culling, they can't be "
+                           "combined with --gpu-culling or --hiz-culling");
+            is_valid = false;
+        }
+        if (options.use_indirect_buffer)
+        {
+            RNDR_LOG_ERROR("--indirect-buffer requires CPU culling, it can't be combined with --gpu-culling or --hiz-culling");
+            is_valid = false;
+        }
+    }
+    if (options.use_depth_prepass && (options.use_instancing || options.sort_draws))
+    {
+        RNDR_LOG_ERROR("--depth-prepass draws in the culling order, it can't be combined with --instancing, --sort-draws, "
+                       "--record-workers or --shader-permutations");
+        is_valid = false;
+    }
+    if (options.use_instancing && (options.use_shader_permutations || options.record_worker_count > 0))
+    {
+        RNDR_LOG_ERROR("--shader-permutations and --record-workers only apply to sorted draws, they can't be combined with --instancing");
+        is_valid = false;
+    }
+    if (options.use_indirect_buffer && (options.use_depth_prepass || options.use_instancing || options.sort_draws))
+    {
+        RNDR_LOG_ERROR("--indirect-buffer replaces the default CPU culled draw only, it can't be combined with --depth-prepass, "
+                       "--instancing, --sort-draws, --record-workers or --shader-permutations");
+        is_valid = false;
+    }
+    return is_valid;
 }
 
 struct PerFrameData
@@ -35,16 +266,11 @@ struct PerFrameData
     Rndr::Point3f camera_position_world;
 };
 
-struct ModelData
-{
-    Rndr::Matrix4x4f model_transform;
-    Rndr::Matrix4x4f normal_transform;
-};
-
 class SceneRenderer : public Rndr::RendererBase
 {
 public:
-    SceneRenderer(const Opal::StringUtf8& name, const Rndr::RendererBaseDesc& desc) : Rndr::RendererBase(name, desc)
+    SceneRenderer(const Opal::StringUtf8& name, const Rndr::RendererBaseDesc& desc, const SceneRendererOptions& options)
+        : Rndr::RendererBase(name, desc), m_options(options)
     {
         using namespace Rndr;
 
@@ -52,18 +278,41 @@ public:
         const Opal::StringUtf8 k_scene_path = Opal::Paths::Combine(nullptr, k_asset_path, "exterior.rndrscene").GetValue();
         const Opal::StringUtf8 k_mesh_path = Opal::Paths::Combine(nullptr, k_asset_path, "exterior.rndrmesh").GetValue();
         const Opal::StringUtf8 k_mat_path = Opal::Paths::Combine(nullptr, k_asset_path, "exterior.rndrmat").GetValue();
-        const bool is_data_loaded = Scene::ReadScene(m_scene_data, k_scene_path, k_mesh_path, k_mat_path, desc.graphics_context);
+        // Shapes, draw commands and model data come from the scene file if they were baked into it, otherwise they are
+        // derived from the scene and can be baked for the next start
+        BakedDrawData baked_draws;
+        const bool is_data_loaded = Scene::ReadSceneWithBakedDraws(m_scene_data, baked_draws, k_scene_path, k_mesh_path, k_mat_path,
+                                                                   desc.graphics_context, &m_load_stats);
         if (!is_data_loaded)
         {
             RNDR_HALT("Failed to load mesh data from file!");
             return;
         }
+        RNDR_LOG_INFO("Scene loaded: read files %.3f ms, hash %.3f ms, build %.3f ms, baked draws %s", m_load_stats.read_files_time_ms,
+                      m_load_stats.hash_time_ms, m_load_stats.build_time_ms,
+                      m_load_stats.is_baked ? "used" : (m_load_stats.is_stale ? "stale" : "missing"));
+        if (m_options.bake_draws && !m_load_stats.is_baked)
+        {
+            if (Scene::WriteSceneWithBakedDraws(m_scene_data, baked_draws, k_scene_path))
+            {
+                RNDR_LOG_INFO("Baked draws of %zu shapes written to %s", baked_draws.shapes.GetSize(), k_scene_path.GetData());
+            }
+            else
+            {
+                RNDR_LOG_WARNING("Failed to write baked draws to %s", k_scene_path.GetData());
+            }
+        }
 
         // Setup shaders
         const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
         const Opal::StringUtf8 vertex_shader_code = Rndr::File::ReadShader(shader_dir, "material-pbr.vert");
         const Opal::StringUtf8 fragment_shader_code = Rndr::File::ReadShader(shader_dir, "material-pbr.frag");
-        m_vertex_shader = Shader(desc.graphics_context, {.type = ShaderType::Vertex, .source = vertex_shader_code});
+        ShaderDesc vertex_shader_desc{.type = ShaderType::Vertex, .source = vertex_shader_code};
+        if (m_options.use_instancing)
+        {
+            vertex_shader_desc.defines.PushBack("USE_INSTANCE_DATA");
+        }
+        m_vertex_shader = Shader(desc.graphics_context, vertex_shader_desc);
         RNDR_ASSERT(m_vertex_shader.IsValid());
         m_pixel_shader =
             Shader(desc.graphics_context, {.type = ShaderType::Fragment, .source = fragment_shader_code, .defines = {"USE_PBR"}});
@@ -86,92 +335,1104 @@ public:
                                 Opal::AsBytes(m_scene_data.mesh_data.index_buffer_data));
         RNDR_ASSERT(m_index_buffer.IsValid());
 
-        // Setup model transforms buffer
-        Opal::DynamicArray<ModelData> model_transforms_data(m_scene_data.shapes.GetSize());
-        for (int i = 0; i < m_scene_data.shapes.GetSize(); i++)
+        // Setup model transforms buffer, it is kept in sync with the scene in Render
+        if (!Scene::SetupModelDataSync(m_model_data_sync, m_scene_data, desc.graphics_context,
+                                       Opal::ArrayView<const ModelData>(baked_draws.model_data)))
+        {
+            RNDR_HALT("Failed to setup model data buffer!");
+            return;
+        }
+
+        // Setup culling data and the buffer with model indices of the visible shapes
+        if (!Culling::SetupShapeBounds(m_shape_bounds, m_scene_data))
+        {
+            RNDR_HALT("Failed to setup shape bounds!");
+            return;
+        }
+        // Dynamic flags of the animated nodes decide where their shapes go in the spatial structures
+        SetupAnimatedNodes();
+        if (!SetupSpatialStructures())
+        {
+            RNDR_HALT("Failed to setup spatial structures!");
+            return;
+        }
+        if (m_options.use_occlusion_culling &&
+            (!Culling::SetupOcclusionBuffer(m_occlusion_buffer, {}) || !Culling::SelectOccluders(m_occlusion_buffer, m_scene_data, m_shape_bounds)))
+        {
+            RNDR_HALT("Failed to setup occlusion culling!");
+            return;
+        }
+        // Instances are tested with the same frustum test as the shapes, but stay out of the spatial structures
+        if (m_options.instance_count > 0 && (!SetupInstanceSets() || !Culling::SetupInstanceSetBounds(m_instance_set_bounds, m_scene_data)))
+        {
+            RNDR_HALT("Failed to setup instance sets!");
+            return;
+        }
+        // With GPU culling the buffer is written by the compute shader and only read back for validation. With CPU culling
+        // the draws read model indices from the frame ring buffer instead. With instancing there is one InstanceData per
+        // visible shape instead of one model index per draw.
+        const size_t model_indices_stride = m_options.use_instancing ? sizeof(InstanceData) : sizeof(u32);
+        const size_t model_indices_size = m_scene_data.shapes.GetSize() * model_indices_stride;
+        const Usage model_indices_usage = m_options.validate_gpu_culling ? Usage::ReadBack : Usage::Default;
+        // Indirect buffer draws all shapes in the shape order, so the model index of each draw is the draw ID
+        Opal::DynamicArray<u32> identity_model_indices;
+        if (m_options.use_indirect_buffer)
+        {
+            identity_model_indices.Resize(m_scene_data.shapes.GetSize());
+            for (u32 i = 0; i < identity_model_indices.GetSize(); ++i)
+            {
+                identity_model_indices[i] = i;
+            }
+        }
+        m_model_indices_buffer = Buffer(desc.graphics_context,
+                                        {.type = BufferType::ShaderStorage,
+                                         .usage = model_indices_usage,
+                                         .size = model_indices_size,
+                                         .stride = model_indices_stride},
+                                        Opal::AsBytes(identity_model_indices));
+        RNDR_ASSERT(m_model_indices_buffer.IsValid());
+
+        m_material_buffer = Buffer(desc.graphics_context, Opal::ArrayView<const MaterialDescription>(m_scene_data.materials),
+                                   BufferType::ShaderStorage, Usage::Dynamic);
+        RNDR_ASSERT(m_material_buffer.IsValid());
+
+        // Camera info and model indices of the visible shapes are written to a persistently mapped ring buffer every frame.
+        // A frame writes per frame data, at most three model index arrays: opaque or instanced, alpha tested and transparent
+        // draws, and the transforms of the visible instances of the instance sets. With shader permutations the sorted draws
+        // write a model index slice per permutation in each of the opaque and alpha tested passes instead of one array.
+        // Recorded draws write one InstanceData per draw, twice the size of the model indices, in place of those two arrays.
+        constexpr size_t k_allocation_alignment = 256;
+        const size_t allocation_count = 5 + (m_options.use_shader_permutations ? 2 * ShaderPermutationCache::k_feature_mask_count : 0);
+        const size_t instance_transforms_size = m_options.instance_count * sizeof(InstanceTransform);
+        const RingBufferDesc ring_buffer_desc{.frame_size = sizeof(PerFrameData) + 3 * model_indices_size + instance_transforms_size +
+                                                            allocation_count * k_allocation_alignment};
+        if (!GpuMemory::SetupRingBuffer(m_frame_ring_buffer, m_desc.graphics_context, ring_buffer_desc))
+        {
+            RNDR_HALT("Failed to setup the frame ring buffer!");
+            return;
+        }
+
+        // Describe what buffers are bound to what slots. No need to describe data layout since we are using vertex pulling.
+        const Rndr::InputLayoutDesc input_layout_desc = Rndr::InputLayoutBuilder()
+                                                            .AddShaderStorage(m_vertex_buffer, 1)
+                                                            .AddShaderStorage(m_model_data_sync.buffer, 2)
+                                                            .AddShaderStorage(m_material_buffer, 3)
+                                                            .AddShaderStorage(m_model_indices_buffer, 4)
+                                                            .AddIndexBuffer(m_index_buffer)
+                                                            .Build();
+        // Recorded draws bind their pipelines inside the command lists, so the instance data slot is left out of their layout
+        // and the instance data bound from the ring buffer before the lists are submitted stays bound
+        const Rndr::InputLayoutDesc recorded_input_layout_desc = Rndr::InputLayoutBuilder()
+                                                                     .AddShaderStorage(m_vertex_buffer, 1)
+                                                                     .AddShaderStorage(m_model_data_sync.buffer, 2)
+                                                                     .AddShaderStorage(m_material_buffer, 3)
+                                                                     .AddIndexBuffer(m_index_buffer)
+                                                                     .Build();
+
+        // Setup pipeline object.
+        m_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_vertex_shader,
+                                                      .pixel_shader = &m_pixel_shader,
+                                                      .input_layout = input_layout_desc,
+                                                      .rasterizer = {.fill_mode = FillMode::Solid},
+                                                      .depth_stencil = {.is_depth_enabled = true}});
+        RNDR_ASSERT(m_pipeline.IsValid());
+
+        // Transparent pass always reads model indices, even if the opaque pass uses instance data, and blends instead of
+        // using the screen door alpha test
+        m_transparent_vertex_shader = Shader(desc.graphics_context, {.type = ShaderType::Vertex, .source = vertex_shader_code});
+        RNDR_ASSERT(m_transparent_vertex_shader.IsValid());
+        m_transparent_pixel_shader = Shader(desc.graphics_context,
+                                            {.type = ShaderType::Fragment, .source = fragment_shader_code, .defines = {"USE_PBR", "USE_TRANSPARENCY"}});
+        RNDR_ASSERT(m_transparent_pixel_shader.IsValid());
+        m_transparent_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_transparent_vertex_shader,
+                                                                  .pixel_shader = &m_transparent_pixel_shader,
+                                                                  .input_layout = input_layout_desc,
+                                                                  .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                  .blend = {.is_enabled = true,
+                                                                            .src_color_factor = BlendFactor::SrcAlpha,
+                                                                            .dst_color_factor = BlendFactor::InvSrcAlpha,
+                                                                            .src_alpha_factor = BlendFactor::One,
+                                                                            .dst_alpha_factor = BlendFactor::InvSrcAlpha},
+                                                                  .depth_stencil = {.is_depth_enabled = true, .depth_mask = DepthMask::None}});
+        RNDR_ASSERT(m_transparent_pipeline.IsValid());
+
+        // Recorded draws look up model and material through instance data, since every command list restarts the draw IDs
+        if (m_options.record_worker_count > 0)
+        {
+            m_instance_data_vertex_shader =
+                Shader(desc.graphics_context, {.type = ShaderType::Vertex, .source = vertex_shader_code, .defines = {"USE_INSTANCE_DATA"}});
+            RNDR_ASSERT(m_instance_data_vertex_shader.IsValid());
+            m_recorded_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_instance_data_vertex_shader,
+                                                                   .pixel_shader = &m_pixel_shader,
+                                                                   .input_layout = recorded_input_layout_desc,
+                                                                   .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                   .depth_stencil = {.is_depth_enabled = true}});
+            RNDR_ASSERT(m_recorded_pipeline.IsValid());
+        }
+
+        // Materials are bucketed by the features they use and each bucket gets a fragment shader without the code of the
+        // features it doesn't use, so the common albedo only material doesn't pay for normal, metallic roughness or alpha test
+        // checks. Recorded draws read instance data, so their permutations use the matching vertex shader.
+        if (m_options.use_shader_permutations)
+        {
+            const ShaderPermutationCacheDesc permutation_desc{
+                .fragment_source = fragment_shader_code,
+                .defines = {"USE_PBR"},
+                .pipeline_desc = {.vertex_shader = m_options.record_worker_count > 0 ? &m_instance_data_vertex_shader : &m_vertex_shader,
+                                  .input_layout = m_options.record_worker_count > 0 ? recorded_input_layout_desc : input_layout_desc,
+                                  .rasterizer = {.fill_mode = FillMode::Solid},
+                                  .depth_stencil = {.is_depth_enabled = true}}};
+            if (!ShaderPermutations::SetupShaderPermutationCache(m_shader_permutations, permutation_desc) ||
+                !ShaderPermutations::AssignMaterialPermutations(m_material_permutations, m_shader_permutations, desc.graphics_context,
+                                                                Opal::ArrayView<const MaterialDescription>(m_scene_data.materials)))
+            {
+                RNDR_HALT("Failed to setup shader permutations!");
+                return;
+            }
+            for (const ShaderPermutation& permutation : m_shader_permutations.permutations)
+            {
+                m_permutation_pipelines.PushBack(&permutation.pipeline);
+            }
+            RNDR_LOG_INFO("Shader permutations: %zu programs for %zu materials, compiled in %.3f ms",
+                          m_shader_permutations.permutations.GetSize(), m_scene_data.materials.GetSize(),
+                          m_shader_permutations.stats.compile_time_ms);
+        }
+
+        // Instance sets read compact transforms instead of the model data and find the material of their set by the draw ID,
+        // since the base instance points to the transforms
+        if (!m_scene_data.instance_sets.IsEmpty())
+        {
+            Opal::DynamicArray<u32> set_materials;
+            for (const InstanceSet& set : m_scene_data.instance_sets)
+            {
+                set_materials.PushBack(set.material_index);
+            }
+            m_instance_set_material_buffer = Buffer(desc.graphics_context,
+                                                    {.type = BufferType::ShaderStorage,
+                                                     .usage = Usage::Default,
+                                                     .size = set_materials.GetSize() * sizeof(u32),
+                                                     .stride = sizeof(u32)},
+                                                    Opal::AsBytes(set_materials));
+            RNDR_ASSERT(m_instance_set_material_buffer.IsValid());
+            const Rndr::InputLayoutDesc instance_set_input_layout_desc = Rndr::InputLayoutBuilder()
+                                                                             .AddShaderStorage(m_vertex_buffer, 1)
+                                                                             .AddShaderStorage(m_material_buffer, 3)
+                                                                             .AddShaderStorage(m_instance_set_material_buffer, 5)
+                                                                             .AddIndexBuffer(m_index_buffer)
+                                                                             .Build();
+            m_instance_set_vertex_shader = Shader(desc.graphics_context,
+                                                  {.type = ShaderType::Vertex, .source = vertex_shader_code, .defines = {"USE_INSTANCE_TRANSFORMS"}});
+            RNDR_ASSERT(m_instance_set_vertex_shader.IsValid());
+            m_instance_set_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_instance_set_vertex_shader,
+                                                                       .pixel_shader = &m_pixel_shader,
+                                                                       .input_layout = instance_set_input_layout_desc,
+                                                                       .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                       .depth_stencil = {.is_depth_enabled = true}});
+            RNDR_ASSERT(m_instance_set_pipeline.IsValid());
+            if (!IndirectCommands::SetupIndirectCommandBuffer(m_instance_set_command_buffer, desc.graphics_context,
+                                                              static_cast<u32>(m_scene_data.instance_sets.GetSize())))
+            {
+                RNDR_HALT("Failed to setup the instance set command buffer!");
+                return;
+            }
+        }
+
+        // Depth prepass writes depth of the opaque shapes with a position only vertex shader and of the alpha tested shapes
+        // with a shader that only runs the alpha test. Shading pass then tests for equal depth and never discards, so each
+        // visible pixel is shaded once. Color written by the prepass is always overwritten by the shading pass.
+        if (m_options.use_depth_prepass)
+        {
+            const Opal::StringUtf8 prepass_shader_code = Rndr::File::ReadShader(shader_dir, "depth-prepass.frag");
+            m_depth_only_vertex_shader =
+                Shader(desc.graphics_context, {.type = ShaderType::Vertex, .source = vertex_shader_code, .defines = {"DEPTH_ONLY"}});
+            RNDR_ASSERT(m_depth_only_vertex_shader.IsValid());
+            m_depth_prepass_pixel_shader = Shader(desc.graphics_context, {.type = ShaderType::Fragment, .source = prepass_shader_code});
+            RNDR_ASSERT(m_depth_prepass_pixel_shader.IsValid());
+            m_alpha_tested_prepass_pixel_shader =
+                Shader(desc.graphics_context, {.type = ShaderType::Fragment, .source = prepass_shader_code, .defines = {"USE_ALPHA_TEST"}});
+            RNDR_ASSERT(m_alpha_tested_prepass_pixel_shader.IsValid());
+            m_depth_equal_pixel_shader = Shader(desc.graphics_context, {.type = ShaderType::Fragment,
+                                                                        .source = fragment_shader_code,
+                                                                        .defines = {"USE_PBR", "USE_DEPTH_PREPASS"}});
+            RNDR_ASSERT(m_depth_equal_pixel_shader.IsValid());
+
+            m_depth_prepass_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_depth_only_vertex_shader,
+                                                                        .pixel_shader = &m_depth_prepass_pixel_shader,
+                                                                        .input_layout = input_layout_desc,
+                                                                        .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                        .depth_stencil = {.is_depth_enabled = true}});
+            RNDR_ASSERT(m_depth_prepass_pipeline.IsValid());
+            m_alpha_tested_prepass_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_vertex_shader,
+                                                                               .pixel_shader = &m_alpha_tested_prepass_pixel_shader,
+                                                                               .input_layout = input_layout_desc,
+                                                                               .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                               .depth_stencil = {.is_depth_enabled = true}});
+            RNDR_ASSERT(m_alpha_tested_prepass_pipeline.IsValid());
+            m_depth_equal_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_vertex_shader,
+                                                                      .pixel_shader = &m_depth_equal_pixel_shader,
+                                                                      .input_layout = input_layout_desc,
+                                                                      .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                      .depth_stencil = {.is_depth_enabled = true,
+                                                                                        .depth_mask = DepthMask::None,
+                                                                                        .depth_comparator = Comparator::Equal}});
+            RNDR_ASSERT(m_depth_equal_pipeline.IsValid());
+        }
+        if (m_options.report_pipeline_statistics)
+        {
+            PipelineStatistics::SetupFragmentInvocationQuery(m_fragment_invocation_query, m_desc.graphics_context);
+        }
+
+        const Opal::StringUtf8 env_map_image_path = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "piazza_bologni_1k.hdr").GetValue();
+        m_env_map_image = LoadImage(TextureType::CubeMap, env_map_image_path);
+        RNDR_ASSERT(m_env_map_image.IsValid());
+
+        const Opal::StringUtf8 irradiance_map_image_path =
+            Opal::Paths::Combine(nullptr, ASSETS_ROOT, "piazza_bologni_1k_irradience.hdr").GetValue();
+        m_irradiance_map_image = LoadImage(TextureType::CubeMap, irradiance_map_image_path);
+        RNDR_ASSERT(m_irradiance_map_image.IsValid());
+
+        const Opal::StringUtf8 brdf_lut_image_path = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "brdf-lut.ktx").GetValue();
+        m_brdf_lut_image = LoadImage(TextureType::Texture2D, brdf_lut_image_path);
+
+        // Draw commands of all shapes were loaded or baked with the scene, culling picks the visible ones every frame
+        m_draw_commands = Opal::Move(baked_draws.draw_commands);
+        if (m_options.use_gpu_culling)
+        {
+            // GPU culling only draws the opaque shapes, transparent ones are culled on the CPU and blended after them
+            m_gpu_draw_commands = m_draw_commands;
+            for (u32 i = 0; i < m_scene_data.shapes.GetSize(); ++i)
+            {
+                if (DrawList::IsTransparent(m_scene_data.materials[m_scene_data.shapes[i].material_index]))
+                {
+                    m_gpu_draw_commands[i].instance_count = 0;
+                    m_transparent_shapes.PushBack(i);
+                }
+            }
+            if (!Culling::SetupGpuCulling(m_gpu_culling, m_scene_data, Opal::ArrayView<const Rndr::DrawIndicesData>(m_gpu_draw_commands),
+                                          desc.graphics_context, {.enable_read_back = m_options.validate_gpu_culling}))
+            {
+                RNDR_HALT("Failed to setup GPU culling!");
+                return;
+            }
+        }
+        if (m_options.use_hiz_culling && !SetupHizCulling())
+        {
+            RNDR_HALT("Failed to setup Hi-Z culling!");
+            return;
+        }
+        if (m_options.use_indirect_buffer)
+        {
+            m_indirect_commands = m_draw_commands;
+            if (!IndirectCommands::SetupIndirectCommandBuffer(m_indirect_command_buffer, desc.graphics_context,
+                                                              static_cast<u32>(m_draw_commands.GetSize())))
+            {
+                RNDR_HALT("Failed to setup the indirect command buffer!");
+                return;
+            }
+        }
+    }
+
+    ~SceneRenderer()
+    {
+        PipelineStatistics::DestroyFragmentInvocationQuery(m_fragment_invocation_query, m_desc.graphics_context);
+        GpuMemory::DestroyRingBuffer(m_frame_ring_buffer, m_desc.graphics_context);
+    }
+
+    bool Render() override
+    {
+        RNDR_CPU_EVENT_SCOPED("Mesh rendering");
+
+        GpuMemory::BeginFrame(m_frame_ring_buffer, m_desc.graphics_context);
+        const bool is_rendered = RenderFrame();
+        GpuMemory::EndFrame(m_frame_ring_buffer, m_desc.graphics_context);
+        return is_rendered;
+    }
+
+    bool RenderFrame()
+    {
+        AnimateNodes();
+
+        // Upload model data only for the shapes whose nodes moved since the last frame
+        Scene::RecalculateWorldTransforms(m_scene_data.scene_description);
+        Scene::SyncModelData(m_model_data_sync, m_scene_data.scene_description, m_desc.graphics_context);
+
+        // Bounds of the moved shapes are recalculated as well so that culling sees the new positions
+        const Opal::ArrayView<const u32> moved_shapes(m_model_data_sync.dirty_shapes);
+        Culling::UpdateShapeBounds(m_shape_bounds, m_scene_data, moved_shapes);
+        Culling::RefitBvh(m_shape_bvh, m_shape_bounds, moved_shapes);
+        for (const u32 shape : m_model_data_sync.dirty_shapes)
+        {
+            if (Culling::ContainsObject(m_dynamic_shapes, shape))
+            {
+                const f32 center[3] = {m_shape_bounds.center_x[shape], m_shape_bounds.center_y[shape], m_shape_bounds.center_z[shape]};
+                const f32 extent[3] = {m_shape_bounds.extent_x[shape], m_shape_bounds.extent_y[shape], m_shape_bounds.extent_z[shape]};
+                Culling::MoveObject(m_dynamic_shapes, shape, center, extent);
+            }
+        }
+        if (!m_raycast_scene.mesh_bvhs.IsEmpty())
+        {
+            Scene::UpdateRaycastScene(m_raycast_scene, m_scene_data, moved_shapes);
+        }
+
+        // Rotate the mesh
+        const Rndr::Matrix4x4f t = Opal::Scale(0.1f);
+        const Rndr::Matrix4x4f clip_from_world = m_camera_transform * t;
+        const Rndr::Matrix4x4f mvp = Opal::Transpose(clip_from_world);
+        PerFrameData per_frame_data = {.view_projection = mvp, .camera_position_world = m_camera_position};
+        m_per_frame_allocation = GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(per_frame_data));
+        if (m_per_frame_allocation.data == nullptr)
+        {
+            return false;
+        }
+
+        if (m_pick_requested)
+        {
+            m_pick_requested = false;
+            PickCenterShape(clip_from_world);
+        }
+
+        if (m_options.use_hiz_culling)
+        {
+            return RenderHizCulled(clip_from_world);
+        }
+        if (m_options.use_gpu_culling)
+        {
+            return RenderGpuCulled(clip_from_world);
+        }
+
+        if (m_options.use_visibility_cache)
+        {
+            RNDR_CPU_EVENT_SCOPED("Frustum culling");
+            Culling::CullShapesCached(m_culling_result, m_visibility_cache, Culling::ExtractFrustum(clip_from_world), m_shape_bounds,
+                                      Opal::ArrayView<const Rndr::DrawIndicesData>(m_draw_commands), moved_shapes);
+            if (m_visibility_cache.stats.was_full_revalidation)
+            {
+                RNDR_LOG_DEBUG("Visibility cache: hit rate %.2f, tested %llu shapes, saved %.3f ms", m_visibility_cache.stats.hit_rate,
+                               m_visibility_cache.stats.tested_count, m_visibility_cache.stats.saved_time_ms);
+            }
+        }
+        else
+        {
+            RNDR_CPU_EVENT_SCOPED("Frustum culling");
+            Culling::CullShapes(m_culling_result, m_shape_bvh, m_dynamic_shapes, Culling::ExtractFrustum(clip_from_world), m_shape_bounds,
+                                Opal::ArrayView<const Rndr::DrawIndicesData>(m_draw_commands));
+        }
+        if (m_options.use_occlusion_culling)
+        {
+            RNDR_CPU_EVENT_SCOPED("Occlusion culling");
+            Culling::RasterizeOccluders(m_occlusion_buffer, m_scene_data.scene_description, clip_from_world);
+            Culling::CullOccluded(m_culling_result, m_occlusion_buffer, clip_from_world, m_shape_bounds);
+        }
+        if (m_dump_occlusion_buffer)
+        {
+            m_dump_occlusion_buffer = false;
+            const Opal::StringUtf8 dump_path = "occlusion-buffer.png";
+            if (Culling::WriteOcclusionDebugImage(m_occlusion_buffer, dump_path))
+            {
+                RNDR_LOG_INFO("Occlusion buffer written to %s, %llu of %llu tested shapes occluded", dump_path.GetData(),
+                              m_occlusion_buffer.stats.occluded_count, m_occlusion_buffer.stats.tested_count);
+            }
+        }
+
+        // Transparent shapes are blended in a separate pass after the opaque ones
+        if (!DrawList::SplitTransparentDraws(m_culling_result, m_transparent_draws, m_scene_data, m_shape_bounds, clip_from_world))
+        {
+            return false;
+        }
+        // Results arrive a few frames late, logging every frame would only repeat the same numbers
+        constexpr i64 k_pipeline_statistics_log_interval = 60;
+        PipelineStatistics::BeginFragmentInvocationQuery(m_fragment_invocation_query, m_desc.graphics_context);
+        const bool is_rendered = RenderOpaque(clip_from_world) && RenderInstanceSets(clip_from_world) && RenderTransparent();
+        if (PipelineStatistics::EndFragmentInvocationQuery(m_fragment_invocation_query, m_desc.graphics_context) &&
+            m_fragment_invocation_query.result_frame_index % k_pipeline_statistics_log_interval == 0)
+        {
+            RNDR_LOG_INFO("Pipeline statistics: %llu fragment shader invocations, depth prepass %s",
+                          m_fragment_invocation_query.fragment_invocations, m_options.use_depth_prepass ? "on" : "off");
+        }
+        return is_rendered;
+    }
+
+    bool RenderOpaque(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        if (m_culling_result.draw_commands.IsEmpty())
+        {
+            return true;
+        }
+        if (m_options.use_depth_prepass)
+        {
+            return RenderWithDepthPrepass();
+        }
+        if (m_options.use_instancing)
+        {
+            return RenderInstanced();
+        }
+        if (m_options.sort_draws)
+        {
+            return RenderSorted(clip_from_world);
+        }
+        if (m_options.use_indirect_buffer)
+        {
+            return RenderIndirect();
+        }
+        if (!BindDrawResources() || !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_culling_result.model_indices))))
+        {
+            return false;
+        }
+        m_desc.graphics_context->DrawIndicesMulti(m_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                  Opal::ArrayView<Rndr::DrawIndicesData>(m_culling_result.draw_commands));
+
+        return true;
+    }
+
+    /**
+     * Culls the instances of all instance sets and draws the sets with a single indirect multi draw, one command per set. Only
+     * the commands of the sets whose visible instance count changed are uploaded.
+     */
+    bool RenderInstanceSets(const Rndr::Matrix4x4f& clip_from_world, const Rndr::FrameBuffer* frame_buffer = nullptr)
+    {
+        if (m_scene_data.instance_sets.IsEmpty())
+        {
+            return true;
+        }
+        {
+            RNDR_CPU_EVENT_SCOPED("Instance set culling");
+            if (!Culling::CullInstanceSets(m_instance_set_culling_result, Culling::ExtractFrustum(clip_from_world), m_instance_set_bounds,
+                                           m_scene_data))
+            {
+                return false;
+            }
+        }
+        if (m_instance_set_culling_result.transforms.IsEmpty())
+        {
+            return true;
+        }
+        if (!IndirectCommands::UpdateIndirectCommandBuffer(m_instance_set_command_buffer, m_desc.graphics_context,
+                                                           Opal::ArrayView<const Rndr::DrawIndicesData>(m_instance_set_culling_result.draw_commands)))
+        {
+            return false;
+        }
+
+        if (!BindDrawResources(m_instance_set_pipeline, frame_buffer) ||
+            !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_instance_set_culling_result.transforms))))
+        {
+            return false;
+        }
+        return IndirectCommands::DrawIndirectCommandBuffer(m_instance_set_command_buffer, m_desc.graphics_context);
+    }
+
+    /**
+     * Draws the opaque shapes from the persistent indirect command buffer. Every shape keeps its command in the shape order
+     * and culled shapes get zero instances, so only the commands of the shapes whose visibility changed are uploaded.
+     */
+    bool RenderIndirect()
+    {
+        for (Rndr::DrawIndicesData& command : m_indirect_commands)
+        {
+            command.instance_count = 0;
+        }
+        for (const u32 shape : m_culling_result.model_indices)
+        {
+            m_indirect_commands[shape].instance_count = 1;
+        }
+        if (!IndirectCommands::UpdateIndirectCommandBuffer(m_indirect_command_buffer, m_desc.graphics_context,
+                                                           Opal::ArrayView<const Rndr::DrawIndicesData>(m_indirect_commands)))
+        {
+            return false;
+        }
+        return BindDrawResources() && IndirectCommands::DrawIndirectCommandBuffer(m_indirect_command_buffer, m_desc.graphics_context);
+    }
+
+    /**
+     * Fills the depth buffer with the opaque and then the alpha tested shapes, and shades all of them with the depth-equal
+     * test. Alpha tested shapes are kept last so the cheaper position only draws occlude as much as possible first.
+     */
+    bool RenderWithDepthPrepass()
+    {
+        const size_t opaque_count = DrawList::PartitionAlphaTestedDraws(m_culling_result, m_scene_data);
+        const size_t draw_count = m_culling_result.draw_commands.GetSize();
+        Rndr::DrawIndicesData* draw_commands = m_culling_result.draw_commands.GetData();
+        const RingBufferAllocation model_indices = GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_culling_result.model_indices));
+        {
+            RNDR_CPU_EVENT_SCOPED("Depth prepass");
+            if (opaque_count > 0)
+            {
+                if (!BindDrawResources(m_depth_prepass_pipeline) || !BindModelIndices(model_indices))
+                {
+                    return false;
+                }
+                m_desc.graphics_context->DrawIndicesMulti(m_depth_prepass_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                          Opal::ArrayView<Rndr::DrawIndicesData>(draw_commands, opaque_count));
+            }
+            if (opaque_count < draw_count)
+            {
+                // Draw IDs restart from zero in every multi draw, so alpha tested draws get a copy of their model indices
+                const Opal::ArrayView<const u8> alpha_tested_indices(
+                    reinterpret_cast<const u8*>(m_culling_result.model_indices.GetData() + opaque_count),
+                    (draw_count - opaque_count) * sizeof(u32));
+                if (!BindDrawResources(m_alpha_tested_prepass_pipeline) ||
+                    !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, alpha_tested_indices)))
+                {
+                    return false;
+                }
+                m_desc.graphics_context->DrawIndicesMulti(
+                    m_alpha_tested_prepass_pipeline, Rndr::PrimitiveTopology::Triangle,
+                    Opal::ArrayView<Rndr::DrawIndicesData>(draw_commands + opaque_count, draw_count - opaque_count));
+            }
+        }
+
+        RNDR_CPU_EVENT_SCOPED("Shading pass");
+        if (!BindDrawResources(m_depth_equal_pipeline) || !BindModelIndices(model_indices))
+        {
+            return false;
+        }
+        m_desc.graphics_context->DrawIndicesMulti(m_depth_equal_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                  Opal::ArrayView<Rndr::DrawIndicesData>(m_culling_result.draw_commands));
+        return true;
+    }
+
+    /**
+     * Blends the transparent shapes over the opaque ones from back to front. Depth is tested but not written, so transparent
+     * shapes don't hide each other and the opaque pass keeps early-Z.
+     */
+    bool RenderTransparent(const Rndr::FrameBuffer* frame_buffer = nullptr)
+    {
+        if (m_transparent_draws.draw_commands.IsEmpty())
+        {
+            return true;
+        }
+        if (!BindDrawResources(m_transparent_pipeline, frame_buffer) ||
+            !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_transparent_draws.model_indices))))
+        {
+            return false;
+        }
+        m_desc.graphics_context->DrawIndicesMulti(m_transparent_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                  Opal::ArrayView<Rndr::DrawIndicesData>(m_transparent_draws.draw_commands));
+        return true;
+    }
+
+    /**
+     * Draws the visible shapes sorted by their draw keys, grouped by material and mesh and front to back within a mesh.
+     */
+    bool RenderSorted(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        if (!DrawList::BuildSortedDrawList(m_sorted_draws, m_culling_result, m_scene_data, m_shape_bounds, clip_from_world,
+                                           Opal::ArrayView<const u32>(m_material_permutations)))
+        {
+            return false;
+        }
+        if (m_options.record_worker_count > 0)
+        {
+            return RenderRecorded();
+        }
+        if (m_options.use_shader_permutations)
+        {
+            return RenderPermutations();
+        }
+        if (!BindDrawResources() || !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_sorted_draws.model_indices))))
+        {
+            return false;
+        }
+        m_desc.graphics_context->DrawIndicesMulti(m_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                  Opal::ArrayView<Rndr::DrawIndicesData>(m_sorted_draws.draw_commands));
+        return true;
+    }
+
+    /**
+     * Draws the sorted draws with one multi draw per run of draws with the same shader permutation. Draw IDs restart in every
+     * multi draw, so each run gets its own slice of the model indices.
+     */
+    bool RenderPermutations()
+    {
+        const size_t draw_count = m_sorted_draws.draw_commands.GetSize();
+        size_t run_start = 0;
+        while (run_start < draw_count)
+        {
+            const u32 permutation = DrawList::GetPipeline(m_sorted_draws.keys[run_start]);
+            size_t run_end = run_start + 1;
+            while (run_end < draw_count && DrawList::GetPipeline(m_sorted_draws.keys[run_end]) == permutation)
+            {
+                run_end++;
+            }
+            const Rndr::Pipeline& pipeline = *m_permutation_pipelines[permutation];
+            const size_t run_size = run_end - run_start;
+            if (!BindDrawResources(pipeline) ||
+                !BindModelIndices(GpuMemory::Write(
+                    m_frame_ring_buffer, Opal::AsBytes(Opal::ArrayView<const u32>(m_sorted_draws.model_indices.GetData() + run_start, run_size)))))
+            {
+                return false;
+            }
+            m_desc.graphics_context->DrawIndicesMulti(pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                      Opal::ArrayView<Rndr::DrawIndicesData>(m_sorted_draws.draw_commands.GetData() + run_start, run_size));
+            run_start = run_end;
+        }
+        return true;
+    }
+
+    /**
+     * Records the sorted draws into one command list per worker slice and submits the lists in the sort order. State shared
+     * by all draws and the instance data are bound once up front, the lists only bind pipelines and draw.
+     */
+    bool RenderRecorded()
+    {
+        const Rndr::Pipeline* recorded_pipelines[] = {&m_recorded_pipeline};
+        // Draw keys hold the permutation index when shader permutations are used, and zero otherwise
+        const Opal::ArrayView<const Rndr::Pipeline* const> pipelines =
+            m_options.use_shader_permutations ? Opal::ArrayView<const Rndr::Pipeline* const>(m_permutation_pipelines)
+                                              : Opal::ArrayView<const Rndr::Pipeline* const>(recorded_pipelines, 1);
+        const RecordDrawListDesc record_desc{.pipelines = pipelines, .worker_count = m_options.record_worker_count};
+        if (!DrawList::RecordDrawListParallel(m_recorded_draws, m_desc.graphics_context, m_sorted_draws, record_desc))
+        {
+            return false;
+        }
+        return BindDrawResources(m_recorded_pipeline) &&
+               DrawList::SubmitRecordedDrawList(m_recorded_draws, m_desc.graphics_context, m_frame_ring_buffer, 4);
+    }
+
+    /**
+     * Draws the visible shapes with one instanced draw command per mesh, LOD and material combination.
+     */
+    bool RenderInstanced()
+    {
+        if (!Mesh::MergeInstancedDraws(m_instanced_draws, Opal::ArrayView<const u32>(m_culling_result.model_indices), m_scene_data.shapes,
+                                       Opal::ArrayView<const Rndr::DrawIndicesData>(m_draw_commands)))
+        {
+            return false;
+        }
+        if (!BindDrawResources() || !BindModelIndices(GpuMemory::Write(m_frame_ring_buffer, Opal::AsBytes(m_instanced_draws.instances))))
+        {
+            return false;
+        }
+        m_desc.graphics_context->DrawIndicesMulti(m_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                                  Opal::ArrayView<Rndr::DrawIndicesData>(m_instanced_draws.draw_commands));
+        return true;
+    }
+
+    /**
+     * Culls the shapes in a compute shader that writes the indirect draw buffer, so the CPU only issues a dispatch and a
+     * single draw call.
+     */
+    bool RenderGpuCulled(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        const Frustum frustum = Culling::ExtractFrustum(clip_from_world);
+        {
+            RNDR_CPU_EVENT_SCOPED("GPU culling");
+            if (!Culling::DispatchGpuCulling(m_gpu_culling, m_desc.graphics_context, frustum, m_model_data_sync.buffer, m_model_indices_buffer))
+            {
+                return false;
+            }
+        }
+        if (m_options.validate_gpu_culling)
+        {
+            ValidateGpuCulling(frustum);
+        }
+
+        return BindDrawResources() && Culling::DrawGpuCulled(m_gpu_culling, m_desc.graphics_context) &&
+               RenderInstanceSets(clip_from_world) && CullTransparentShapes(clip_from_world) && RenderTransparent();
+    }
+
+    /**
+     * Frustum culls the shapes left out of the GPU culling and sorts them back to front into the transparent draw list.
+     */
+    bool CullTransparentShapes(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        RNDR_CPU_EVENT_SCOPED("Transparent culling");
+        const Frustum frustum = Culling::ExtractFrustum(clip_from_world);
+        m_transparent_culling_result.draw_commands.Clear();
+        m_transparent_culling_result.model_indices.Clear();
+        for (const u32 shape : m_transparent_shapes)
+        {
+            const f32 center[3] = {m_shape_bounds.center_x[shape], m_shape_bounds.center_y[shape], m_shape_bounds.center_z[shape]};
+            const f32 extent[3] = {m_shape_bounds.extent_x[shape], m_shape_bounds.extent_y[shape], m_shape_bounds.extent_z[shape]};
+            if (Culling::ClassifyBox(frustum, center, extent) >= 0)
+            {
+                m_transparent_culling_result.draw_commands.PushBack(m_draw_commands[shape]);
+                m_transparent_culling_result.model_indices.PushBack(shape);
+            }
+        }
+        return DrawList::SplitTransparentDraws(m_transparent_culling_result, m_transparent_draws, m_scene_data, m_shape_bounds,
+                                               clip_from_world);
+    }
+
+    /**
+     * Renders to an offscreen frame buffer in two phases so that the depth of the first phase can be read while building
+     * the depth pyramid. The result is copied to the swap chain with a full screen triangle.
+     */
+    bool RenderHizCulled(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        const Rndr::SwapChainDesc& swap_chain_desc = m_desc.swap_chain->GetDesc();
+        if (swap_chain_desc.width != m_hiz_culling.width || swap_chain_desc.height != m_hiz_culling.height)
+        {
+            if (!SetupHizCulling())
+            {
+                return false;
+            }
+        }
+
+        m_desc.graphics_context->ClearFrameBufferColorAttachment(m_scene_frame_buffer, 0, Rndr::Colors::k_white);
+        m_desc.graphics_context->ClearFrameBufferDepthStencilAttachment(m_scene_frame_buffer, 1.0f, 0);
+        {
+            RNDR_CPU_EVENT_SCOPED("Hi-Z phase one");
+            if (!Culling::DispatchHizCulling(m_hiz_culling, m_gpu_culling, m_desc.graphics_context, HizCullingPhase::VisibleLastFrame,
+                                             clip_from_world, m_model_data_sync.buffer) ||
+                !BindDrawResources(&m_scene_frame_buffer) ||
+                !Culling::DrawHizCulled(m_hiz_culling, m_desc.graphics_context, HizCullingPhase::VisibleLastFrame, 4))
+            {
+                return false;
+            }
+        }
+        {
+            RNDR_CPU_EVENT_SCOPED("Hi-Z phase two");
+            // Phase two culls against the pyramid, so a failed build would test against last frame's depth
+            if (!Culling::BuildDepthPyramid(m_hiz_culling, m_desc.graphics_context, m_scene_frame_buffer.GetDepthStencilAttachment()) ||
+                !Culling::DispatchHizCulling(m_hiz_culling, m_gpu_culling, m_desc.graphics_context, HizCullingPhase::NewlyVisible,
+                                             clip_from_world, m_model_data_sync.buffer) ||
+                !BindDrawResources(&m_scene_frame_buffer) ||
+                !Culling::DrawHizCulled(m_hiz_culling, m_desc.graphics_context, HizCullingPhase::NewlyVisible, 4))
+            {
+                return false;
+            }
+        }
+        // Instance sets are culled on the CPU and drawn after both phases, they don't take part in the depth pyramid
+        if (!RenderInstanceSets(clip_from_world, &m_scene_frame_buffer) || !CullTransparentShapes(clip_from_world) ||
+            !RenderTransparent(&m_scene_frame_buffer))
+        {
+            return false;
+        }
+
+        m_desc.graphics_context->BindSwapChainFrameBuffer(*m_desc.swap_chain);
+        m_desc.graphics_context->BindPipeline(m_copy_pipeline);
+        m_desc.graphics_context->BindTexture(m_scene_frame_buffer.GetColorAttachment(0), 0);
+        m_desc.graphics_context->DrawVertices(Rndr::PrimitiveTopology::Triangle, 3);
+        return true;
+    }
+
+    /**
+     * Creates the offscreen frame buffer matching the swap chain, the pipeline that copies it to the swap chain and the
+     * Hi-Z culling resources.
+     */
+    bool SetupHizCulling()
+    {
+        using namespace Rndr;
+
+        const SwapChainDesc& swap_chain_desc = m_desc.swap_chain->GetDesc();
+        m_scene_frame_buffer = FrameBuffer(m_desc.graphics_context,
+                                           FrameBufferDesc{.color_attachments = {{.width = swap_chain_desc.width,
+                                                                                  .height = swap_chain_desc.height,
+                                                                                  .pixel_format = PixelFormat::R8G8B8A8_UNORM}},
+                                                           .color_attachment_samplers = {{}},
+                                                           .use_depth_stencil = true,
+                                                           .depth_stencil_attachment = {.width = swap_chain_desc.width,
+                                                                                        .height = swap_chain_desc.height,
+                                                                                        .pixel_format = PixelFormat::D24_UNORM_S8_UINT}});
+        if (!m_scene_frame_buffer.IsValid())
+        {
+            return false;
+        }
+
+        if (!m_copy_pipeline.IsValid())
+        {
+            const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
+            const Opal::StringUtf8 pixel_shader_code = R"(
+                #version 460
+                layout(location = 0) in vec2 uv;
+                layout(location = 0) out vec4 frag_color;
+                layout(binding = 0) uniform sampler2D scene_color;
+                void main()
+                {
+                    frag_color = texture(scene_color, uv);
+                }
+            )";
+            m_copy_vertex_shader =
+                Shader(m_desc.graphics_context, {.type = ShaderType::Vertex, .source = File::ReadShader(shader_dir, "full-screen-triangle.vert")});
+            m_copy_pixel_shader = Shader(m_desc.graphics_context, {.type = ShaderType::Fragment, .source = pixel_shader_code});
+            m_copy_pipeline = Pipeline(m_desc.graphics_context, {.vertex_shader = &m_copy_vertex_shader,
+                                                                 .pixel_shader = &m_copy_pixel_shader,
+                                                                 .input_layout = InputLayoutBuilder().Build(),
+                                                                 .rasterizer = {.fill_mode = FillMode::Solid},
+                                                                 .depth_stencil = {.is_depth_enabled = false}});
+            if (!m_copy_pipeline.IsValid())
+            {
+                return false;
+            }
+        }
+
+        return Culling::SetupHizCulling(m_hiz_culling, m_gpu_culling, swap_chain_desc.width, swap_chain_desc.height, m_desc.graphics_context);
+    }
+
+    /**
+     * Compares the output of the GPU culling with the CPU frustum culling over all shapes. Boxes that touch a frustum plane
+     * can go either way due to the float precision so only the number of differences is reported.
+     */
+    void ValidateGpuCulling(const Frustum& frustum)
+    {
+        CullingResult gpu_result;
+        if (!Culling::ReadGpuCullingResult(gpu_result, m_gpu_culling, m_desc.graphics_context, m_model_indices_buffer))
+        {
+            RNDR_LOG_ERROR("Failed to read back GPU culling result!");
+            return;
+        }
+        Culling::CullShapes(m_culling_result, frustum, m_shape_bounds, Opal::ArrayView<const Rndr::DrawIndicesData>(m_draw_commands));
+
+        u64 mismatch_count = 0;
+        for (size_t i = 0; i < m_culling_result.visibility.GetSize(); ++i)
+        {
+            // Shapes left out of the GPU culling are culled on the CPU
+            if (m_gpu_draw_commands[i].instance_count == 0)
+            {
+                continue;
+            }
+            mismatch_count += m_culling_result.visibility[i] != gpu_result.visibility[i] ? 1 : 0;
+        }
+        if (mismatch_count > 0)
         {
-            const MeshDrawData& shape = m_scene_data.shapes[i];
-            const Matrix4x4f model_transform = m_scene_data.scene_description.world_transforms[shape.transform_index];
-            const Matrix4x4f normal_transform = Opal::Transpose(Opal::Inverse(model_transform));
-            model_transforms_data[i] = {.model_transform = model_transform, .normal_transform = normal_transform};
+            RNDR_LOG_WARNING("GPU culling: %llu visible, CPU culling: %llu visible, %llu shapes differ", gpu_result.stats.visible_count,
+                             m_culling_result.stats.visible_count, mismatch_count);
         }
-        m_model_transforms_buffer = Buffer(desc.graphics_context, Opal::ArrayView<const ModelData>(model_transforms_data),
-                                           BufferType::ShaderStorage, Usage::Dynamic);
-        RNDR_ASSERT(m_model_transforms_buffer.IsValid());
+    }
 
-        m_material_buffer = Buffer(desc.graphics_context, Opal::ArrayView<const MaterialDescription>(m_scene_data.materials),
-                                   BufferType::ShaderStorage, Usage::Dynamic);
-        RNDR_ASSERT(m_material_buffer.IsValid());
+    bool BindDrawResources(const Rndr::FrameBuffer* frame_buffer = nullptr) { return BindDrawResources(m_pipeline, frame_buffer); }
 
-        // Setup buffer that will be updated every frame with camera info
-        constexpr size_t k_per_frame_size = sizeof(PerFrameData);
-        m_per_frame_buffer = Rndr::Buffer(
-            m_desc.graphics_context,
-            {.type = Rndr::BufferType::Constant, .usage = Rndr::Usage::Dynamic, .size = k_per_frame_size, .stride = k_per_frame_size});
-        RNDR_ASSERT(m_per_frame_buffer.IsValid());
+    bool BindDrawResources(const Rndr::Pipeline& pipeline, const Rndr::FrameBuffer* frame_buffer = nullptr)
+    {
+        if (frame_buffer != nullptr)
+        {
+            m_desc.graphics_context->BindFrameBuffer(*frame_buffer);
+        }
+        else
+        {
+            m_desc.graphics_context->BindSwapChainFrameBuffer(*m_desc.swap_chain);
+        }
+        m_desc.graphics_context->BindPipeline(pipeline);
+        m_desc.graphics_context->BindTexture(m_env_map_image, 5);
+        m_desc.graphics_context->BindTexture(m_irradiance_map_image, 6);
+        m_desc.graphics_context->BindTexture(m_brdf_lut_image, 7);
+        return GpuMemory::BindAllocation(m_frame_ring_buffer, m_desc.graphics_context, m_per_frame_allocation, Rndr::BufferType::Constant, 0);
+    }
 
-        // Describe what buffers are bound to what slots. No need to describe data layout since we are using vertex pulling.
-        const Rndr::InputLayoutDesc input_layout_desc = Rndr::InputLayoutBuilder()
-                                                            .AddShaderStorage(m_vertex_buffer, 1)
-                                                            .AddShaderStorage(m_model_transforms_buffer, 2)
-                                                            .AddShaderStorage(m_material_buffer, 3)
-                                                            .AddIndexBuffer(m_index_buffer)
-                                                            .Build();
+    /**
+     * Binds model indices or instance data written to the ring buffer this frame in place of the model indices buffer. Has
+     * to be called after the pipeline is bound since binding the pipeline rebinds the buffers of its input layout.
+     */
+    bool BindModelIndices(const RingBufferAllocation& allocation)
+    {
+        return GpuMemory::BindAllocation(m_frame_ring_buffer, m_desc.graphics_context, allocation, Rndr::BufferType::ShaderStorage, 4);
+    }
 
-        // Setup pipeline object.
-        m_pipeline = Pipeline(desc.graphics_context, {.vertex_shader = &m_vertex_shader,
-                                                      .pixel_shader = &m_pixel_shader,
-                                                      .input_layout = input_layout_desc,
-                                                      .rasterizer = {.fill_mode = FillMode::Solid},
-                                                      .depth_stencil = {.is_depth_enabled = true}});
-        RNDR_ASSERT(m_pipeline.IsValid());
+    /**
+     * Picks nodes of shapes spread over the shape list to move during rendering. Each node bobs by the size of its shape, so
+     * the movement is visible regardless of the scene scale.
+     */
+    void SetupAnimatedNodes()
+    {
+        const size_t shape_count = m_scene_data.shapes.GetSize();
+        const size_t node_count = std::min<size_t>(m_options.animated_node_count, shape_count);
+        if (node_count == 0)
+        {
+            return;
+        }
+        SceneDescription& description = m_scene_data.scene_description;
+        const size_t shape_step = shape_count / node_count;
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            const u32 shape = static_cast<u32>(i * shape_step);
+            const Scene::NodeId node = static_cast<Scene::NodeId>(m_scene_data.shapes[shape].transform_index);
+            if (std::find(m_animated_nodes.begin(), m_animated_nodes.end(), node) != m_animated_nodes.end())
+            {
+                continue;
+            }
+            if (m_animated_nodes.GetSize() % 2 == 0)
+            {
+                Scene::SetNodeFlags(description, node, description.node_flags[node] | Scene::NodeFlags::Dynamic);
+            }
+            const f32 amplitude = std::max(m_shape_bounds.extent_x[shape], std::max(m_shape_bounds.extent_y[shape], m_shape_bounds.extent_z[shape]));
+            m_animated_nodes.PushBack(node);
+            m_animated_node_origins.PushBack(description.local_transforms[node].translation);
+            m_animated_node_amplitudes.PushBack(amplitude);
+        }
+        m_animation_start_time = Opal::GetSeconds();
+        RNDR_LOG_INFO("Animating %zu nodes", m_animated_nodes.GetSize());
+    }
 
-        const Opal::StringUtf8 env_map_image_path = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "piazza_bologni_1k.hdr").GetValue();
-        m_env_map_image = LoadImage(TextureType::CubeMap, env_map_image_path);
-        RNDR_ASSERT(m_env_map_image.IsValid());
+    void AnimateNodes()
+    {
+        const f32 time = static_cast<f32>(Opal::GetSeconds() - m_animation_start_time);
+        SceneDescription& description = m_scene_data.scene_description;
+        for (size_t i = 0; i < m_animated_nodes.GetSize(); ++i)
+        {
+            const Scene::NodeId node = m_animated_nodes[i];
+            const f32 offset = m_animated_node_amplitudes[i] * std::sin(2.0f * time + static_cast<f32>(i));
+            description.local_transforms[node].translation = m_animated_node_origins[i] + Rndr::Vector3f(0.0f, offset, 0.0f);
+            Scene::MarkAsChanged(description, node);
+        }
+    }
 
-        const Opal::StringUtf8 irradiance_map_image_path =
-            Opal::Paths::Combine(nullptr, ASSETS_ROOT, "piazza_bologni_1k_irradience.hdr").GetValue();
-        m_irradiance_map_image = LoadImage(TextureType::CubeMap, irradiance_map_image_path);
-        RNDR_ASSERT(m_irradiance_map_image.IsValid());
+    /**
+     * Static shapes go to the BVH and shapes on nodes flagged as dynamic go to the loose octree so that moving them doesn't
+     * require BVH refits.
+     */
+    bool SetupSpatialStructures()
+    {
+        Opal::DynamicArray<u32> static_shapes;
+        Opal::DynamicArray<u32> dynamic_shapes;
+        f32 world_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        f32 world_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (u32 i = 0; i < m_scene_data.shapes.GetSize(); ++i)
+        {
+            const Scene::NodeId node = static_cast<Scene::NodeId>(m_scene_data.shapes[i].transform_index);
+            if (Scene::IsDynamicNode(m_scene_data.scene_description, node))
+            {
+                dynamic_shapes.PushBack(i);
+            }
+            else
+            {
+                static_shapes.PushBack(i);
+            }
+            const f32 center[3] = {m_shape_bounds.center_x[i], m_shape_bounds.center_y[i], m_shape_bounds.center_z[i]};
+            const f32 extent[3] = {m_shape_bounds.extent_x[i], m_shape_bounds.extent_y[i], m_shape_bounds.extent_z[i]};
+            for (i32 axis = 0; axis < 3; ++axis)
+            {
+                world_min[axis] = std::min(world_min[axis], center[axis] - extent[axis]);
+                world_max[axis] = std::max(world_max[axis], center[axis] + extent[axis]);
+            }
+        }
 
-        const Opal::StringUtf8 brdf_lut_image_path = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "brdf-lut.ktx").GetValue();
-        m_brdf_lut_image = LoadImage(TextureType::Texture2D, brdf_lut_image_path);
+        if (!Culling::BuildBvh(m_shape_bvh, m_shape_bounds, Opal::ArrayView<const u32>(static_shapes)))
+        {
+            return false;
+        }
+        RNDR_LOG_INFO("Built BVH with %zu nodes over %zu static shapes in %.3f ms", m_shape_bvh.nodes.GetSize(), static_shapes.GetSize(),
+                      m_shape_bvh.stats.build_time_ms);
 
-        // Setup draw commands based on the mesh data
-        Opal::DynamicArray<DrawIndicesData> draw_commands;
-        if (!Mesh::GetDrawCommands(draw_commands, m_scene_data.shapes, m_scene_data.mesh_data))
+        // Dynamic shapes can move away from the scene so leave some room around it
+        const f32 world_size = 2.0f * std::max(world_max[0] - world_min[0], std::max(world_max[1] - world_min[1], world_max[2] - world_min[2]));
+        const LooseOctreeDesc octree_desc{.world_min = Rndr::Point3f(world_min[0] - 0.25f * world_size, world_min[1] - 0.25f * world_size,
+                                                                     world_min[2] - 0.25f * world_size),
+                                          .world_size = world_size};
+        if (!Culling::SetupLooseOctree(m_dynamic_shapes, octree_desc))
         {
-            RNDR_HALT("Failed to get draw commands from mesh data!");
-            return;
+            return false;
+        }
+        for (const u32 shape : dynamic_shapes)
+        {
+            const f32 center[3] = {m_shape_bounds.center_x[shape], m_shape_bounds.center_y[shape], m_shape_bounds.center_z[shape]};
+            const f32 extent[3] = {m_shape_bounds.extent_x[shape], m_shape_bounds.extent_y[shape], m_shape_bounds.extent_z[shape]};
+            Culling::InsertObject(m_dynamic_shapes, shape, center, extent);
+        }
+        return true;
+    }
+
+    /**
+     * Scatters the instances over the ground of the scene, split into a few instance sets that reuse meshes and materials of
+     * the scene shapes. Stands in for foliage and other clutter that is not part of the scene file.
+     */
+    bool SetupInstanceSets()
+    {
+        constexpr u32 k_instance_set_count = 4;
+        const size_t shape_count = m_scene_data.shapes.GetSize();
+        if (shape_count == 0)
+        {
+            RNDR_LOG_ERROR("Instance sets need at least one shape to take the mesh from!");
+            return false;
+        }
+        f32 world_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        f32 world_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (size_t i = 0; i < shape_count; ++i)
+        {
+            const f32 center[3] = {m_shape_bounds.center_x[i], m_shape_bounds.center_y[i], m_shape_bounds.center_z[i]};
+            const f32 extent[3] = {m_shape_bounds.extent_x[i], m_shape_bounds.extent_y[i], m_shape_bounds.extent_z[i]};
+            for (i32 axis = 0; axis < 3; ++axis)
+            {
+                world_min[axis] = std::min(world_min[axis], center[axis] - extent[axis]);
+                world_max[axis] = std::max(world_max[axis], center[axis] + extent[axis]);
+            }
         }
-        const Opal::ArrayView<DrawIndicesData> draw_commands_span(draw_commands);
 
-        // Create a command list
-        m_command_list = CommandList(m_desc.graphics_context);
-        m_command_list.BindSwapChainFrameBuffer(*m_desc.swap_chain);
-        m_command_list.BindPipeline(m_pipeline);
-        m_command_list.BindBuffer(m_per_frame_buffer, 0);
-        m_command_list.BindTexture(m_env_map_image, 5);
-        m_command_list.BindTexture(m_irradiance_map_image, 6);
-        m_command_list.BindTexture(m_brdf_lut_image, 7);
-        m_command_list.DrawIndicesMulti(m_pipeline, PrimitiveTopology::Triangle, draw_commands_span);
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<f32> x_distribution(world_min[0], world_max[0]);
+        std::uniform_real_distribution<f32> z_distribution(world_min[2], world_max[2]);
+        std::uniform_real_distribution<f32> half_angle_distribution(0.0f, std::numbers::pi_v<f32>);
+        std::uniform_real_distribution<f32> scale_distribution(0.5f, 1.5f);
+        Opal::DynamicArray<InstanceTransform> transforms;
+        for (u32 set = 0; set < k_instance_set_count; ++set)
+        {
+            const MeshDrawData& shape = m_scene_data.shapes[set * shape_count / k_instance_set_count];
+            const u32 count = m_options.instance_count / k_instance_set_count + (set < m_options.instance_count % k_instance_set_count ? 1 : 0);
+            transforms.Resize(count);
+            for (InstanceTransform& transform : transforms)
+            {
+                // Rotated around the up axis only, like vegetation standing on the ground
+                const f32 half_angle = half_angle_distribution(generator);
+                transform.position = Rndr::Vector3f(x_distribution(generator), world_min[1], z_distribution(generator));
+                transform.scale = scale_distribution(generator);
+                transform.rotation.v = Rndr::Vector3f(0.0f, std::sin(half_angle), 0.0f);
+                transform.rotation.w = std::cos(half_angle);
+            }
+            if (Scene::AddInstanceSet(m_scene_data, static_cast<u32>(shape.mesh_index), static_cast<u32>(shape.material_index),
+                                      Opal::ArrayView<const InstanceTransform>(transforms)) < 0)
+            {
+                return false;
+            }
+        }
+        RNDR_LOG_INFO("Created %u instance sets with %u instances", k_instance_set_count, m_options.instance_count);
+        return true;
     }
 
-    bool Render() override
+    /** Writes the occlusion depth buffer to an image at the end of the next frame's culling. */
+    void RequestOcclusionBufferDump()
     {
-        RNDR_CPU_EVENT_SCOPED("Mesh rendering");
+        if (!m_options.use_occlusion_culling)
+        {
+            RNDR_LOG_WARNING("Occlusion buffer is only rendered with --occlusion-culling");
+            return;
+        }
+        m_dump_occlusion_buffer = true;
+    }
 
-        // Rotate the mesh
-        const Rndr::Matrix4x4f t = Opal::Scale(0.1f);
-        Rndr::Matrix4x4f mvp = m_camera_transform * t;
-        mvp = Opal::Transpose(mvp);
-        PerFrameData per_frame_data = {.view_projection = mvp, .camera_position_world = m_camera_position};
-        m_desc.graphics_context->UpdateBuffer(m_per_frame_buffer, Opal::AsBytes(per_frame_data));
+    /** Logs the shape under the center of the screen during the next frame. */
+    void RequestPick() { m_pick_requested = true; }
 
-        m_command_list.Submit();
+    [[nodiscard]] const SceneLoadStats& GetLoadStats() const { return m_load_stats; }
 
-        return true;
+    /**
+     * Casts a ray through the center of the screen against the scene triangles. Raycast acceleration structure is built on the
+     * first pick so that it doesn't slow down the startup.
+     */
+    void PickCenterShape(const Rndr::Matrix4x4f& clip_from_world)
+    {
+        if (m_raycast_scene.mesh_bvhs.IsEmpty() && !Scene::BuildRaycastScene(m_raycast_scene, m_scene_data))
+        {
+            RNDR_LOG_ERROR("Failed to build the raycast scene!");
+            return;
+        }
+
+        // Unproject two points on the view axis, they are both inside the clip volume regardless of the depth range
+        const Rndr::Matrix4x4f world_from_clip = Opal::Inverse(clip_from_world);
+        const auto unproject = [&world_from_clip](f32 ndc_depth)
+        {
+            f32 position[4];
+            for (i32 row = 0; row < 4; ++row)
+            {
+                position[row] = world_from_clip.elements[row][2] * ndc_depth + world_from_clip.elements[row][3];
+            }
+            return Rndr::Point3f(position[0] / position[3], position[1] / position[3], position[2] / position[3]);
+        };
+        const Rndr::Point3f near_point = unproject(0.0f);
+        const Rndr::Point3f far_point = unproject(1.0f);
+        const Ray ray{.origin = near_point,
+                      .direction = Rndr::Vector3f(far_point.x - near_point.x, far_point.y - near_point.y, far_point.z - near_point.z)};
+
+        const f64 start_time = Opal::GetSeconds();
+        RaycastHit hit;
+        const bool is_hit = Scene::Raycast(hit, m_raycast_scene, ray);
+        const f64 pick_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+        if (!is_hit)
+        {
+            RNDR_LOG_INFO("Pick: Nothing under the cursor (%.3f ms)", pick_time_ms);
+            return;
+        }
+        const MeshDrawData& shape = m_scene_data.shapes[hit.shape_index];
+        RNDR_LOG_INFO("Pick: Shape %u, mesh %lld, material %lld, triangle %u (%.3f ms)", hit.shape_index, shape.mesh_index,
+                      shape.material_index, hit.triangle_index, pick_time_ms);
     }
 
     void SetCameraTransform(const Rndr::Matrix4x4f& transform, const Rndr::Point3f& position)
@@ -260,29 +1521,89 @@ public:
     }
 
 private:
+    SceneRendererOptions m_options;
+
     Rndr::Shader m_vertex_shader;
     Rndr::Shader m_pixel_shader;
 
     Rndr::Buffer m_vertex_buffer;
     Rndr::Buffer m_index_buffer;
-    Rndr::Buffer m_model_transforms_buffer;
     Rndr::Buffer m_material_buffer;
 
     Rndr::Texture m_env_map_image;
     Rndr::Texture m_irradiance_map_image;
     Rndr::Texture m_brdf_lut_image;
 
-    Rndr::Buffer m_per_frame_buffer;
+    RingBuffer m_frame_ring_buffer;
+    RingBufferAllocation m_per_frame_allocation;
     Rndr::Pipeline m_pipeline;
-    Rndr::CommandList m_command_list;
+    Rndr::Shader m_transparent_vertex_shader;
+    Rndr::Shader m_transparent_pixel_shader;
+    Rndr::Pipeline m_transparent_pipeline;
+    Rndr::Shader m_depth_only_vertex_shader;
+    Rndr::Shader m_depth_prepass_pixel_shader;
+    Rndr::Shader m_alpha_tested_prepass_pixel_shader;
+    Rndr::Shader m_depth_equal_pixel_shader;
+    Rndr::Pipeline m_depth_prepass_pipeline;
+    Rndr::Pipeline m_alpha_tested_prepass_pipeline;
+    Rndr::Pipeline m_depth_equal_pipeline;
+    Rndr::Shader m_instance_data_vertex_shader;
+    Rndr::Pipeline m_recorded_pipeline;
+    Rndr::Shader m_instance_set_vertex_shader;
+    Rndr::Pipeline m_instance_set_pipeline;
+    Rndr::Buffer m_instance_set_material_buffer;
+    ShaderPermutationCache m_shader_permutations;
+    /** Permutation of each material, empty if shader permutations are not used. */
+    Opal::DynamicArray<u32> m_material_permutations;
+    Opal::DynamicArray<const Rndr::Pipeline*> m_permutation_pipelines;
+    Rndr::Buffer m_model_indices_buffer;
 
     SceneDrawData m_scene_data;
+    ModelDataSync m_model_data_sync;
+    Opal::DynamicArray<Rndr::DrawIndicesData> m_draw_commands;
+    /** Draw commands given to the GPU culling, transparent shapes have zero instances so that it skips them. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> m_gpu_draw_commands;
+    Opal::DynamicArray<Rndr::DrawIndicesData> m_indirect_commands;
+    IndirectCommandBuffer m_indirect_command_buffer;
+    ShapeBounds m_shape_bounds;
+    Bvh m_shape_bvh;
+    LooseOctree m_dynamic_shapes;
+    CullingResult m_culling_result;
+    InstancedDrawList m_instanced_draws;
+    SortedDrawList m_sorted_draws;
+    RecordedDrawList m_recorded_draws;
+    TransparentDrawList m_transparent_draws;
+    /** Shapes left out of the GPU culling, they are culled on the CPU and drawn in the transparent pass. */
+    Opal::DynamicArray<u32> m_transparent_shapes;
+    CullingResult m_transparent_culling_result;
+    ShapeBounds m_instance_set_bounds;
+    InstanceSetCullingResult m_instance_set_culling_result;
+    IndirectCommandBuffer m_instance_set_command_buffer;
+    VisibilityCache m_visibility_cache;
+    GpuCulling m_gpu_culling;
+    HizCulling m_hiz_culling;
+    Rndr::FrameBuffer m_scene_frame_buffer;
+    Rndr::Shader m_copy_vertex_shader;
+    Rndr::Shader m_copy_pixel_shader;
+    Rndr::Pipeline m_copy_pipeline;
+    OcclusionBuffer m_occlusion_buffer;
+    bool m_dump_occlusion_buffer = false;
+    RaycastScene m_raycast_scene;
+    Opal::DynamicArray<Scene::NodeId> m_animated_nodes;
+    Opal::DynamicArray<Rndr::Vector3f> m_animated_node_origins;
+    Opal::DynamicArray<f32> m_animated_node_amplitudes;
+    f64 m_animation_start_time = 0.0;
+    bool m_pick_requested = false;
+    FragmentInvocationQuery m_fragment_invocation_query;
+    SceneLoadStats m_load_stats;
     Rndr::Matrix4x4f m_camera_transform;
     Rndr::Point3f m_camera_position;
 };
 
-void Run()
+void Run(const SceneRendererOptions& options)
 {
+    // Time to first frame covers everything from the start of the run, including window creation and scene loading
+    const f64 run_start_time = Opal::GetSeconds();
     Rndr::Window window({.width = 1600, .height = 1200, .name = "Scene Renderer Example"});
     Rndr::GraphicsContext graphics_context({.window_handle = window.GetNativeWindowHandle(), .enable_bindless_textures = true});
     RNDR_ASSERT(graphics_context.IsValid());
@@ -306,7 +1627,24 @@ void Run()
         Opal::MakeDefaultScoped<Rndr::ClearRenderer>("Clear the screen", renderer_desc, k_clear_color);
     const Opal::ScopePtr<Rndr::RendererBase> present_renderer =
         Opal::MakeDefaultScoped<Rndr::PresentRenderer>("Present the back buffer", renderer_desc);
-    const Opal::ScopePtr<SceneRenderer> mesh_renderer = Opal::MakeDefaultScoped<SceneRenderer>("Render a mesh", renderer_desc);
+    const Opal::ScopePtr<SceneRenderer> mesh_renderer = Opal::MakeDefaultScoped<SceneRenderer>("Render a mesh", renderer_desc, options);
+
+    Opal::DynamicArray<Rndr::InputBinding> dump_bindings;
+    dump_bindings.PushBack({Rndr::InputPrimitive::Keyboard_F9, Rndr::InputTrigger::ButtonReleased});
+    Rndr::InputSystem::GetCurrentContext().AddAction(
+        Rndr::InputAction("DumpOcclusionBuffer"),
+        Rndr::InputActionData{.callback = [&mesh_renderer](Rndr::InputPrimitive, Rndr::InputTrigger, float)
+                              { mesh_renderer->RequestOcclusionBufferDump(); },
+                              .native_window = window.GetNativeWindowHandle(),
+                              .bindings = Opal::ArrayView<Rndr::InputBinding>(dump_bindings)});
+
+    Opal::DynamicArray<Rndr::InputBinding> pick_bindings;
+    pick_bindings.PushBack({Rndr::InputPrimitive::Keyboard_F8, Rndr::InputTrigger::ButtonReleased});
+    Rndr::InputSystem::GetCurrentContext().AddAction(
+        Rndr::InputAction("PickShape"),
+        Rndr::InputActionData{.callback = [&mesh_renderer](Rndr::InputPrimitive, Rndr::InputTrigger, float) { mesh_renderer->RequestPick(); },
+                              .native_window = window.GetNativeWindowHandle(),
+                              .bindings = Opal::ArrayView<Rndr::InputBinding>(pick_bindings)});
 
     Rndr::FlyCamera fly_camera(&window, &Rndr::InputSystem::GetCurrentContext(),
                                {.start_position = Rndr::Point3f(-20.0f, 15.0f, 20.0f),
@@ -321,6 +1659,7 @@ void Run()
 
     Rndr::FramesPerSecondCounter fps_counter(0.1f);
     f32 delta_seconds = 0.033f;
+    bool is_first_frame = true;
     while (!window.IsClosed())
     {
         RNDR_CPU_EVENT_SCOPED("Frame");
@@ -339,5 +1678,510 @@ void Run()
 
         const f64 end_time = Opal::GetSeconds();
         delta_seconds = static_cast<f32>(end_time - start_time);
+        if (is_first_frame)
+        {
+            RNDR_LOG_INFO("Time to first frame: %.3f ms, baked draws %s", (end_time - run_start_time) * 1000.0,
+                          mesh_renderer->GetLoadStats().is_baked ? "used" : "not used");
+            is_first_frame = false;
+        }
+    }
+}
+
+void RunNormalTransformBenchmark()
+{
+    constexpr size_t k_transform_count = 100'000;
+    constexpr i32 k_iteration_count = 20;
+
+    // Mix that roughly matches Bistro, most of the transforms are rigid or uniformly scaled
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<f32> distribution(-1.0f, 1.0f);
+    Opal::DynamicArray<ModelData> model_data(k_transform_count);
+    for (size_t i = 0; i < k_transform_count; ++i)
+    {
+        Scene::LocalTransform transform;
+        transform.translation = Rndr::Vector3f(100 * distribution(generator), 100 * distribution(generator), 100 * distribution(generator));
+        const Rndr::Vector3f axis(distribution(generator), distribution(generator), distribution(generator));
+        const f32 w = distribution(generator);
+        const f32 length = std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z + w * w) + 1e-6f;
+        transform.rotation.v = Rndr::Vector3f(axis.x / length, axis.y / length, axis.z / length);
+        transform.rotation.w = w / length;
+        const size_t kind = i % 10;
+        if (kind >= 6 && kind < 9)
+        {
+            const f32 scale = 2.0f + distribution(generator);
+            transform.scale = Rndr::Vector3f(scale, scale, scale);
+        }
+        else if (kind == 9)
+        {
+            transform.scale = Rndr::Vector3f(2.0f + distribution(generator), 2.0f + distribution(generator), 2.0f + distribution(generator));
+        }
+        model_data[i].model_transform = Scene::ToMatrix(transform);
+    }
+
+    f64 start_time = Opal::GetSeconds();
+    for (i32 iteration = 0; iteration < k_iteration_count; ++iteration)
+    {
+        for (ModelData& data : model_data)
+        {
+            data.normal_transform = Opal::Transpose(Opal::Inverse(data.model_transform));
+        }
+    }
+    const f64 general_inverse_time = (Opal::GetSeconds() - start_time) / k_iteration_count;
+
+    NormalTransformStats stats;
+    start_time = Opal::GetSeconds();
+    for (i32 iteration = 0; iteration < k_iteration_count; ++iteration)
+    {
+        stats = {};
+        Scene::CalculateNormalTransforms(Opal::ArrayView<ModelData>(model_data), &stats);
+    }
+    const f64 batched_time = (Opal::GetSeconds() - start_time) / k_iteration_count;
+
+    RNDR_LOG_INFO("Normal transforms for %zu transforms (rigid: %llu, uniform scale: %llu, general: %llu)", k_transform_count,
+                  static_cast<unsigned long long>(stats.rigid_count), static_cast<unsigned long long>(stats.uniform_scale_count),
+                  static_cast<unsigned long long>(stats.general_count));
+    RNDR_LOG_INFO("Transpose(Inverse(m)): %.3f ms", general_inverse_time * 1000.0);
+    RNDR_LOG_INFO("Batched: %.3f ms", batched_time * 1000.0);
+}
+
+void RunLooseOctreeBenchmark()
+{
+    constexpr size_t k_object_counts[] = {10'000, 100'000, 1'000'000};
+    constexpr f32 k_world_size = 10'000.0f;
+
+    // Camera in the middle of the world looking down the -Z axis
+    Frustum frustum;
+    frustum.planes[0] = Rndr::Vector4f(1.0f, 0.0f, -1.0f, 0.0f);
+    frustum.planes[1] = Rndr::Vector4f(-1.0f, 0.0f, -1.0f, 0.0f);
+    frustum.planes[2] = Rndr::Vector4f(0.0f, 1.0f, -1.0f, 0.0f);
+    frustum.planes[3] = Rndr::Vector4f(0.0f, -1.0f, -1.0f, 0.0f);
+    frustum.planes[4] = Rndr::Vector4f(0.0f, 0.0f, -1.0f, -1.0f);
+    frustum.planes[5] = Rndr::Vector4f(0.0f, 0.0f, 1.0f, 2000.0f);
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<f32> position_distribution(-0.5f * k_world_size, 0.5f * k_world_size);
+    std::uniform_real_distribution<f32> extent_distribution(0.5f, 20.0f);
+    std::uniform_real_distribution<f32> velocity_distribution(-5.0f, 5.0f);
+    for (const size_t object_count : k_object_counts)
+    {
+        LooseOctree octree;
+        Culling::SetupLooseOctree(octree, {.world_min = Rndr::Point3f(-0.5f * k_world_size, -0.5f * k_world_size, -0.5f * k_world_size),
+                                           .world_size = k_world_size,
+                                           .max_depth = 10});
+
+        Opal::DynamicArray<f32> centers(3 * object_count);
+        Opal::DynamicArray<f32> extents(3 * object_count);
+        for (size_t i = 0; i < 3 * object_count; ++i)
+        {
+            centers[i] = position_distribution(generator);
+            extents[i] = extent_distribution(generator);
+        }
+
+        f64 start_time = Opal::GetSeconds();
+        for (u32 i = 0; i < object_count; ++i)
+        {
+            Culling::InsertObject(octree, i, centers.GetData() + 3 * i, extents.GetData() + 3 * i);
+        }
+        const f64 insert_time = Opal::GetSeconds() - start_time;
+
+        for (size_t i = 0; i < 3 * object_count; ++i)
+        {
+            centers[i] += velocity_distribution(generator);
+        }
+        start_time = Opal::GetSeconds();
+        for (u32 i = 0; i < object_count; ++i)
+        {
+            Culling::MoveObject(octree, i, centers.GetData() + 3 * i, extents.GetData() + 3 * i);
+        }
+        const f64 move_time = Opal::GetSeconds() - start_time;
+
+        Opal::DynamicArray<u32> visible_objects;
+        start_time = Opal::GetSeconds();
+        Culling::QueryOctree(visible_objects, octree, frustum);
+        const f64 frustum_query_time = Opal::GetSeconds() - start_time;
+        const size_t frustum_object_count = visible_objects.GetSize();
+
+        visible_objects.Clear();
+        start_time = Opal::GetSeconds();
+        Culling::QueryOctree(visible_objects, octree, Rndr::Point3f(0.0f, 0.0f, 0.0f), 500.0f);
+        const f64 sphere_query_time = Opal::GetSeconds() - start_time;
+
+        RNDR_LOG_INFO("%zu objects, %zu cells: insert %.3f ms, move all %.3f ms, frustum query %.3f ms (%zu objects), sphere query %.3f ms (%zu objects)",
+                      object_count, octree.cells.size(), insert_time * 1000.0, move_time * 1000.0, frustum_query_time * 1000.0,
+                      frustum_object_count, sphere_query_time * 1000.0, visible_objects.GetSize());
+    }
+}
+
+void RunDrawRecordingBenchmark()
+{
+    constexpr size_t k_draw_count = 100'000;
+    constexpr u32 k_pipeline_count = 16;
+    constexpr u32 k_material_count = 1'000;
+    constexpr u32 k_mesh_count = 5'000;
+    constexpr u32 k_worker_counts[] = {1, 2, 4, 8, 16};
+    constexpr i32 k_iteration_count = 20;
+
+    // Command lists and pipelines need a context even though nothing is submitted
+    Rndr::Window window({.width = 64, .height = 64, .name = "Draw Recording Benchmark"});
+    Rndr::GraphicsContext graphics_context({.window_handle = window.GetNativeWindowHandle()});
+    RNDR_ASSERT(graphics_context.IsValid());
+
+    const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
+    const Rndr::Shader vertex_shader(graphics_context, {.type = Rndr::ShaderType::Vertex,
+                                                        .source = Rndr::File::ReadShader(shader_dir, "material-pbr.vert"),
+                                                        .defines = {"USE_INSTANCE_DATA"}});
+    const Rndr::Shader pixel_shader(graphics_context, {.type = Rndr::ShaderType::Fragment,
+                                                       .source = Rndr::File::ReadShader(shader_dir, "material-pbr.frag"),
+                                                       .defines = {"USE_PBR"}});
+    RNDR_ASSERT(vertex_shader.IsValid() && pixel_shader.IsValid());
+    // Only fills the vertex slot of the input layout, the instance data slot is left out like in the scene's recorded pipeline
+    const Rndr::Buffer vertex_buffer(graphics_context, {.type = Rndr::BufferType::ShaderStorage, .size = sizeof(f32), .stride = sizeof(f32)});
+    RNDR_ASSERT(vertex_buffer.IsValid());
+    const Rndr::Pipeline pipeline(graphics_context,
+                                  {.vertex_shader = &vertex_shader,
+                                   .pixel_shader = &pixel_shader,
+                                   .input_layout = Rndr::InputLayoutBuilder().AddShaderStorage(vertex_buffer, 1).Build(),
+                                   .depth_stencil = {.is_depth_enabled = true}});
+    RNDR_ASSERT(pipeline.IsValid());
+    // Every pipeline slot points to the same pipeline, binds are still recorded whenever the pipeline field changes
+    const Rndr::Pipeline* pipelines[k_pipeline_count];
+    for (const Rndr::Pipeline*& slot : pipelines)
+    {
+        slot = &pipeline;
+    }
+
+    // Random keys sorted the same way as the scene draws
+    std::mt19937 generator(42);
+    const auto random_below = [&generator](u32 count) { return static_cast<u32>(generator() % count); };
+    SortedDrawList draw_list;
+    draw_list.keys.Resize(k_draw_count);
+    draw_list.shape_indices.Resize(k_draw_count);
+    draw_list.scratch_keys.Resize(k_draw_count);
+    draw_list.scratch_shape_indices.Resize(k_draw_count);
+    for (u32 i = 0; i < k_draw_count; ++i)
+    {
+        draw_list.keys[i] = DrawList::MakeKey(DrawPass::Opaque, random_below(k_pipeline_count), random_below(k_material_count),
+                                              random_below(k_mesh_count), random_below(DrawList::k_max_depth + 1));
+        draw_list.shape_indices[i] = i;
+    }
+    DrawList::RadixSort(Opal::ArrayView<u64>(draw_list.keys), Opal::ArrayView<u32>(draw_list.shape_indices),
+                        Opal::ArrayView<u64>(draw_list.scratch_keys), Opal::ArrayView<u32>(draw_list.scratch_shape_indices));
+    draw_list.draw_commands.Resize(k_draw_count);
+    draw_list.model_indices.Resize(k_draw_count);
+    for (size_t i = 0; i < k_draw_count; ++i)
+    {
+        const u32 shape = draw_list.shape_indices[i];
+        draw_list.draw_commands[i] = {.index_count = 3 * (1 + shape % 1000),
+                                      .instance_count = 1,
+                                      .first_index = shape * 3,
+                                      .base_vertex = 0,
+                                      .base_instance = shape % k_material_count};
+        draw_list.model_indices[i] = shape;
+    }
+
+    RNDR_LOG_INFO("Recording %zu sorted draws with %u pipelines, %u hardware threads", k_draw_count, k_pipeline_count,
+                  std::thread::hardware_concurrency());
+    for (const u32 worker_count : k_worker_counts)
+    {
+        RecordedDrawList recorded;
+        f64 record_time_ms = 0.0;
+        f64 prepare_time_ms = 0.0;
+        for (i32 iteration = 0; iteration < k_iteration_count; ++iteration)
+        {
+            const bool is_recorded = DrawList::RecordDrawListParallel(
+                recorded, graphics_context, draw_list,
+                {.pipelines = Opal::ArrayView<const Rndr::Pipeline* const>(pipelines, k_pipeline_count), .worker_count = worker_count});
+            RNDR_ASSERT(is_recorded);
+            record_time_ms += recorded.stats.record_time_ms;
+            prepare_time_ms += recorded.stats.prepare_time_ms;
+        }
+        RNDR_LOG_INFO("%2u workers: record %.3f ms of which parallel preparation %.3f ms, %llu pipeline binds", worker_count,
+                      record_time_ms / k_iteration_count, prepare_time_ms / k_iteration_count, recorded.stats.pipeline_bind_count);
+    }
+}
+
+void RunRaycastBenchmark()
+{
+    constexpr u32 k_patch_size = 32;
+    constexpr i32 k_grid_size = 32;
+    constexpr f32 k_grid_spacing = 3.0f;
+    constexpr u32 k_ray_grid_size = 512;
+    constexpr i32 k_iteration_count = 5;
+
+    // Wavy patch of k_patch_size^2 quads with positions only, shared by all shapes
+    SceneDrawData scene;
+    Opal::DynamicArray<Rndr::Point3f> positions;
+    Opal::DynamicArray<u32> indices;
+    for (u32 z = 0; z <= k_patch_size; ++z)
+    {
+        for (u32 x = 0; x <= k_patch_size; ++x)
+        {
+            const f32 u = 2.0f * static_cast<f32>(x) / k_patch_size - 1.0f;
+            const f32 v = 2.0f * static_cast<f32>(z) / k_patch_size - 1.0f;
+            positions.PushBack(Rndr::Point3f(u, 0.25f * std::sin(3.0f * u) * std::cos(3.0f * v), v));
+        }
+    }
+    for (u32 z = 0; z < k_patch_size; ++z)
+    {
+        for (u32 x = 0; x < k_patch_size; ++x)
+        {
+            const u32 corner = z * (k_patch_size + 1) + x;
+            const u32 quad[6] = {corner, corner + k_patch_size + 1, corner + 1, corner + 1, corner + k_patch_size + 1, corner + k_patch_size + 2};
+            for (const u32 index : quad)
+            {
+                indices.PushBack(index);
+            }
+        }
+    }
+    MeshDescription mesh{.vertex_count = static_cast<i64>(positions.GetSize()), .vertex_size = sizeof(Rndr::Point3f), .lod_count = 1};
+    mesh.lod_offsets[0] = 0;
+    mesh.lod_offsets[1] = static_cast<u32>(indices.GetSize());
+    scene.mesh_data.meshes.PushBack(mesh);
+    scene.mesh_data.bounding_boxes.PushBack(Bounds3f(Rndr::Point3f(-1.0f, -0.25f, -1.0f), Rndr::Point3f(1.0f, 0.25f, 1.0f)));
+    const u8* vertex_data = reinterpret_cast<const u8*>(positions.GetData());
+    scene.mesh_data.vertex_buffer_data.Insert(scene.mesh_data.vertex_buffer_data.cend(), vertex_data,
+                                              vertex_data + positions.GetSize() * sizeof(Rndr::Point3f));
+    const u8* index_data = reinterpret_cast<const u8*>(indices.GetData());
+    scene.mesh_data.index_buffer_data.Insert(scene.mesh_data.index_buffer_data.cend(), index_data, index_data + indices.GetSize() * sizeof(u32));
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<f32> distribution(-1.0f, 1.0f);
+    for (i32 z = 0; z < k_grid_size; ++z)
+    {
+        for (i32 x = 0; x < k_grid_size; ++x)
+        {
+            const Scene::NodeId node = Scene::AddNode(scene.scene_description, Scene::k_invalid_node_id, 0);
+            Scene::LocalTransform& transform = scene.scene_description.local_transforms[node];
+            transform.translation = Rndr::Vector3f(k_grid_spacing * static_cast<f32>(x - k_grid_size / 2), 2.0f * distribution(generator),
+                                                   k_grid_spacing * static_cast<f32>(z - k_grid_size / 2));
+            const f32 half_angle = 0.5f * std::numbers::pi_v<f32> * distribution(generator);
+            transform.rotation.v = Rndr::Vector3f(0.0f, std::sin(half_angle), 0.0f);
+            transform.rotation.w = std::cos(half_angle);
+            const f32 scale = 1.0f + 0.4f * distribution(generator);
+            transform.scale = Rndr::Vector3f(scale, scale, scale);
+            scene.shapes.PushBack({.mesh_index = 0,
+                                   .material_index = 0,
+                                   .lod = 0,
+                                   .vertex_buffer_offset = 0,
+                                   .index_buffer_offset = 0,
+                                   .transform_index = node});
+        }
+    }
+    Scene::MarkAllAsChanged(scene.scene_description);
+    Scene::RecalculateWorldTransforms(scene.scene_description);
+
+    RaycastScene raycast_scene;
+    [[maybe_unused]] const bool is_built = Scene::BuildRaycastScene(raycast_scene, scene);
+    RNDR_ASSERT(is_built, "Failed to build the raycast scene");
+
+    // Rays from one point above the grid through a grid of targets slightly larger than the scene, so that neighbouring
+    // rays are coherent and the ones at the border miss
+    const Rndr::Point3f origin(0.0f, 40.0f, 60.0f);
+    const f32 target_extent = 0.6f * k_grid_spacing * k_grid_size;
+    Opal::DynamicArray<Ray> rays(static_cast<size_t>(k_ray_grid_size) * k_ray_grid_size);
+    for (u32 y = 0; y < k_ray_grid_size; ++y)
+    {
+        for (u32 x = 0; x < k_ray_grid_size; ++x)
+        {
+            const f32 target_x = target_extent * (2.0f * (static_cast<f32>(x) + 0.5f) / k_ray_grid_size - 1.0f);
+            const f32 target_z = target_extent * (2.0f * (static_cast<f32>(y) + 0.5f) / k_ray_grid_size - 1.0f);
+            rays[y * k_ray_grid_size + x] = {.origin = origin, .direction = Rndr::Vector3f(target_x - origin.x, -origin.y, target_z - origin.z)};
+        }
+    }
+    const size_t ray_count = rays.GetSize();
+
+    Opal::DynamicArray<RaycastHit> single_hits(ray_count);
+    f64 start_time = Opal::GetSeconds();
+    for (i32 iteration = 0; iteration < k_iteration_count; ++iteration)
+    {
+        for (size_t i = 0; i < ray_count; ++i)
+        {
+            single_hits[i] = {};
+            Scene::Raycast(single_hits[i], raycast_scene, rays[i]);
+        }
+    }
+    const f64 single_time = (Opal::GetSeconds() - start_time) / k_iteration_count;
+
+    Opal::DynamicArray<RaycastHit> batch_hits(ray_count);
+    start_time = Opal::GetSeconds();
+    for (i32 iteration = 0; iteration < k_iteration_count; ++iteration)
+    {
+        Scene::RaycastBatch(Opal::ArrayView<RaycastHit>(batch_hits), raycast_scene, Opal::ArrayView<const Ray>(rays));
+    }
+    const f64 batch_time = (Opal::GetSeconds() - start_time) / k_iteration_count;
+
+    // Both paths run the same intersection tests but round differently, so a ray through a shared triangle edge can slip
+    // between the triangles in one of them. Results may only differ if the closer of the two hits lies within a percent of
+    // the triangle size from an edge, rays far from the mesh and grazing the triangle lose a few digits of the barycentrics.
+    constexpr f32 k_edge_epsilon = 1e-2f;
+    u64 hit_count = 0;
+    u64 edge_count = 0;
+    u64 mismatch_count = 0;
+    for (size_t i = 0; i < ray_count; ++i)
+    {
+        const RaycastHit& single = single_hits[i];
+        const RaycastHit& batch = batch_hits[i];
+        hit_count += single.IsHit() ? 1 : 0;
+        if (single.IsHit() == batch.IsHit() &&
+            (!single.IsHit() || std::abs(single.distance - batch.distance) <= 1e-5f * std::max(1.0f, single.distance)))
+        {
+            continue;
+        }
+        const RaycastHit& closer = single.distance <= batch.distance ? single : batch;
+        if (std::min({closer.u, closer.v, 1.0f - closer.u - closer.v}) < k_edge_epsilon)
+        {
+            edge_count++;
+        }
+        else
+        {
+            mismatch_count++;
+        }
+    }
+
+    const f64 million_rays = static_cast<f64>(ray_count) / 1e6;
+    RNDR_LOG_INFO("%zu rays against %zu shapes with %zu triangles each, %llu hits, %llu differ on triangle edges", ray_count,
+                  scene.shapes.GetSize(), indices.GetSize() / 3, hit_count, edge_count);
+    RNDR_LOG_INFO("Raycast: %.3f ms (%.2f Mrays/s)", single_time * 1000.0, million_rays / single_time);
+    RNDR_LOG_INFO("RaycastBatch: %.3f ms (%.2f Mrays/s), %u hardware threads", batch_time * 1000.0, million_rays / batch_time,
+                  std::thread::hardware_concurrency());
+    RNDR_ASSERT(mismatch_count == 0, "Raycast and RaycastBatch hits differ");
+}
+
+bool RunGpuCullingTest()
+{
+    constexpr i32 k_grid_size = 40;
+    constexpr f32 k_grid_spacing = 4.0f;
+    constexpr i32 k_layer_count = 4;
+
+    // Compute shaders and buffers need a context even though nothing is presented
+    Rndr::Window window({.width = 64, .height = 64, .name = "GPU Culling Test"});
+    Rndr::GraphicsContext graphics_context({.window_handle = window.GetNativeWindowHandle()});
+    RNDR_ASSERT(graphics_context.IsValid());
+
+    // Grid of randomly rotated and scaled boxes sharing one mesh that is offset from its origin, so that the GPU has to
+    // transform both the center and the extent of the local bounds
+    SceneDrawData scene;
+    scene.mesh_data.meshes.PushBack(MeshDescription{.lod_count = 1});
+    scene.mesh_data.bounding_boxes.PushBack(Bounds3f(Rndr::Point3f(-1.0f, 0.0f, -0.5f), Rndr::Point3f(1.0f, 2.0f, 0.5f)));
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<f32> distribution(-1.0f, 1.0f);
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+    for (i32 layer = 0; layer < k_layer_count; ++layer)
+    {
+        for (i32 z = 0; z < k_grid_size; ++z)
+        {
+            for (i32 x = 0; x < k_grid_size; ++x)
+            {
+                const Scene::NodeId node = Scene::AddNode(scene.scene_description, Scene::k_invalid_node_id, 0);
+                Scene::LocalTransform& transform = scene.scene_description.local_transforms[node];
+                transform.translation = Rndr::Vector3f(k_grid_spacing * static_cast<f32>(x - k_grid_size / 2),
+                                                       k_grid_spacing * static_cast<f32>(layer),
+                                                       k_grid_spacing * static_cast<f32>(z - k_grid_size / 2));
+                const Rndr::Vector3f axis(distribution(generator), distribution(generator), distribution(generator));
+                const f32 w = distribution(generator);
+                const f32 length = std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z + w * w) + 1e-6f;
+                transform.rotation.v = Rndr::Vector3f(axis.x / length, axis.y / length, axis.z / length);
+                transform.rotation.w = w / length;
+                const f32 scale = 1.0f + 0.5f * distribution(generator);
+                transform.scale = Rndr::Vector3f(scale, scale, scale);
+                scene.shapes.PushBack({.mesh_index = 0,
+                                       .material_index = 0,
+                                       .lod = 0,
+                                       .vertex_buffer_offset = 0,
+                                       .index_buffer_offset = 0,
+                                       .transform_index = node});
+                draw_commands.PushBack({.index_count = 36,
+                                        .instance_count = 1,
+                                        .first_index = 0,
+                                        .base_vertex = 0,
+                                        .base_instance = static_cast<u32>(draw_commands.GetSize())});
+            }
+        }
+    }
+    Scene::MarkAllAsChanged(scene.scene_description);
+    Scene::RecalculateWorldTransforms(scene.scene_description);
+
+    ModelDataSync model_data_sync;
+    ShapeBounds shape_bounds;
+    GpuCulling gpu_culling;
+    const Opal::ArrayView<const Rndr::DrawIndicesData> draw_commands_view(draw_commands);
+    if (!Scene::SetupModelDataSync(model_data_sync, scene, graphics_context) || !Culling::SetupShapeBounds(shape_bounds, scene) ||
+        !Culling::SetupGpuCulling(gpu_culling, scene, draw_commands_view, graphics_context, {.enable_read_back = true}))
+    {
+        RNDR_LOG_ERROR("GPU culling test: Failed to set up the scene!");
+        return false;
+    }
+    const size_t shape_count = scene.shapes.GetSize();
+    const Rndr::Buffer model_indices_buffer(
+        graphics_context,
+        {.type = Rndr::BufferType::ShaderStorage, .usage = Rndr::Usage::ReadBack, .size = shape_count * sizeof(u32), .stride = sizeof(u32)});
+    RNDR_ASSERT(model_indices_buffer.IsValid());
+
+    // Cameras looking at the grid from outside, from inside, along the grid rows and away from it
+    struct TestCamera
+    {
+        Rndr::Point3f position;
+        Rndr::Point3f target;
+        f32 fov;
+    };
+    const TestCamera cameras[] = {
+        {Rndr::Point3f(0.0f, 60.0f, 120.0f), Rndr::Point3f(0.0f, 0.0f, 0.0f), 45.0f},
+        {Rndr::Point3f(0.0f, 6.0f, 0.0f), Rndr::Point3f(30.0f, 4.0f, 10.0f), 60.0f},
+        {Rndr::Point3f(-90.0f, 8.0f, 0.0f), Rndr::Point3f(90.0f, 8.0f, 0.0f), 20.0f},
+        {Rndr::Point3f(10.0f, 30.0f, 10.0f), Rndr::Point3f(12.0f, 0.0f, 14.0f), 90.0f},
+        {Rndr::Point3f(0.0f, 10.0f, 200.0f), Rndr::Point3f(0.0f, 10.0f, 400.0f), 45.0f},
+    };
+
+    bool is_passed = true;
+    CullingResult cpu_result;
+    CullingResult gpu_result;
+    for (const TestCamera& camera : cameras)
+    {
+        const Rndr::Matrix4x4f view = Opal::LookAt_RH(camera.position, camera.target, Rndr::Vector3f(0.0f, 1.0f, 0.0f));
+        const Rndr::Matrix4x4f projection = Rndr::PerspectiveOpenGL(camera.fov, 1.0f, 0.5f, 150.0f);
+        const Frustum frustum = Culling::ExtractFrustum(projection * view);
+
+        if (!Culling::DispatchGpuCulling(gpu_culling, graphics_context, frustum, model_data_sync.buffer, model_indices_buffer) ||
+            !Culling::ReadGpuCullingResult(gpu_result, gpu_culling, graphics_context, model_indices_buffer) ||
+            !Culling::CullShapes(cpu_result, frustum, shape_bounds, draw_commands_view))
+        {
+            RNDR_LOG_ERROR("GPU culling test: Failed to cull the scene!");
+            return false;
+        }
+
+        // Boxes touching a frustum plane can go either way due to the float precision. Only shapes that keep their
+        // visibility when the box grows or shrinks by a tiny bit have to agree.
+        u64 mismatch_count = 0;
+        u64 ambiguous_count = 0;
+        for (size_t i = 0; i < shape_count; ++i)
+        {
+            if (cpu_result.visibility[i] == gpu_result.visibility[i])
+            {
+                continue;
+            }
+            const f32 center[3] = {shape_bounds.center_x[i], shape_bounds.center_y[i], shape_bounds.center_z[i]};
+            const f32 grown_extent[3] = {shape_bounds.extent_x[i] * 1.001f, shape_bounds.extent_y[i] * 1.001f,
+                                         shape_bounds.extent_z[i] * 1.001f};
+            const f32 shrunk_extent[3] = {shape_bounds.extent_x[i] * 0.999f, shape_bounds.extent_y[i] * 0.999f,
+                                          shape_bounds.extent_z[i] * 0.999f};
+            const bool is_grown_visible = Culling::ClassifyBox(frustum, center, grown_extent) >= 0;
+            const bool is_shrunk_visible = Culling::ClassifyBox(frustum, center, shrunk_extent) >= 0;
+            if (is_grown_visible != is_shrunk_visible)
+            {
+                ambiguous_count++;
+            }
+            else
+            {
+                mismatch_count++;
+            }
+        }
+        RNDR_LOG_INFO("GPU culling test: CPU %llu visible, GPU %llu visible, %llu ambiguous, %llu mismatched out of %zu shapes",
+                      cpu_result.stats.visible_count, gpu_result.stats.visible_count, ambiguous_count, mismatch_count, shape_count);
+        is_passed = is_passed && mismatch_count == 0;
+    }
+    if (!is_passed)
+    {
+        RNDR_LOG_ERROR("GPU culling test: GPU and CPU visible lists differ!");
     }
-}
\ No newline at end of file
+    return is_passed;
+}
@@ -18,8 +18,10 @@
 #include "rndr/projections.h"
 
 #include "assimp-helpers.h"
+#include "culling.h"
 #include "imgui-wrapper.h"
 #include "mesh.h"
+#include "ring-buffer.h"
 #include "types.h"
 
 void Run();
@@ -34,6 +36,27 @@ int main() {
 struct PerFrameData {
 };
 
+/**
+ * Data of a single mesh read by both the shadow and the scene pass. Matches the std430 layout of DrawData in the shaders.
+ */
+struct PerDrawData {
+    Rndr::Matrix4x4f world_from_model;
+    u64 albedo_texture = 0;
+    u64 padding = 0;
+};
+
+/**
+ * Shadow caster counts of the last frame.
+ */
+struct ShadowCasterStats {
+    i32 total_count = 0;
+    /** Casters outside the light frustum. */
+    i32 outside_light_count = 0;
+    /** Casters whose shadow can't reach anything the camera sees. */
+    i32 shadow_not_visible_count = 0;
+    i32 drawn_count = 0;
+};
+
 struct GameState {
     f32 light_fov = 60.0f;
     f32 light_distance = 12.0f;
@@ -46,11 +69,13 @@ struct GameState {
     // Set by shadow renderer
     Rndr::Matrix4x4f light_clip_from_world;
     Rndr::Point3f light_position;
+    ShadowCasterStats caster_stats;
 };
 
 class MeshContainer {
 public:
-    explicit MeshContainer(Rndr::GraphicsContext *graphics_context) : m_graphics_context(graphics_context) {
+    MeshContainer(Rndr::GraphicsContext *graphics_context, RingBuffer *frame_ring_buffer)
+        : m_graphics_context(graphics_context), m_frame_ring_buffer(frame_ring_buffer) {
         // Setup vertex and index buffers
         const Opal::StringUtf8 mesh_file_path = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "duck.gltf").GetValue();
         [[maybe_unused]] bool status = AssimpHelpers::ReadMeshData(m_mesh_data, mesh_file_path,
@@ -69,14 +94,19 @@ public:
 
         m_model_matrices.PushBack(
             Opal::Identity<f32>() * Opal::RotateY(-90.0f) * Opal::RotateX(-90.0f) * Opal::Scale(4.0f));
-        m_model_matrices[0] = Opal::Transpose(m_model_matrices[0]);
         m_model_matrices.PushBack(Opal::Identity<f32>());
-        m_model_matrices[1] = Opal::Transpose(m_model_matrices[1]);
 
+        // Meshes don't move so world bounds are calculated once, before the matrices are transposed for the GPU
+        for (size_t i = 0; i < m_model_matrices.GetSize(); ++i) {
+            CalculateWorldBounds(static_cast<u32>(i));
+            m_model_matrices[i] = Opal::Transpose(m_model_matrices[i]);
+        }
+
+        // Draw data is written to the frame ring buffer once per frame, this buffer only fills the slot in the input layout
         err = m_model_buffer.Initialize(
             m_graphics_context,
             Rndr::BufferDesc{
-                .type = Rndr::BufferType::ShaderStorage, .usage = Rndr::Usage::Dynamic, .size = sizeof(Rndr::Matrix4x4f)
+                .type = Rndr::BufferType::ShaderStorage, .usage = Rndr::Usage::Default, .size = sizeof(PerDrawData)
             });
         RNDR_ASSERT(err == Rndr::ErrorCode::Success);
 
@@ -103,7 +133,7 @@ public:
             m_graphics_context,
             {
                 .width = bitmap.GetWidth(), .height = bitmap.GetHeight(), .pixel_format = bitmap.GetPixelFormat(),
-                .use_mips = true
+                .use_mips = true, .is_bindless = true
             }, {},
             Opal::ArrayView<const u8>(bitmap.GetData(), bitmap.GetSize2D()));
         RNDR_ASSERT(err == Rndr::ErrorCode::Success);
@@ -116,26 +146,165 @@ public:
             m_graphics_context,
             {
                 .width = bitmap.GetWidth(), .height = bitmap.GetHeight(), .pixel_format = bitmap.GetPixelFormat(),
-                .use_mips = true
+                .use_mips = true, .is_bindless = true
             }, {},
             Opal::ArrayView<const u8>(bitmap.GetData(), bitmap.GetSize2D()));
         RNDR_ASSERT(err == Rndr::ErrorCode::Success);
+
+        // Both meshes are drawn with a single multi draw. Base instance of each draw is the mesh index, so the shadow pass
+        // can draw a subset of the meshes and still find the draw data that is shared with the scene pass.
+        const u64 albedo_textures[] = {m_albedo_texture.GetBindlessHandle(), m_brick_texture.GetBindlessHandle()};
+        for (u32 i = 0; i < m_model_matrices.GetSize(); ++i) {
+            const MeshDescription &mesh = m_mesh_data.meshes[i];
+            m_draw_data.PushBack({.world_from_model = m_model_matrices[i], .albedo_texture = albedo_textures[i]});
+            m_draw_commands.PushBack({
+                .index_count = static_cast<u32>(mesh.GetLodIndicesCount(0)), .instance_count = 1,
+                .first_index = static_cast<u32>(mesh.index_offset), .base_vertex = 0, .base_instance = i
+            });
+        }
     }
 
     [[nodiscard]] const Rndr::InputLayoutDesc &GetInputLayoutDesc() const { return m_input_layout_desc; }
 
-    void Draw() {
-        m_graphics_context->UpdateBuffer(m_model_buffer, Opal::AsBytes(m_model_matrices[0]));
-        m_graphics_context->BindTexture(m_albedo_texture, 0);
-        m_graphics_context->DrawIndices(Rndr::PrimitiveTopology::Triangle, m_mesh_data.meshes[0].lod_offsets[1], 1, 0);
-        m_graphics_context->UpdateBuffer(m_model_buffer, Opal::AsBytes(m_model_matrices[1]));
-        m_graphics_context->BindTexture(m_brick_texture, 0);
-        m_graphics_context->DrawIndices(Rndr::PrimitiveTopology::Triangle, m_mesh_data.meshes[1].lod_offsets[1], 1,
-                                        static_cast<i32>(m_mesh_data.meshes[1].index_offset));
+    /**
+     * Writes the draw data of all meshes to the frame ring buffer. Called once per frame, before any of the passes draw. If
+     * the ring buffer is full the allocation is empty and the draws of this frame fail to bind it.
+     */
+    void UploadDrawData() {
+        m_draw_data_allocation = GpuMemory::Write(*m_frame_ring_buffer, Opal::AsBytes(m_draw_data));
+    }
+
+    bool Draw(const Rndr::Pipeline &pipeline) {
+        if (!GpuMemory::BindAllocation(*m_frame_ring_buffer, m_graphics_context, m_draw_data_allocation,
+                                       Rndr::BufferType::ShaderStorage, 2)) {
+            return false;
+        }
+        m_graphics_context->DrawIndicesMulti(pipeline, Rndr::PrimitiveTopology::Triangle,
+                                             Opal::ArrayView<Rndr::DrawIndicesData>(m_draw_commands));
+        return true;
+    }
+
+    /**
+     * Draws only the given meshes, for example the shadow casters that passed culling.
+     */
+    bool Draw(const Rndr::Pipeline &pipeline, const Opal::ArrayView<const u32> &mesh_indices) {
+        if (mesh_indices.GetSize() == 0) {
+            return true;
+        }
+        m_subset_draw_commands.Clear();
+        for (const u32 mesh_index: mesh_indices) {
+            m_subset_draw_commands.PushBack(m_draw_commands[mesh_index]);
+        }
+        if (!GpuMemory::BindAllocation(*m_frame_ring_buffer, m_graphics_context, m_draw_data_allocation,
+                                       Rndr::BufferType::ShaderStorage, 2)) {
+            return false;
+        }
+        m_graphics_context->DrawIndicesMulti(pipeline, Rndr::PrimitiveTopology::Triangle,
+                                             Opal::ArrayView<Rndr::DrawIndicesData>(m_subset_draw_commands));
+        return true;
+    }
+
+    /**
+     * Writes the meshes that can cast a visible shadow to the caster list. A mesh is skipped if it is outside the light
+     * frustum, or if its shadow volume, the bounds swept away from the light up to the light's far plane, is outside the
+     * camera frustum.
+     * @param out_casters Compacted list of mesh indices to draw into the shadow map.
+     * @param out_stats Caster counts.
+     * @param light_frustum Frustum of the light in world space.
+     * @param camera_frustum Frustum of the camera in world space.
+     * @param light_position Position of the light in world space.
+     */
+    void CullShadowCasters(Opal::DynamicArray<u32> &out_casters, ShadowCasterStats &out_stats, const Frustum &light_frustum,
+                           const Frustum &camera_frustum, const Rndr::Point3f &light_position) const {
+        out_casters.Clear();
+        out_stats = {.total_count = static_cast<i32>(m_bounds.GetSize())};
+        for (u32 i = 0; i < m_bounds.GetSize(); ++i) {
+            const Rndr::Bounds3f &bounds = m_bounds[i];
+            const f32 center[3] = {
+                0.5f * (bounds.min.x + bounds.max.x), 0.5f * (bounds.min.y + bounds.max.y), 0.5f * (bounds.min.z + bounds.max.z)
+            };
+            const f32 extent[3] = {
+                0.5f * (bounds.max.x - bounds.min.x), 0.5f * (bounds.max.y - bounds.min.y), 0.5f * (bounds.max.z - bounds.min.z)
+            };
+            if (Culling::ClassifyBox(light_frustum, center, extent) < 0) {
+                out_stats.outside_light_count++;
+                continue;
+            }
+            Rndr::Bounds3f shadow_bounds;
+            if (CalculateShadowVolumeBounds(shadow_bounds, bounds, light_frustum, light_position)) {
+                const f32 shadow_center[3] = {
+                    0.5f * (shadow_bounds.min.x + shadow_bounds.max.x), 0.5f * (shadow_bounds.min.y + shadow_bounds.max.y),
+                    0.5f * (shadow_bounds.min.z + shadow_bounds.max.z)
+                };
+                const f32 shadow_extent[3] = {
+                    0.5f * (shadow_bounds.max.x - shadow_bounds.min.x), 0.5f * (shadow_bounds.max.y - shadow_bounds.min.y),
+                    0.5f * (shadow_bounds.max.z - shadow_bounds.min.z)
+                };
+                if (Culling::ClassifyBox(camera_frustum, shadow_center, shadow_extent) < 0) {
+                    out_stats.shadow_not_visible_count++;
+                    continue;
+                }
+            }
+            out_casters.PushBack(i);
+        }
+        out_stats.drawn_count = static_cast<i32>(out_casters.GetSize());
     }
 
 private:
+    /**
+     * Calculates world space bounds of a mesh from its vertices. Indices in the index buffer already point to the vertices
+     * of the whole vertex buffer since the meshes are drawn with vertex pulling.
+     */
+    void CalculateWorldBounds(u32 mesh_index) {
+        const MeshDescription &mesh = m_mesh_data.meshes[mesh_index];
+        const Rndr::Matrix4x4f &world_from_model = m_model_matrices[mesh_index];
+        const u32 *indices = reinterpret_cast<const u32 *>(m_mesh_data.index_buffer_data.GetData()) + mesh.index_offset;
+        const u8 *vertices = m_mesh_data.vertex_buffer_data.GetData();
+
+        Rndr::Bounds3f bounds(Rndr::Point3f(Opal::k_largest_float), Rndr::Point3f(Opal::k_smallest_float));
+        for (i64 i = 0; i < mesh.GetLodIndicesCount(0); ++i) {
+            const f32 *position = reinterpret_cast<const f32 *>(vertices + indices[i] * mesh.vertex_size);
+            const Rndr::Point3f world_position = world_from_model * Rndr::Point3f(position[0], position[1], position[2]);
+            bounds.min = Opal::Min(bounds.min, world_position);
+            bounds.max = Opal::Max(bounds.max, world_position);
+        }
+        m_bounds.PushBack(bounds);
+    }
+
+    /**
+     * Bounds of the volume a box can shadow. Corners are projected from the light onto the light's far plane, and since the
+     * projection keeps lines straight, the box together with the projected corners contains the whole swept volume.
+     * @return False if a corner is behind the light, in which case the shadow can go anywhere.
+     */
+    static bool CalculateShadowVolumeBounds(Rndr::Bounds3f &out_bounds, const Rndr::Bounds3f &bounds,
+                                            const Frustum &light_frustum, const Rndr::Point3f &light_position) {
+        const Rndr::Vector4f &far_plane = light_frustum.planes[5];
+        const f32 light_to_far_plane = far_plane.x * light_position.x + far_plane.y * light_position.y +
+                                       far_plane.z * light_position.z + far_plane.w;
+        out_bounds = bounds;
+        for (i32 corner_index = 0; corner_index < 8; ++corner_index) {
+            const Rndr::Point3f corner((corner_index & 1) ? bounds.max.x : bounds.min.x,
+                                       (corner_index & 2) ? bounds.max.y : bounds.min.y,
+                                       (corner_index & 4) ? bounds.max.z : bounds.min.z);
+            const Rndr::Vector3f direction = corner - light_position;
+            // Far plane faces the light, so directions pointing away from the light have a negative dot product with it
+            const f32 direction_dot_plane = far_plane.x * direction.x + far_plane.y * direction.y + far_plane.z * direction.z;
+            if (direction_dot_plane >= 0.0f) {
+                return false;
+            }
+            const f32 t = -light_to_far_plane / direction_dot_plane;
+            if (t <= 1.0f) {
+                continue;
+            }
+            const Rndr::Point3f projected_corner = light_position + direction * t;
+            out_bounds.min = Opal::Min(out_bounds.min, projected_corner);
+            out_bounds.max = Opal::Max(out_bounds.max, projected_corner);
+        }
+        return true;
+    }
+
     Opal::Ref<Rndr::GraphicsContext> m_graphics_context;
+    Opal::Ref<RingBuffer> m_frame_ring_buffer;
     MeshData m_mesh_data;
     Rndr::Buffer m_vertex_buffer;
     Rndr::Buffer m_model_buffer;
@@ -144,13 +313,19 @@ private:
     Rndr::Texture m_brick_texture;
     Rndr::InputLayoutDesc m_input_layout_desc;
     Opal::DynamicArray<Rndr::Matrix4x4f> m_model_matrices;
+    Opal::DynamicArray<Rndr::Bounds3f> m_bounds;
+    Opal::DynamicArray<PerDrawData> m_draw_data;
+    RingBufferAllocation m_draw_data_allocation;
+    Opal::DynamicArray<Rndr::DrawIndicesData> m_draw_commands;
+    Opal::DynamicArray<Rndr::DrawIndicesData> m_subset_draw_commands;
 };
 
 class ShadowRenderer : public Rndr::RendererBase {
 public:
     ShadowRenderer(const Opal::StringUtf8 &name, const Rndr::RendererBaseDesc &desc, MeshContainer *mesh_container,
-                   GameState *game_state)
-        : RendererBase(name, desc), m_mesh_container(mesh_container), m_game_state(game_state) {
+                   GameState *game_state, Rndr::ProjectionCamera *camera, RingBuffer *frame_ring_buffer)
+        : RendererBase(name, desc), m_mesh_container(mesh_container), m_game_state(game_state), m_camera(camera),
+          m_frame_ring_buffer(frame_ring_buffer) {
         // Setup shaders
         const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
         const Opal::StringUtf8 vertex_shader_contents = Rndr::File::ReadShader(shader_dir, "shadow.vert");
@@ -190,12 +365,6 @@ public:
                     .width = 1024, .height = 1024, .pixel_format = Rndr::PixelFormat::D24_UNORM_S8_UINT
                 }
             });
-
-        m_per_frame_buffer.Initialize(
-            m_desc.graphics_context,
-            Rndr::BufferDesc{
-                .type = Rndr::BufferType::Constant, .usage = Rndr::Usage::Dynamic, .size = sizeof(Rndr::Matrix4x4f)
-            });
     }
 
     bool Render() override {
@@ -212,17 +381,25 @@ public:
         Rndr::Matrix4x4f mvp = light_projection * light_view;
         m_game_state->light_clip_from_world = mvp;
         m_game_state->light_position = light_position;
+
+        // Only meshes that are lit and whose shadow can land in the view are drawn
+        const Frustum light_frustum = Culling::ExtractFrustum(m_game_state->light_clip_from_world);
+        const Frustum camera_frustum = Culling::ExtractFrustum(m_camera->FromWorldToNDC());
+        m_mesh_container->CullShadowCasters(m_casters, m_game_state->caster_stats, light_frustum, camera_frustum,
+                                            light_position);
+
         mvp = Opal::Transpose(mvp); // OpenGL expects column-major matrices
 
-        m_desc.graphics_context->UpdateBuffer(m_per_frame_buffer, Opal::AsBytes(mvp));
+        const RingBufferAllocation per_frame_data = GpuMemory::Write(*m_frame_ring_buffer, Opal::AsBytes(mvp));
         m_desc.graphics_context->ClearFrameBufferColorAttachment(m_frame_buffer, 0, Rndr::Colors::k_black);
         m_desc.graphics_context->ClearFrameBufferDepthStencilAttachment(m_frame_buffer, 1.0f, 0);
         m_desc.graphics_context->BindFrameBuffer(m_frame_buffer);
         m_desc.graphics_context->BindPipeline(m_pipeline);
-        m_desc.graphics_context->BindBuffer(m_per_frame_buffer, 0);
-        m_mesh_container->Draw();
+        const bool is_drawn = GpuMemory::BindAllocation(*m_frame_ring_buffer, m_desc.graphics_context, per_frame_data,
+                                                        Rndr::BufferType::Constant, 0) &&
+                              m_mesh_container->Draw(m_pipeline, Opal::ArrayView<const u32>(m_casters));
         m_desc.graphics_context->BindSwapChainFrameBuffer(m_desc.swap_chain);
-        return true;
+        return is_drawn;
     }
 
     const Rndr::FrameBuffer *GetFrameBuffer() const { return &m_frame_buffer; }
@@ -230,23 +407,26 @@ public:
 private:
     Opal::Ref<MeshContainer> m_mesh_container;
     Opal::Ref<GameState> m_game_state;
+    Opal::Ref<Rndr::ProjectionCamera> m_camera;
     Rndr::Shader m_vertex_shader;
     Rndr::Shader m_pixel_shader;
     Rndr::Pipeline m_pipeline;
     Rndr::FrameBuffer m_frame_buffer;
-    Rndr::Buffer m_per_frame_buffer;
+    Opal::Ref<RingBuffer> m_frame_ring_buffer;
+    Opal::DynamicArray<u32> m_casters;
 };
 
 class SceneRenderer : public Rndr::RendererBase {
 public:
     SceneRenderer(const Opal::StringUtf8 &name, const Rndr::RendererBaseDesc &desc, MeshContainer *mesh_container,
                   GameState *game_state,
-                  const Rndr::Texture *shadow_texture, Rndr::ProjectionCamera *camera)
+                  const Rndr::Texture *shadow_texture, Rndr::ProjectionCamera *camera, RingBuffer *frame_ring_buffer)
         : RendererBase(name, desc),
           m_mesh_container(mesh_container),
           m_game_state(game_state),
           m_camera(camera),
-          m_shadow_texture(shadow_texture) {
+          m_shadow_texture(shadow_texture),
+          m_frame_ring_buffer(frame_ring_buffer) {
         // Setup shaders
         const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
         const Opal::StringUtf8 vertex_shader_contents = Rndr::File::ReadShader(shader_dir, "scene-shadow.vert");
@@ -270,12 +450,6 @@ public:
                                         .depth_stencil = {.is_depth_enabled = true},
                                     });
         RNDR_ASSERT(m_pipeline.IsValid());
-
-        m_per_frame_buffer.Initialize(
-            m_desc.graphics_context,
-            Rndr::BufferDesc{
-                .type = Rndr::BufferType::Constant, .usage = Rndr::Usage::Dynamic, .size = sizeof(PerFrameData)
-            });
     }
 
     struct PerFrameData {
@@ -302,13 +476,16 @@ public:
                 Rndr::Point4f(m_game_state->light_position.x, m_game_state->light_position.y,
                               m_game_state->light_position.z, 1.0f);
 
-        m_desc.graphics_context->UpdateBuffer(m_per_frame_buffer, Opal::AsBytes(per_frame_data));
+        const RingBufferAllocation per_frame_allocation =
+                GpuMemory::Write(*m_frame_ring_buffer, Opal::AsBytes(per_frame_data));
         m_desc.graphics_context->BindSwapChainFrameBuffer(m_desc.swap_chain);
         m_desc.graphics_context->BindPipeline(m_pipeline);
-        m_desc.graphics_context->BindBuffer(m_per_frame_buffer, 0);
+        if (!GpuMemory::BindAllocation(*m_frame_ring_buffer, m_desc.graphics_context, per_frame_allocation,
+                                       Rndr::BufferType::Constant, 0)) {
+            return false;
+        }
         m_desc.graphics_context->BindTexture(*m_shadow_texture, 1);
-        m_mesh_container->Draw();
-        return true;
+        return m_mesh_container->Draw(m_pipeline);
     }
 
 private:
@@ -318,8 +495,8 @@ private:
     Rndr::Shader m_vertex_shader;
     Rndr::Shader m_pixel_shader;
     Rndr::Pipeline m_pipeline;
-    Rndr::Buffer m_per_frame_buffer;
     Opal::Ref<const Rndr::Texture> m_shadow_texture;
+    Opal::Ref<RingBuffer> m_frame_ring_buffer;
 };
 
 class PostProcessRenderer : public Rndr::RendererBase {
@@ -407,6 +584,10 @@ public:
         ImGui::SliderFloat("Pos::Dist", &m_game_state->light_distance, 0.5f, 100.0f);
         ImGui::SliderFloat("Pos::AngleX", &m_game_state->light_x_angle, -3.15f, +3.15f);
         ImGui::SliderFloat("Pos::AngleY", &m_game_state->light_y_angle, -3.15f, +3.15f);
+        const ShadowCasterStats &caster_stats = m_game_state->caster_stats;
+        ImGui::Text("Shadow casters: %d drawn of %d", caster_stats.drawn_count, caster_stats.total_count);
+        ImGui::Text("Culled: %d outside light, %d shadow not visible", caster_stats.outside_light_count,
+                    caster_stats.shadow_not_visible_count);
         ImGui::End();
 
         ImGuiWrapper::TextureWindow("Color", m_shadow_frame_buffer->GetColorAttachment(0));
@@ -423,7 +604,7 @@ private:
 
 void Run() {
     Rndr::Window window({.width = 1600, .height = 1200, .name = "Shadows Example"});
-    Rndr::GraphicsContext graphics_context({.window_handle = window.GetNativeWindowHandle()});
+    Rndr::GraphicsContext graphics_context({.window_handle = window.GetNativeWindowHandle(), .enable_bindless_textures = true});
     RNDR_ASSERT(graphics_context.IsValid());
     Rndr::SwapChain swap_chain(graphics_context, {
                                    .width = window.GetWidth(), .height = window.GetHeight(), .enable_vsync = false
@@ -446,7 +627,14 @@ void Run() {
         .graphics_context = Opal::Ref{graphics_context}, .swap_chain = Opal::Ref{swap_chain}
     };
 
-    MeshContainer mesh_container(&graphics_context);
+    // Per frame and per draw constants of all renderers are written to a persistently mapped ring buffer
+    RingBuffer frame_ring_buffer;
+    if (!GpuMemory::SetupRingBuffer(frame_ring_buffer, graphics_context, {.frame_size = 64 * 1024})) {
+        RNDR_LOG_ERROR("Failed to setup the frame ring buffer!");
+        return;
+    }
+
+    MeshContainer mesh_container(&graphics_context, &frame_ring_buffer);
     GameState game_state;
 
     Rndr::FlyCamera fly_camera(&window, &Rndr::InputSystem::GetCurrentContext(),
@@ -461,14 +649,15 @@ void Run() {
     const Opal::ScopePtr<Rndr::RendererBase> clear_renderer =
             Opal::MakeDefaultScoped<Rndr::ClearRenderer>("Clear the screen", renderer_desc, k_clear_color);
     const Opal::ScopePtr<Rndr::RendererBase> shadow_renderer =
-            Opal::MakeDefaultScoped<ShadowRenderer>("Render shadows", renderer_desc, &mesh_container, &game_state);
+            Opal::MakeDefaultScoped<ShadowRenderer>("Render shadows", renderer_desc, &mesh_container, &game_state,
+                                                    &fly_camera, &frame_ring_buffer);
     //    const Opal::ScopePtr<Rndr::RendererBase> post_process_renderer = Opal::MakeDefaultScoped<PostProcessRenderer>(renderer_desc,
     //    true);
     const ShadowRenderer *shadow_renderer_ptr = static_cast<ShadowRenderer *>(shadow_renderer.Get());
     const Opal::ScopePtr<Rndr::RendererBase> scene_renderer =
             Opal::MakeDefaultScoped<SceneRenderer>("Render the scene", renderer_desc, &mesh_container, &game_state,
                                                    &shadow_renderer_ptr->GetFrameBuffer()->GetDepthStencilAttachment(),
-                                                   &fly_camera);
+                                                   &fly_camera, &frame_ring_buffer);
     const Opal::ScopePtr<Rndr::RendererBase> ui_renderer =
             Opal::MakeDefaultScoped<UIRenderer>(renderer_desc, window, &game_state,
                                                 shadow_renderer_ptr->GetFrameBuffer());
@@ -494,9 +683,13 @@ void Run() {
 
         fly_camera.Update(delta_seconds);
 
+        GpuMemory::BeginFrame(frame_ring_buffer, graphics_context);
+        mesh_container.UploadDrawData();
         renderer_manager.Render();
+        GpuMemory::EndFrame(frame_ring_buffer, graphics_context);
 
         const f64 end_time = Opal::GetSeconds();
         delta_seconds = static_cast<f32>(end_time - start_time);
     }
+    GpuMemory::DestroyRingBuffer(frame_ring_buffer, graphics_context);
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <execution>
 #include <optional>
 
 #include "opal/defines.h"
@@ -28,6 +30,8 @@
 #include "vulkan/vulkan-swap-chain.hpp"
 
 static constexpr i32 k_max_frames_in_flight = 2;
+/** Number of threads that record the draws of a frame, each into its own secondary command buffer. */
+static constexpr u32 k_recording_thread_count = 4;
 
 struct Vertex
 {
@@ -140,10 +144,12 @@ private:
     void CreateDescriptorPool();
     void CreateDescriptorSets();
     void CreateCommandBuffers();
+    void CreateRecordingCommandBuffers();
     void CreateSyncObjects();
     void CleanUpSwapChain();
 
     void RecordCommandBuffer(VkCommandBuffer command_buffer, u32 image_index);
+    void RecordDrawSlice(u32 thread_index, u32 image_index);
     void CopyBuffer(VkBuffer source_buffer, VkBuffer dst_buffer, VkDeviceSize size);
     void UpdateUniformBuffer(u32 current_frame);
 
@@ -167,6 +173,11 @@ private:
     VkBuffer m_index_buffer = VK_NULL_HANDLE;
     VkDeviceMemory m_index_buffer_memory = VK_NULL_HANDLE;
     Opal::DynamicArray<VkCommandBuffer> m_command_buffers;
+    /** Command pool and secondary command buffer of each recording thread in each frame in flight, indexed by
+     * frame * k_recording_thread_count + thread. Pools are not shared between threads since they are externally
+     * synchronized, and not between frames so that a frame can reset its pools while the previous one is still executing. */
+    Opal::DynamicArray<VkCommandPool> m_recording_command_pools;
+    Opal::DynamicArray<VkCommandBuffer> m_recording_command_buffers;
     Opal::DynamicArray<VkSemaphore> m_image_available_semaphores;
     Opal::DynamicArray<VkSemaphore> m_render_finished_semaphores;
     Opal::DynamicArray<VkFence> m_in_flight_fences;
@@ -240,6 +251,7 @@ VulkanRenderer::VulkanRenderer(VulkanRendererDesc desc) : m_desc(Opal::Move(desc
     CreateDescriptorPool();
     CreateDescriptorSets();
     CreateCommandBuffers();
+    CreateRecordingCommandBuffers();
     CreateSyncObjects();
 }
 
@@ -271,6 +283,10 @@ VulkanRenderer::~VulkanRenderer()
     vkDestroyPipelineLayout(m_device.GetNativeDevice(), m_pipeline_layout, nullptr);
     vkDestroyRenderPass(m_device.GetNativeDevice(), m_render_pass, nullptr);
     m_device.DestroyCommandBuffers(m_command_buffers, m_queue_family_indices.graphics_family);
+    for (const VkCommandPool& command_pool : m_recording_command_pools)
+    {
+        vkDestroyCommandPool(m_device.GetNativeDevice(), command_pool, nullptr);
+    }
     m_swap_chain.Destroy();
     m_surface.Destroy();
     m_device.Destroy();
@@ -495,6 +511,28 @@ void VulkanRenderer::CreateCommandBuffers()
     RNDR_ASSERT(m_command_buffers.GetSize() == k_max_frames_in_flight, "Failed to create command buffers!");
 }
 
+void VulkanRenderer::CreateRecordingCommandBuffers()
+{
+    const u32 pool_count = k_max_frames_in_flight * k_recording_thread_count;
+    m_recording_command_pools.Resize(pool_count);
+    m_recording_command_buffers.Resize(pool_count);
+    for (u32 i = 0; i < pool_count; ++i)
+    {
+        VkCommandPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.queueFamilyIndex = m_queue_family_indices.graphics_family;
+        pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        VK_CHECK(vkCreateCommandPool(m_device.GetNativeDevice(), &pool_info, nullptr, &m_recording_command_pools[i]));
+
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = m_recording_command_pools[i];
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        alloc_info.commandBufferCount = 1;
+        VK_CHECK(vkAllocateCommandBuffers(m_device.GetNativeDevice(), &alloc_info, &m_recording_command_buffers[i]));
+    }
+}
+
 void VulkanRenderer::RecordCommandBuffer(VkCommandBuffer command_buffer, u32 image_index)
 {
     VkCommandBufferBeginInfo begin_info{};
@@ -515,7 +553,46 @@ void VulkanRenderer::RecordCommandBuffer(VkCommandBuffer command_buffer, u32 ima
     render_pass_info.clearValueCount = 1;
     render_pass_info.pClearValues = &clear_color;
 
-    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    // Draws are recorded into secondary command buffers on multiple threads and executed in the thread order, which keeps
+    // the draw order the same as if they were recorded inline
+    u32 thread_indices[k_recording_thread_count];
+    for (u32 i = 0; i < k_recording_thread_count; ++i)
+    {
+        thread_indices[i] = i;
+    }
+    std::for_each(std::execution::par, thread_indices, thread_indices + k_recording_thread_count,
+                  [this, image_index](u32 thread_index) { RecordDrawSlice(thread_index, image_index); });
+
+    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(command_buffer, k_recording_thread_count,
+                         &m_recording_command_buffers[m_current_frame_in_flight * k_recording_thread_count]);
+    vkCmdEndRenderPass(command_buffer);
+
+    VK_CHECK(vkEndCommandBuffer(command_buffer));
+}
+
+void VulkanRenderer::RecordDrawSlice(u32 thread_index, u32 image_index)
+{
+    const u32 buffer_index = m_current_frame_in_flight * k_recording_thread_count + thread_index;
+    VkCommandBuffer command_buffer = m_recording_command_buffers[buffer_index];
+
+    // The fence of this frame was waited on, so the pool can be reset together with its command buffer
+    VK_CHECK(vkResetCommandPool(m_device.GetNativeDevice(), m_recording_command_pools[buffer_index], 0));
+
+    VkCommandBufferInheritanceInfo inheritance_info{};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = m_render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = m_swap_chain_frame_buffers[image_index];
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+    // Secondary command buffers don't inherit any state, so each one binds everything it uses
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
     vkCmdSetViewport(command_buffer, 0, 1, &m_viewport);
     vkCmdSetScissor(command_buffer, 0, 1, &m_scissor);
@@ -529,8 +606,14 @@ void VulkanRenderer::RecordCommandBuffer(VkCommandBuffer command_buffer, u32 ima
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1,
                             &m_descriptor_sets[m_current_frame_in_flight], 0, nullptr);
 
-    vkCmdDrawIndexed(command_buffer, static_cast<u32>(g_indices.GetSize()), 1, 0, 0, 0);
-    vkCmdEndRenderPass(command_buffer);
+    // Each thread draws its share of the triangles, threads past the triangle count record an empty buffer
+    const u32 triangle_count = static_cast<u32>(g_indices.GetSize()) / 3;
+    const u32 first_triangle = triangle_count * thread_index / k_recording_thread_count;
+    const u32 end_triangle = triangle_count * (thread_index + 1) / k_recording_thread_count;
+    if (end_triangle > first_triangle)
+    {
+        vkCmdDrawIndexed(command_buffer, 3 * (end_triangle - first_triangle), 1, 3 * first_triangle, 0, 0);
+    }
 
     VK_CHECK(vkEndCommandBuffer(command_buffer));
 }
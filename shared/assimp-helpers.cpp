@@ -505,13 +505,17 @@ void Traverse(SceneDescription& out_scene, const aiScene* ai_scene, const aiNode
         const u32 mesh_id = ai_node->mMeshes[i];
         Scene::SetNodeMeshId(out_scene, new_sub_node_id, mesh_id);
         Scene::SetNodeMaterialId(out_scene, new_sub_node_id, ai_scene->mMeshes[mesh_id]->mMaterialIndex);
-
-        out_scene.local_transforms[new_sub_node_id] = Rndr::Matrix4x4f(1.0f);
-        out_scene.world_transforms[new_sub_node_id] = Rndr::Matrix4x4f(1.0f);
     }
 
-    out_scene.local_transforms[new_node_id] = AssimpHelpers::Convert(ai_node->mTransformation);
-    out_scene.world_transforms[new_node_id] = Rndr::Matrix4x4f(1.0f);
+    aiVector3D ai_scale;
+    aiQuaternion ai_rotation;
+    aiVector3D ai_translation;
+    ai_node->mTransformation.Decompose(ai_scale, ai_rotation, ai_translation);
+    Scene::LocalTransform& local_transform = out_scene.local_transforms[new_node_id];
+    local_transform.translation = Rndr::Vector3f(ai_translation.x, ai_translation.y, ai_translation.z);
+    local_transform.rotation.v = Rndr::Vector3f(ai_rotation.x, ai_rotation.y, ai_rotation.z);
+    local_transform.rotation.w = ai_rotation.w;
+    local_transform.scale = Rndr::Vector3f(ai_scale.x, ai_scale.y, ai_scale.z);
 
     for (u32 i = 0; i < ai_node->mNumChildren; ++i)
     {
@@ -0,0 +1,236 @@
+#include "baked-draws.h"
+
+#include <cstring>
+
+#include "opal/time.h"
+
+#include "rndr/file.h"
+#include "rndr/log.h"
+
+namespace
+{
+constexpr u32 k_baked_draws_magic = 0x44454B42;
+constexpr u32 k_baked_draws_version = 1;
+
+constexpr u64 k_hash_seed = 0xCBF29CE484222325ull;
+constexpr u64 k_hash_prime = 0x100000001B3ull;
+
+/**
+ * Header of the baked draw data section, written after the scene description.
+ */
+struct BakedDrawsHeader
+{
+    u32 magic = k_baked_draws_magic;
+    u32 version = k_baked_draws_version;
+    u64 content_hash = 0;
+    u64 shape_count = 0;
+};
+
+/** FNV-1a over eight byte words, with the remaining bytes hashed one by one. */
+u64 HashBytes(u64 hash, const void* data, size_t size)
+{
+    const u8* bytes = static_cast<const u8*>(data);
+    size_t offset = 0;
+    for (; offset + sizeof(u64) <= size; offset += sizeof(u64))
+    {
+        u64 word = 0;
+        std::memcpy(&word, bytes + offset, sizeof(u64));
+        hash = (hash ^ word) * k_hash_prime;
+    }
+    for (; offset < size; ++offset)
+    {
+        hash = (hash ^ bytes[offset]) * k_hash_prime;
+    }
+    return hash;
+}
+
+template <typename T>
+u64 HashArray(u64 hash, const Opal::DynamicArray<T>& array)
+{
+    const u64 size = array.GetSize();
+    hash = HashBytes(hash, &size, sizeof(size));
+    return size > 0 ? HashBytes(hash, array.GetData(), size * sizeof(T)) : hash;
+}
+
+/** Final mix of SplitMix64, spreads the entries of a map before they are added together. */
+u64 MixBits(u64 value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+/** Hash maps don't keep the insertion order, so entries are combined with a sum that doesn't depend on it. */
+u64 HashMap(u64 hash, const Opal::HashMap<Scene::NodeId, uint32_t>& map)
+{
+    u64 sum = 0;
+    for (const auto& pair : map)
+    {
+        sum += MixBits((static_cast<u64>(static_cast<u32>(pair.first)) << 32) | pair.second);
+    }
+    const u64 size = map.size();
+    hash = HashBytes(hash, &size, sizeof(size));
+    return HashBytes(hash, &sum, sizeof(sum));
+}
+
+bool ReadBakedDraws(BakedDrawData& out_baked, Rndr::FileHandler& file)
+{
+    // Files written without the section end right after the scene description
+    BakedDrawsHeader header;
+    if (!file.Read(&header, sizeof(header), 1))
+    {
+        return false;
+    }
+    if (header.magic != k_baked_draws_magic || header.version != k_baked_draws_version)
+    {
+        RNDR_LOG_WARNING("Unsupported baked draw data section in the scene file, ignoring it");
+        return false;
+    }
+
+    const size_t shape_count = header.shape_count;
+    out_baked.shapes.Resize(shape_count);
+    out_baked.draw_commands.Resize(shape_count);
+    out_baked.model_data.Resize(shape_count);
+    if (shape_count > 0 && (!file.Read(out_baked.shapes.GetData(), sizeof(out_baked.shapes[0]), shape_count) ||
+                            !file.Read(out_baked.draw_commands.GetData(), sizeof(out_baked.draw_commands[0]), shape_count) ||
+                            !file.Read(out_baked.model_data.GetData(), sizeof(out_baked.model_data[0]), shape_count)))
+    {
+        RNDR_LOG_WARNING("Baked draw data section of the scene file is truncated, ignoring it");
+        out_baked = {};
+        return false;
+    }
+    out_baked.content_hash = header.content_hash;
+    return true;
+}
+}  // namespace
+
+u64 Scene::HashBakeInputs(const SceneDrawData& scene)
+{
+    const SceneDescription& description = scene.scene_description;
+    u64 hash = k_hash_seed;
+    hash = HashArray(hash, description.local_transforms);
+    hash = HashArray(hash, description.hierarchy);
+    hash = HashArray(hash, description.node_flags);
+    hash = HashMap(hash, description.node_id_to_mesh_id);
+    hash = HashMap(hash, description.node_id_to_material_id);
+    hash = HashArray(hash, scene.mesh_data.meshes);
+    const u64 material_count = scene.materials.GetSize();
+    hash = HashBytes(hash, &material_count, sizeof(material_count));
+    // Zero marks missing baked data
+    return hash != 0 ? hash : 1;
+}
+
+bool Scene::BakeDraws(BakedDrawData& out_baked, const SceneDrawData& scene)
+{
+    const size_t shape_count = scene.shapes.GetSize();
+    out_baked.content_hash = HashBakeInputs(scene);
+    out_baked.shapes = scene.shapes;
+    if (!Mesh::GetDrawCommands(out_baked.draw_commands, scene.shapes, scene.mesh_data))
+    {
+        RNDR_LOG_ERROR("BakeDraws: Failed to create the draw commands!");
+        out_baked = {};
+        return false;
+    }
+    out_baked.model_data.Resize(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        out_baked.model_data[i].model_transform = scene.scene_description.world_transforms[scene.shapes[i].transform_index];
+    }
+    CalculateNormalTransforms(Opal::ArrayView<ModelData>(out_baked.model_data));
+    return true;
+}
+
+bool Scene::WriteSceneWithBakedDraws(const SceneDrawData& scene, const BakedDrawData& baked, const Opal::StringUtf8& scene_file)
+{
+    const size_t shape_count = baked.shapes.GetSize();
+    if (baked.content_hash == 0 || baked.draw_commands.GetSize() != shape_count || baked.model_data.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("WriteSceneWithBakedDraws: Baked draw data is empty or inconsistent!");
+        return false;
+    }
+
+    Rndr::FileHandler file(scene_file.GetData(), "wb");
+    if (!file.IsValid())
+    {
+        RNDR_LOG_ERROR("WriteSceneWithBakedDraws: Failed to open %s!", scene_file.GetData());
+        return false;
+    }
+    if (!WriteSceneDescription(scene.scene_description, file))
+    {
+        return false;
+    }
+
+    const BakedDrawsHeader header{.content_hash = baked.content_hash, .shape_count = shape_count};
+    file.Write(&header, sizeof(header), 1);
+    if (shape_count > 0)
+    {
+        file.Write(baked.shapes.GetData(), sizeof(baked.shapes[0]), shape_count);
+        file.Write(baked.draw_commands.GetData(), sizeof(baked.draw_commands[0]), shape_count);
+        file.Write(baked.model_data.GetData(), sizeof(baked.model_data[0]), shape_count);
+    }
+    return true;
+}
+
+bool Scene::ReadSceneWithBakedDraws(SceneDrawData& out_scene, BakedDrawData& out_baked, const Opal::StringUtf8& scene_file,
+                                    const Opal::StringUtf8& mesh_file, const Opal::StringUtf8& material_file,
+                                    const Rndr::GraphicsContext& graphics_context, SceneLoadStats* out_stats)
+{
+    SceneLoadStats stats;
+    f64 start_time = Opal::GetSeconds();
+    {
+        Rndr::FileHandler file(scene_file.GetData(), "rb");
+        if (!file.IsValid())
+        {
+            RNDR_LOG_ERROR("ReadSceneWithBakedDraws: Failed to open %s!", scene_file.GetData());
+            return false;
+        }
+        if (!ReadSceneDescription(out_scene.scene_description, file))
+        {
+            return false;
+        }
+        out_baked = {};
+        ReadBakedDraws(out_baked, file);
+    }
+    if (!Mesh::ReadData(out_scene.mesh_data, mesh_file))
+    {
+        return false;
+    }
+    if (!Material::ReadDataLoadTextures(out_scene.materials, out_scene.textures, material_file, graphics_context))
+    {
+        return false;
+    }
+    stats.read_files_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+
+    if (out_baked.content_hash != 0)
+    {
+        start_time = Opal::GetSeconds();
+        stats.is_baked = out_baked.content_hash == HashBakeInputs(out_scene);
+        stats.is_stale = !stats.is_baked;
+        stats.hash_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+        if (stats.is_stale)
+        {
+            RNDR_LOG_WARNING("Baked draw data in %s doesn't match the scene, rebuilding it", scene_file.GetData());
+        }
+    }
+
+    start_time = Opal::GetSeconds();
+    if (stats.is_baked)
+    {
+        out_scene.shapes = out_baked.shapes;
+    }
+    else
+    {
+        BuildShapes(out_scene);
+    }
+    // World transforms are not baked, nodes that move later need the transforms of their parents
+    MarkAllAsChanged(out_scene.scene_description);
+    RecalculateWorldTransforms(out_scene.scene_description);
+    const bool is_success = stats.is_baked || BakeDraws(out_baked, out_scene);
+    stats.build_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+
+    if (out_stats != nullptr)
+    {
+        *out_stats = stats;
+    }
+    return is_success;
+}
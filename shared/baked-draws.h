@@ -0,0 +1,92 @@
+#pragma once
+
+#include "opal/container/dynamic-array.h"
+#include "opal/container/string.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/render-api.h"
+
+#include "mesh.h"
+#include "model-data.h"
+#include "scene.h"
+#include "types.h"
+
+/**
+ * Draw data derived from the scene at load time, precomputed and stored in an optional section at the end of the scene
+ * file. Loading it skips building the shapes from the node maps, converting them to draw commands and calculating the
+ * model and normal transforms.
+ */
+struct BakedDrawData
+{
+    /** Hash of the scene inputs the data was baked from, see Scene::HashBakeInputs. Zero if there is no baked data. */
+    u64 content_hash = 0;
+
+    /** Shapes in the same order as SceneDrawData::shapes. */
+    Opal::DynamicArray<MeshDrawData> shapes;
+    /** Draw command of each shape, as created by Mesh::GetDrawCommands. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+    /** Model data of each shape in the rest pose of the scene. */
+    Opal::DynamicArray<ModelData> model_data;
+};
+
+/**
+ * Timings of a scene load, in milliseconds.
+ */
+struct SceneLoadStats
+{
+    /** True if valid baked draw data was found in the scene file and used. */
+    bool is_baked = false;
+    /** True if the scene file had baked draw data that no longer matches the scene inputs. */
+    bool is_stale = false;
+    f64 read_files_time_ms = 0.0;
+    f64 hash_time_ms = 0.0;
+    /** Time spent building shapes and world transforms, and baking the draw data when it is not used from the file. */
+    f64 build_time_ms = 0.0;
+};
+
+namespace Scene
+{
+
+/**
+ * Hashes everything the baked draw data depends on: transforms, hierarchy and flags of the nodes, node to mesh and node to
+ * material maps, mesh descriptions and the material count. Map entries are combined independently of their order.
+ * @param scene The scene draw data with the scene description, mesh data and materials loaded.
+ * @return Hash of the inputs, never zero.
+ */
+u64 HashBakeInputs(const SceneDrawData& scene);
+
+/**
+ * Bakes the draw data of a scene.
+ * @param out_baked The baked draw data.
+ * @param scene The scene draw data with the shapes built and the world transforms up to date.
+ * @return True if the draw data was baked, false otherwise.
+ */
+bool BakeDraws(BakedDrawData& out_baked, const SceneDrawData& scene);
+
+/**
+ * Writes the scene description followed by the baked draw data section.
+ * @param scene The scene draw data whose description is written.
+ * @param baked The baked draw data to write.
+ * @param scene_file The file to write the scene description to.
+ * @return True if the file was successfully written, false otherwise.
+ */
+bool WriteSceneWithBakedDraws(const SceneDrawData& scene, const BakedDrawData& baked, const Opal::StringUtf8& scene_file);
+
+/**
+ * Loads a scene like ReadScene, and uses the baked draw data from the scene file if its hash matches the loaded inputs.
+ * Otherwise the shapes are built from the scene description and the draw data is baked from them, so the result is the
+ * same either way.
+ * @param out_scene The scene draw data to fill.
+ * @param out_baked The baked draw data, either read from the file or baked during the load.
+ * @param scene_file The file to load the scene description and the baked draw data from.
+ * @param mesh_file The file to load the mesh data from.
+ * @param material_file The file to load the material data from.
+ * @param graphics_context Graphics context used to load the textures to the GPU.
+ * @param out_stats Optional timings of the load and whether baked data was used.
+ * @return True if the scene was successfully loaded, false otherwise.
+ */
+bool ReadSceneWithBakedDraws(SceneDrawData& out_scene, BakedDrawData& out_baked, const Opal::StringUtf8& scene_file,
+                             const Opal::StringUtf8& mesh_file, const Opal::StringUtf8& material_file,
+                             const Rndr::GraphicsContext& graphics_context, SceneLoadStats* out_stats = nullptr);
+
+}  // namespace Scene
@@ -0,0 +1,424 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <execution>
+#include <limits>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Number of bins used to evaluate SAH along each axis. */
+constexpr i32 k_bin_count = 16;
+
+/** Subtrees with at least this many shapes are built in parallel. */
+constexpr u32 k_parallel_build_shape_count = 4096;
+
+/** Only the top levels fork, which already gives 2^depth tasks, so that parallel loops are not nested deep in the tree. */
+constexpr u32 k_max_parallel_build_depth = 4;
+
+/** Depth of the query stack. Depth first traversal keeps at most one pending sibling per level plus both children of the
+ * deepest node, and the build never goes deeper than Culling::k_max_bvh_depth. */
+constexpr u32 k_query_stack_size = Culling::k_max_bvh_depth + 1;
+
+struct Aabb
+{
+    f32 min[3] = {std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max()};
+    f32 max[3] = {std::numeric_limits<f32>::lowest(), std::numeric_limits<f32>::lowest(), std::numeric_limits<f32>::lowest()};
+
+    void Grow(const f32 point_min[3], const f32 point_max[3])
+    {
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = std::min(min[axis], point_min[axis]);
+            max[axis] = std::max(max[axis], point_max[axis]);
+        }
+    }
+
+    [[nodiscard]] f32 GetHalfArea() const
+    {
+        if (min[0] > max[0])
+        {
+            return 0.0f;
+        }
+        const f32 dx = max[0] - min[0];
+        const f32 dy = max[1] - min[1];
+        const f32 dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+struct BuildContext
+{
+    const ShapeBounds& bounds;
+    Bvh& bvh;
+    std::atomic<u32> next_node;
+};
+
+void GetShapeBounds(const ShapeBounds& bounds, u32 shape, f32 out_min[3], f32 out_max[3])
+{
+    out_min[0] = bounds.center_x[shape] - bounds.extent_x[shape];
+    out_min[1] = bounds.center_y[shape] - bounds.extent_y[shape];
+    out_min[2] = bounds.center_z[shape] - bounds.extent_z[shape];
+    out_max[0] = bounds.center_x[shape] + bounds.extent_x[shape];
+    out_max[1] = bounds.center_y[shape] + bounds.extent_y[shape];
+    out_max[2] = bounds.center_z[shape] + bounds.extent_z[shape];
+}
+
+f32 GetCenter(const ShapeBounds& bounds, u32 shape, i32 axis)
+{
+    switch (axis)
+    {
+        case 0:
+            return bounds.center_x[shape];
+        case 1:
+            return bounds.center_y[shape];
+        default:
+            return bounds.center_z[shape];
+    }
+}
+
+void SetLeafBounds(BvhNode& node, const Bvh& bvh, const ShapeBounds& bounds)
+{
+    Aabb aabb;
+    for (u32 i = node.first_shape; i < node.first_shape + node.shape_count; ++i)
+    {
+        f32 shape_min[3];
+        f32 shape_max[3];
+        GetShapeBounds(bounds, bvh.shape_indices[i], shape_min, shape_max);
+        aabb.Grow(shape_min, shape_max);
+    }
+    std::copy(aabb.min, aabb.min + 3, node.min);
+    std::copy(aabb.max, aabb.max + 3, node.max);
+}
+
+void BuildNode(BuildContext& context, u32 node_index, u32 first_shape, u32 shape_count, u32 parent, u32 depth)
+{
+    Bvh& bvh = context.bvh;
+    BvhNode& node = bvh.nodes[node_index];
+    node.first_shape = first_shape;
+    node.shape_count = shape_count;
+    node.parent = parent;
+    node.left_child = Bvh::k_invalid_node;
+    SetLeafBounds(node, bvh, context.bounds);
+
+    if (shape_count <= Culling::k_max_shapes_per_leaf || depth + 1 >= Culling::k_max_bvh_depth)
+    {
+        for (u32 i = first_shape; i < first_shape + shape_count; ++i)
+        {
+            bvh.shape_to_leaf[bvh.shape_indices[i]] = node_index;
+        }
+        return;
+    }
+
+    u32* const shapes_begin = bvh.shape_indices.GetData() + first_shape;
+    u32* const shapes_end = shapes_begin + shape_count;
+
+    Aabb centroid_bounds;
+    for (u32* shape = shapes_begin; shape != shapes_end; ++shape)
+    {
+        const f32 centroid[3] = {GetCenter(context.bounds, *shape, 0), GetCenter(context.bounds, *shape, 1),
+                                 GetCenter(context.bounds, *shape, 2)};
+        centroid_bounds.Grow(centroid, centroid);
+    }
+
+    // Evaluate SAH at bin boundaries along every axis
+    i32 best_axis = -1;
+    i32 best_split = 0;
+    f32 best_cost = std::numeric_limits<f32>::max();
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        const f32 axis_min = centroid_bounds.min[axis];
+        const f32 axis_extent = centroid_bounds.max[axis] - axis_min;
+        if (axis_extent <= 0.0f)
+        {
+            continue;
+        }
+
+        Aabb bins[k_bin_count];
+        u32 bin_counts[k_bin_count] = {};
+        const f32 scale = k_bin_count / axis_extent;
+        for (u32* shape = shapes_begin; shape != shapes_end; ++shape)
+        {
+            const i32 bin = std::min(k_bin_count - 1, static_cast<i32>((GetCenter(context.bounds, *shape, axis) - axis_min) * scale));
+            f32 shape_min[3];
+            f32 shape_max[3];
+            GetShapeBounds(context.bounds, *shape, shape_min, shape_max);
+            bins[bin].Grow(shape_min, shape_max);
+            bin_counts[bin]++;
+        }
+
+        f32 right_areas[k_bin_count];
+        u32 right_counts[k_bin_count];
+        Aabb right_bounds;
+        u32 right_count = 0;
+        for (i32 bin = k_bin_count - 1; bin > 0; --bin)
+        {
+            right_bounds.Grow(bins[bin].min, bins[bin].max);
+            right_count += bin_counts[bin];
+            right_areas[bin] = right_bounds.GetHalfArea();
+            right_counts[bin] = right_count;
+        }
+
+        Aabb left_bounds;
+        u32 left_count = 0;
+        for (i32 split = 1; split < k_bin_count; ++split)
+        {
+            left_bounds.Grow(bins[split - 1].min, bins[split - 1].max);
+            left_count += bin_counts[split - 1];
+            if (left_count == 0 || right_counts[split] == 0)
+            {
+                continue;
+            }
+            const f32 cost = left_bounds.GetHalfArea() * static_cast<f32>(left_count) + right_areas[split] * static_cast<f32>(right_counts[split]);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    u32* middle = nullptr;
+    if (best_axis != -1)
+    {
+        const f32 axis_min = centroid_bounds.min[best_axis];
+        const f32 scale = k_bin_count / (centroid_bounds.max[best_axis] - axis_min);
+        middle = std::partition(shapes_begin, shapes_end,
+                                [&](u32 shape)
+                                {
+                                    const i32 bin = std::min(k_bin_count - 1,
+                                                             static_cast<i32>((GetCenter(context.bounds, shape, best_axis) - axis_min) * scale));
+                                    return bin < best_split;
+                                });
+    }
+    if (middle == nullptr || middle == shapes_begin || middle == shapes_end)
+    {
+        // All centroids are in the same spot, split by count
+        middle = shapes_begin + shape_count / 2;
+    }
+
+    const u32 left_count = static_cast<u32>(middle - shapes_begin);
+    const u32 left_child = context.next_node.fetch_add(2);
+    node.left_child = left_child;
+
+    const u32 child_first_shape[2] = {first_shape, first_shape + left_count};
+    const u32 child_shape_count[2] = {left_count, shape_count - left_count};
+    const auto build_child = [&](u32 child)
+    { BuildNode(context, left_child + child, child_first_shape[child], child_shape_count[child], node_index, depth + 1); };
+    if (shape_count >= k_parallel_build_shape_count && depth < k_max_parallel_build_depth)
+    {
+        const u32 children[2] = {0, 1};
+        std::for_each(std::execution::par, children, children + 2, build_child);
+    }
+    else
+    {
+        build_child(0);
+        build_child(1);
+    }
+}
+
+/**
+ * Walks the BVH and collects shapes for which the classify function doesn't return -1. Subtrees for which it returns 1 are
+ * accepted without testing their children.
+ */
+template <typename ClassifyFunction>
+void QueryBvhNodes(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const ShapeBounds& bounds, const ClassifyFunction& classify)
+{
+    const f64 start_time = Opal::GetSeconds();
+
+    out_shapes.Clear();
+    bvh.stats.nodes_visited = 0;
+    bvh.stats.nodes_accepted = 0;
+    if (bvh.nodes.IsEmpty())
+    {
+        return;
+    }
+
+    u32 stack[k_query_stack_size];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const BvhNode& node = bvh.nodes[stack[--stack_size]];
+        bvh.stats.nodes_visited++;
+
+        const f32 center[3] = {0.5f * (node.min[0] + node.max[0]), 0.5f * (node.min[1] + node.max[1]), 0.5f * (node.min[2] + node.max[2])};
+        const f32 extent[3] = {0.5f * (node.max[0] - node.min[0]), 0.5f * (node.max[1] - node.min[1]), 0.5f * (node.max[2] - node.min[2])};
+        const i32 classification = classify(center, extent);
+        if (classification < 0)
+        {
+            continue;
+        }
+        if (classification > 0)
+        {
+            bvh.stats.nodes_accepted++;
+            out_shapes.Insert(out_shapes.cend(), bvh.shape_indices.cbegin() + node.first_shape,
+                              bvh.shape_indices.cbegin() + node.first_shape + node.shape_count);
+            continue;
+        }
+        if (node.left_child != Bvh::k_invalid_node)
+        {
+            RNDR_ASSERT(stack_size + 2 <= k_query_stack_size, "BVH is deeper than the query stack");
+            stack[stack_size++] = node.left_child + 1;
+            stack[stack_size++] = node.left_child;
+            continue;
+        }
+
+        for (u32 i = node.first_shape; i < node.first_shape + node.shape_count; ++i)
+        {
+            const u32 shape = bvh.shape_indices[i];
+            const f32 shape_center[3] = {bounds.center_x[shape], bounds.center_y[shape], bounds.center_z[shape]};
+            const f32 shape_extent[3] = {bounds.extent_x[shape], bounds.extent_y[shape], bounds.extent_z[shape]};
+            if (classify(shape_center, shape_extent) >= 0)
+            {
+                out_shapes.PushBack(shape);
+            }
+        }
+    }
+
+    // Keep the draw order stable from frame to frame
+    std::sort(out_shapes.begin(), out_shapes.end());
+
+    bvh.stats.query_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+}
+}  // namespace
+
+bool Culling::BuildBvh(Bvh& out_bvh, const ShapeBounds& bounds)
+{
+    const u32 shape_count = static_cast<u32>(bounds.center_x.GetSize());
+    if (shape_count == 0)
+    {
+        RNDR_LOG_ERROR("Can't build a BVH without shapes!");
+        return false;
+    }
+
+    Opal::DynamicArray<u32> shapes(shape_count);
+    for (u32 i = 0; i < shape_count; ++i)
+    {
+        shapes[i] = i;
+    }
+    return BuildBvh(out_bvh, bounds, Opal::ArrayView<const u32>(shapes));
+}
+
+bool Culling::BuildBvh(Bvh& out_bvh, const ShapeBounds& bounds, const Opal::ArrayView<const u32>& shapes)
+{
+    const f64 start_time = Opal::GetSeconds();
+
+    const u32 shape_count = static_cast<u32>(shapes.GetSize());
+    out_bvh.nodes.Clear();
+    out_bvh.shape_indices.Resize(shape_count);
+    out_bvh.shape_to_leaf.Clear();
+    out_bvh.shape_to_leaf.Resize(bounds.center_x.GetSize(), Bvh::k_invalid_node);
+    for (u32 i = 0; i < shape_count; ++i)
+    {
+        out_bvh.shape_indices[i] = shapes[i];
+    }
+
+    if (shape_count > 0)
+    {
+        out_bvh.nodes.Resize(2 * static_cast<size_t>(shape_count) - 1);
+        BuildContext context{.bounds = bounds, .bvh = out_bvh, .next_node = 1};
+        BuildNode(context, 0, 0, shape_count, Bvh::k_invalid_node, 0);
+        out_bvh.nodes.Resize(context.next_node.load());
+    }
+
+    out_bvh.node_marks.Clear();
+    out_bvh.node_marks.Resize(out_bvh.nodes.GetSize(), 0);
+    out_bvh.stats.build_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
+
+void Culling::RefitBvh(Bvh& in_out_bvh, const ShapeBounds& bounds, const Opal::ArrayView<const u32>& changed_shapes)
+{
+    if (changed_shapes.GetSize() == 0)
+    {
+        return;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    // Collect changed leaves and all of their ancestors, each node only once
+    in_out_bvh.dirty_nodes.Clear();
+    for (size_t i = 0; i < changed_shapes.GetSize(); ++i)
+    {
+        for (u32 node = in_out_bvh.shape_to_leaf[changed_shapes[i]]; node != Bvh::k_invalid_node && in_out_bvh.node_marks[node] == 0;
+             node = in_out_bvh.nodes[node].parent)
+        {
+            in_out_bvh.node_marks[node] = 1;
+            in_out_bvh.dirty_nodes.PushBack(node);
+        }
+    }
+
+    // Children are always allocated after their parents so going from the highest index visits children first
+    std::sort(in_out_bvh.dirty_nodes.begin(), in_out_bvh.dirty_nodes.end(), [](u32 a, u32 b) { return a > b; });
+    for (const u32 node_index : in_out_bvh.dirty_nodes)
+    {
+        BvhNode& node = in_out_bvh.nodes[node_index];
+        if (node.left_child == Bvh::k_invalid_node)
+        {
+            SetLeafBounds(node, in_out_bvh, bounds);
+        }
+        else
+        {
+            const BvhNode& left = in_out_bvh.nodes[node.left_child];
+            const BvhNode& right = in_out_bvh.nodes[node.left_child + 1];
+            for (i32 axis = 0; axis < 3; ++axis)
+            {
+                node.min[axis] = std::min(left.min[axis], right.min[axis]);
+                node.max[axis] = std::max(left.max[axis], right.max[axis]);
+            }
+        }
+        in_out_bvh.node_marks[node_index] = 0;
+    }
+
+    in_out_bvh.stats.refit_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+}
+
+void Culling::QueryBvh(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const Frustum& frustum, const ShapeBounds& bounds)
+{
+    QueryBvhNodes(out_shapes, bvh, bounds,
+                  [&frustum](const f32 center[3], const f32 extent[3]) { return ClassifyBox(frustum, center, extent); });
+}
+
+void Culling::QueryBvh(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const Rndr::Point3f& center, f32 radius, const ShapeBounds& bounds)
+{
+    QueryBvhNodes(out_shapes, bvh, bounds,
+                  [&center, radius](const f32 box_center[3], const f32 box_extent[3])
+                  { return ClassifyBox(center, radius, box_center, box_extent); });
+}
+
+bool Culling::CullShapes(CullingResult& out_result, Bvh& bvh, const Frustum& frustum, const ShapeBounds& bounds,
+                         const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands)
+{
+    const size_t shape_count = draw_commands.GetSize();
+    if (bvh.shape_to_leaf.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("BVH and draw commands are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    QueryBvh(out_result.model_indices, bvh, frustum, bounds);
+    out_result.draw_commands.Clear();
+    out_result.draw_commands.Reserve(out_result.model_indices.GetSize());
+    out_result.visibility.Resize(shape_count);
+    std::fill(out_result.visibility.begin(), out_result.visibility.end(), static_cast<u8>(0));
+    for (const u32 shape : out_result.model_indices)
+    {
+        out_result.draw_commands.PushBack(draw_commands[shape]);
+        out_result.visibility[shape] = 1;
+    }
+
+    out_result.stats.total_count = shape_count;
+    out_result.stats.visible_count = out_result.draw_commands.GetSize();
+    out_result.stats.culled_count = shape_count - out_result.draw_commands.GetSize();
+    out_result.stats.cull_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "culling.h"
+
+/**
+ * Node of a bounding volume hierarchy. Children of a node are always stored next to each other so only the index of the
+ * left child is stored. Every node covers a contiguous range of shape indices in Bvh::shape_indices.
+ */
+struct BvhNode
+{
+    f32 min[3];
+    /** First shape covered by this node in the Bvh::shape_indices array. */
+    u32 first_shape;
+    f32 max[3];
+    /** Number of shapes covered by this node. */
+    u32 shape_count;
+    /** Index of the left child or Bvh::k_invalid_node if this node is a leaf. Right child is at left_child + 1. */
+    u32 left_child;
+    /** Index of the parent or Bvh::k_invalid_node for the root. */
+    u32 parent;
+};
+
+/**
+ * Timings of the last BVH operations.
+ */
+struct BvhStats
+{
+    f64 build_time_ms = 0.0;
+    f64 refit_time_ms = 0.0;
+    f64 query_time_ms = 0.0;
+    /** Number of nodes tested against the frustum in the last query. */
+    u64 nodes_visited = 0;
+    /** Number of nodes fully inside the frustum in the last query, their subtrees were accepted without testing. */
+    u64 nodes_accepted = 0;
+};
+
+/**
+ * Bounding volume hierarchy over world space shape bounds stored in a flat array with the root at index 0.
+ */
+struct Bvh
+{
+    static constexpr u32 k_invalid_node = 0xFFFFFFFF;
+
+    Opal::DynamicArray<BvhNode> nodes;
+
+    /** Shape indices ordered so that each node covers a contiguous range. */
+    Opal::DynamicArray<u32> shape_indices;
+
+    /** For each shape, index of the leaf that contains it. */
+    Opal::DynamicArray<u32> shape_to_leaf;
+
+    /** Scratch arrays used during refit, kept around to avoid allocations. */
+    Opal::DynamicArray<u32> dirty_nodes;
+    Opal::DynamicArray<u8> node_marks;
+
+    BvhStats stats;
+};
+
+namespace Culling
+{
+
+/** Maximum number of shapes in a BVH leaf. Leaves at k_max_bvh_depth can hold more. */
+constexpr u32 k_max_shapes_per_leaf = 4;
+
+/** Maximum number of levels in a BVH. Bounds the stack used to traverse it, nodes at the last level are always leaves. */
+constexpr u32 k_max_bvh_depth = 64;
+
+/**
+ * Builds a BVH over shape bounds using binned SAH. Large subtrees near the root are built in parallel.
+ * @param out_bvh BVH to build.
+ * @param bounds World space bounds of the shapes.
+ * @return True if the BVH was built, false if there are no shapes.
+ */
+bool BuildBvh(Bvh& out_bvh, const ShapeBounds& bounds);
+
+/**
+ * Builds a BVH over a subset of shapes using binned SAH. Shapes that are not in the subset are ignored by refits and
+ * queries.
+ * @param out_bvh BVH to build.
+ * @param bounds World space bounds of all the shapes.
+ * @param shapes Indices of the shapes to put in the BVH. Can be empty in which case the BVH is empty.
+ * @return True if the BVH was built, false otherwise.
+ */
+bool BuildBvh(Bvh& out_bvh, const ShapeBounds& bounds, const Opal::ArrayView<const u32>& shapes);
+
+/**
+ * Updates bounds of the leaves containing the given shapes and of all their ancestors. Tree topology is kept so the
+ * quality of the tree degrades if shapes move a lot, in which case it should be rebuilt.
+ * @param in_out_bvh BVH to refit.
+ * @param bounds Updated world space bounds of the shapes.
+ * @param changed_shapes Shapes whose bounds changed since the build or the last refit.
+ */
+void RefitBvh(Bvh& in_out_bvh, const ShapeBounds& bounds, const Opal::ArrayView<const u32>& changed_shapes);
+
+/**
+ * Collects shapes that intersect the frustum. Subtrees outside of the frustum are skipped and subtrees fully inside of the
+ * frustum are accepted without testing their children.
+ * @param out_shapes Visible shape indices, sorted.
+ * @param bvh BVH to query. Stats are updated.
+ * @param frustum Frustum to test against.
+ * @param bounds World space bounds of the shapes, used to test shapes in the partially visible leaves.
+ */
+void QueryBvh(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const Frustum& frustum, const ShapeBounds& bounds);
+
+/**
+ * Collects shapes that intersect the sphere.
+ * @param out_shapes Visible shape indices, sorted.
+ * @param bvh BVH to query. Stats are updated.
+ * @param center Center of the sphere.
+ * @param radius Radius of the sphere.
+ * @param bounds World space bounds of the shapes, used to test shapes in the partially covered leaves.
+ */
+void QueryBvh(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const Rndr::Point3f& center, f32 radius, const ShapeBounds& bounds);
+
+/**
+ * Same as CullShapes but uses the BVH to find visible shapes.
+ * @param out_result Compacted draw commands, model indices and stats.
+ * @param bvh BVH built over the shape bounds.
+ * @param frustum Frustum to test against.
+ * @param bounds World space bounds of the shapes.
+ * @param draw_commands Draw commands of all the shapes, in the shape order.
+ * @return True if culling was successful, false otherwise.
+ */
+bool CullShapes(CullingResult& out_result, Bvh& bvh, const Frustum& frustum, const ShapeBounds& bounds,
+                const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands);
+
+}  // namespace Culling
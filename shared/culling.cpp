@@ -0,0 +1,342 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Number of shapes tested by a single task when culling runs on multiple threads. */
+constexpr size_t k_shapes_per_task = 2048;
+
+/**
+ * Tests shapes in [begin, end) range against the frustum using center-extent form. A box is outside if for any plane
+ * dot(normal, center) + distance < -dot(abs(normal), extent).
+ */
+void TestRange(u8* out_visibility, const Frustum& frustum, const ShapeBounds& bounds, size_t begin, size_t end)
+{
+    size_t i = begin;
+#if defined(__AVX2__)
+    for (; i + 8 <= end; i += 8)
+    {
+        const __m256 center_x = _mm256_loadu_ps(bounds.center_x.GetData() + i);
+        const __m256 center_y = _mm256_loadu_ps(bounds.center_y.GetData() + i);
+        const __m256 center_z = _mm256_loadu_ps(bounds.center_z.GetData() + i);
+        const __m256 extent_x = _mm256_loadu_ps(bounds.extent_x.GetData() + i);
+        const __m256 extent_y = _mm256_loadu_ps(bounds.extent_y.GetData() + i);
+        const __m256 extent_z = _mm256_loadu_ps(bounds.extent_z.GetData() + i);
+
+        __m256 outside = _mm256_setzero_ps();
+        for (const Rndr::Vector4f& plane : frustum.planes)
+        {
+            const __m256 distance = _mm256_fmadd_ps(
+                _mm256_set1_ps(plane.x), center_x,
+                _mm256_fmadd_ps(_mm256_set1_ps(plane.y), center_y, _mm256_fmadd_ps(_mm256_set1_ps(plane.z), center_z, _mm256_set1_ps(plane.w))));
+            const __m256 radius =
+                _mm256_fmadd_ps(_mm256_set1_ps(std::abs(plane.x)), extent_x,
+                                _mm256_fmadd_ps(_mm256_set1_ps(std::abs(plane.y)), extent_y, _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), extent_z)));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+
+        const i32 outside_mask = _mm256_movemask_ps(outside);
+        for (i32 lane = 0; lane < 8; ++lane)
+        {
+            out_visibility[i + lane] = static_cast<u8>(((outside_mask >> lane) & 1) == 0);
+        }
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        bool is_visible = true;
+        for (const Rndr::Vector4f& plane : frustum.planes)
+        {
+            const f32 distance = plane.x * bounds.center_x[i] + plane.y * bounds.center_y[i] + plane.z * bounds.center_z[i] + plane.w;
+            const f32 radius =
+                std::abs(plane.x) * bounds.extent_x[i] + std::abs(plane.y) * bounds.extent_y[i] + std::abs(plane.z) * bounds.extent_z[i];
+            is_visible = is_visible && distance + radius >= 0.0f;
+        }
+        out_visibility[i] = static_cast<u8>(is_visible);
+    }
+}
+
+/**
+ * Tests shapes in [0, count) range, split across multiple threads when there are more than k_parallel_shape_count of them.
+ */
+void TestBounds(u8* out_visibility, const Frustum& frustum, const ShapeBounds& bounds, size_t count)
+{
+    if (count > Culling::k_parallel_shape_count)
+    {
+        Opal::DynamicArray<size_t> task_starts;
+        task_starts.Reserve(count / k_shapes_per_task + 1);
+        for (size_t start = 0; start < count; start += k_shapes_per_task)
+        {
+            task_starts.PushBack(start);
+        }
+        std::for_each(std::execution::par, task_starts.begin(), task_starts.end(),
+                      [&](size_t start) { TestRange(out_visibility, frustum, bounds, start, std::min(start + k_shapes_per_task, count)); });
+    }
+    else
+    {
+        TestRange(out_visibility, frustum, bounds, 0, count);
+    }
+}
+
+void WriteBounds(ShapeBounds& bounds, size_t index, const Rndr::Matrix4x4f& m, const Bounds3f& local_bounds)
+{
+    const f32 local_center[3] = {0.5f * (local_bounds.min.x + local_bounds.max.x), 0.5f * (local_bounds.min.y + local_bounds.max.y),
+                                 0.5f * (local_bounds.min.z + local_bounds.max.z)};
+    const f32 local_extent[3] = {0.5f * (local_bounds.max.x - local_bounds.min.x), 0.5f * (local_bounds.max.y - local_bounds.min.y),
+                                 0.5f * (local_bounds.max.z - local_bounds.min.z)};
+
+    // Center is transformed as a point, extent by the absolute values of the upper 3x3
+    f32 center[3];
+    f32 extent[3];
+    for (i32 row = 0; row < 3; ++row)
+    {
+        center[row] = m.elements[row][3];
+        extent[row] = 0.0f;
+        for (i32 column = 0; column < 3; ++column)
+        {
+            center[row] += m.elements[row][column] * local_center[column];
+            extent[row] += std::abs(m.elements[row][column]) * local_extent[column];
+        }
+    }
+
+    bounds.center_x[index] = center[0];
+    bounds.center_y[index] = center[1];
+    bounds.center_z[index] = center[2];
+    bounds.extent_x[index] = extent[0];
+    bounds.extent_y[index] = extent[1];
+    bounds.extent_z[index] = extent[2];
+}
+
+void CalculateShapeBounds(ShapeBounds& bounds, const SceneDrawData& scene, size_t shape_index)
+{
+    const MeshDrawData& shape = scene.shapes[shape_index];
+    WriteBounds(bounds, shape_index, scene.scene_description.world_transforms[shape.transform_index],
+                scene.mesh_data.bounding_boxes[shape.mesh_index]);
+}
+
+void ResizeBounds(ShapeBounds& bounds, size_t count)
+{
+    bounds.center_x.Resize(count);
+    bounds.center_y.Resize(count);
+    bounds.center_z.Resize(count);
+    bounds.extent_x.Resize(count);
+    bounds.extent_y.Resize(count);
+    bounds.extent_z.Resize(count);
+}
+}  // namespace
+
+Frustum Culling::ExtractFrustum(const Rndr::Matrix4x4f& clip_from_world)
+{
+    const auto row = [&clip_from_world](i32 r)
+    {
+        return Rndr::Vector4f(clip_from_world.elements[r][0], clip_from_world.elements[r][1], clip_from_world.elements[r][2],
+                              clip_from_world.elements[r][3]);
+    };
+    const Rndr::Vector4f x = row(0);
+    const Rndr::Vector4f y = row(1);
+    const Rndr::Vector4f z = row(2);
+    const Rndr::Vector4f w = row(3);
+
+    Frustum frustum;
+    frustum.planes[0] = Rndr::Vector4f(w.x + x.x, w.y + x.y, w.z + x.z, w.w + x.w);
+    frustum.planes[1] = Rndr::Vector4f(w.x - x.x, w.y - x.y, w.z - x.z, w.w - x.w);
+    frustum.planes[2] = Rndr::Vector4f(w.x + y.x, w.y + y.y, w.z + y.z, w.w + y.w);
+    frustum.planes[3] = Rndr::Vector4f(w.x - y.x, w.y - y.y, w.z - y.z, w.w - y.w);
+    frustum.planes[4] = Rndr::Vector4f(w.x + z.x, w.y + z.y, w.z + z.z, w.w + z.w);
+    frustum.planes[5] = Rndr::Vector4f(w.x - z.x, w.y - z.y, w.z - z.z, w.w - z.w);
+    return frustum;
+}
+
+i32 Culling::ClassifyBox(const Frustum& frustum, const f32 center[3], const f32 extent[3])
+{
+    i32 result = 1;
+    for (const Rndr::Vector4f& plane : frustum.planes)
+    {
+        const f32 distance = plane.x * center[0] + plane.y * center[1] + plane.z * center[2] + plane.w;
+        const f32 radius = std::abs(plane.x) * extent[0] + std::abs(plane.y) * extent[1] + std::abs(plane.z) * extent[2];
+        if (distance + radius < 0.0f)
+        {
+            return -1;
+        }
+        if (distance - radius < 0.0f)
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+i32 Culling::ClassifyBox(const Rndr::Point3f& sphere_center, f32 sphere_radius, const f32 center[3], const f32 extent[3])
+{
+    const f32 sphere[3] = {sphere_center.x, sphere_center.y, sphere_center.z};
+    f32 closest_distance_squared = 0.0f;
+    f32 farthest_distance_squared = 0.0f;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        const f32 distance = std::abs(sphere[axis] - center[axis]);
+        const f32 closest = std::max(0.0f, distance - extent[axis]);
+        const f32 farthest = distance + extent[axis];
+        closest_distance_squared += closest * closest;
+        farthest_distance_squared += farthest * farthest;
+    }
+    const f32 radius_squared = sphere_radius * sphere_radius;
+    if (closest_distance_squared > radius_squared)
+    {
+        return -1;
+    }
+    return farthest_distance_squared <= radius_squared ? 1 : 0;
+}
+
+bool Culling::SetupShapeBounds(ShapeBounds& out_bounds, const SceneDrawData& scene)
+{
+    if (scene.mesh_data.bounding_boxes.GetSize() != scene.mesh_data.meshes.GetSize())
+    {
+        RNDR_LOG_ERROR("Mesh data has no bounding boxes!");
+        return false;
+    }
+
+    const size_t shape_count = scene.shapes.GetSize();
+    ResizeBounds(out_bounds, shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        CalculateShapeBounds(out_bounds, scene, i);
+    }
+    return true;
+}
+
+void Culling::UpdateShapeBounds(ShapeBounds& in_out_bounds, const SceneDrawData& scene, const Opal::ArrayView<const u32>& shape_indices)
+{
+    for (size_t i = 0; i < shape_indices.GetSize(); ++i)
+    {
+        CalculateShapeBounds(in_out_bounds, scene, shape_indices[i]);
+    }
+}
+
+bool Culling::CullShapes(CullingResult& out_result, const Frustum& frustum, const ShapeBounds& bounds,
+                         const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands)
+{
+    const size_t shape_count = draw_commands.GetSize();
+    if (bounds.center_x.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("Shape bounds and draw commands are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    out_result.visibility.Resize(shape_count);
+    u8* visibility = out_result.visibility.GetData();
+    TestBounds(visibility, frustum, bounds, shape_count);
+
+    out_result.draw_commands.Clear();
+    out_result.model_indices.Clear();
+    out_result.draw_commands.Reserve(shape_count);
+    out_result.model_indices.Reserve(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        if (visibility[i] != 0)
+        {
+            out_result.draw_commands.PushBack(draw_commands[i]);
+            out_result.model_indices.PushBack(static_cast<u32>(i));
+        }
+    }
+
+    out_result.stats.total_count = shape_count;
+    out_result.stats.visible_count = out_result.draw_commands.GetSize();
+    out_result.stats.culled_count = shape_count - out_result.draw_commands.GetSize();
+    out_result.stats.cull_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
+
+bool Culling::SetupInstanceSetBounds(ShapeBounds& out_bounds, const SceneDrawData& scene)
+{
+    if (scene.mesh_data.bounding_boxes.GetSize() != scene.mesh_data.meshes.GetSize())
+    {
+        RNDR_LOG_ERROR("Mesh data has no bounding boxes!");
+        return false;
+    }
+
+    size_t instance_count = 0;
+    for (const InstanceSet& set : scene.instance_sets)
+    {
+        instance_count += set.transforms.GetSize();
+    }
+    ResizeBounds(out_bounds, instance_count);
+
+    size_t index = 0;
+    for (const InstanceSet& set : scene.instance_sets)
+    {
+        const Bounds3f& local_bounds = scene.mesh_data.bounding_boxes[set.mesh_index];
+        for (const InstanceTransform& transform : set.transforms)
+        {
+            const Scene::LocalTransform local_transform{.translation = transform.position,
+                                                        .rotation = transform.rotation,
+                                                        .scale = Rndr::Vector3f(transform.scale, transform.scale, transform.scale)};
+            WriteBounds(out_bounds, index++, Scene::ToMatrix(local_transform), local_bounds);
+        }
+    }
+    return true;
+}
+
+bool Culling::CullInstanceSets(InstanceSetCullingResult& out_result, const Frustum& frustum, const ShapeBounds& bounds,
+                               const SceneDrawData& scene)
+{
+    size_t instance_count = 0;
+    for (const InstanceSet& set : scene.instance_sets)
+    {
+        instance_count += set.transforms.GetSize();
+    }
+    if (bounds.center_x.GetSize() != instance_count)
+    {
+        RNDR_LOG_ERROR("Instance set bounds and instance sets are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    out_result.visibility.Resize(instance_count);
+    u8* visibility = out_result.visibility.GetData();
+    TestBounds(visibility, frustum, bounds, instance_count);
+
+    const size_t set_count = scene.instance_sets.GetSize();
+    out_result.draw_commands.Resize(set_count);
+    out_result.transforms.Clear();
+    out_result.transforms.Reserve(instance_count);
+    size_t index = 0;
+    for (size_t set_index = 0; set_index < set_count; ++set_index)
+    {
+        const InstanceSet& set = scene.instance_sets[set_index];
+        const size_t first_visible = out_result.transforms.GetSize();
+        for (const InstanceTransform& transform : set.transforms)
+        {
+            if (visibility[index++] != 0)
+            {
+                out_result.transforms.PushBack(transform);
+            }
+        }
+
+        const MeshDescription& mesh = scene.mesh_data.meshes[set.mesh_index];
+        out_result.draw_commands[set_index] = {.index_count = static_cast<u32>(mesh.GetLodIndicesCount(0)),
+                                               .instance_count = static_cast<u32>(out_result.transforms.GetSize() - first_visible),
+                                               .first_index = static_cast<u32>(mesh.index_offset),
+                                               .base_vertex = static_cast<u32>(mesh.vertex_offset),
+                                               .base_instance = static_cast<u32>(first_visible)};
+    }
+
+    out_result.stats.total_count = instance_count;
+    out_result.stats.visible_count = out_result.transforms.GetSize();
+    out_result.stats.culled_count = instance_count - out_result.transforms.GetSize();
+    out_result.stats.cull_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
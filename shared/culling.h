@@ -0,0 +1,171 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/math.h"
+
+#include "scene.h"
+
+/**
+ * Camera frustum described by six planes in world space. Each plane is stored as (normal, distance) where points inside the
+ * frustum give a non-negative dot(normal, point) + distance. Planes are not normalized.
+ */
+struct Frustum
+{
+    static constexpr i32 k_plane_count = 6;
+
+    /** Left, right, bottom, top, near and far plane. */
+    Rndr::Vector4f planes[k_plane_count];
+};
+
+/**
+ * World space bounding boxes of all shapes in a scene, stored as centers and half extents in separate arrays so that
+ * multiple boxes can be tested against a plane at once.
+ */
+struct ShapeBounds
+{
+    Opal::DynamicArray<f32> center_x;
+    Opal::DynamicArray<f32> center_y;
+    Opal::DynamicArray<f32> center_z;
+    Opal::DynamicArray<f32> extent_x;
+    Opal::DynamicArray<f32> extent_y;
+    Opal::DynamicArray<f32> extent_z;
+};
+
+/**
+ * Per frame culling counters.
+ */
+struct CullingStats
+{
+    u64 total_count = 0;
+    u64 visible_count = 0;
+    u64 culled_count = 0;
+    /** Time spent testing and compacting in milliseconds. */
+    f64 cull_time_ms = 0.0;
+};
+
+/**
+ * Output of the culling stage.
+ */
+struct CullingResult
+{
+    /** Draw commands of the visible shapes, in the shape order. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+
+    /** For each visible draw command, index of the shape and therefore of its ModelData. */
+    Opal::DynamicArray<u32> model_indices;
+
+    /** Visibility of each shape, one if it is in model_indices. Filled by every culling path, kept around to avoid
+     * allocations every frame. */
+    Opal::DynamicArray<u8> visibility;
+
+    CullingStats stats;
+};
+
+/**
+ * Output of the instance set culling.
+ */
+struct InstanceSetCullingResult
+{
+    /** One instanced draw command per instance set, in the set order. Instance count is the number of visible instances and
+     * base instance is the index of the first of them in the visible transforms. Sets with no visible instances keep their
+     * command with zero instances, so the draw ID of a command is always the index of its set. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+
+    /** Transforms of the visible instances, grouped by set. */
+    Opal::DynamicArray<InstanceTransform> transforms;
+
+    /** Scratch array with visibility of each instance, kept around to avoid allocations every frame. */
+    Opal::DynamicArray<u8> visibility;
+
+    CullingStats stats;
+};
+
+namespace Culling
+{
+
+/**
+ * Shapes count above which the culling is split across multiple threads.
+ */
+constexpr size_t k_parallel_shape_count = 10'000;
+
+/**
+ * Extracts frustum planes from a matrix that transforms world space positions to the clip space. Assumes clip space depth
+ * is in [-w, w] range, which is conservative for [0, w] range as well.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space.
+ * @return Frustum in world space.
+ */
+Frustum ExtractFrustum(const Rndr::Matrix4x4f& clip_from_world);
+
+/**
+ * Tests a box given with center and half extent against the frustum.
+ * @param frustum Frustum to test against.
+ * @param center Center of the box.
+ * @param extent Half extent of the box.
+ * @return -1 if the box is outside, 1 if it is fully inside and 0 if it intersects the frustum.
+ */
+i32 ClassifyBox(const Frustum& frustum, const f32 center[3], const f32 extent[3]);
+
+/**
+ * Tests a box given with center and half extent against a sphere.
+ * @param sphere_center Center of the sphere.
+ * @param sphere_radius Radius of the sphere.
+ * @param center Center of the box.
+ * @param extent Half extent of the box.
+ * @return -1 if the box is outside, 1 if it is fully inside and 0 if it intersects the sphere.
+ */
+i32 ClassifyBox(const Rndr::Point3f& sphere_center, f32 sphere_radius, const f32 center[3], const f32 extent[3]);
+
+/**
+ * Calculates world space bounding boxes of all shapes in the scene.
+ * @param out_bounds Bounds to fill.
+ * @param scene Scene with up to date world transforms and mesh bounding boxes.
+ * @return True if bounds were calculated, false if the mesh data has no bounding boxes.
+ */
+bool SetupShapeBounds(ShapeBounds& out_bounds, const SceneDrawData& scene);
+
+/**
+ * Recalculates world space bounding boxes of the given shapes. Should be called when the world transforms of the shapes
+ * change, for example with the shapes updated by Scene::SyncModelData.
+ * @param in_out_bounds Bounds to update.
+ * @param scene Scene with up to date world transforms and mesh bounding boxes.
+ * @param shape_indices Indices of the shapes to update.
+ */
+void UpdateShapeBounds(ShapeBounds& in_out_bounds, const SceneDrawData& scene, const Opal::ArrayView<const u32>& shape_indices);
+
+/**
+ * Tests bounds of all shapes against the frustum and writes draw commands of the visible shapes to the result. Uses AVX2
+ * to test eight shapes at a time when available and multiple threads for scenes with more than k_parallel_shape_count
+ * shapes.
+ * @param out_result Compacted draw commands, model indices and stats.
+ * @param frustum Frustum to test against.
+ * @param bounds World space bounds of the shapes.
+ * @param draw_commands Draw commands of all the shapes, in the shape order.
+ * @return True if culling was successful, false otherwise.
+ */
+bool CullShapes(CullingResult& out_result, const Frustum& frustum, const ShapeBounds& bounds,
+                const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands);
+
+/**
+ * Calculates world space bounding boxes of all instances of all instance sets in the scene. Bounds of the sets are stored
+ * one after the other in the set order.
+ * @param out_bounds Bounds to fill.
+ * @param scene Scene with instance sets and mesh bounding boxes.
+ * @return True if bounds were calculated, false if the mesh data has no bounding boxes.
+ */
+bool SetupInstanceSetBounds(ShapeBounds& out_bounds, const SceneDrawData& scene);
+
+/**
+ * Tests bounds of all instances against the frustum in the same way as CullShapes, and writes one instanced draw command
+ * per set together with the transforms of the visible instances.
+ * @param out_result Draw commands, visible transforms and stats.
+ * @param frustum Frustum to test against.
+ * @param bounds World space bounds of the instances, as calculated by SetupInstanceSetBounds.
+ * @param scene Scene with instance sets and mesh data.
+ * @return True if culling was successful, false otherwise.
+ */
+bool CullInstanceSets(InstanceSetCullingResult& out_result, const Frustum& frustum, const ShapeBounds& bounds, const SceneDrawData& scene);
+
+}  // namespace Culling
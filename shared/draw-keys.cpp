@@ -0,0 +1,395 @@
+#include "draw-keys.h"
+
+#include <algorithm>
+#include <execution>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Number of keys handled by a single task in a radix sort pass. */
+constexpr size_t k_radix_chunk_size = 16 * 1024;
+constexpr u32 k_radix_bits = 8;
+constexpr u32 k_radix_bucket_count = 1u << k_radix_bits;
+constexpr u32 k_radix_pass_count = 64 / k_radix_bits;
+
+/** Marks shapes that are not visible in the transparent draw list's slot array. */
+constexpr u32 k_invalid_slot = 0xFFFFFFFF;
+/** Set on a slot once the shape has been placed in the back to front order. */
+constexpr u32 k_placed_slot_bit = 0x80000000;
+
+u64 Field(u32 value, u32 bit_count, u32 shift)
+{
+    return (static_cast<u64>(value) & ((1ull << bit_count) - 1)) << shift;
+}
+
+f32 GetViewDepth(const Rndr::Matrix4x4f& clip_from_world, const ShapeBounds& bounds, u32 shape)
+{
+    const f32* w_row = clip_from_world.elements[3];
+    return w_row[0] * bounds.center_x[shape] + w_row[1] * bounds.center_y[shape] + w_row[2] * bounds.center_z[shape] + w_row[3];
+}
+
+DrawPass GetMaterialPass(const MaterialDescription& material)
+{
+    if (DrawList::IsTransparent(material))
+    {
+        return DrawPass::Transparent;
+    }
+    if (Material::IsAlphaTested(material))
+    {
+        return DrawPass::AlphaTested;
+    }
+    return DrawPass::Opaque;
+}
+}  // namespace
+
+bool DrawList::IsTransparent(const MaterialDescription& material)
+{
+    return !!(material.flags & MaterialFlags::Transparent);
+}
+
+u64 DrawList::MakeKey(DrawPass pass, u32 pipeline, u32 material, u32 mesh, u32 depth)
+{
+    u64 key = Field(static_cast<u32>(pass), k_pass_bits, k_pass_shift) | Field(pipeline, k_pipeline_bits, k_pipeline_shift);
+    if (pass == DrawPass::Transparent)
+    {
+        return key | Field(k_max_depth - std::min(depth, k_max_depth), k_material_bits, k_material_shift) |
+               Field(material, k_depth_bits, k_depth_shift);
+    }
+    return key | Field(material, k_material_bits, k_material_shift) | Field(mesh, k_mesh_bits, k_mesh_shift) |
+           Field(std::min(depth, k_max_depth), k_depth_bits, k_depth_shift);
+}
+
+DrawPass DrawList::GetPass(u64 key)
+{
+    return static_cast<DrawPass>((key >> k_pass_shift) & ((1ull << k_pass_bits) - 1));
+}
+
+u32 DrawList::GetPipeline(u64 key)
+{
+    return static_cast<u32>((key >> k_pipeline_shift) & ((1ull << k_pipeline_bits) - 1));
+}
+
+void DrawList::RadixSort(Opal::ArrayView<u64> in_out_keys, Opal::ArrayView<u32> in_out_values, Opal::ArrayView<u64> scratch_keys,
+                         Opal::ArrayView<u32> scratch_values)
+{
+    const size_t count = in_out_keys.GetSize();
+    RNDR_ASSERT(in_out_values.GetSize() == count && scratch_keys.GetSize() >= count && scratch_values.GetSize() >= count,
+                "Keys, values and scratch space must have the same size");
+    if (count < 2)
+    {
+        return;
+    }
+
+    const size_t chunk_count = (count + k_radix_chunk_size - 1) / k_radix_chunk_size;
+    Opal::DynamicArray<u32> chunks(chunk_count);
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        chunks[i] = static_cast<u32>(i);
+    }
+    // One histogram per chunk, turned into the scatter offsets of the chunk before the scatter
+    Opal::DynamicArray<u32> histograms(chunk_count * k_radix_bucket_count);
+
+    u64* src_keys = in_out_keys.GetData();
+    u32* src_values = in_out_values.GetData();
+    u64* dst_keys = scratch_keys.GetData();
+    u32* dst_values = scratch_values.GetData();
+    for (u32 pass = 0; pass < k_radix_pass_count; ++pass)
+    {
+        const u32 shift = pass * k_radix_bits;
+        std::for_each(std::execution::par, chunks.begin(), chunks.end(),
+                      [&](u32 chunk)
+                      {
+                          u32* histogram = histograms.GetData() + chunk * k_radix_bucket_count;
+                          std::fill(histogram, histogram + k_radix_bucket_count, 0u);
+                          const size_t end = std::min(count, (chunk + 1) * k_radix_chunk_size);
+                          for (size_t i = chunk * k_radix_chunk_size; i < end; ++i)
+                          {
+                              histogram[(src_keys[i] >> shift) & (k_radix_bucket_count - 1)]++;
+                          }
+                      });
+
+        // Keys that share the digit would stay in place, which is common for the pass and pipeline bits
+        const u32 first_digit = static_cast<u32>((src_keys[0] >> shift) & (k_radix_bucket_count - 1));
+        size_t first_digit_count = 0;
+        for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+        {
+            first_digit_count += histograms[chunk * k_radix_bucket_count + first_digit];
+        }
+        if (first_digit_count == count)
+        {
+            continue;
+        }
+
+        u32 offset = 0;
+        for (u32 digit = 0; digit < k_radix_bucket_count; ++digit)
+        {
+            for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+            {
+                u32& bucket = histograms[chunk * k_radix_bucket_count + digit];
+                const u32 bucket_count = bucket;
+                bucket = offset;
+                offset += bucket_count;
+            }
+        }
+
+        std::for_each(std::execution::par, chunks.begin(), chunks.end(),
+                      [&](u32 chunk)
+                      {
+                          u32* offsets = histograms.GetData() + chunk * k_radix_bucket_count;
+                          const size_t end = std::min(count, (chunk + 1) * k_radix_chunk_size);
+                          for (size_t i = chunk * k_radix_chunk_size; i < end; ++i)
+                          {
+                              const u32 destination = offsets[(src_keys[i] >> shift) & (k_radix_bucket_count - 1)]++;
+                              dst_keys[destination] = src_keys[i];
+                              dst_values[destination] = src_values[i];
+                          }
+                      });
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+
+    if (src_keys != in_out_keys.GetData())
+    {
+        std::copy(src_keys, src_keys + count, in_out_keys.GetData());
+        std::copy(src_values, src_values + count, in_out_values.GetData());
+    }
+}
+
+bool DrawList::BuildSortedDrawList(SortedDrawList& out_draw_list, const CullingResult& visible, const SceneDrawData& scene,
+                                   const ShapeBounds& bounds, const Rndr::Matrix4x4f& clip_from_world,
+                                   const Opal::ArrayView<const u32>& material_pipelines)
+{
+    const size_t draw_count = visible.model_indices.GetSize();
+    if (visible.draw_commands.GetSize() != draw_count)
+    {
+        RNDR_LOG_ERROR("Culling result draw commands and model indices are out of sync!");
+        return false;
+    }
+    if (material_pipelines.GetSize() > 0 && material_pipelines.GetSize() != scene.materials.GetSize())
+    {
+        RNDR_LOG_ERROR("Material pipelines and materials are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    // View depth is the clip space w of the bounds center, it is quantized relative to the farthest visible shape
+    out_draw_list.view_depths.Resize(draw_count);
+    f32 max_view_depth = 0.0f;
+    for (size_t i = 0; i < draw_count; ++i)
+    {
+        const f32 view_depth = GetViewDepth(clip_from_world, bounds, visible.model_indices[i]);
+        out_draw_list.view_depths[i] = std::max(view_depth, 0.0f);
+        max_view_depth = std::max(max_view_depth, view_depth);
+    }
+    const f32 depth_scale = max_view_depth > 0.0f ? static_cast<f32>(k_max_depth) / max_view_depth : 0.0f;
+
+    out_draw_list.keys.Resize(draw_count);
+    out_draw_list.shape_indices.Resize(draw_count);
+    out_draw_list.scratch_keys.Resize(draw_count);
+    out_draw_list.scratch_shape_indices.Resize(draw_count);
+    for (size_t i = 0; i < draw_count; ++i)
+    {
+        const MeshDrawData& shape = scene.shapes[visible.model_indices[i]];
+        const MaterialDescription& material = scene.materials[shape.material_index];
+        const u32 depth = static_cast<u32>(out_draw_list.view_depths[i] * depth_scale);
+        const u32 pipeline = material_pipelines.GetSize() > 0 ? material_pipelines[shape.material_index] : 0;
+        out_draw_list.keys[i] = MakeKey(GetMaterialPass(material), pipeline, static_cast<u32>(shape.material_index),
+                                        static_cast<u32>(shape.mesh_index), depth);
+        // Index into the culling result rather than the shape, so the draw command can be looked up after the sort
+        out_draw_list.shape_indices[i] = static_cast<u32>(i);
+    }
+
+    const f64 sort_start_time = Opal::GetSeconds();
+    RadixSort(Opal::ArrayView<u64>(out_draw_list.keys), Opal::ArrayView<u32>(out_draw_list.shape_indices),
+              Opal::ArrayView<u64>(out_draw_list.scratch_keys), Opal::ArrayView<u32>(out_draw_list.scratch_shape_indices));
+    const f64 sort_end_time = Opal::GetSeconds();
+
+    out_draw_list.draw_commands.Resize(draw_count);
+    out_draw_list.model_indices.Resize(draw_count);
+    DrawListStats& stats = out_draw_list.stats;
+    stats = {.draw_count = draw_count};
+    for (size_t i = 0; i < draw_count; ++i)
+    {
+        const u32 visible_index = out_draw_list.shape_indices[i];
+        const u32 shape_index = visible.model_indices[visible_index];
+        out_draw_list.draw_commands[i] = visible.draw_commands[visible_index];
+        out_draw_list.model_indices[i] = shape_index;
+        out_draw_list.shape_indices[i] = shape_index;
+        if (i > 0)
+        {
+            const MeshDrawData& shape = scene.shapes[shape_index];
+            const MeshDrawData& previous_shape = scene.shapes[out_draw_list.model_indices[i - 1]];
+            stats.material_change_count += shape.material_index != previous_shape.material_index ? 1 : 0;
+            stats.mesh_change_count += shape.mesh_index != previous_shape.mesh_index ? 1 : 0;
+        }
+    }
+    stats.build_keys_time_ms = (sort_start_time - start_time) * 1000.0;
+    stats.sort_time_ms = (sort_end_time - sort_start_time) * 1000.0;
+    return true;
+}
+
+bool DrawList::SplitTransparentDraws(CullingResult& in_out_visible, TransparentDrawList& in_out_transparent, const SceneDrawData& scene,
+                                     const ShapeBounds& bounds, const Rndr::Matrix4x4f& clip_from_world)
+{
+    const size_t draw_count = in_out_visible.model_indices.GetSize();
+    if (in_out_visible.draw_commands.GetSize() != draw_count)
+    {
+        RNDR_LOG_ERROR("Culling result draw commands and model indices are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    // Compact opaque draws in place and remember which slot of this frame's transparent draws each transparent shape got.
+    // Draw i is read before anything is written to it, so the compaction doesn't overwrite transparent draws.
+    TransparentDrawList& list = in_out_transparent;
+    list.visible_slots.Resize(scene.shapes.GetSize(), k_invalid_slot);
+    list.visible_shapes.Clear();
+    list.visible_draw_commands.Clear();
+    size_t opaque_count = 0;
+    for (size_t i = 0; i < draw_count; ++i)
+    {
+        const u32 shape = in_out_visible.model_indices[i];
+        const MaterialDescription& material = scene.materials[scene.shapes[shape].material_index];
+        if (IsTransparent(material))
+        {
+            list.visible_slots[shape] = static_cast<u32>(list.visible_shapes.GetSize());
+            list.visible_shapes.PushBack(shape);
+            list.visible_draw_commands.PushBack(in_out_visible.draw_commands[i]);
+            continue;
+        }
+        in_out_visible.draw_commands[opaque_count] = in_out_visible.draw_commands[i];
+        in_out_visible.model_indices[opaque_count] = shape;
+        opaque_count++;
+    }
+    in_out_visible.draw_commands.Resize(opaque_count);
+    in_out_visible.model_indices.Resize(opaque_count);
+
+    // Shapes that stay visible start from the last frame's order, so an insertion sort is cheap for them
+    list.scratch_shape_indices.Clear();
+    for (const u32 shape : list.shape_indices)
+    {
+        u32& slot = list.visible_slots[shape];
+        if (slot != k_invalid_slot && (slot & k_placed_slot_bit) == 0)
+        {
+            slot |= k_placed_slot_bit;
+            list.scratch_shape_indices.PushBack(shape);
+        }
+    }
+    const size_t kept_count = list.scratch_shape_indices.GetSize();
+    list.scratch_view_depths.Resize(kept_count);
+    for (size_t i = 0; i < kept_count; ++i)
+    {
+        list.scratch_view_depths[i] = GetViewDepth(clip_from_world, bounds, list.scratch_shape_indices[i]);
+    }
+    u64 move_count = 0;
+    for (size_t i = 1; i < kept_count; ++i)
+    {
+        const f32 depth = list.scratch_view_depths[i];
+        const u32 shape = list.scratch_shape_indices[i];
+        size_t j = i;
+        for (; j > 0 && list.scratch_view_depths[j - 1] < depth; --j)
+        {
+            list.scratch_view_depths[j] = list.scratch_view_depths[j - 1];
+            list.scratch_shape_indices[j] = list.scratch_shape_indices[j - 1];
+        }
+        list.scratch_view_depths[j] = depth;
+        list.scratch_shape_indices[j] = shape;
+        move_count += i - j;
+    }
+
+    // Newly visible shapes have no useful order, they are sorted on their own and merged in
+    list.new_shapes.Clear();
+    for (const u32 shape : list.visible_shapes)
+    {
+        u32& slot = list.visible_slots[shape];
+        if ((slot & k_placed_slot_bit) == 0)
+        {
+            slot |= k_placed_slot_bit;
+            list.new_shapes.PushBack(shape);
+        }
+    }
+    std::sort(list.new_shapes.begin(), list.new_shapes.end(), [&clip_from_world, &bounds](u32 a, u32 b)
+              { return GetViewDepth(clip_from_world, bounds, a) > GetViewDepth(clip_from_world, bounds, b); });
+
+    const size_t transparent_count = kept_count + list.new_shapes.GetSize();
+    list.shape_indices.Resize(transparent_count);
+    list.view_depths.Resize(transparent_count);
+    size_t kept_index = 0;
+    size_t new_index = 0;
+    for (size_t i = 0; i < transparent_count; ++i)
+    {
+        const bool is_kept_next = new_index == list.new_shapes.GetSize() ||
+                                  (kept_index < kept_count &&
+                                   list.scratch_view_depths[kept_index] >= GetViewDepth(clip_from_world, bounds, list.new_shapes[new_index]));
+        if (is_kept_next)
+        {
+            list.shape_indices[i] = list.scratch_shape_indices[kept_index];
+            list.view_depths[i] = list.scratch_view_depths[kept_index];
+            kept_index++;
+        }
+        else
+        {
+            list.shape_indices[i] = list.new_shapes[new_index];
+            list.view_depths[i] = GetViewDepth(clip_from_world, bounds, list.new_shapes[new_index]);
+            new_index++;
+        }
+    }
+
+    list.draw_commands.Resize(transparent_count);
+    list.model_indices.Resize(transparent_count);
+    for (size_t i = 0; i < transparent_count; ++i)
+    {
+        const u32 shape = list.shape_indices[i];
+        u32& slot = list.visible_slots[shape];
+        list.draw_commands[i] = list.visible_draw_commands[slot & ~k_placed_slot_bit];
+        list.model_indices[i] = shape;
+        slot = k_invalid_slot;
+    }
+
+    list.stats = {.draw_count = transparent_count, .move_count = move_count, .sort_time_ms = (Opal::GetSeconds() - start_time) * 1000.0};
+    return true;
+}
+
+size_t DrawList::PartitionAlphaTestedDraws(CullingResult& in_out_visible, const SceneDrawData& scene)
+{
+    const size_t draw_count = in_out_visible.model_indices.GetSize();
+    if (in_out_visible.draw_commands.GetSize() != draw_count)
+    {
+        RNDR_LOG_ERROR("Culling result draw commands and model indices are out of sync!");
+        return draw_count;
+    }
+
+    const auto is_alpha_tested = [&](size_t draw)
+    {
+        const u32 shape = in_out_visible.model_indices[draw];
+        return Material::IsAlphaTested(scene.materials[scene.shapes[shape].material_index]);
+    };
+
+    size_t first = 0;
+    size_t last = draw_count;
+    while (true)
+    {
+        while (first < last && !is_alpha_tested(first))
+        {
+            first++;
+        }
+        while (first < last && is_alpha_tested(last - 1))
+        {
+            last--;
+        }
+        if (first >= last)
+        {
+            break;
+        }
+        last--;
+        std::swap(in_out_visible.draw_commands[first], in_out_visible.draw_commands[last]);
+        std::swap(in_out_visible.model_indices[first], in_out_visible.model_indices[last]);
+        first++;
+    }
+    return first;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/math.h"
+
+#include "culling.h"
+#include "material.h"
+#include "scene.h"
+
+/**
+ * Render passes in submission order. Stored in the most significant bits of a draw key so that all draws of a pass end up
+ * next to each other after sorting.
+ */
+enum class DrawPass : u8
+{
+    Opaque = 0,
+    AlphaTested = 1,
+    Transparent = 2,
+};
+
+/**
+ * Per frame draw sorting counters.
+ */
+struct DrawListStats
+{
+    u64 draw_count = 0;
+    /** Number of times consecutive draws use a different material, lower is better. */
+    u64 material_change_count = 0;
+    /** Number of times consecutive draws use a different mesh, lower is better. */
+    u64 mesh_change_count = 0;
+    f64 build_keys_time_ms = 0.0;
+    f64 sort_time_ms = 0.0;
+};
+
+/**
+ * Visible draws sorted by their draw keys.
+ */
+struct SortedDrawList
+{
+    /** Draw keys in the sorted order. */
+    Opal::DynamicArray<u64> keys;
+    /** Shape of each draw, in the sorted order. */
+    Opal::DynamicArray<u32> shape_indices;
+
+    /** Draw commands and model indices in the sorted order, same layout as in CullingResult. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+    Opal::DynamicArray<u32> model_indices;
+
+    /** Scratch arrays, kept around to avoid allocations every frame. */
+    Opal::DynamicArray<u64> scratch_keys;
+    Opal::DynamicArray<u32> scratch_shape_indices;
+    Opal::DynamicArray<f32> view_depths;
+
+    DrawListStats stats;
+};
+
+/**
+ * Per frame transparent pass counters.
+ */
+struct TransparentDrawStats
+{
+    u64 draw_count = 0;
+    /** Number of moves done by the insertion sort of the shapes that stayed visible, close to zero when the order barely
+     * changes. */
+    u64 move_count = 0;
+    f64 sort_time_ms = 0.0;
+};
+
+/**
+ * Visible transparent shapes in back to front order. The order is kept between frames and only fixed up with an insertion
+ * sort, which is close to linear when the camera and the shapes move a little. Newly visible shapes are sorted separately
+ * and merged in.
+ */
+struct TransparentDrawList
+{
+    /** Shapes in back to front order, kept from the previous frame. */
+    Opal::DynamicArray<u32> shape_indices;
+    /** View depth of each shape in shape_indices. */
+    Opal::DynamicArray<f32> view_depths;
+
+    /** Draw commands and model indices in back to front order, same layout as in CullingResult. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+    Opal::DynamicArray<u32> model_indices;
+
+    /** Scratch arrays, kept around to avoid allocations every frame. */
+    Opal::DynamicArray<u32> visible_slots;
+    Opal::DynamicArray<u32> visible_shapes;
+    Opal::DynamicArray<Rndr::DrawIndicesData> visible_draw_commands;
+    Opal::DynamicArray<u32> new_shapes;
+    Opal::DynamicArray<u32> scratch_shape_indices;
+    Opal::DynamicArray<f32> scratch_view_depths;
+
+    TransparentDrawStats stats;
+};
+
+namespace DrawList
+{
+
+/**
+ * Checks if the material has to be blended and therefore drawn in the transparent pass.
+ */
+bool IsTransparent(const MaterialDescription& material);
+
+/**
+ * Layout of an opaque draw key from the most significant bits: pass, pipeline, material, mesh and view depth. Draws are
+ * grouped by state first and drawn front to back within the same mesh.
+ *
+ * Transparent draws store inverted view depth in the material field and the material in the depth field, so they are drawn
+ * back to front regardless of the state.
+ *
+ * Values that don't fit into their fields are truncated, which only makes the sort less coherent.
+ */
+constexpr u32 k_pass_bits = 4;
+constexpr u32 k_pipeline_bits = 8;
+constexpr u32 k_material_bits = 16;
+constexpr u32 k_mesh_bits = 20;
+constexpr u32 k_depth_bits = 16;
+static_assert(k_pass_bits + k_pipeline_bits + k_material_bits + k_mesh_bits + k_depth_bits == 64);
+
+constexpr u32 k_depth_shift = 0;
+constexpr u32 k_mesh_shift = k_depth_shift + k_depth_bits;
+constexpr u32 k_material_shift = k_mesh_shift + k_mesh_bits;
+constexpr u32 k_pipeline_shift = k_material_shift + k_material_bits;
+constexpr u32 k_pass_shift = k_pipeline_shift + k_pipeline_bits;
+
+/** Largest quantized view depth. */
+constexpr u32 k_max_depth = (1u << k_depth_bits) - 1;
+
+/**
+ * Creates a draw key.
+ * @param pass Pass the draw belongs to.
+ * @param pipeline Index of the pipeline or shader permutation used by the draw.
+ * @param material Material index.
+ * @param mesh Mesh index.
+ * @param depth View depth quantized to [0, k_max_depth] range, 0 being the closest to the camera.
+ * @return Draw key.
+ */
+u64 MakeKey(DrawPass pass, u32 pipeline, u32 material, u32 mesh, u32 depth);
+
+/** Returns the pass stored in the draw key. */
+DrawPass GetPass(u64 key);
+
+/** Returns the pipeline stored in the draw key. */
+u32 GetPipeline(u64 key);
+
+/**
+ * Sorts the keys and the values alongside them with LSD radix sort, eight bits per pass. Histograms and scatters are done
+ * per chunk of keys in parallel, and passes in which all keys have the same digit are skipped. The sort is stable.
+ * @param in_out_keys Keys to sort.
+ * @param in_out_values Values that are moved together with the keys.
+ * @param scratch_keys Scratch space with the same size as the keys.
+ * @param scratch_values Scratch space with the same size as the values.
+ */
+void RadixSort(Opal::ArrayView<u64> in_out_keys, Opal::ArrayView<u32> in_out_values, Opal::ArrayView<u64> scratch_keys,
+               Opal::ArrayView<u32> scratch_values);
+
+/**
+ * Builds a draw key for each visible shape, sorts the keys and writes the draw commands in the key order. Pass is picked
+ * from the material: transparent materials go to the transparent pass and Material::IsAlphaTested materials to the alpha
+ * tested pass.
+ * @param out_draw_list Sorted draw commands, model indices and stats.
+ * @param visible Output of the culling stage.
+ * @param scene The scene with the shapes and materials.
+ * @param bounds World space bounds of the shapes, used to calculate the view depth.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space. Its last row gives the view depth.
+ * @param material_pipelines Optional pipeline of each material, for example its shader permutation. Stored in the pipeline
+ * field of the keys so that draws are grouped by pipeline first. If empty all draws use pipeline 0.
+ * @return True if the draw list was built, false otherwise.
+ */
+bool BuildSortedDrawList(SortedDrawList& out_draw_list, const CullingResult& visible, const SceneDrawData& scene, const ShapeBounds& bounds,
+                         const Rndr::Matrix4x4f& clip_from_world, const Opal::ArrayView<const u32>& material_pipelines = {});
+
+/**
+ * Moves the transparent shapes out of the culling result into the transparent draw list and sorts them back to front by
+ * view depth. Shapes that were visible in the previous frame start from their previous order.
+ * @param in_out_visible Output of the culling stage. Only opaque shapes are left in it, in the same order as before.
+ * @param in_out_transparent Transparent draw list from the previous frame, updated for this frame.
+ * @param scene The scene with the shapes and materials.
+ * @param bounds World space bounds of the shapes, used to calculate the view depth.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space. Its last row gives the view depth.
+ * @return True if the shapes were split, false otherwise.
+ */
+bool SplitTransparentDraws(CullingResult& in_out_visible, TransparentDrawList& in_out_transparent, const SceneDrawData& scene,
+                           const ShapeBounds& bounds, const Rndr::Matrix4x4f& clip_from_world);
+
+/**
+ * Reorders the visible draws so that the alpha tested shapes come after all other shapes. Order within the two groups is not
+ * kept. Meant to be called after SplitTransparentDraws so that the draws before the alpha tested ones are all opaque.
+ * @param in_out_visible Output of the culling stage.
+ * @param scene The scene with the shapes and materials.
+ * @return Number of draws that are not alpha tested, which is also the index of the first alpha tested draw.
+ */
+size_t PartitionAlphaTestedDraws(CullingResult& in_out_visible, const SceneDrawData& scene);
+
+}  // namespace DrawList
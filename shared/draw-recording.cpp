@@ -0,0 +1,136 @@
+#include "draw-recording.h"
+
+#include <algorithm>
+#include <execution>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+bool DrawList::RecordDrawListParallel(RecordedDrawList& out_recorded, Rndr::GraphicsContext& graphics_context,
+                                      const SortedDrawList& draw_list, const RecordDrawListDesc& desc)
+{
+    const size_t draw_count = draw_list.draw_commands.GetSize();
+    if (desc.worker_count == 0)
+    {
+        RNDR_LOG_ERROR("RecordDrawListParallel: Worker count can't be zero!");
+        return false;
+    }
+    if (draw_list.keys.GetSize() != draw_count || draw_list.model_indices.GetSize() != draw_count)
+    {
+        RNDR_LOG_ERROR("RecordDrawListParallel: Keys, model indices and draw commands must have the same size!");
+        return false;
+    }
+    // Validate the pipelines up front so that workers never have to report errors
+    for (const u64 key : draw_list.keys)
+    {
+        const u32 pipeline = GetPipeline(key);
+        if (pipeline >= desc.pipelines.GetSize() || desc.pipelines[pipeline] == nullptr)
+        {
+            RNDR_LOG_ERROR("RecordDrawListParallel: Draw key uses pipeline %u which was not provided!", pipeline);
+            return false;
+        }
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+    const u32 worker_count = desc.worker_count;
+    out_recorded.draw_commands.Resize(draw_count);
+    out_recorded.instances.Resize(draw_count);
+    out_recorded.slice_starts.Resize(worker_count + 1);
+    for (u32 worker = 0; worker <= worker_count; ++worker)
+    {
+        out_recorded.slice_starts[worker] = draw_count * worker / worker_count;
+    }
+    // Command lists have no reset, so they are recreated every frame. Creation stays on this thread in case the context
+    // does more than record the commands.
+    out_recorded.command_lists.Clear();
+    for (u32 worker = 0; worker < worker_count; ++worker)
+    {
+        out_recorded.command_lists.PushBack(Rndr::CommandList(graphics_context));
+    }
+
+    // Only the CPU side preparation of the draws runs on the workers. Command list calls stay on this thread since the
+    // lists are created for a graphics context that is only current here, and recording is not guaranteed to be free of
+    // graphics API calls.
+    Opal::DynamicArray<u32> workers(worker_count);
+    for (u32 worker = 0; worker < worker_count; ++worker)
+    {
+        workers[worker] = worker;
+    }
+    std::for_each(std::execution::par, workers.begin(), workers.end(),
+                  [&](u32 worker)
+                  {
+                      Rndr::DrawIndicesData* draw_commands = out_recorded.draw_commands.GetData();
+                      // Material index travels in the base instance of the culled draw commands, it moves to the
+                      // instance data so that the base instance can point to it
+                      for (size_t i = out_recorded.slice_starts[worker]; i < out_recorded.slice_starts[worker + 1]; ++i)
+                      {
+                          const Rndr::DrawIndicesData& command = draw_list.draw_commands[i];
+                          out_recorded.instances[i] = {.model_index = draw_list.model_indices[i], .material_index = command.base_instance};
+                          draw_commands[i] = command;
+                          draw_commands[i].base_instance = static_cast<u32>(i);
+                      }
+                  });
+    const f64 prepare_end_time = Opal::GetSeconds();
+
+    u64 pipeline_bind_count = 0;
+    for (u32 worker = 0; worker < worker_count; ++worker)
+    {
+        const size_t slice_end = out_recorded.slice_starts[worker + 1];
+        Rndr::CommandList& command_list = out_recorded.command_lists[worker];
+        Rndr::DrawIndicesData* draw_commands = out_recorded.draw_commands.GetData();
+        size_t run_start = out_recorded.slice_starts[worker];
+        while (run_start < slice_end)
+        {
+            const u32 pipeline = GetPipeline(draw_list.keys[run_start]);
+            size_t run_end = run_start + 1;
+            while (run_end < slice_end && GetPipeline(draw_list.keys[run_end]) == pipeline)
+            {
+                run_end++;
+            }
+            const Rndr::Pipeline& run_pipeline = *desc.pipelines[pipeline];
+            command_list.BindPipeline(run_pipeline);
+            command_list.DrawIndicesMulti(run_pipeline, Rndr::PrimitiveTopology::Triangle,
+                                          Opal::ArrayView<Rndr::DrawIndicesData>(draw_commands + run_start, run_end - run_start));
+            pipeline_bind_count++;
+            run_start = run_end;
+        }
+    }
+
+    RecordedDrawListStats& stats = out_recorded.stats;
+    stats.worker_count = worker_count;
+    stats.draw_count = draw_count;
+    stats.pipeline_bind_count = pipeline_bind_count;
+    stats.prepare_time_ms = (prepare_end_time - start_time) * 1000.0;
+    stats.record_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
+
+bool DrawList::SubmitRecordedDrawList(RecordedDrawList& in_out_recorded, Rndr::GraphicsContext& graphics_context,
+                                      RingBuffer& frame_ring_buffer, u32 instance_slot)
+{
+    if (in_out_recorded.instances.IsEmpty())
+    {
+        in_out_recorded.stats.submit_time_ms = 0.0;
+        return true;
+    }
+    const f64 start_time = Opal::GetSeconds();
+    // Pipelines of the recorded draws don't bind the instance slot, so the instance data stays bound for all the lists
+    const RingBufferAllocation instances = GpuMemory::Write(frame_ring_buffer, Opal::AsBytes(in_out_recorded.instances));
+    if (!GpuMemory::BindAllocation(frame_ring_buffer, graphics_context, instances, Rndr::BufferType::ShaderStorage, instance_slot))
+    {
+        RNDR_LOG_ERROR("SubmitRecordedDrawList: Failed to write the instance data to the frame ring buffer!");
+        return false;
+    }
+    bool is_success = true;
+    for (Rndr::CommandList& command_list : in_out_recorded.command_lists)
+    {
+        is_success &= command_list.Submit();
+    }
+    in_out_recorded.stats.submit_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    if (!is_success)
+    {
+        RNDR_LOG_ERROR("SubmitRecordedDrawList: Failed to submit the recorded draws!");
+    }
+    return is_success;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/render-api.h"
+
+#include "draw-keys.h"
+#include "mesh.h"
+#include "ring-buffer.h"
+#include "types.h"
+
+/**
+ * Per frame counters of the parallel draw recording.
+ */
+struct RecordedDrawListStats
+{
+    u64 worker_count = 0;
+    u64 draw_count = 0;
+    /** Number of pipeline binds recorded over all command lists. Every list binds its first pipeline, so this is at least
+     * the number of non-empty lists. */
+    u64 pipeline_bind_count = 0;
+    /** Time the workers spent preparing the draw commands and instance data, included in record_time_ms. */
+    f64 prepare_time_ms = 0.0;
+    f64 record_time_ms = 0.0;
+    f64 submit_time_ms = 0.0;
+};
+
+/**
+ * Sorted draw list recorded into one command list per worker. Each worker prepares a contiguous slice of the draws that is
+ * then recorded into its own list, so submitting the lists in order keeps the sort order. Draws find their model and material through the instance data
+ * instead of the draw ID, since draw IDs restart in every multi draw of every list.
+ */
+struct RecordedDrawList
+{
+    /** One command list per worker, in the draw order. */
+    Opal::DynamicArray<Rndr::CommandList> command_lists;
+    /** Index of the first draw of each worker's slice, with the total draw count at the end. */
+    Opal::DynamicArray<size_t> slice_starts;
+
+    /** Sorted draw commands with the base instance pointing to the draw's instance data. Command lists refer to them, so
+     * they are kept until the lists are submitted. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+    /** Model and material index of each draw, written to the frame ring buffer when the lists are submitted. */
+    Opal::DynamicArray<InstanceData> instances;
+
+    RecordedDrawListStats stats;
+};
+
+/**
+ * Resources used by the recorded draws.
+ */
+struct RecordDrawListDesc
+{
+    /** Pipelines indexed by the pipeline field of the draw keys. All have to read the instance data, for example material
+     * shaders compiled with USE_INSTANCE_DATA, and their input layout must leave the instance data slot out, so that the
+     * pipeline binds recorded in the lists don't replace the instance data bound at submit. */
+    Opal::ArrayView<const Rndr::Pipeline* const> pipelines;
+    /** Number of slices to split the draws into, each recorded into its own command list. Preparation runs on the parallel
+     * algorithms thread pool, so the number of threads that actually work is capped by the hardware. */
+    u32 worker_count = 4;
+};
+
+namespace DrawList
+{
+
+/**
+ * Splits the sorted draws into equal slices, prepares the draw commands and instance data of the slices in parallel and
+ * records each slice into its own command list. Recording stays on the calling thread, the one the graphics context is
+ * current on, since command lists may call the graphics API. A list binds the pipeline whenever the pipeline field of the
+ * draw key changes and draws each run of draws with the same pipeline with a single multi draw. Frame buffer, per frame data and other resources shared by all draws are not recorded and have to
+ * be bound before the lists are submitted.
+ * @param out_recorded Command lists, draw commands and instance data. Arrays are reused between frames.
+ * @param graphics_context Graphics context the command lists are created for.
+ * @param draw_list Draws sorted by their keys.
+ * @param desc Pipelines and the number of workers.
+ * @return True if the draws were recorded, false otherwise.
+ */
+bool RecordDrawListParallel(RecordedDrawList& out_recorded, Rndr::GraphicsContext& graphics_context, const SortedDrawList& draw_list,
+                            const RecordDrawListDesc& desc);
+
+/**
+ * Writes the instance data to the frame ring buffer, binds it and submits the command lists in the draw order.
+ * @param in_out_recorded Recorded draw list. Submit time is written to its stats.
+ * @param graphics_context Graphics context used to bind the instance data.
+ * @param frame_ring_buffer Ring buffer of the current frame, has to fit an InstanceData per draw.
+ * @param instance_slot Shader slot of the instance data.
+ * @return True if the instance data was bound and all the command lists were submitted, false otherwise.
+ */
+bool SubmitRecordedDrawList(RecordedDrawList& in_out_recorded, Rndr::GraphicsContext& graphics_context, RingBuffer& frame_ring_buffer,
+                            u32 instance_slot);
+
+}  // namespace DrawList
@@ -0,0 +1,190 @@
+#include "gpu-culling.h"
+
+#include <algorithm>
+
+#include "opal/paths.h"
+
+#include "rndr/file.h"
+#include "rndr/log.h"
+
+#include "render-backend.h"
+
+bool Culling::SetupGpuCulling(GpuCulling& out_culling, const SceneDrawData& scene,
+                              const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands, const Rndr::GraphicsContext& graphics_context,
+                              const GpuCullingDesc& desc)
+{
+    using namespace Rndr;
+
+    const size_t shape_count = scene.shapes.GetSize();
+    if (shape_count == 0 || draw_commands.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("SetupGpuCulling: Draw commands and shapes are out of sync!");
+        return false;
+    }
+
+    out_culling = {};
+    out_culling.desc = desc;
+    out_culling.shape_count = static_cast<u32>(shape_count);
+    // Older drivers can't source the draw count from a buffer and fall back to zero instance draws.
+    out_culling.use_draw_count_buffer = RenderBackend::IsDrawCountSupported(graphics_context);
+
+    const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
+    const Opal::StringUtf8 shader_source = File::ReadShader(shader_dir, "compute-culling.glsl");
+    if (shader_source.IsEmpty())
+    {
+        RNDR_LOG_ERROR("SetupGpuCulling: Failed to read culling shader!");
+        return false;
+    }
+    out_culling.shader = Shader(graphics_context, {.type = ShaderType::Compute, .source = shader_source});
+    out_culling.pipeline = Pipeline(graphics_context, {.compute_shader = &out_culling.shader});
+    if (!out_culling.shader.IsValid() || !out_culling.pipeline.IsValid())
+    {
+        RNDR_LOG_ERROR("SetupGpuCulling: Failed to create culling pipeline!");
+        return false;
+    }
+
+    Opal::DynamicArray<GpuShapeBounds> shape_bounds(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        const Bounds3f& bounds = scene.mesh_data.bounding_boxes[scene.shapes[i].mesh_index];
+        shape_bounds[i].local_center = Rndr::Vector4f(0.5f * (bounds.min.x + bounds.max.x), 0.5f * (bounds.min.y + bounds.max.y),
+                                                      0.5f * (bounds.min.z + bounds.max.z), 0.0f);
+        shape_bounds[i].local_extent = Rndr::Vector4f(0.5f * (bounds.max.x - bounds.min.x), 0.5f * (bounds.max.y - bounds.min.y),
+                                                      0.5f * (bounds.max.z - bounds.min.z), 0.0f);
+    }
+
+    const Usage output_usage = desc.enable_read_back ? Usage::ReadBack : Usage::Default;
+    out_culling.culling_data_buffer = Buffer(graphics_context, {.type = BufferType::Constant,
+                                                                .usage = Usage::Dynamic,
+                                                                .size = sizeof(GpuCullingData),
+                                                                .stride = sizeof(GpuCullingData)});
+    out_culling.shape_bounds_buffer = Buffer(graphics_context, Opal::ArrayView<const GpuShapeBounds>(shape_bounds),
+                                             BufferType::ShaderStorage, Usage::Default);
+    out_culling.draw_commands_buffer = Buffer(graphics_context, draw_commands, BufferType::ShaderStorage, Usage::Default);
+    out_culling.visible_draw_commands_buffer = Buffer(graphics_context, {.type = BufferType::ShaderStorage,
+                                                                         .usage = output_usage,
+                                                                         .size = shape_count * sizeof(Rndr::DrawIndicesData),
+                                                                         .stride = sizeof(Rndr::DrawIndicesData)});
+    out_culling.draw_count_buffer =
+        Buffer(graphics_context, {.type = BufferType::ShaderStorage, .usage = output_usage, .size = sizeof(u32), .stride = sizeof(u32)});
+    if (!out_culling.culling_data_buffer.IsValid() || !out_culling.shape_bounds_buffer.IsValid() ||
+        !out_culling.draw_commands_buffer.IsValid() || !out_culling.visible_draw_commands_buffer.IsValid() ||
+        !out_culling.draw_count_buffer.IsValid())
+    {
+        RNDR_LOG_ERROR("SetupGpuCulling: Failed to create culling buffers!");
+        return false;
+    }
+    return true;
+}
+
+bool Culling::DispatchGpuCulling(GpuCulling& culling, Rndr::GraphicsContext& graphics_context, const Frustum& frustum,
+                                 const Rndr::Buffer& model_data, const Rndr::Buffer& out_model_indices)
+{
+    GpuCullingData culling_data;
+    for (i32 i = 0; i < Frustum::k_plane_count; ++i)
+    {
+        culling_data.frustum_planes[i] = frustum.planes[i];
+    }
+    culling_data.shape_count = culling.shape_count;
+    culling_data.compact_commands = culling.use_draw_count_buffer ? 1 : 0;
+    if (!graphics_context.UpdateBuffer(culling.culling_data_buffer, Opal::AsBytes(culling_data)))
+    {
+        RNDR_LOG_ERROR("DispatchGpuCulling: Failed to update culling data!");
+        return false;
+    }
+
+    if (!RenderBackend::ClearBuffer(graphics_context, culling.draw_count_buffer))
+    {
+        return false;
+    }
+
+    graphics_context.BindPipeline(culling.pipeline);
+    graphics_context.BindBuffer(culling.culling_data_buffer, 0);
+    graphics_context.BindBuffer(culling.shape_bounds_buffer, 1);
+    graphics_context.BindBuffer(model_data, 2);
+    graphics_context.BindBuffer(culling.draw_commands_buffer, 3);
+    graphics_context.BindBuffer(out_model_indices, 4);
+    graphics_context.BindBuffer(culling.visible_draw_commands_buffer, 5);
+    graphics_context.BindBuffer(culling.draw_count_buffer, 6);
+    const u32 group_count = (culling.shape_count + GpuCulling::k_group_size - 1) / GpuCulling::k_group_size;
+    if (!graphics_context.DispatchCompute(group_count, 1, 1, false))
+    {
+        RNDR_LOG_ERROR("DispatchGpuCulling: Failed to dispatch culling shader!");
+        return false;
+    }
+
+    // Draw commands are consumed by the indirect draw and model indices by the vertex shader.
+    RenderBackend::InsertBarrier(graphics_context, BarrierFlags::IndirectCommands | BarrierFlags::ShaderStorage);
+    return true;
+}
+
+bool Culling::DrawGpuCulled(const GpuCulling& culling, Rndr::GraphicsContext& graphics_context)
+{
+    return RenderBackend::DrawIndicesIndirect(graphics_context, Rndr::PrimitiveTopology::Triangle, culling.visible_draw_commands_buffer,
+                                              culling.shape_count, culling.use_draw_count_buffer ? &culling.draw_count_buffer : nullptr);
+}
+
+bool Culling::ReadGpuCullingResult(CullingResult& out_result, const GpuCulling& culling, Rndr::GraphicsContext& graphics_context,
+                                   const Rndr::Buffer& model_indices)
+{
+    if (!culling.desc.enable_read_back)
+    {
+        RNDR_LOG_ERROR("ReadGpuCullingResult: Read back is not enabled!");
+        return false;
+    }
+
+    u32 draw_count = culling.shape_count;
+    if (culling.use_draw_count_buffer)
+    {
+        Opal::DynamicArray<u32> count_storage(1);
+        Opal::ArrayView<u8> count_data = Opal::AsWritableBytes(count_storage);
+        if (graphics_context.ReadBuffer(culling.draw_count_buffer, count_data) != Rndr::ErrorCode::Success)
+        {
+            RNDR_LOG_ERROR("ReadGpuCullingResult: Failed to read draw count!");
+            return false;
+        }
+        draw_count = std::min(count_storage[0], culling.shape_count);
+    }
+
+    Opal::DynamicArray<Rndr::DrawIndicesData> commands(culling.shape_count);
+    Opal::DynamicArray<u32> indices(culling.shape_count);
+    Opal::ArrayView<u8> command_data = Opal::AsWritableBytes(commands);
+    Opal::ArrayView<u8> index_data = Opal::AsWritableBytes(indices);
+    if (graphics_context.ReadBuffer(culling.visible_draw_commands_buffer, command_data) != Rndr::ErrorCode::Success ||
+        graphics_context.ReadBuffer(model_indices, index_data, 0, static_cast<i32>(culling.shape_count * sizeof(u32))) !=
+            Rndr::ErrorCode::Success)
+    {
+        RNDR_LOG_ERROR("ReadGpuCullingResult: Failed to read visible draw commands!");
+        return false;
+    }
+
+    // Atomic appends come out in arbitrary order, sort them to match the CPU culling.
+    Opal::DynamicArray<u32> order;
+    order.Reserve(draw_count);
+    for (u32 i = 0; i < draw_count; ++i)
+    {
+        if (commands[i].instance_count != 0)
+        {
+            order.PushBack(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&indices](u32 a, u32 b) { return indices[a] < indices[b]; });
+
+    out_result.draw_commands.Clear();
+    out_result.model_indices.Clear();
+    out_result.draw_commands.Reserve(order.GetSize());
+    out_result.model_indices.Reserve(order.GetSize());
+    out_result.visibility.Resize(culling.shape_count);
+    std::fill(out_result.visibility.begin(), out_result.visibility.end(), static_cast<u8>(0));
+    for (const u32 i : order)
+    {
+        out_result.draw_commands.PushBack(commands[i]);
+        out_result.model_indices.PushBack(indices[i]);
+        out_result.visibility[indices[i]] = 1;
+    }
+    out_result.stats.total_count = culling.shape_count;
+    out_result.stats.visible_count = order.GetSize();
+    out_result.stats.culled_count = culling.shape_count - order.GetSize();
+    out_result.stats.cull_time_ms = 0.0;
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/math.h"
+#include "rndr/render-api.h"
+
+#include "culling.h"
+#include "scene.h"
+
+/**
+ * Local space bounds of a shape as read by the culling compute shader.
+ */
+struct GpuShapeBounds
+{
+    Rndr::Vector4f local_center;
+    Rndr::Vector4f local_extent;
+};
+
+/**
+ * Per frame data of the culling compute shader. Matches the std140 layout of the CullingData block.
+ */
+struct GpuCullingData
+{
+    Rndr::Vector4f frustum_planes[Frustum::k_plane_count];
+    u32 shape_count = 0;
+    u32 compact_commands = 1;
+    u32 padding[2] = {};
+};
+
+/**
+ * Configuration of the GPU culling.
+ */
+struct GpuCullingDesc
+{
+    /** Allows reading the culling output back to the CPU with Culling::ReadGpuCullingResult. Meant for validation only. */
+    bool enable_read_back = false;
+};
+
+/**
+ * Frustum culling that runs in a compute shader and writes the indirect draw buffer directly, so the CPU never sees the
+ * list of visible shapes. Shape bounds are transformed to world space on the GPU using the ModelData buffer.
+ */
+struct GpuCulling
+{
+    static constexpr u32 k_group_size = 64;
+
+    GpuCullingDesc desc;
+
+    Rndr::Shader shader;
+    Rndr::Pipeline pipeline;
+
+    /** Uniform buffer with the GpuCullingData. */
+    Rndr::Buffer culling_data_buffer;
+
+    /** One GpuShapeBounds per shape. */
+    Rndr::Buffer shape_bounds_buffer;
+
+    /** Draw commands of all shapes, in the shape order. */
+    Rndr::Buffer draw_commands_buffer;
+
+    /** Draw commands of the visible shapes written by the compute shader. */
+    Rndr::Buffer visible_draw_commands_buffer;
+
+    /** Single u32 with the number of visible draw commands, reset every dispatch. */
+    Rndr::Buffer draw_count_buffer;
+
+    u32 shape_count = 0;
+
+    /** False when the driver can't source the draw count from a buffer. Hidden shapes then get draws with zero instances. */
+    bool use_draw_count_buffer = true;
+};
+
+namespace Culling
+{
+
+/**
+ * Creates the compute pipeline and uploads the local bounds and draw commands of all shapes.
+ * @param out_culling The GPU culling object to set up.
+ * @param scene The scene with shapes and mesh bounds.
+ * @param draw_commands Draw commands of all shapes, in the shape order. Shapes whose command has zero instances are never
+ * drawn, which leaves them to other passes.
+ * @param graphics_context Graphics context used to create the resources.
+ * @param desc The configuration.
+ * @return True if all resources were created, false otherwise.
+ */
+bool SetupGpuCulling(GpuCulling& out_culling, const SceneDrawData& scene, const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands,
+                     const Rndr::GraphicsContext& graphics_context, const GpuCullingDesc& desc = {});
+
+/**
+ * Resets the draw count and dispatches the culling compute shader.
+ * @param culling The GPU culling object.
+ * @param graphics_context Graphics context used to dispatch the work.
+ * @param frustum The camera frustum in world space.
+ * @param model_data Buffer with ModelData of all shapes.
+ * @param out_model_indices Buffer that receives the shape index of each visible draw command. Needs space for all shapes.
+ * @return True if the dispatch was successful, false otherwise.
+ */
+bool DispatchGpuCulling(GpuCulling& culling, Rndr::GraphicsContext& graphics_context, const Frustum& frustum, const Rndr::Buffer& model_data,
+                        const Rndr::Buffer& out_model_indices);
+
+/**
+ * Draws the visible shapes with a single multi draw indirect count call. Pipeline with all the resources used by the
+ * shaders needs to be bound.
+ * @param culling The GPU culling object after DispatchGpuCulling.
+ * @param graphics_context Graphics context used to draw.
+ * @return True if the draw was issued, false otherwise.
+ */
+bool DrawGpuCulled(const GpuCulling& culling, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Reads visible draw commands and model indices back to the CPU. Stalls until the GPU is done so it should only be used to
+ * validate the GPU path against Culling::CullShapes.
+ * @param out_result Result in the same form as the one produced by the CPU culling, sorted by shape index.
+ * @param culling The GPU culling object created with read back enabled.
+ * @param graphics_context Graphics context used to read the buffers.
+ * @param model_indices The buffer passed to DispatchGpuCulling. Needs to be created with read back usage.
+ * @return True if the buffers were read, false otherwise.
+ */
+bool ReadGpuCullingResult(CullingResult& out_result, const GpuCulling& culling, Rndr::GraphicsContext& graphics_context,
+                          const Rndr::Buffer& model_indices);
+
+}  // namespace Culling
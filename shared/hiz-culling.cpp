@@ -0,0 +1,214 @@
+#include "hiz-culling.h"
+
+#include <algorithm>
+
+#include "opal/paths.h"
+
+#include "rndr/file.h"
+#include "rndr/log.h"
+
+#include "render-backend.h"
+
+namespace
+{
+bool CreateComputePipeline(Rndr::Shader& out_shader, Rndr::Pipeline& out_pipeline, const Rndr::GraphicsContext& graphics_context,
+                           const char* shader_name)
+{
+    const Opal::StringUtf8 shader_dir = Opal::Paths::Combine(nullptr, ASSETS_ROOT, "shaders").GetValue();
+    const Opal::StringUtf8 shader_source = Rndr::File::ReadShader(shader_dir, shader_name);
+    if (shader_source.IsEmpty())
+    {
+        RNDR_LOG_ERROR("SetupHizCulling: Failed to read [%s] shader!", shader_name);
+        return false;
+    }
+    out_shader = Rndr::Shader(graphics_context, {.type = Rndr::ShaderType::Compute, .source = shader_source});
+    out_pipeline = Rndr::Pipeline(graphics_context, {.compute_shader = &out_shader});
+    if (!out_shader.IsValid() || !out_pipeline.IsValid())
+    {
+        RNDR_LOG_ERROR("SetupHizCulling: Failed to create [%s] pipeline!", shader_name);
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+bool Culling::SetupHizCulling(HizCulling& out_culling, const GpuCulling& gpu_culling, i32 width, i32 height,
+                              const Rndr::GraphicsContext& graphics_context)
+{
+    using namespace Rndr;
+
+    if (width <= 0 || height <= 0 || gpu_culling.shape_count == 0)
+    {
+        RNDR_LOG_ERROR("SetupHizCulling: Invalid depth buffer size %dx%d or no shapes!", width, height);
+        return false;
+    }
+
+    out_culling = {};
+    out_culling.width = width;
+    out_culling.height = height;
+    out_culling.shape_count = gpu_culling.shape_count;
+    out_culling.use_draw_count_buffer = gpu_culling.use_draw_count_buffer;
+    if (!CreateComputePipeline(out_culling.culling_shader, out_culling.culling_pipeline, graphics_context, "compute-hiz-culling.glsl") ||
+        !CreateComputePipeline(out_culling.pyramid_shader, out_culling.pyramid_pipeline, graphics_context, "compute-depth-pyramid.glsl"))
+    {
+        return false;
+    }
+
+    // Each level halves the previous one rounding up, so every texel of the level below is covered.
+    u32 level_width = static_cast<u32>(width);
+    u32 level_height = static_cast<u32>(height);
+    u32 pyramid_size = 0;
+    do
+    {
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+        out_culling.pyramid_levels.PushBack({.offset = pyramid_size, .width = level_width, .height = level_height});
+        pyramid_size += level_width * level_height;
+    } while ((level_width > 1 || level_height > 1) && out_culling.pyramid_levels.GetSize() < HizCullingData::k_max_pyramid_levels);
+
+    out_culling.depth_pyramid_buffer =
+        Buffer(graphics_context, {.type = BufferType::ShaderStorage, .usage = Usage::Default, .size = pyramid_size * sizeof(f32), .stride = sizeof(f32)});
+    if (!out_culling.depth_pyramid_buffer.IsValid())
+    {
+        RNDR_LOG_ERROR("SetupHizCulling: Failed to create depth pyramid buffer!");
+        return false;
+    }
+
+    for (size_t i = 0; i < out_culling.pyramid_levels.GetSize(); ++i)
+    {
+        const HizPyramidLevel& dst = out_culling.pyramid_levels[i];
+        HizPyramidBuildData build_data{.dst_offset = dst.offset, .dst_width = dst.width, .dst_height = dst.height};
+        if (i == 0)
+        {
+            build_data.src_width = static_cast<u32>(width);
+            build_data.src_height = static_cast<u32>(height);
+            build_data.read_depth_texture = 1;
+        }
+        else
+        {
+            const HizPyramidLevel& src = out_culling.pyramid_levels[i - 1];
+            build_data.src_offset = src.offset;
+            build_data.src_width = src.width;
+            build_data.src_height = src.height;
+        }
+        const Opal::ArrayView<const HizPyramidBuildData> build_data_view(&build_data, 1);
+        out_culling.pyramid_build_buffers.PushBack(Buffer(graphics_context, build_data_view, BufferType::Constant, Usage::Default));
+        if (!out_culling.pyramid_build_buffers.Back().GetValue().IsValid())
+        {
+            RNDR_LOG_ERROR("SetupHizCulling: Failed to create depth pyramid level buffer!");
+            return false;
+        }
+    }
+
+    // Nothing was visible before the first frame, so the first phase draws nothing and the second one tests everything.
+    const u32 visibility_word_count = (out_culling.shape_count + 31) / 32;
+    const Opal::DynamicArray<u32> visibility_bits(visibility_word_count, 0u);
+    out_culling.visibility_buffer =
+        Buffer(graphics_context, Opal::ArrayView<const u32>(visibility_bits), BufferType::ShaderStorage, Usage::Default);
+
+    const size_t shape_count = out_culling.shape_count;
+    for (u32 phase = 0; phase < HizCulling::k_phase_count; ++phase)
+    {
+        out_culling.culling_data_buffers[phase] = Buffer(graphics_context, {.type = BufferType::Constant,
+                                                                            .usage = Usage::Dynamic,
+                                                                            .size = sizeof(HizCullingData),
+                                                                            .stride = sizeof(HizCullingData)});
+        out_culling.draw_commands_buffers[phase] = Buffer(graphics_context, {.type = BufferType::ShaderStorage,
+                                                                             .usage = Usage::Default,
+                                                                             .size = shape_count * sizeof(DrawIndicesData),
+                                                                             .stride = sizeof(DrawIndicesData)});
+        out_culling.draw_count_buffers[phase] =
+            Buffer(graphics_context, {.type = BufferType::ShaderStorage, .usage = Usage::Default, .size = sizeof(u32), .stride = sizeof(u32)});
+        out_culling.model_indices_buffers[phase] = Buffer(
+            graphics_context, {.type = BufferType::ShaderStorage, .usage = Usage::Default, .size = shape_count * sizeof(u32), .stride = sizeof(u32)});
+        if (!out_culling.culling_data_buffers[phase].IsValid() || !out_culling.draw_commands_buffers[phase].IsValid() ||
+            !out_culling.draw_count_buffers[phase].IsValid() || !out_culling.model_indices_buffers[phase].IsValid())
+        {
+            RNDR_LOG_ERROR("SetupHizCulling: Failed to create culling buffers!");
+            return false;
+        }
+    }
+    return out_culling.visibility_buffer.IsValid();
+}
+
+bool Culling::DispatchHizCulling(HizCulling& culling, const GpuCulling& gpu_culling, Rndr::GraphicsContext& graphics_context,
+                                 HizCullingPhase phase, const Rndr::Matrix4x4f& clip_from_world, const Rndr::Buffer& model_data)
+{
+    const u32 phase_index = static_cast<u32>(phase);
+    const Frustum frustum = ExtractFrustum(clip_from_world);
+
+    HizCullingData culling_data;
+    culling_data.clip_from_world = Opal::Transpose(clip_from_world);
+    for (i32 i = 0; i < Frustum::k_plane_count; ++i)
+    {
+        culling_data.frustum_planes[i] = frustum.planes[i];
+    }
+    culling_data.shape_count = culling.shape_count;
+    culling_data.compact_commands = culling.use_draw_count_buffer ? 1 : 0;
+    culling_data.phase = phase_index;
+    culling_data.pyramid_level_count = static_cast<u32>(culling.pyramid_levels.GetSize());
+    culling_data.screen_width = static_cast<u32>(culling.width);
+    culling_data.screen_height = static_cast<u32>(culling.height);
+    std::copy(culling.pyramid_levels.begin(), culling.pyramid_levels.end(), culling_data.pyramid_levels);
+    if (!graphics_context.UpdateBuffer(culling.culling_data_buffers[phase_index], Opal::AsBytes(culling_data)))
+    {
+        RNDR_LOG_ERROR("DispatchHizCulling: Failed to update culling data!");
+        return false;
+    }
+
+    if (!RenderBackend::ClearBuffer(graphics_context, culling.draw_count_buffers[phase_index]))
+    {
+        return false;
+    }
+
+    graphics_context.BindPipeline(culling.culling_pipeline);
+    graphics_context.BindBuffer(culling.culling_data_buffers[phase_index], 0);
+    graphics_context.BindBuffer(gpu_culling.shape_bounds_buffer, 1);
+    graphics_context.BindBuffer(model_data, 2);
+    graphics_context.BindBuffer(gpu_culling.draw_commands_buffer, 3);
+    graphics_context.BindBuffer(culling.model_indices_buffers[phase_index], 4);
+    graphics_context.BindBuffer(culling.draw_commands_buffers[phase_index], 5);
+    graphics_context.BindBuffer(culling.draw_count_buffers[phase_index], 6);
+    graphics_context.BindBuffer(culling.visibility_buffer, 7);
+    graphics_context.BindBuffer(culling.depth_pyramid_buffer, 8);
+    const u32 group_count = (culling.shape_count + HizCulling::k_group_size - 1) / HizCulling::k_group_size;
+    if (!graphics_context.DispatchCompute(group_count, 1, 1, false))
+    {
+        RNDR_LOG_ERROR("DispatchHizCulling: Failed to dispatch culling shader!");
+        return false;
+    }
+
+    RenderBackend::InsertBarrier(graphics_context, BarrierFlags::IndirectCommands | BarrierFlags::ShaderStorage);
+    return true;
+}
+
+bool Culling::BuildDepthPyramid(HizCulling& culling, Rndr::GraphicsContext& graphics_context, const Rndr::Texture& depth_texture)
+{
+    graphics_context.BindPipeline(culling.pyramid_pipeline);
+    graphics_context.BindTexture(depth_texture, 0);
+    graphics_context.BindBuffer(culling.depth_pyramid_buffer, 1);
+    for (size_t i = 0; i < culling.pyramid_levels.GetSize(); ++i)
+    {
+        const HizPyramidLevel& level = culling.pyramid_levels[i];
+        graphics_context.BindBuffer(culling.pyramid_build_buffers[i], 0);
+        const u32 group_count_x = (level.width + HizCulling::k_pyramid_group_size - 1) / HizCulling::k_pyramid_group_size;
+        const u32 group_count_y = (level.height + HizCulling::k_pyramid_group_size - 1) / HizCulling::k_pyramid_group_size;
+        if (!graphics_context.DispatchCompute(group_count_x, group_count_y, 1, false))
+        {
+            RNDR_LOG_ERROR("BuildDepthPyramid: Failed to dispatch level %zu!", i);
+            return false;
+        }
+        // Next level reads this one.
+        RenderBackend::InsertBarrier(graphics_context, BarrierFlags::ShaderStorage);
+    }
+    return true;
+}
+
+bool Culling::DrawHizCulled(const HizCulling& culling, Rndr::GraphicsContext& graphics_context, HizCullingPhase phase, i32 model_indices_slot)
+{
+    const u32 phase_index = static_cast<u32>(phase);
+    graphics_context.BindBuffer(culling.model_indices_buffers[phase_index], model_indices_slot);
+    return RenderBackend::DrawIndicesIndirect(graphics_context, Rndr::PrimitiveTopology::Triangle, culling.draw_commands_buffers[phase_index],
+                                              culling.shape_count,
+                                              culling.use_draw_count_buffer ? &culling.draw_count_buffers[phase_index] : nullptr);
+}
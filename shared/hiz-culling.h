@@ -0,0 +1,159 @@
+#pragma once
+
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/math.h"
+#include "rndr/render-api.h"
+
+#include "culling.h"
+#include "gpu-culling.h"
+
+/**
+ * Phases of the two phase occlusion culling.
+ */
+enum class HizCullingPhase : u32
+{
+    /** Draws shapes in the frustum that were visible in the previous frame. */
+    VisibleLastFrame = 0,
+    /** Draws shapes in the frustum that are not hidden by the depth pyramid and were not drawn in the first phase. */
+    NewlyVisible = 1,
+    Count
+};
+
+/**
+ * Location of one depth pyramid level in the pyramid buffer. Matches the layout of the uvec4 in the culling shader.
+ */
+struct HizPyramidLevel
+{
+    u32 offset = 0;
+    u32 width = 0;
+    u32 height = 0;
+    u32 padding = 0;
+};
+
+/**
+ * Per phase data of the Hi-Z culling compute shader. Matches the std140 layout of the CullingData block.
+ */
+struct HizCullingData
+{
+    static constexpr u32 k_max_pyramid_levels = 16;
+
+    /** Transposed since the shader expects column-major matrices. */
+    Rndr::Matrix4x4f clip_from_world;
+    Rndr::Vector4f frustum_planes[Frustum::k_plane_count];
+    u32 shape_count = 0;
+    u32 compact_commands = 1;
+    u32 phase = 0;
+    u32 pyramid_level_count = 0;
+    u32 screen_width = 0;
+    u32 screen_height = 0;
+    u32 padding[2] = {};
+    HizPyramidLevel pyramid_levels[k_max_pyramid_levels];
+};
+
+/**
+ * Data of one depth pyramid build step. Matches the std140 layout of the PyramidLevel block.
+ */
+struct HizPyramidBuildData
+{
+    u32 src_offset = 0;
+    u32 src_width = 0;
+    u32 src_height = 0;
+    u32 dst_offset = 0;
+    u32 dst_width = 0;
+    u32 dst_height = 0;
+    u32 read_depth_texture = 0;
+    u32 padding = 0;
+};
+
+/**
+ * Two phase GPU occlusion culling. Shapes visible in the last frame are drawn first, a depth pyramid is built from the
+ * resulting depth buffer and the remaining shapes are tested against it. Visibility of each shape is kept in a persistent
+ * bit array on the GPU. Uses the shape bounds and draw commands uploaded by GpuCulling.
+ */
+struct HizCulling
+{
+    static constexpr u32 k_group_size = 64;
+    static constexpr u32 k_pyramid_group_size = 8;
+    static constexpr u32 k_phase_count = static_cast<u32>(HizCullingPhase::Count);
+
+    Rndr::Shader culling_shader;
+    Rndr::Pipeline culling_pipeline;
+    Rndr::Shader pyramid_shader;
+    Rndr::Pipeline pyramid_pipeline;
+
+    /** Uniform buffers with HizCullingData, one per phase so that both can be in flight. */
+    Rndr::Buffer culling_data_buffers[k_phase_count];
+
+    /** Uniform buffers with HizPyramidBuildData, one per pyramid level. */
+    Opal::DynamicArray<Rndr::Buffer> pyramid_build_buffers;
+
+    /** All pyramid levels stored one after another as floats. Level zero has half the resolution of the depth buffer. */
+    Rndr::Buffer depth_pyramid_buffer;
+
+    /** One bit per shape, set if the shape was visible in the previous frame. */
+    Rndr::Buffer visibility_buffer;
+
+    /** Output of each phase. */
+    Rndr::Buffer draw_commands_buffers[k_phase_count];
+    Rndr::Buffer draw_count_buffers[k_phase_count];
+    Rndr::Buffer model_indices_buffers[k_phase_count];
+
+    Opal::DynamicArray<HizPyramidLevel> pyramid_levels;
+    i32 width = 0;
+    i32 height = 0;
+    u32 shape_count = 0;
+    bool use_draw_count_buffer = true;
+};
+
+namespace Culling
+{
+
+/**
+ * Creates the compute pipelines, the depth pyramid and the per phase buffers. Should be called again when the size of the
+ * depth buffer changes, which also resets the visibility of all shapes.
+ * @param out_culling The Hi-Z culling object to set up.
+ * @param gpu_culling GPU culling object with shape bounds and draw commands of all shapes.
+ * @param width Width of the depth buffer.
+ * @param height Height of the depth buffer.
+ * @param graphics_context Graphics context used to create the resources.
+ * @return True if all resources were created, false otherwise.
+ */
+bool SetupHizCulling(HizCulling& out_culling, const GpuCulling& gpu_culling, i32 width, i32 height,
+                     const Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Dispatches the culling shader for the given phase. NewlyVisible phase needs the depth pyramid built from the depth
+ * buffer after the VisibleLastFrame draws.
+ * @param culling The Hi-Z culling object.
+ * @param gpu_culling GPU culling object passed to SetupHizCulling.
+ * @param graphics_context Graphics context used to dispatch the work.
+ * @param phase The phase to cull for.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space.
+ * @param model_data Buffer with ModelData of all shapes.
+ * @return True if the dispatch was successful, false otherwise.
+ */
+bool DispatchHizCulling(HizCulling& culling, const GpuCulling& gpu_culling, Rndr::GraphicsContext& graphics_context, HizCullingPhase phase,
+                        const Rndr::Matrix4x4f& clip_from_world, const Rndr::Buffer& model_data);
+
+/**
+ * Builds the depth pyramid from the depth buffer, one dispatch per level.
+ * @param culling The Hi-Z culling object.
+ * @param graphics_context Graphics context used to dispatch the work.
+ * @param depth_texture Depth attachment with the depth of the shapes drawn in the first phase.
+ * @return True if all dispatches were successful, false otherwise.
+ */
+bool BuildDepthPyramid(HizCulling& culling, Rndr::GraphicsContext& graphics_context, const Rndr::Texture& depth_texture);
+
+/**
+ * Draws the shapes appended in the given phase. Pipeline with all the resources used by the shaders needs to be bound.
+ * Model indices of the phase are bound to the given slot.
+ * @param culling The Hi-Z culling object.
+ * @param graphics_context Graphics context used to bind the model indices.
+ * @param phase The phase to draw.
+ * @param model_indices_slot Slot of the model indices buffer in the vertex shader.
+ * @return True if the draw was issued, false otherwise.
+ */
+bool DrawHizCulled(const HizCulling& culling, Rndr::GraphicsContext& graphics_context, HizCullingPhase phase, i32 model_indices_slot);
+
+}  // namespace Culling
@@ -0,0 +1,116 @@
+#include "indirect-command-buffer.h"
+
+#include <cstring>
+
+#include "rndr/log.h"
+
+#include "render-backend.h"
+
+namespace
+{
+/** Unchanged commands between two changed ones that are uploaded anyway to save an upload call. */
+constexpr size_t k_max_clean_gap = 4;
+
+bool IsSameCommand(const Rndr::DrawIndicesData& a, const Rndr::DrawIndicesData& b)
+{
+    return std::memcmp(&a, &b, sizeof(Rndr::DrawIndicesData)) == 0;
+}
+}  // namespace
+
+bool IndirectCommands::SetupIndirectCommandBuffer(IndirectCommandBuffer& out_buffer, const Rndr::GraphicsContext& graphics_context,
+                                                  u32 capacity)
+{
+    using namespace Rndr;
+
+    if (capacity == 0)
+    {
+        RNDR_LOG_ERROR("SetupIndirectCommandBuffer: Capacity can't be zero!");
+        return false;
+    }
+
+    out_buffer = {};
+    out_buffer.commands.Resize(capacity, DrawIndicesData{});
+    out_buffer.buffer = Buffer(graphics_context,
+                               {.type = BufferType::ShaderStorage,
+                                .usage = Usage::Dynamic,
+                                .size = capacity * sizeof(DrawIndicesData),
+                                .stride = sizeof(DrawIndicesData)},
+                               Opal::AsBytes(out_buffer.commands));
+    if (!out_buffer.buffer.IsValid())
+    {
+        RNDR_LOG_ERROR("SetupIndirectCommandBuffer: Failed to create the buffer!");
+        return false;
+    }
+    return true;
+}
+
+bool IndirectCommands::UpdateIndirectCommandBuffer(IndirectCommandBuffer& in_out_buffer, Rndr::GraphicsContext& graphics_context,
+                                                   const Opal::ArrayView<const Rndr::DrawIndicesData>& commands)
+{
+    IndirectCommandBufferStats& stats = in_out_buffer.stats;
+    stats.commands_updated_last_frame = 0;
+    stats.ranges_uploaded_last_frame = 0;
+    stats.bytes_uploaded_last_frame = 0;
+
+    const size_t command_count = commands.GetSize();
+    if (command_count > in_out_buffer.commands.GetSize())
+    {
+        RNDR_LOG_ERROR("UpdateIndirectCommandBuffer: %zu commands don't fit into a buffer with capacity of %zu!", command_count,
+                       in_out_buffer.commands.GetSize());
+        return false;
+    }
+
+    // Commands past the draw count are not drawn so they are left as they are
+    bool is_success = true;
+    size_t range_start = 0;
+    size_t range_end = 0;
+    bool has_range = false;
+    for (size_t i = 0; i <= command_count; ++i)
+    {
+        const bool is_changed = i < command_count && !IsSameCommand(in_out_buffer.commands[i], commands[i]);
+        if (is_changed)
+        {
+            in_out_buffer.commands[i] = commands[i];
+            stats.commands_updated_last_frame++;
+            if (has_range && i - range_end <= k_max_clean_gap)
+            {
+                range_end = i + 1;
+                continue;
+            }
+        }
+        else if (i < command_count)
+        {
+            continue;
+        }
+
+        // Either a change too far from the current range or the end of the commands, flush the current range
+        if (has_range)
+        {
+            const Opal::ArrayView<const Rndr::DrawIndicesData> range(in_out_buffer.commands.GetData() + range_start, range_end - range_start);
+            const u64 offset = static_cast<u64>(range_start) * sizeof(Rndr::DrawIndicesData);
+            is_success &= graphics_context.UpdateBuffer(in_out_buffer.buffer, Opal::AsBytes(range), static_cast<i64>(offset));
+            stats.ranges_uploaded_last_frame++;
+            stats.bytes_uploaded_last_frame += static_cast<u64>(range_end - range_start) * sizeof(Rndr::DrawIndicesData);
+        }
+        has_range = is_changed;
+        range_start = i;
+        range_end = i + 1;
+    }
+    stats.total_bytes_uploaded += stats.bytes_uploaded_last_frame;
+    in_out_buffer.draw_count = static_cast<u32>(command_count);
+
+    if (!is_success)
+    {
+        RNDR_LOG_ERROR("UpdateIndirectCommandBuffer: Failed to upload draw commands!");
+    }
+    return is_success;
+}
+
+bool IndirectCommands::DrawIndirectCommandBuffer(const IndirectCommandBuffer& buffer, Rndr::GraphicsContext& graphics_context)
+{
+    if (buffer.draw_count == 0)
+    {
+        return true;
+    }
+    return RenderBackend::DrawIndicesIndirect(graphics_context, Rndr::PrimitiveTopology::Triangle, buffer.buffer, buffer.draw_count);
+}
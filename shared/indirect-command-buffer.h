@@ -0,0 +1,72 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/render-api.h"
+
+#include "types.h"
+
+/**
+ * Upload counters of the indirect command buffer.
+ */
+struct IndirectCommandBufferStats
+{
+    u64 commands_updated_last_frame = 0;
+    u64 ranges_uploaded_last_frame = 0;
+    u64 bytes_uploaded_last_frame = 0;
+    u64 total_bytes_uploaded = 0;
+};
+
+/**
+ * GPU buffer of draw commands that lives across frames. Commands are compared with a CPU copy of the buffer and only the
+ * ones that changed are uploaded, so a draw list that barely changes between frames, for example after culling or LOD
+ * selection, costs only the bytes that changed. Draws are issued straight from the buffer with the current draw count.
+ */
+struct IndirectCommandBuffer
+{
+    /** GPU buffer with capacity draw commands. */
+    Rndr::Buffer buffer;
+
+    /** CPU copy of the buffer contents, used to find the commands that changed. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> commands;
+
+    /** Number of commands at the start of the buffer that are drawn. */
+    u32 draw_count = 0;
+
+    IndirectCommandBufferStats stats;
+};
+
+namespace IndirectCommands
+{
+
+/**
+ * Creates the GPU buffer. Commands are zero initialized, which draws nothing.
+ * @param out_buffer The indirect command buffer to set up.
+ * @param graphics_context Graphics context used to create the buffer.
+ * @param capacity Maximum number of draw commands.
+ * @return True if the buffer was created, false otherwise.
+ */
+bool SetupIndirectCommandBuffer(IndirectCommandBuffer& out_buffer, const Rndr::GraphicsContext& graphics_context, u32 capacity);
+
+/**
+ * Replaces the commands in the buffer and sets the draw count to the number of commands. Only the commands that differ from
+ * the previous contents are uploaded, close ones are merged into a single upload.
+ * @param in_out_buffer The indirect command buffer to update.
+ * @param graphics_context Graphics context used to upload the commands.
+ * @param commands New draw commands. Can't be larger than the capacity of the buffer.
+ * @return True if the buffer was updated, false otherwise.
+ */
+bool UpdateIndirectCommandBuffer(IndirectCommandBuffer& in_out_buffer, Rndr::GraphicsContext& graphics_context,
+                                 const Opal::ArrayView<const Rndr::DrawIndicesData>& commands);
+
+/**
+ * Draws the first draw count commands of the buffer. Pipeline with all the resources used by the shaders needs to be bound.
+ * @param buffer The indirect command buffer to draw.
+ * @param graphics_context Graphics context used to draw.
+ * @return True if the draw was issued, false otherwise.
+ */
+bool DrawIndirectCommandBuffer(const IndirectCommandBuffer& buffer, Rndr::GraphicsContext& graphics_context);
+
+}  // namespace IndirectCommands
@@ -0,0 +1,341 @@
+#include "loose-octree.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+constexpr u64 k_coordinate_bits = 19;
+constexpr u64 k_coordinate_mask = (1ull << k_coordinate_bits) - 1;
+
+u64 MakeKey(i32 depth, u64 x, u64 y, u64 z)
+{
+    return (static_cast<u64>(depth) << (3 * k_coordinate_bits)) | (x << (2 * k_coordinate_bits)) | (y << k_coordinate_bits) | z;
+}
+
+i32 GetDepth(u64 key)
+{
+    return static_cast<i32>(key >> (3 * k_coordinate_bits));
+}
+
+void GetCoordinates(u64 key, u64 out_coordinates[3])
+{
+    out_coordinates[0] = (key >> (2 * k_coordinate_bits)) & k_coordinate_mask;
+    out_coordinates[1] = (key >> k_coordinate_bits) & k_coordinate_mask;
+    out_coordinates[2] = key & k_coordinate_mask;
+}
+
+u64 GetParentKey(u64 key)
+{
+    u64 coordinates[3];
+    GetCoordinates(key, coordinates);
+    return MakeKey(GetDepth(key) - 1, coordinates[0] >> 1, coordinates[1] >> 1, coordinates[2] >> 1);
+}
+
+f32 GetCellSize(const LooseOctreeDesc& desc, i32 depth)
+{
+    return desc.world_size / static_cast<f32>(1u << depth);
+}
+
+/**
+ * Picks the deepest cell whose loose bounds contain the object. Object fits in a cell at some depth if its center is in
+ * the cell and its half extent is at most (loose_factor - 1) * cell_size / 2.
+ */
+u64 FindCellKey(const LooseOctreeDesc& desc, const f32 center[3], const f32 extent[3])
+{
+    const f32 world_min[3] = {desc.world_min.x, desc.world_min.y, desc.world_min.z};
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        if (center[axis] < world_min[axis] || center[axis] > world_min[axis] + desc.world_size)
+        {
+            return LooseOctree::k_outside_key;
+        }
+    }
+
+    const f32 max_extent = std::max(extent[0], std::max(extent[1], extent[2]));
+    const f32 root_max_extent = (desc.loose_factor - 1.0f) * desc.world_size * 0.5f;
+    if (max_extent > root_max_extent)
+    {
+        return LooseOctree::k_outside_key;
+    }
+    i32 depth = desc.max_depth;
+    if (max_extent > 0.0f)
+    {
+        depth = std::min(depth, static_cast<i32>(std::floor(std::log2(root_max_extent / max_extent))));
+    }
+
+    const f32 cell_size = GetCellSize(desc, depth);
+    const u64 max_coordinate = (1ull << depth) - 1;
+    u64 coordinates[3];
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        const f32 cell = std::floor((center[axis] - world_min[axis]) / cell_size);
+        coordinates[axis] = std::min(static_cast<u64>(std::max(cell, 0.0f)), max_coordinate);
+    }
+    return MakeKey(depth, coordinates[0], coordinates[1], coordinates[2]);
+}
+
+void GetLooseCellBounds(const LooseOctreeDesc& desc, u64 key, f32 out_center[3], f32 out_extent[3])
+{
+    const f32 cell_size = GetCellSize(desc, GetDepth(key));
+    const f32 world_min[3] = {desc.world_min.x, desc.world_min.y, desc.world_min.z};
+    u64 coordinates[3];
+    GetCoordinates(key, coordinates);
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        out_center[axis] = world_min[axis] + (static_cast<f32>(coordinates[axis]) + 0.5f) * cell_size;
+        out_extent[axis] = 0.5f * cell_size * desc.loose_factor;
+    }
+}
+
+/**
+ * Walks the cells and collects objects for which the classify function doesn't return -1. Cells for which it returns 1
+ * are accepted together with their descendants without further tests.
+ */
+template <typename ClassifyFunction>
+void QueryCells(Opal::DynamicArray<u32>& out_objects, const LooseOctree& octree, const ClassifyFunction& classify)
+{
+    for (const u32 object_id : octree.outside_objects)
+    {
+        const LooseOctreeObject& object = octree.objects[object_id];
+        if (classify(object.center, object.extent) >= 0)
+        {
+            out_objects.PushBack(object_id);
+        }
+    }
+
+    struct StackEntry
+    {
+        u64 key;
+        bool is_accepted;
+    };
+    Opal::DynamicArray<StackEntry> stack;
+    stack.Reserve(64);
+    if (octree.cells.find(MakeKey(0, 0, 0, 0)) != octree.cells.end())
+    {
+        stack.PushBack({.key = MakeKey(0, 0, 0, 0), .is_accepted = false});
+    }
+    while (!stack.IsEmpty())
+    {
+        StackEntry entry = stack.Back().GetValue();
+        stack.PopBack();
+
+        if (!entry.is_accepted)
+        {
+            f32 center[3];
+            f32 extent[3];
+            GetLooseCellBounds(octree.desc, entry.key, center, extent);
+            const i32 classification = classify(center, extent);
+            if (classification < 0)
+            {
+                continue;
+            }
+            entry.is_accepted = classification > 0;
+        }
+
+        const LooseOctreeCell& cell = octree.cells.find(entry.key)->second;
+        for (const u32 object_id : cell.objects)
+        {
+            const LooseOctreeObject& object = octree.objects[object_id];
+            if (entry.is_accepted || classify(object.center, object.extent) >= 0)
+            {
+                out_objects.PushBack(object_id);
+            }
+        }
+
+        const i32 depth = GetDepth(entry.key);
+        if (depth == octree.desc.max_depth || cell.subtree_object_count == cell.objects.GetSize())
+        {
+            continue;
+        }
+        u64 coordinates[3];
+        GetCoordinates(entry.key, coordinates);
+        for (u64 child = 0; child < 8; ++child)
+        {
+            const u64 child_key =
+                MakeKey(depth + 1, 2 * coordinates[0] + (child & 1), 2 * coordinates[1] + ((child >> 1) & 1), 2 * coordinates[2] + (child >> 2));
+            if (octree.cells.find(child_key) != octree.cells.end())
+            {
+                stack.PushBack({.key = child_key, .is_accepted = entry.is_accepted});
+            }
+        }
+    }
+}
+}  // namespace
+
+bool Culling::SetupLooseOctree(LooseOctree& out_octree, const LooseOctreeDesc& desc)
+{
+    if (desc.max_depth < 0 || desc.max_depth > LooseOctree::k_max_depth)
+    {
+        RNDR_LOG_ERROR("Loose octree depth must be in [0, %d] range!", LooseOctree::k_max_depth);
+        return false;
+    }
+    if (desc.loose_factor <= 1.0f)
+    {
+        RNDR_LOG_ERROR("Loose factor must be larger than 1!");
+        return false;
+    }
+    if (desc.world_size <= 0.0f)
+    {
+        RNDR_LOG_ERROR("World size must be positive!");
+        return false;
+    }
+
+    out_octree.desc = desc;
+    out_octree.cells.clear();
+    out_octree.objects.Clear();
+    out_octree.outside_objects.Clear();
+    out_octree.object_count = 0;
+    return true;
+}
+
+void Culling::InsertObject(LooseOctree& octree, u32 object_id, const f32 center[3], const f32 extent[3])
+{
+    if (object_id >= octree.objects.GetSize())
+    {
+        octree.objects.Resize(object_id + 1);
+    }
+    LooseOctreeObject& object = octree.objects[object_id];
+    RNDR_ASSERT(!object.is_valid, "Object is already in the octree");
+
+    std::copy(center, center + 3, object.center);
+    std::copy(extent, extent + 3, object.extent);
+    object.cell_key = FindCellKey(octree.desc, center, extent);
+    object.is_valid = true;
+    octree.object_count++;
+
+    if (object.cell_key == LooseOctree::k_outside_key)
+    {
+        object.index_in_cell = static_cast<u32>(octree.outside_objects.GetSize());
+        octree.outside_objects.PushBack(object_id);
+        return;
+    }
+
+    LooseOctreeCell& cell = octree.cells[object.cell_key];
+    object.index_in_cell = static_cast<u32>(cell.objects.GetSize());
+    cell.objects.PushBack(object_id);
+    cell.subtree_object_count++;
+    for (u64 key = object.cell_key; GetDepth(key) > 0;)
+    {
+        key = GetParentKey(key);
+        octree.cells[key].subtree_object_count++;
+    }
+}
+
+void Culling::RemoveObject(LooseOctree& octree, u32 object_id)
+{
+    RNDR_ASSERT(ContainsObject(octree, object_id), "Object is not in the octree");
+    LooseOctreeObject& object = octree.objects[object_id];
+    object.is_valid = false;
+    octree.object_count--;
+
+    // Swap with the last object in the list so that removal takes constant time
+    Opal::DynamicArray<u32>* list = &octree.outside_objects;
+    if (object.cell_key != LooseOctree::k_outside_key)
+    {
+        list = &octree.cells.find(object.cell_key)->second.objects;
+    }
+    const u32 last_object_id = list->Back().GetValue();
+    (*list)[object.index_in_cell] = last_object_id;
+    octree.objects[last_object_id].index_in_cell = object.index_in_cell;
+    list->PopBack();
+
+    if (object.cell_key == LooseOctree::k_outside_key)
+    {
+        return;
+    }
+    for (u64 key = object.cell_key;; key = GetParentKey(key))
+    {
+        auto cell_iter = octree.cells.find(key);
+        if (--cell_iter->second.subtree_object_count == 0)
+        {
+            octree.cells.erase(cell_iter);
+        }
+        if (GetDepth(key) == 0)
+        {
+            break;
+        }
+    }
+}
+
+void Culling::MoveObject(LooseOctree& octree, u32 object_id, const f32 center[3], const f32 extent[3])
+{
+    RNDR_ASSERT(ContainsObject(octree, object_id), "Object is not in the octree");
+    LooseOctreeObject& object = octree.objects[object_id];
+    const u64 new_key = FindCellKey(octree.desc, center, extent);
+    if (new_key == object.cell_key)
+    {
+        std::copy(center, center + 3, object.center);
+        std::copy(extent, extent + 3, object.extent);
+        return;
+    }
+    RemoveObject(octree, object_id);
+    InsertObject(octree, object_id, center, extent);
+}
+
+bool Culling::ContainsObject(const LooseOctree& octree, u32 object_id)
+{
+    return object_id < octree.objects.GetSize() && octree.objects[object_id].is_valid;
+}
+
+void Culling::QueryOctree(Opal::DynamicArray<u32>& out_objects, const LooseOctree& octree, const Frustum& frustum)
+{
+    QueryCells(out_objects, octree, [&frustum](const f32 center[3], const f32 extent[3]) { return ClassifyBox(frustum, center, extent); });
+}
+
+void Culling::QueryOctree(Opal::DynamicArray<u32>& out_objects, const LooseOctree& octree, const Rndr::Point3f& center, f32 radius)
+{
+    QueryCells(out_objects, octree,
+               [&center, radius](const f32 box_center[3], const f32 box_extent[3]) { return ClassifyBox(center, radius, box_center, box_extent); });
+}
+
+bool Culling::CullShapes(CullingResult& out_result, Bvh& bvh, const LooseOctree& octree, const Frustum& frustum, const ShapeBounds& bounds,
+                         const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands)
+{
+    const size_t shape_count = draw_commands.GetSize();
+    if (bvh.shape_to_leaf.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("BVH and draw commands are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    QueryBvh(out_result.model_indices, bvh, frustum, bounds);
+    if (octree.object_count > 0)
+    {
+        QueryOctree(out_result.model_indices, octree, frustum);
+        std::sort(out_result.model_indices.begin(), out_result.model_indices.end());
+    }
+
+    out_result.draw_commands.Clear();
+    out_result.draw_commands.Reserve(out_result.model_indices.GetSize());
+    out_result.visibility.Resize(shape_count);
+    std::fill(out_result.visibility.begin(), out_result.visibility.end(), static_cast<u8>(0));
+    for (const u32 shape : out_result.model_indices)
+    {
+        out_result.draw_commands.PushBack(draw_commands[shape]);
+        out_result.visibility[shape] = 1;
+    }
+
+    out_result.stats.total_count = shape_count;
+    out_result.stats.visible_count = out_result.draw_commands.GetSize();
+    out_result.stats.culled_count = shape_count - out_result.draw_commands.GetSize();
+    out_result.stats.cull_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    return true;
+}
+
+void Culling::QuerySphere(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const LooseOctree& octree, const ShapeBounds& bounds,
+                          const Rndr::Point3f& center, f32 radius)
+{
+    QueryBvh(out_shapes, bvh, center, radius, bounds);
+    if (octree.object_count > 0)
+    {
+        QueryOctree(out_shapes, octree, center, radius);
+        std::sort(out_shapes.begin(), out_shapes.end());
+    }
+}
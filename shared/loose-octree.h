@@ -0,0 +1,167 @@
+#pragma once
+
+#include "opal/container/dynamic-array.h"
+#include "opal/container/hash-map.h"
+
+#include "rndr/math.h"
+
+#include "bvh.h"
+#include "culling.h"
+
+/**
+ * Configuration of a loose octree.
+ */
+struct LooseOctreeDesc
+{
+    /** Minimum corner of the region covered by the octree. Objects outside of it are stored in a separate list. */
+    Rndr::Point3f world_min = Rndr::Point3f(-1000.0f, -1000.0f, -1000.0f);
+
+    /** Size of the region covered by the octree along each axis. */
+    f32 world_size = 2000.0f;
+
+    /** How much bigger the bounds of a cell are compared to the cell size. Bigger factor places objects in deeper cells. */
+    f32 loose_factor = 2.0f;
+
+    /** Maximum depth of the octree, root cell is at depth 0. Can't be larger than LooseOctree::k_max_depth. */
+    i32 max_depth = 8;
+};
+
+/**
+ * Cell of a loose octree.
+ */
+struct LooseOctreeCell
+{
+    /** Objects stored in this cell. */
+    Opal::DynamicArray<u32> objects;
+
+    /** Number of objects stored in this cell and all of its descendants. Cell is removed once this reaches zero. */
+    u32 subtree_object_count = 0;
+};
+
+/**
+ * Object stored in a loose octree.
+ */
+struct LooseOctreeObject
+{
+    f32 center[3] = {};
+    f32 extent[3] = {};
+    /** Key of the cell containing the object or LooseOctree::k_outside_key if it is outside of the world region. */
+    u64 cell_key = 0;
+    /** Index of the object in the object list of its cell. */
+    u32 index_in_cell = 0;
+    bool is_valid = false;
+};
+
+/**
+ * Loose octree with cells stored in a hash map keyed by depth and cell coordinates. Cells exist only while they or their
+ * descendants contain objects. Object depth is picked from its size and the cell from its center, so insert, remove and
+ * move don't need to walk the tree and take constant time, apart from updating object counts of the ancestors.
+ */
+struct LooseOctree
+{
+    /** Cell coordinates are packed into 19 bits per axis in the cell key. */
+    static constexpr i32 k_max_depth = 19;
+    static constexpr u64 k_outside_key = 0xFFFFFFFFFFFFFFFF;
+
+    LooseOctreeDesc desc;
+
+    Opal::HashMap<u64, LooseOctreeCell> cells;
+
+    /** Objects indexed by their id. */
+    Opal::DynamicArray<LooseOctreeObject> objects;
+
+    /** Objects that are outside of the world region, they are always tested one by one. */
+    Opal::DynamicArray<u32> outside_objects;
+
+    /** Number of objects in the octree. */
+    size_t object_count = 0;
+};
+
+namespace Culling
+{
+
+/**
+ * Prepares an empty octree.
+ * @param out_octree The octree to set up.
+ * @param desc The configuration of the octree.
+ * @return True if the configuration is valid, false otherwise.
+ */
+bool SetupLooseOctree(LooseOctree& out_octree, const LooseOctreeDesc& desc);
+
+/**
+ * Inserts an object into the octree.
+ * @param octree The octree to insert the object to.
+ * @param object_id The id of the object, usually the shape index. Must not already be in the octree.
+ * @param center World space center of the object bounds.
+ * @param extent World space half extent of the object bounds.
+ */
+void InsertObject(LooseOctree& octree, u32 object_id, const f32 center[3], const f32 extent[3]);
+
+/**
+ * Removes an object from the octree.
+ * @param octree The octree to remove the object from.
+ * @param object_id The id of the object. Must be in the octree.
+ */
+void RemoveObject(LooseOctree& octree, u32 object_id);
+
+/**
+ * Updates bounds of an object. Object is moved to a different cell only if its center or size changed enough.
+ * @param octree The octree containing the object.
+ * @param object_id The id of the object. Must be in the octree.
+ * @param center New world space center of the object bounds.
+ * @param extent New world space half extent of the object bounds.
+ */
+void MoveObject(LooseOctree& octree, u32 object_id, const f32 center[3], const f32 extent[3]);
+
+/**
+ * Check if an object is in the octree.
+ * @param octree The octree to check.
+ * @param object_id The id of the object.
+ * @return True if the object is in the octree, false otherwise.
+ */
+bool ContainsObject(const LooseOctree& octree, u32 object_id);
+
+/**
+ * Appends ids of the objects that intersect the frustum. Output is not sorted.
+ * @param out_objects Array to append the object ids to.
+ * @param octree The octree to query.
+ * @param frustum The frustum to test against.
+ */
+void QueryOctree(Opal::DynamicArray<u32>& out_objects, const LooseOctree& octree, const Frustum& frustum);
+
+/**
+ * Appends ids of the objects that intersect the sphere. Output is not sorted.
+ * @param out_objects Array to append the object ids to.
+ * @param octree The octree to query.
+ * @param center Center of the sphere.
+ * @param radius Radius of the sphere.
+ */
+void QueryOctree(Opal::DynamicArray<u32>& out_objects, const LooseOctree& octree, const Rndr::Point3f& center, f32 radius);
+
+/**
+ * Finds shapes that intersect the frustum using the BVH for the static shapes and the octree for the dynamic shapes, and
+ * writes their draw commands to the result.
+ * @param out_result Compacted draw commands, model indices and stats.
+ * @param bvh BVH built over the static shapes.
+ * @param octree Octree containing the dynamic shapes, with shape indices as object ids.
+ * @param frustum Frustum to test against.
+ * @param bounds World space bounds of the shapes.
+ * @param draw_commands Draw commands of all the shapes, in the shape order.
+ * @return True if culling was successful, false otherwise.
+ */
+bool CullShapes(CullingResult& out_result, Bvh& bvh, const LooseOctree& octree, const Frustum& frustum, const ShapeBounds& bounds,
+                const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands);
+
+/**
+ * Finds shapes that intersect the sphere using the BVH for the static shapes and the octree for the dynamic shapes.
+ * @param out_shapes Shape indices, sorted.
+ * @param bvh BVH built over the static shapes.
+ * @param octree Octree containing the dynamic shapes, with shape indices as object ids.
+ * @param bounds World space bounds of the shapes.
+ * @param center Center of the sphere.
+ * @param radius Radius of the sphere.
+ */
+void QuerySphere(Opal::DynamicArray<u32>& out_shapes, Bvh& bvh, const LooseOctree& octree, const ShapeBounds& bounds,
+                 const Rndr::Point3f& center, f32 radius);
+
+}  // namespace Culling
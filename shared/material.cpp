@@ -20,10 +20,16 @@ Opal::StringUtf8 ConvertTexture(
     Opal::HashMap<Opal::StringUtf8, uint64_t, Opal::StringHash<Opal::StringUtf8>>& albedo_texture_path_to_opacity_texture_index,
     const Opal::DynamicArray<Opal::StringUtf8>& opacity_textures, const Opal::StringUtf8& out_base_path);
 bool SetupMaterial(MaterialDescription& in_out_material, Opal::DynamicArray<Rndr::Texture>& out_textures,
-                   const Rndr::GraphicsContext& graphics_context, const Opal::DynamicArray<Opal::StringUtf8>& in_texture_paths);
+                   Opal::DynamicArray<ImageId>& in_out_texture_handles, const Rndr::GraphicsContext& graphics_context,
+                   const Opal::DynamicArray<Opal::StringUtf8>& in_texture_paths);
 Rndr::Texture LoadTexture(const Rndr::GraphicsContext& graphics_context, const Opal::StringUtf8& texture_path);
 }  // namespace
 
+bool Material::IsAlphaTested(const MaterialDescription& material)
+{
+    return material.alpha_test > 0.0f;
+}
+
 bool Material::ConvertAndDownscaleTextures(const Opal::DynamicArray<MaterialDescription>& materials, const Opal::StringUtf8& base_path,
                                            Opal::DynamicArray<Opal::StringUtf8>& texture_paths,
                                            const Opal::DynamicArray<Opal::StringUtf8>& opacity_textures, const Opal::StringUtf8& out_base_path)
@@ -80,8 +86,8 @@ bool Material::WriteData(const Opal::DynamicArray<MaterialDescription>& material
     return true;
 }
 
-bool Material::ReadDataLoadTextures(Opal::DynamicArray<MaterialDescription>& out_materials, Opal::DynamicArray<Rndr::Texture>& out_textures,
-                                    const Opal::StringUtf8& file_path, const Rndr::GraphicsContext& graphics_context)
+bool Material::ReadData(Opal::DynamicArray<MaterialDescription>& out_materials, Opal::DynamicArray<Opal::StringUtf8>& out_texture_paths,
+                        const Opal::StringUtf8& file_path)
 {
     Opal::StringLocale file_path_locale;
     file_path_locale.Resize(300);
@@ -108,7 +114,8 @@ bool Material::ReadDataLoadTextures(Opal::DynamicArray<MaterialDescription>& out
     auto base_path_result = Opal::Paths::GetParentPath(file_path);
     RNDR_ASSERT(base_path_result.HasValue(), "Failed to get parent path");
     Opal::StringUtf8 base_path = Opal::Move(base_path_result.GetValue());
-    Opal::DynamicArray<Opal::StringUtf8> texture_paths(texture_paths_count);
+    out_texture_paths.Clear();
+    out_texture_paths.Resize(texture_paths_count);
     for (uint32_t i = 0; i < texture_paths_count; ++i)
     {
         size_t texture_path_length = 0;
@@ -119,16 +126,16 @@ bool Material::ReadDataLoadTextures(Opal::DynamicArray<MaterialDescription>& out
         }
         RNDR_ASSERT(texture_path_length > 0, "Texture path is empty");
 
-        texture_paths[i].Resize(texture_path_length);
-        if (!f.Read(texture_paths[i].GetData(), sizeof(texture_paths[i][0]), texture_path_length))
+        out_texture_paths[i].Resize(texture_path_length);
+        if (!f.Read(out_texture_paths[i].GetData(), sizeof(out_texture_paths[i][0]), texture_path_length))
         {
             RNDR_LOG_ERROR("Failed to read texture path!");
             return false;
         }
 
-        auto combine_result = Opal::Paths::Combine(nullptr, base_path, texture_paths[i]);
+        auto combine_result = Opal::Paths::Combine(nullptr, base_path, out_texture_paths[i]);
         RNDR_ASSERT(combine_result.HasValue(), "Failed to combine paths");
-        texture_paths[i] = Opal::Move(combine_result.GetValue());
+        out_texture_paths[i] = Opal::Move(combine_result.GetValue());
     }
 
     size_t materials_count = 0;
@@ -146,104 +153,93 @@ bool Material::ReadDataLoadTextures(Opal::DynamicArray<MaterialDescription>& out
         return false;
     }
 
-    for (MaterialDescription& material : out_materials)
+    return true;
+}
+
+bool Material::LoadTextures(Opal::DynamicArray<MaterialDescription>& in_out_materials, Opal::DynamicArray<Rndr::Texture>& out_textures,
+                            const Opal::DynamicArray<Opal::StringUtf8>& texture_paths, const Rndr::GraphicsContext& graphics_context)
+{
+    // Bindless handles of textures that are already loaded, indexed the same way as texture paths
+    Opal::DynamicArray<ImageId> texture_handles(texture_paths.GetSize(), k_invalid_image_id);
+    for (MaterialDescription& material : in_out_materials)
     {
-        if (!SetupMaterial(material, out_textures, graphics_context, texture_paths))
+        if (!SetupMaterial(material, out_textures, texture_handles, graphics_context, texture_paths))
         {
             RNDR_LOG_ERROR("Failed to setup material!");
             return false;
         }
     }
-
     return true;
 }
 
-namespace
-{
-bool SetupMaterial(MaterialDescription& in_out_material, Opal::DynamicArray<Rndr::Texture>& out_textures,
-                   const Rndr::GraphicsContext& graphics_context, const Opal::DynamicArray<Opal::StringUtf8>& in_texture_paths)
+bool Material::ReadDataLoadTextures(Opal::DynamicArray<MaterialDescription>& out_materials, Opal::DynamicArray<Rndr::Texture>& out_textures,
+                                    const Opal::StringUtf8& file_path, const Rndr::GraphicsContext& graphics_context)
 {
-    if (in_out_material.albedo_texture != k_invalid_image_id)
-    {
-        const Opal::StringUtf8& albedo_map_path = in_texture_paths[static_cast<size_t>(in_out_material.albedo_texture)];
-        Rndr::Texture albedo_map = LoadTexture(graphics_context, albedo_map_path);
-        if (!albedo_map.IsValid())
-        {
-            RNDR_LOG_ERROR("Failed to load albedo map: %s", albedo_map_path.GetData());
-            return false;
-        }
-        in_out_material.albedo_texture = albedo_map.GetBindlessHandle();
-        out_textures.PushBack(std::move(albedo_map));
-    }
-    else
-    {
-        in_out_material.albedo_texture = 0;
-    }
-    if (in_out_material.metallic_roughness_texture != k_invalid_image_id)
+    Opal::DynamicArray<Opal::StringUtf8> texture_paths;
+    if (!ReadData(out_materials, texture_paths, file_path))
     {
-        const Opal::StringUtf8& metallic_roughness_map_path =
-            in_texture_paths[static_cast<size_t>(in_out_material.metallic_roughness_texture)];
-        Rndr::Texture metallic_roughness_map = LoadTexture(graphics_context, metallic_roughness_map_path);
-        if (!metallic_roughness_map.IsValid())
-        {
-            RNDR_LOG_ERROR("Failed to load metallic roughness map: %s", metallic_roughness_map_path.GetData());
-            return false;
-        }
-        in_out_material.metallic_roughness_texture = metallic_roughness_map.GetBindlessHandle();
-        out_textures.PushBack(std::move(metallic_roughness_map));
+        return false;
     }
-    else
+    return LoadTextures(out_materials, out_textures, texture_paths, graphics_context);
+}
+
+namespace
+{
+bool SetupTexture(ImageId& in_out_texture, const char* texture_name, Opal::DynamicArray<Rndr::Texture>& out_textures,
+                  Opal::DynamicArray<ImageId>& in_out_texture_handles, const Rndr::GraphicsContext& graphics_context,
+                  const Opal::DynamicArray<Opal::StringUtf8>& in_texture_paths)
+{
+    if (in_out_texture == k_invalid_image_id)
     {
-        in_out_material.metallic_roughness_texture = 0;
+        in_out_texture = 0;
+        return true;
     }
-    if (in_out_material.normal_texture != k_invalid_image_id)
+
+    const size_t texture_index = static_cast<size_t>(in_out_texture);
+    if (in_out_texture_handles[texture_index] == k_invalid_image_id)
     {
-        const Opal::StringUtf8& normal_map_path = in_texture_paths[static_cast<size_t>(in_out_material.normal_texture)];
-        Rndr::Texture normal_map = LoadTexture(graphics_context, normal_map_path);
-        if (!normal_map.IsValid())
+        const Opal::StringUtf8& texture_path = in_texture_paths[texture_index];
+        Rndr::Texture texture = LoadTexture(graphics_context, texture_path);
+        if (!texture.IsValid())
         {
-            RNDR_LOG_ERROR("Failed to load normal map: %s", normal_map_path.GetData());
+            RNDR_LOG_ERROR("Failed to load %s: %s", texture_name, texture_path.GetData());
             return false;
         }
-        in_out_material.normal_texture = normal_map.GetBindlessHandle();
-        out_textures.PushBack(std::move(normal_map));
+        in_out_texture_handles[texture_index] = texture.GetBindlessHandle();
+        out_textures.PushBack(std::move(texture));
     }
-    else
+    in_out_texture = in_out_texture_handles[texture_index];
+    return true;
+}
+
+bool SetupMaterial(MaterialDescription& in_out_material, Opal::DynamicArray<Rndr::Texture>& out_textures,
+                   Opal::DynamicArray<ImageId>& in_out_texture_handles, const Rndr::GraphicsContext& graphics_context,
+                   const Opal::DynamicArray<Opal::StringUtf8>& in_texture_paths)
+{
+    if (!SetupTexture(in_out_material.albedo_texture, "albedo map", out_textures, in_out_texture_handles, graphics_context,
+                      in_texture_paths))
     {
-        in_out_material.normal_texture = 0;
+        return false;
     }
-    if (in_out_material.ambient_occlusion_texture != k_invalid_image_id)
+    if (!SetupTexture(in_out_material.metallic_roughness_texture, "metallic roughness map", out_textures, in_out_texture_handles,
+                      graphics_context, in_texture_paths))
     {
-        const Opal::StringUtf8& ambient_occlusion_map_path =
-            in_texture_paths[static_cast<size_t>(in_out_material.ambient_occlusion_texture)];
-        Rndr::Texture ambient_occlusion_map = LoadTexture(graphics_context, ambient_occlusion_map_path);
-        if (!ambient_occlusion_map.IsValid())
-        {
-            RNDR_LOG_ERROR("Failed to load ambient occlusion map: %s", ambient_occlusion_map_path.GetData());
-            return false;
-        }
-        in_out_material.ambient_occlusion_texture = ambient_occlusion_map.GetBindlessHandle();
-        out_textures.PushBack(std::move(ambient_occlusion_map));
+        return false;
     }
-    else
+    if (!SetupTexture(in_out_material.normal_texture, "normal map", out_textures, in_out_texture_handles, graphics_context,
+                      in_texture_paths))
     {
-        in_out_material.ambient_occlusion_texture = 0;
+        return false;
     }
-    if (in_out_material.emissive_texture != k_invalid_image_id)
+    if (!SetupTexture(in_out_material.ambient_occlusion_texture, "ambient occlusion map", out_textures, in_out_texture_handles,
+                      graphics_context, in_texture_paths))
     {
-        const Opal::StringUtf8& emissive_map_path = in_texture_paths[static_cast<size_t>(in_out_material.emissive_texture)];
-        Rndr::Texture emissive_map = LoadTexture(graphics_context, emissive_map_path);
-        if (!emissive_map.IsValid())
-        {
-            RNDR_LOG_ERROR("Failed to load emissive map: %s", emissive_map_path.GetData());
-            return false;
-        }
-        in_out_material.emissive_texture = emissive_map.GetBindlessHandle();
-        out_textures.PushBack(std::move(emissive_map));
+        return false;
     }
-    else
+    if (!SetupTexture(in_out_material.emissive_texture, "emissive map", out_textures, in_out_texture_handles, graphics_context,
+                      in_texture_paths))
     {
-        in_out_material.emissive_texture = 0;
+        return false;
     }
 
     in_out_material.opacity_texture = 0;
@@ -66,6 +66,14 @@ struct MaterialDescription final
 namespace Material
 {
 
+/**
+ * Checks if the material discards fragments with the alpha test, the same condition as RunAlphaTest in alpha-test.glsl. The
+ * opacity texture is not checked since it is merged into the albedo map and is zero in the loaded materials.
+ * @param material Material to check.
+ * @return True if the material is alpha tested, false otherwise.
+ */
+bool IsAlphaTested(const MaterialDescription& material);
+
 /**
  * Rescales textures to 512x512, puts opacity data into the alpha channel of the albedo map and saves the textures as pngs with '_rescaled'
  * name suffix.
@@ -90,6 +98,29 @@ bool ConvertAndDownscaleTextures(const Opal::DynamicArray<MaterialDescription>&
 bool WriteData(const Opal::DynamicArray<MaterialDescription>& materials, const Opal::DynamicArray<Opal::StringUtf8>& texture_paths,
                const Opal::StringUtf8& file_path);
 
+/**
+ * Reads the material data from a file without loading the textures. Texture maps in the material descriptions are indices into the
+ * array of texture paths.
+ * @param out_materials Destination material descriptions.
+ * @param out_texture_paths Destination texture paths. Paths are combined with the directory of the material file.
+ * @param file_path Path to the file.
+ * @return True if the material data was read successfully, false otherwise.
+ */
+bool ReadData(Opal::DynamicArray<MaterialDescription>& out_materials, Opal::DynamicArray<Opal::StringUtf8>& out_texture_paths,
+              const Opal::StringUtf8& file_path);
+
+/**
+ * Loads textures used by the materials to the GPU and replaces texture path indices in the materials with bindless handles. Each
+ * texture is loaded only once, even if it is used by multiple materials.
+ * @param in_out_materials Material descriptions whose texture maps are indices into the texture_paths array.
+ * @param out_textures Destination textures.
+ * @param texture_paths List of texture paths.
+ * @param graphics_context Graphics context used to load the textures to the GPU.
+ * @return True if all textures were loaded successfully, false otherwise.
+ */
+bool LoadTextures(Opal::DynamicArray<MaterialDescription>& in_out_materials, Opal::DynamicArray<Rndr::Texture>& out_textures,
+                  const Opal::DynamicArray<Opal::StringUtf8>& texture_paths, const Rndr::GraphicsContext& graphics_context);
+
 /**
  * Reads the material data from a file and loads textures to the GPU.
  * @param out_materials Destination material descriptions.
@@ -1,11 +1,19 @@
 #include "mesh.h"
 
+#include <algorithm>
+
+#include "opal/time.h"
+
 #include "rndr/file.h"
 #include "rndr/log.h"
 
 namespace
 {
 constexpr uint32_t k_magic = 0x89ABCDEF;
+
+/** Bit layout of the instancing group key: material in the low 32 bits, then LOD, then mesh. */
+constexpr u32 k_group_lod_shift = 32;
+constexpr u32 k_group_mesh_shift = 36;
 }
 
 bool Mesh::ReadData(MeshData& out_mesh_data, const Opal::StringUtf8& file_path)
@@ -148,8 +156,35 @@ bool Mesh::Merge(MeshData& out_mesh_data, const Opal::ArrayView<MeshData>& mesh_
         return false;
     }
 
+    // Offsets continue after the meshes that are already in the destination
     int64_t vertex_offset = 0;
     int64_t index_offset = 0;
+    for (const MeshDescription& mesh_desc : out_mesh_data.meshes)
+    {
+        vertex_offset += mesh_desc.vertex_count;
+        index_offset += mesh_desc.lod_offsets[mesh_desc.lod_count];
+    }
+
+    // Figure out the final sizes up front so that each destination array is allocated only once
+    size_t mesh_count = out_mesh_data.meshes.GetSize();
+    size_t vertex_buffer_size = out_mesh_data.vertex_buffer_data.GetSize();
+    size_t index_buffer_size = out_mesh_data.index_buffer_data.GetSize();
+    bool has_bounding_boxes = out_mesh_data.bounding_boxes.GetSize() == out_mesh_data.meshes.GetSize();
+    for (const MeshData& mesh : mesh_data)
+    {
+        mesh_count += mesh.meshes.GetSize();
+        vertex_buffer_size += mesh.vertex_buffer_data.GetSize();
+        index_buffer_size += mesh.index_buffer_data.GetSize();
+        has_bounding_boxes = has_bounding_boxes && mesh.bounding_boxes.GetSize() == mesh.meshes.GetSize();
+    }
+    out_mesh_data.meshes.Reserve(mesh_count);
+    out_mesh_data.vertex_buffer_data.Reserve(vertex_buffer_size);
+    out_mesh_data.index_buffer_data.Reserve(index_buffer_size);
+    if (has_bounding_boxes)
+    {
+        out_mesh_data.bounding_boxes.Reserve(mesh_count);
+    }
+
     for (const MeshData& mesh : mesh_data)
     {
         for (const MeshDescription& mesh_desc : mesh.meshes)
@@ -158,7 +193,9 @@ bool Mesh::Merge(MeshData& out_mesh_data, const Opal::ArrayView<MeshData>& mesh_
             new_mesh_desc.vertex_offset += vertex_offset;
             new_mesh_desc.index_offset += index_offset;
             out_mesh_data.meshes.PushBack(new_mesh_desc);
-
+        }
+        for (const MeshDescription& mesh_desc : mesh.meshes)
+        {
             vertex_offset += mesh_desc.vertex_count;
             for (int64_t i = 0; i < mesh_desc.lod_count; ++i)
             {
@@ -170,9 +207,18 @@ bool Mesh::Merge(MeshData& out_mesh_data, const Opal::ArrayView<MeshData>& mesh_
                                                 mesh.vertex_buffer_data.cend());
         out_mesh_data.index_buffer_data.Insert(out_mesh_data.index_buffer_data.cend(), mesh.index_buffer_data.cbegin(),
                                                mesh.index_buffer_data.cend());
+        if (has_bounding_boxes)
+        {
+            out_mesh_data.bounding_boxes.Insert(out_mesh_data.bounding_boxes.cend(), mesh.bounding_boxes.cbegin(),
+                                                mesh.bounding_boxes.cend());
+        }
     }
 
-    UpdateBoundingBoxes(out_mesh_data);
+    // Bounding boxes are in mesh local space so they can be copied over, recalculate them only if some are missing
+    if (!has_bounding_boxes)
+    {
+        UpdateBoundingBoxes(out_mesh_data);
+    }
 
     return true;
 }
@@ -204,6 +250,67 @@ bool Mesh::GetDrawCommands(Opal::DynamicArray<Rndr::DrawIndicesData>& out_draw_c
     return true;
 }
 
+bool Mesh::MergeInstancedDraws(InstancedDrawList& out_draw_list, const Opal::ArrayView<const u32>& shape_indices,
+                               const Opal::DynamicArray<MeshDrawData>& mesh_draw_data,
+                               const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands)
+{
+    if (draw_commands.GetSize() != mesh_draw_data.GetSize())
+    {
+        RNDR_LOG_ERROR("Mesh draw data and draw commands are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    const size_t shape_count = shape_indices.GetSize();
+    out_draw_list.sort_entries.Resize(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        const u32 shape_index = shape_indices[i];
+        const MeshDrawData& shape = mesh_draw_data[shape_index];
+        RNDR_ASSERT(shape.mesh_index >= 0 && shape.mesh_index < (1ll << (64 - k_group_mesh_shift)), "Mesh index is out of bounds");
+        RNDR_ASSERT(shape.lod >= 0 && shape.lod < MeshDescription::k_max_lods, "LOD is out of bounds");
+        RNDR_ASSERT(shape.material_index >= 0 && shape.material_index < (1ll << k_group_lod_shift), "Material index is out of bounds");
+        const u64 group_key = (static_cast<u64>(shape.mesh_index) << k_group_mesh_shift) | (static_cast<u64>(shape.lod) << k_group_lod_shift) |
+                              static_cast<u64>(shape.material_index);
+        out_draw_list.sort_entries[i] = {.group_key = group_key, .shape_index = shape_index};
+    }
+    std::sort(out_draw_list.sort_entries.begin(), out_draw_list.sort_entries.end(),
+              [](const InstancedDrawList::SortEntry& a, const InstancedDrawList::SortEntry& b)
+              { return a.group_key != b.group_key ? a.group_key < b.group_key : a.shape_index < b.shape_index; });
+
+    out_draw_list.draw_commands.Clear();
+    out_draw_list.instances.Resize(shape_count);
+    size_t group_start = 0;
+    while (group_start < shape_count)
+    {
+        const u64 group_key = out_draw_list.sort_entries[group_start].group_key;
+        size_t group_end = group_start + 1;
+        while (group_end < shape_count && out_draw_list.sort_entries[group_end].group_key == group_key)
+        {
+            ++group_end;
+        }
+
+        for (size_t i = group_start; i < group_end; ++i)
+        {
+            const u32 shape_index = out_draw_list.sort_entries[i].shape_index;
+            out_draw_list.instances[i] = {.model_index = shape_index,
+                                          .material_index = static_cast<u32>(mesh_draw_data[shape_index].material_index)};
+        }
+
+        Rndr::DrawIndicesData draw_command = draw_commands[out_draw_list.sort_entries[group_start].shape_index];
+        draw_command.instance_count = static_cast<u32>(group_end - group_start);
+        draw_command.base_instance = static_cast<u32>(group_start);
+        out_draw_list.draw_commands.PushBack(draw_command);
+        group_start = group_end;
+    }
+
+    out_draw_list.stats = {.shape_count = shape_count,
+                           .draw_count = out_draw_list.draw_commands.GetSize(),
+                           .merge_time_ms = (Opal::GetSeconds() - start_time) * 1000.0};
+    return true;
+}
+
 Rndr::ErrorCode Mesh::AddPlaneXZ(MeshData& out_mesh_data, const Point3f& center, f32 scale, MeshAttributesToLoad attributes_to_load)
 {
     const Opal::InPlaceArray<Rndr::Point3f, 4> vertices = {
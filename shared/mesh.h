@@ -104,6 +104,51 @@ struct MeshFileHeader
     size_t index_buffer_size;
 };
 
+/**
+ * Per instance data of an instanced draw. Instances of a draw command are stored contiguously starting at the command's
+ * base_instance, so the vertex shader finds its instance at gl_BaseInstance + gl_InstanceID.
+ */
+struct InstanceData
+{
+    /** Index of the shape and therefore of its ModelData. */
+    u32 model_index;
+    /** Index of the material in the materials array in SceneDrawData. */
+    u32 material_index;
+};
+
+/**
+ * Per frame instancing counters.
+ */
+struct InstancedDrawStats
+{
+    u64 shape_count = 0;
+    u64 draw_count = 0;
+    /** Time spent sorting and merging in milliseconds. */
+    f64 merge_time_ms = 0.0;
+};
+
+/**
+ * Draw commands where shapes sharing the mesh, LOD and material are merged into a single instanced command.
+ */
+struct InstancedDrawList
+{
+    /** Merged draw commands. Base instance is the offset of the command's first instance in the instances array. */
+    Opal::DynamicArray<Rndr::DrawIndicesData> draw_commands;
+
+    /** Instance data of all commands, upload to the buffer the vertex shader reads the instances from. */
+    Opal::DynamicArray<InstanceData> instances;
+
+    /** Scratch array used to group shapes, kept around to avoid allocations every frame. */
+    struct SortEntry
+    {
+        u64 group_key;
+        u32 shape_index;
+    };
+    Opal::DynamicArray<SortEntry> sort_entries;
+
+    InstancedDrawStats stats;
+};
+
 enum class MeshAttributesToLoad : u8
 {
     LoadPositions = 1 << 0,
@@ -159,6 +204,19 @@ bool Merge(MeshData& out_mesh_data, const Opal::ArrayView<MeshData>& mesh_data);
 bool GetDrawCommands(Opal::DynamicArray<Rndr::DrawIndicesData>& out_draw_commands, const Opal::DynamicArray<MeshDrawData>& mesh_draw_data,
                      const MeshData& mesh_data);
 
+/**
+ * Groups shapes by mesh, LOD and material and creates one instanced draw command per group. Shapes in a group keep their
+ * relative order.
+ * @param out_draw_list Merged draw commands, instance data and stats.
+ * @param shape_indices Shapes to draw, for example the visible shapes after culling.
+ * @param mesh_draw_data Draw data for all meshes.
+ * @param draw_commands Draw commands of all shapes as created by GetDrawCommands.
+ * @return True if draw commands were merged successfully, false otherwise.
+ */
+bool MergeInstancedDraws(InstancedDrawList& out_draw_list, const Opal::ArrayView<const u32>& shape_indices,
+                         const Opal::DynamicArray<MeshDrawData>& mesh_draw_data,
+                         const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands);
+
 Rndr::ErrorCode AddPlaneXZ(MeshData& out_mesh_data, const Rndr::Point3f& center, f32 scale, MeshAttributesToLoad attributes_to_load);
 
 }  // namespace Mesh
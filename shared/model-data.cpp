@@ -0,0 +1,283 @@
+#include "model-data.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <immintrin.h>
+
+#include "rndr/log.h"
+
+namespace
+{
+/**
+ * Dirty ranges separated by at most this many clean shapes are uploaded as one range. Re-sending a few clean matrices is
+ * cheaper than issuing another buffer update.
+ */
+constexpr u32 k_max_clean_gap = 4;
+
+/** Relative tolerance used to decide if the columns of a transform are orthogonal and of equal length. */
+constexpr f32 k_classify_epsilon = 1e-4f;
+
+enum class TransformClass : u8
+{
+    Rigid,
+    UniformScale,
+    General
+};
+
+/**
+ * Classifies the upper 3x3 of a transform. Columns hold the scaled axes so the transform is rigid or uniformly scaled if
+ * the columns are orthogonal and of equal length.
+ * @param m The transform to classify.
+ * @param out_scale_squared Squared scale if the transform is uniformly scaled.
+ */
+TransformClass Classify(const Rndr::Matrix4x4f& m, f32& out_scale_squared)
+{
+    const auto column_dot = [&m](int32_t a, int32_t b)
+    { return m.elements[0][a] * m.elements[0][b] + m.elements[1][a] * m.elements[1][b] + m.elements[2][a] * m.elements[2][b]; };
+
+    const f32 length_squared_x = column_dot(0, 0);
+    const f32 length_squared_y = column_dot(1, 1);
+    const f32 length_squared_z = column_dot(2, 2);
+    const f32 tolerance = k_classify_epsilon * length_squared_x;
+    if (std::abs(length_squared_x - length_squared_y) > tolerance || std::abs(length_squared_x - length_squared_z) > tolerance)
+    {
+        return TransformClass::General;
+    }
+    if (std::abs(column_dot(0, 1)) > tolerance || std::abs(column_dot(0, 2)) > tolerance || std::abs(column_dot(1, 2)) > tolerance)
+    {
+        return TransformClass::General;
+    }
+    if (length_squared_x == 0.0f)
+    {
+        return TransformClass::General;
+    }
+    out_scale_squared = length_squared_x;
+    return std::abs(length_squared_x - 1.0f) <= k_classify_epsilon ? TransformClass::Rigid : TransformClass::UniformScale;
+}
+
+/**
+ * Copies the upper 3x3 of the model transform multiplied by a factor. For orthogonal matrices inverse-transpose is the
+ * matrix itself divided by the squared scale.
+ */
+void ScaledUpper3x3(Rndr::Matrix4x4f& out, const Rndr::Matrix4x4f& m, f32 factor)
+{
+    for (int32_t row = 0; row < 3; ++row)
+    {
+        out.elements[row][0] = m.elements[row][0] * factor;
+        out.elements[row][1] = m.elements[row][1] * factor;
+        out.elements[row][2] = m.elements[row][2] * factor;
+        out.elements[row][3] = 0.0f;
+    }
+}
+
+__m128 Cross(__m128 a, __m128 b)
+{
+    const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+/**
+ * Inverse-transpose of the upper 3x3. With rows r0, r1 and r2 the rows of the result are r1 x r2, r2 x r0 and r0 x r1
+ * divided by the determinant, which is r0 . (r1 x r2).
+ */
+void InverseTransposeUpper3x3(Rndr::Matrix4x4f& out, const Rndr::Matrix4x4f& m)
+{
+    // Translation is stored in the last column so it has to be masked out of the rows
+    const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    const __m128 r0 = _mm_and_ps(_mm_loadu_ps(m.elements[0]), mask);
+    const __m128 r1 = _mm_and_ps(_mm_loadu_ps(m.elements[1]), mask);
+    const __m128 r2 = _mm_and_ps(_mm_loadu_ps(m.elements[2]), mask);
+
+    const __m128 c0 = Cross(r1, r2);
+    const __m128 c1 = Cross(r2, r0);
+    const __m128 c2 = Cross(r0, r1);
+
+    __m128 det = _mm_mul_ps(r0, c0);
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    _mm_storeu_ps(out.elements[0], _mm_mul_ps(c0, inv_det));
+    _mm_storeu_ps(out.elements[1], _mm_mul_ps(c1, inv_det));
+    _mm_storeu_ps(out.elements[2], _mm_mul_ps(c2, inv_det));
+}
+}  // namespace
+
+void Scene::CalculateNormalTransforms(Opal::ArrayView<ModelData> in_out_model_data, NormalTransformStats* out_stats)
+{
+    NormalTransformStats stats;
+    for (size_t i = 0; i < in_out_model_data.GetSize(); ++i)
+    {
+        const Rndr::Matrix4x4f& model = in_out_model_data[i].model_transform;
+        Rndr::Matrix4x4f& normal = in_out_model_data[i].normal_transform;
+
+        f32 scale_squared = 1.0f;
+        switch (Classify(model, scale_squared))
+        {
+            case TransformClass::Rigid:
+                ScaledUpper3x3(normal, model, 1.0f);
+                stats.rigid_count++;
+                break;
+            case TransformClass::UniformScale:
+                ScaledUpper3x3(normal, model, 1.0f / scale_squared);
+                stats.uniform_scale_count++;
+                break;
+            case TransformClass::General:
+                InverseTransposeUpper3x3(normal, model);
+                stats.general_count++;
+                break;
+        }
+        normal.elements[3][0] = 0.0f;
+        normal.elements[3][1] = 0.0f;
+        normal.elements[3][2] = 0.0f;
+        normal.elements[3][3] = 1.0f;
+    }
+
+    if (out_stats != nullptr)
+    {
+        out_stats->rigid_count += stats.rigid_count;
+        out_stats->uniform_scale_count += stats.uniform_scale_count;
+        out_stats->general_count += stats.general_count;
+    }
+}
+
+bool Scene::SetupModelDataSync(ModelDataSync& out_sync, SceneDrawData& scene, const Rndr::GraphicsContext& graphics_context,
+                               const Opal::ArrayView<const ModelData>& precomputed_model_data)
+{
+    const SceneDescription& description = scene.scene_description;
+    const size_t node_count = description.hierarchy.GetSize();
+    const size_t shape_count = scene.shapes.GetSize();
+    if (shape_count == 0)
+    {
+        RNDR_LOG_ERROR("Scene has no shapes!");
+        return false;
+    }
+
+    // Counting sort of shapes by the node they are attached to
+    out_sync.node_shape_offsets.Clear();
+    out_sync.node_shape_offsets.Resize(node_count + 1, 0);
+    for (const MeshDrawData& shape : scene.shapes)
+    {
+        out_sync.node_shape_offsets[static_cast<size_t>(shape.transform_index) + 1]++;
+    }
+    for (size_t i = 0; i < node_count; ++i)
+    {
+        out_sync.node_shape_offsets[i + 1] += out_sync.node_shape_offsets[i];
+    }
+    Opal::DynamicArray<u32> write_offsets(out_sync.node_shape_offsets);
+    out_sync.node_shapes.Resize(shape_count);
+    for (u32 shape_index = 0; shape_index < shape_count; ++shape_index)
+    {
+        const size_t node = static_cast<size_t>(scene.shapes[shape_index].transform_index);
+        out_sync.node_shapes[write_offsets[node]++] = shape_index;
+    }
+
+    out_sync.model_data.Resize(shape_count);
+    out_sync.normal_stats = {};
+    if (precomputed_model_data.GetSize() == shape_count)
+    {
+        std::copy(precomputed_model_data.GetData(), precomputed_model_data.GetData() + shape_count, out_sync.model_data.GetData());
+    }
+    else
+    {
+        for (size_t i = 0; i < shape_count; ++i)
+        {
+            out_sync.model_data[i].model_transform = description.world_transforms[scene.shapes[i].transform_index];
+        }
+        CalculateNormalTransforms(Opal::ArrayView<ModelData>(out_sync.model_data), &out_sync.normal_stats);
+    }
+    out_sync.buffer = Rndr::Buffer(graphics_context, Opal::ArrayView<const ModelData>(out_sync.model_data), Rndr::BufferType::ShaderStorage,
+                                   Rndr::Usage::Dynamic);
+    if (!out_sync.buffer.IsValid())
+    {
+        RNDR_LOG_ERROR("Failed to create model data buffer!");
+        return false;
+    }
+
+    out_sync.dirty_shapes.Clear();
+    out_sync.dirty_shapes.Reserve(shape_count);
+    scene.scene_description.changed_nodes.Clear();
+    scene.scene_description.track_changed_nodes = true;
+
+    const u64 buffer_size = shape_count * sizeof(ModelData);
+    out_sync.stats = {.shapes_updated_last_frame = shape_count,
+                      .ranges_uploaded_last_frame = 1,
+                      .bytes_uploaded_last_frame = buffer_size,
+                      .total_bytes_uploaded = buffer_size};
+    return true;
+}
+
+bool Scene::SyncModelData(ModelDataSync& sync, SceneDescription& scene, Rndr::GraphicsContext& graphics_context)
+{
+    sync.stats.shapes_updated_last_frame = 0;
+    sync.stats.ranges_uploaded_last_frame = 0;
+    sync.stats.bytes_uploaded_last_frame = 0;
+    sync.dirty_shapes.Clear();
+    if (scene.changed_nodes.IsEmpty())
+    {
+        return true;
+    }
+
+    RNDR_ASSERT(sync.node_shape_offsets.GetSize() == scene.hierarchy.GetSize() + 1, "Model data sync is out of date, set it up again");
+
+    for (const NodeId node : scene.changed_nodes)
+    {
+        if (IsRemovedNode(scene, node))
+        {
+            continue;
+        }
+        const u32 begin = sync.node_shape_offsets[static_cast<size_t>(node)];
+        const u32 end = sync.node_shape_offsets[static_cast<size_t>(node) + 1];
+        for (u32 i = begin; i < end; ++i)
+        {
+            const u32 shape_index = sync.node_shapes[i];
+            sync.model_data[shape_index].model_transform = scene.world_transforms[node];
+            sync.dirty_shapes.PushBack(shape_index);
+        }
+    }
+    scene.changed_nodes.Clear();
+    if (sync.dirty_shapes.IsEmpty())
+    {
+        return true;
+    }
+
+    // Same node can be recalculated more than once between syncs
+    std::sort(sync.dirty_shapes.begin(), sync.dirty_shapes.end());
+    auto unique_end = std::unique(sync.dirty_shapes.begin(), sync.dirty_shapes.end());
+    sync.dirty_shapes.Resize(static_cast<size_t>(unique_end - sync.dirty_shapes.begin()));
+    sync.stats.shapes_updated_last_frame = sync.dirty_shapes.GetSize();
+
+    bool is_success = true;
+    size_t range_start = 0;
+    for (size_t i = 1; i <= sync.dirty_shapes.GetSize(); ++i)
+    {
+        const bool is_range_end =
+            i == sync.dirty_shapes.GetSize() || sync.dirty_shapes[i] - sync.dirty_shapes[i - 1] > k_max_clean_gap + 1;
+        if (!is_range_end)
+        {
+            continue;
+        }
+
+        // Clean shapes inside of the range are recalculated as well since that is cheaper than skipping them
+        const u32 first_shape = sync.dirty_shapes[range_start];
+        const u32 shape_count = sync.dirty_shapes[i - 1] - first_shape + 1;
+        CalculateNormalTransforms(Opal::ArrayView<ModelData>(sync.model_data.GetData() + first_shape, shape_count), &sync.normal_stats);
+        const Opal::ArrayView<const ModelData> range(sync.model_data.GetData() + first_shape, shape_count);
+        const u64 offset = static_cast<u64>(first_shape) * sizeof(ModelData);
+        is_success &= graphics_context.UpdateBuffer(sync.buffer, Opal::AsBytes(range), static_cast<i64>(offset));
+
+        sync.stats.ranges_uploaded_last_frame++;
+        sync.stats.bytes_uploaded_last_frame += static_cast<u64>(shape_count) * sizeof(ModelData);
+        range_start = i;
+    }
+    sync.stats.total_bytes_uploaded += sync.stats.bytes_uploaded_last_frame;
+
+    if (!is_success)
+    {
+        RNDR_LOG_ERROR("Failed to update model data buffer!");
+    }
+    return is_success;
+}
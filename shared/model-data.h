@@ -0,0 +1,111 @@
+#pragma once
+
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/math.h"
+#include "rndr/render-api.h"
+
+#include "scene.h"
+
+/**
+ * Per shape data used by the shaders to transform the vertices and normals.
+ */
+struct ModelData
+{
+    Rndr::Matrix4x4f model_transform;
+    Rndr::Matrix4x4f normal_transform;
+};
+
+/**
+ * Counters describing how much model data was sent to the GPU.
+ */
+struct ModelDataUploadStats
+{
+    /** Number of shapes whose model data was recalculated in the last sync. */
+    u64 shapes_updated_last_frame = 0;
+    /** Number of buffer updates issued in the last sync. */
+    u64 ranges_uploaded_last_frame = 0;
+    /** Number of bytes sent to the GPU in the last sync. */
+    u64 bytes_uploaded_last_frame = 0;
+    /** Number of bytes sent to the GPU since the sync was set up, including the initial upload. */
+    u64 total_bytes_uploaded = 0;
+};
+
+/**
+ * Counts how many transforms took each path when calculating normal transforms.
+ */
+struct NormalTransformStats
+{
+    /** Rotation and translation only, normal transform is the upper 3x3 of the model transform. */
+    u64 rigid_count = 0;
+    /** Rotation, translation and uniform scale, normal transform is the upper 3x3 divided by the squared scale. */
+    u64 uniform_scale_count = 0;
+    /** Non-uniform scale or shear, normal transform is the full 3x3 inverse-transpose. */
+    u64 general_count = 0;
+};
+
+/**
+ * Keeps a GPU buffer of ModelData in sync with the world transforms of the scene. Only shapes attached to the nodes whose
+ * world transform changed are recalculated and uploaded.
+ */
+struct ModelDataSync
+{
+    /** GPU buffer with one ModelData per shape, in the same order as SceneDrawData::shapes. */
+    Rndr::Buffer buffer;
+
+    /** CPU copy of the buffer contents, used as the source of the partial updates. */
+    Opal::DynamicArray<ModelData> model_data;
+
+    /** For each node, range of the node_shapes array containing shapes attached to that node. Has node count + 1 entries. */
+    Opal::DynamicArray<u32> node_shape_offsets;
+
+    /** Shape indices grouped by the node they are attached to. */
+    Opal::DynamicArray<u32> node_shapes;
+
+    /** Sorted list of shapes updated by the last sync. Can be used by other systems that depend on world transforms. */
+    Opal::DynamicArray<u32> dirty_shapes;
+
+    ModelDataUploadStats stats;
+
+    /** Paths taken by normal transform calculations since the sync was set up. */
+    NormalTransformStats normal_stats;
+};
+
+namespace Scene
+{
+
+/**
+ * Calculates normal transforms from model transforms. Each transform is classified as rigid, uniformly scaled or general
+ * and only the general ones pay for the inverse. General transforms use an SSE inverse-transpose of the upper 3x3.
+ * Translation is not needed for normals so it is zero in the normal transform.
+ * @param in_out_model_data Model data with the model transforms set. Normal transforms are written in place.
+ * @param out_stats Optional stats to increment with the number of transforms that took each path.
+ */
+void CalculateNormalTransforms(Opal::ArrayView<ModelData> in_out_model_data, NormalTransformStats* out_stats = nullptr);
+
+/**
+ * Calculates model data for all the shapes and uploads it to a new GPU buffer. Consumes the list of changed nodes in the
+ * scene description since all the data is up to date after this call, and turns on tracking of changed nodes for the
+ * following syncs. Should be called again if nodes or shapes are added or removed.
+ * @param out_sync The sync object to set up.
+ * @param scene The scene with up to date world transforms.
+ * @param graphics_context Graphics context used to create the buffer.
+ * @param precomputed_model_data Optional model data of all shapes, for example baked with the scene, used instead of
+ *                               calculating it. Ignored if it doesn't have one entry per shape.
+ * @return True if the buffer was successfully created, false otherwise.
+ */
+bool SetupModelDataSync(ModelDataSync& out_sync, SceneDrawData& scene, const Rndr::GraphicsContext& graphics_context,
+                        const Opal::ArrayView<const ModelData>& precomputed_model_data = {});
+
+/**
+ * Recalculates model data of the shapes attached to the nodes whose world transforms were recalculated since the last
+ * sync and uploads it to the GPU. Neighbouring dirty shapes are uploaded with a single buffer update. Should be called
+ * after RecalculateWorldTransforms.
+ * @param sync The sync object.
+ * @param scene The scene description with the list of changed nodes. The list is cleared.
+ * @param graphics_context Graphics context used to update the buffer.
+ * @return True if all updates were successful, false otherwise.
+ */
+bool SyncModelData(ModelDataSync& sync, SceneDescription& scene, Rndr::GraphicsContext& graphics_context);
+
+}  // namespace Scene
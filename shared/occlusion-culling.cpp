@@ -0,0 +1,524 @@
+#include "occlusion-culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <limits>
+
+#include <xmmintrin.h>
+
+#include "stb_image_write.h"
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Vertices with w below this value are considered to be behind the camera. */
+constexpr f32 k_near_w = 1e-3f;
+
+struct ClipVertex
+{
+    f32 x;
+    f32 y;
+    f32 z;
+    f32 w;
+};
+
+ClipVertex TransformPoint(const Rndr::Matrix4x4f& m, const Rndr::Point3f& p)
+{
+    ClipVertex out;
+    out.x = m.elements[0][0] * p.x + m.elements[0][1] * p.y + m.elements[0][2] * p.z + m.elements[0][3];
+    out.y = m.elements[1][0] * p.x + m.elements[1][1] * p.y + m.elements[1][2] * p.z + m.elements[1][3];
+    out.z = m.elements[2][0] * p.x + m.elements[2][1] * p.y + m.elements[2][2] * p.z + m.elements[2][3];
+    out.w = m.elements[3][0] * p.x + m.elements[3][1] * p.y + m.elements[3][2] * p.z + m.elements[3][3];
+    return out;
+}
+
+/**
+ * Converts clip space triangle into the screen space edge functions and depth plane. Returns false if the triangle is
+ * degenerate or does not cover any pixel centers.
+ */
+bool SetupTriangle(OccluderTriangle& out_triangle, const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, i32 width, i32 height)
+{
+    const ClipVertex* vertices[3] = {&v0, &v1, &v2};
+    f32 x[3];
+    f32 y[3];
+    f32 inv_w[3];
+    for (i32 i = 0; i < 3; ++i)
+    {
+        inv_w[i] = 1.0f / vertices[i]->w;
+        x[i] = (vertices[i]->x * inv_w[i] * 0.5f + 0.5f) * static_cast<f32>(width);
+        y[i] = (0.5f - vertices[i]->y * inv_w[i] * 0.5f) * static_cast<f32>(height);
+    }
+
+    const f32 area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (std::abs(area) < 1e-8f)
+    {
+        return false;
+    }
+
+    // Occluders are rasterized regardless of the winding, so flip the edges to keep the inside positive.
+    const f32 sign = area > 0.0f ? 1.0f : -1.0f;
+    for (i32 i = 0; i < 3; ++i)
+    {
+        const i32 a = (i + 1) % 3;
+        const i32 b = (i + 2) % 3;
+        out_triangle.edge_a[i] = sign * (y[a] - y[b]);
+        out_triangle.edge_b[i] = sign * (x[b] - x[a]);
+        out_triangle.edge_c[i] = sign * (x[a] * y[b] - x[b] * y[a]);
+    }
+
+    // Solve inverse w as a plane over the screen: inv_w = a * x + b * y + c.
+    const f32 inv_area = 1.0f / area;
+    const f32 dw1 = inv_w[1] - inv_w[0];
+    const f32 dw2 = inv_w[2] - inv_w[0];
+    out_triangle.inv_w_a = (dw1 * (y[2] - y[0]) - dw2 * (y[1] - y[0])) * inv_area;
+    out_triangle.inv_w_b = (dw2 * (x[1] - x[0]) - dw1 * (x[2] - x[0])) * inv_area;
+    out_triangle.inv_w_c = inv_w[0] - out_triangle.inv_w_a * x[0] - out_triangle.inv_w_b * y[0];
+
+    const f32 min_x = std::min({x[0], x[1], x[2]});
+    const f32 max_x = std::max({x[0], x[1], x[2]});
+    const f32 min_y = std::min({y[0], y[1], y[2]});
+    const f32 max_y = std::max({y[0], y[1], y[2]});
+    out_triangle.min_x = std::max(0, static_cast<i32>(std::floor(min_x)));
+    out_triangle.min_y = std::max(0, static_cast<i32>(std::floor(min_y)));
+    out_triangle.max_x = std::min(width - 1, static_cast<i32>(std::ceil(max_x)));
+    out_triangle.max_y = std::min(height - 1, static_cast<i32>(std::ceil(max_y)));
+    return out_triangle.min_x <= out_triangle.max_x && out_triangle.min_y <= out_triangle.max_y;
+}
+
+/**
+ * Clips the triangle against the w = k_near_w plane and sets up the resulting one or two triangles.
+ */
+void ClipAndSetupTriangle(Opal::DynamicArray<OccluderTriangle>& out_triangles, const ClipVertex (&triangle)[3], i32 width, i32 height)
+{
+    ClipVertex polygon[4];
+    i32 vertex_count = 0;
+    for (i32 i = 0; i < 3; ++i)
+    {
+        const ClipVertex& current = triangle[i];
+        const ClipVertex& next = triangle[(i + 1) % 3];
+        const bool is_current_inside = current.w >= k_near_w;
+        const bool is_next_inside = next.w >= k_near_w;
+        if (is_current_inside)
+        {
+            polygon[vertex_count++] = current;
+        }
+        if (is_current_inside != is_next_inside)
+        {
+            const f32 t = (k_near_w - current.w) / (next.w - current.w);
+            polygon[vertex_count++] = {current.x + t * (next.x - current.x), current.y + t * (next.y - current.y),
+                                       current.z + t * (next.z - current.z), k_near_w};
+        }
+    }
+
+    for (i32 i = 2; i < vertex_count; ++i)
+    {
+        OccluderTriangle setup;
+        if (SetupTriangle(setup, polygon[0], polygon[i - 1], polygon[i], width, height))
+        {
+            out_triangles.PushBack(setup);
+        }
+    }
+}
+
+/**
+ * Rasterizes all triangles binned to a tile, keeping the closest depth in each pixel. Four pixels of a row are processed
+ * at once.
+ */
+void RasterizeTile(OcclusionBuffer& buffer, i32 tile_index)
+{
+    const i32 width = buffer.level_widths[0];
+    const i32 tiles_x = width / OcclusionBuffer::k_tile_width;
+    const i32 tile_min_x = (tile_index % tiles_x) * OcclusionBuffer::k_tile_width;
+    const i32 tile_min_y = (tile_index / tiles_x) * OcclusionBuffer::k_tile_height;
+    const i32 tile_max_x = tile_min_x + OcclusionBuffer::k_tile_width - 1;
+    const i32 tile_max_y = tile_min_y + OcclusionBuffer::k_tile_height - 1;
+    f32* depth = buffer.levels[0].GetData();
+
+    const __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    for (const u32 triangle_index : buffer.tile_triangles[tile_index])
+    {
+        const OccluderTriangle& triangle = buffer.triangles[triangle_index];
+        // Start at the multiple of four so that the loads stay inside of the tile.
+        const i32 min_x = std::max(tile_min_x, triangle.min_x) & ~3;
+        const i32 max_x = std::min(tile_max_x, triangle.max_x);
+        const i32 min_y = std::max(tile_min_y, triangle.min_y);
+        const i32 max_y = std::min(tile_max_y, triangle.max_y);
+
+        const __m128 edge_a[3] = {_mm_set1_ps(triangle.edge_a[0]), _mm_set1_ps(triangle.edge_a[1]), _mm_set1_ps(triangle.edge_a[2])};
+        const __m128 inv_w_a = _mm_set1_ps(triangle.inv_w_a);
+        for (i32 y = min_y; y <= max_y; ++y)
+        {
+            const f32 pixel_y = static_cast<f32>(y) + 0.5f;
+            __m128 edge_row[3];
+            for (i32 e = 0; e < 3; ++e)
+            {
+                edge_row[e] = _mm_set1_ps(triangle.edge_b[e] * pixel_y + triangle.edge_c[e]);
+            }
+            const __m128 inv_w_row = _mm_set1_ps(triangle.inv_w_b * pixel_y + triangle.inv_w_c);
+
+            f32* row = depth + static_cast<size_t>(y) * width;
+            for (i32 x = min_x; x <= max_x; x += 4)
+            {
+                const __m128 pixel_x = _mm_add_ps(_mm_set1_ps(static_cast<f32>(x)), lane_offsets);
+                const __m128 e0 = _mm_add_ps(_mm_mul_ps(edge_a[0], pixel_x), edge_row[0]);
+                const __m128 e1 = _mm_add_ps(_mm_mul_ps(edge_a[1], pixel_x), edge_row[1]);
+                const __m128 e2 = _mm_add_ps(_mm_mul_ps(edge_a[2], pixel_x), edge_row[2]);
+                const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+                if (_mm_movemask_ps(inside) == 0)
+                {
+                    continue;
+                }
+                const __m128 inv_w = _mm_add_ps(_mm_mul_ps(inv_w_a, pixel_x), inv_w_row);
+                const __m128 old_depth = _mm_loadu_ps(row + x);
+                const __m128 new_depth = _mm_max_ps(old_depth, _mm_and_ps(inside, inv_w));
+                _mm_storeu_ps(row + x, new_depth);
+            }
+        }
+    }
+}
+
+void BuildHierarchy(OcclusionBuffer& buffer)
+{
+    for (size_t level = 1; level < buffer.levels.GetSize(); ++level)
+    {
+        const i32 src_width = buffer.level_widths[level - 1];
+        const i32 src_height = buffer.level_heights[level - 1];
+        const i32 dst_width = buffer.level_widths[level];
+        const i32 dst_height = buffer.level_heights[level];
+        const f32* src = buffer.levels[level - 1].GetData();
+        f32* dst = buffer.levels[level].GetData();
+        for (i32 y = 0; y < dst_height; ++y)
+        {
+            // Odd sized levels fold the last row and column into the last texel so no occluder depth is skipped.
+            const i32 y0 = 2 * y;
+            const i32 y1 = y == dst_height - 1 ? src_height - 1 : 2 * y + 1;
+            for (i32 x = 0; x < dst_width; ++x)
+            {
+                const i32 x0 = 2 * x;
+                const i32 x1 = x == dst_width - 1 ? src_width - 1 : 2 * x + 1;
+                f32 min_depth = std::numeric_limits<f32>::max();
+                for (i32 sy = y0; sy <= y1; ++sy)
+                {
+                    for (i32 sx = x0; sx <= x1; ++sx)
+                    {
+                        min_depth = std::min(min_depth, src[static_cast<size_t>(sy) * src_width + sx]);
+                    }
+                }
+                dst[static_cast<size_t>(y) * dst_width + x] = min_depth;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+bool Culling::SetupOcclusionBuffer(OcclusionBuffer& out_buffer, const OcclusionBufferDesc& desc)
+{
+    if (desc.width <= 0 || desc.height <= 0)
+    {
+        RNDR_LOG_ERROR("SetupOcclusionBuffer: Invalid size %dx%d!", desc.width, desc.height);
+        return false;
+    }
+
+    out_buffer = {};
+    out_buffer.desc = desc;
+    out_buffer.desc.width = (desc.width + OcclusionBuffer::k_tile_width - 1) / OcclusionBuffer::k_tile_width * OcclusionBuffer::k_tile_width;
+    out_buffer.desc.height =
+        (desc.height + OcclusionBuffer::k_tile_height - 1) / OcclusionBuffer::k_tile_height * OcclusionBuffer::k_tile_height;
+
+    i32 width = out_buffer.desc.width;
+    i32 height = out_buffer.desc.height;
+    while (true)
+    {
+        out_buffer.levels.PushBack(Opal::DynamicArray<f32>(static_cast<size_t>(width) * height, 0.0f));
+        out_buffer.level_widths.PushBack(width);
+        out_buffer.level_heights.PushBack(height);
+        if (width == 1 && height == 1)
+        {
+            break;
+        }
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    const i32 tile_count = (out_buffer.desc.width / OcclusionBuffer::k_tile_width) * (out_buffer.desc.height / OcclusionBuffer::k_tile_height);
+    out_buffer.tile_triangles.Resize(tile_count);
+    return true;
+}
+
+bool Culling::SelectOccluders(OcclusionBuffer& in_out_buffer, const SceneDrawData& scene, const ShapeBounds& bounds)
+{
+    const size_t shape_count = scene.shapes.GetSize();
+    if (bounds.center_x.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("SelectOccluders: Shape bounds and shapes are out of sync!");
+        return false;
+    }
+
+    Opal::DynamicArray<u32> candidates;
+    candidates.Reserve(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        const MeshDrawData& shape = scene.shapes[i];
+        if (Scene::IsDynamicNode(scene.scene_description, static_cast<Scene::NodeId>(shape.transform_index)))
+        {
+            continue;
+        }
+        if (shape.material_index >= 0 && static_cast<size_t>(shape.material_index) < scene.materials.GetSize())
+        {
+            // Transparent and alpha tested surfaces have holes in them so they can't hide anything.
+            const MaterialDescription& material = scene.materials[shape.material_index];
+            if (!!(material.flags & MaterialFlags::Transparent) || Material::IsAlphaTested(material))
+            {
+                continue;
+            }
+        }
+        candidates.PushBack(static_cast<u32>(i));
+    }
+
+    const auto surface_area = [&bounds](u32 i)
+    { return bounds.extent_x[i] * bounds.extent_y[i] + bounds.extent_y[i] * bounds.extent_z[i] + bounds.extent_z[i] * bounds.extent_x[i]; };
+    std::sort(candidates.begin(), candidates.end(), [&surface_area](u32 a, u32 b) { return surface_area(a) > surface_area(b); });
+
+    in_out_buffer.occluders.Clear();
+    in_out_buffer.occluder_positions.Clear();
+    const u32* indices = reinterpret_cast<const u32*>(scene.mesh_data.index_buffer_data.GetData());
+    const u8* vertices = scene.mesh_data.vertex_buffer_data.GetData();
+    u64 triangle_count = 0;
+    for (const u32 shape_index : candidates)
+    {
+        if (in_out_buffer.occluders.GetSize() >= static_cast<size_t>(in_out_buffer.desc.max_occluder_count))
+        {
+            break;
+        }
+
+        const MeshDrawData& shape = scene.shapes[shape_index];
+        const MeshDescription& mesh = scene.mesh_data.meshes[shape.mesh_index];
+        // Coarser LODs can stick out of the rendered surface and hide shapes that are visible, so only the full detail
+        // mesh is conservative.
+        constexpr i64 lod = 0;
+        if (mesh.lod_count <= 0)
+        {
+            continue;
+        }
+        const i64 index_count = mesh.GetLodIndicesCount(lod);
+        const u64 shape_triangle_count = static_cast<u64>(index_count / 3);
+        if (shape_triangle_count == 0 || triangle_count + shape_triangle_count > in_out_buffer.desc.max_occluder_triangle_count)
+        {
+            continue;
+        }
+
+        Occluder occluder;
+        occluder.transform_index = shape.transform_index;
+        occluder.first_triangle = static_cast<u32>(triangle_count);
+        occluder.triangle_count = static_cast<u32>(shape_triangle_count);
+        const u32* lod_indices = indices + mesh.index_offset + mesh.lod_offsets[lod];
+        for (i64 i = 0; i < static_cast<i64>(shape_triangle_count) * 3; ++i)
+        {
+            const f32* position = reinterpret_cast<const f32*>(vertices + (mesh.vertex_offset + lod_indices[i]) * mesh.vertex_size);
+            in_out_buffer.occluder_positions.PushBack(Rndr::Point3f(position[0], position[1], position[2]));
+        }
+        in_out_buffer.occluders.PushBack(occluder);
+        triangle_count += shape_triangle_count;
+    }
+
+    in_out_buffer.stats.occluder_count = in_out_buffer.occluders.GetSize();
+    in_out_buffer.stats.occluder_triangle_count = triangle_count;
+    RNDR_LOG_INFO("SelectOccluders: Picked %llu occluders with %llu triangles out of %llu candidates", in_out_buffer.stats.occluder_count,
+                  triangle_count, static_cast<u64>(candidates.GetSize()));
+    return true;
+}
+
+void Culling::RasterizeOccluders(OcclusionBuffer& in_out_buffer, const SceneDescription& scene, const Rndr::Matrix4x4f& clip_from_world)
+{
+    const f64 start_time = Opal::GetSeconds();
+    const i32 width = in_out_buffer.desc.width;
+    const i32 height = in_out_buffer.desc.height;
+
+    in_out_buffer.triangles.Clear();
+    for (const Occluder& occluder : in_out_buffer.occluders)
+    {
+        const Rndr::Matrix4x4f clip_from_object = clip_from_world * scene.world_transforms[occluder.transform_index];
+        const Rndr::Point3f* positions = in_out_buffer.occluder_positions.GetData() + static_cast<size_t>(occluder.first_triangle) * 3;
+        for (u32 i = 0; i < occluder.triangle_count; ++i)
+        {
+            const ClipVertex triangle[3] = {TransformPoint(clip_from_object, positions[3 * i]),
+                                            TransformPoint(clip_from_object, positions[3 * i + 1]),
+                                            TransformPoint(clip_from_object, positions[3 * i + 2])};
+            if (triangle[0].w < k_near_w && triangle[1].w < k_near_w && triangle[2].w < k_near_w)
+            {
+                continue;
+            }
+            if (triangle[0].w >= k_near_w && triangle[1].w >= k_near_w && triangle[2].w >= k_near_w)
+            {
+                OccluderTriangle setup;
+                if (SetupTriangle(setup, triangle[0], triangle[1], triangle[2], width, height))
+                {
+                    in_out_buffer.triangles.PushBack(setup);
+                }
+                continue;
+            }
+            ClipAndSetupTriangle(in_out_buffer.triangles, triangle, width, height);
+        }
+    }
+
+    const i32 tiles_x = width / OcclusionBuffer::k_tile_width;
+    for (Opal::DynamicArray<u32>& bin : in_out_buffer.tile_triangles)
+    {
+        bin.Clear();
+    }
+    for (size_t i = 0; i < in_out_buffer.triangles.GetSize(); ++i)
+    {
+        const OccluderTriangle& triangle = in_out_buffer.triangles[i];
+        for (i32 ty = triangle.min_y / OcclusionBuffer::k_tile_height; ty <= triangle.max_y / OcclusionBuffer::k_tile_height; ++ty)
+        {
+            for (i32 tx = triangle.min_x / OcclusionBuffer::k_tile_width; tx <= triangle.max_x / OcclusionBuffer::k_tile_width; ++tx)
+            {
+                in_out_buffer.tile_triangles[ty * tiles_x + tx].PushBack(static_cast<u32>(i));
+            }
+        }
+    }
+
+    Opal::DynamicArray<f32>& depth = in_out_buffer.levels[0];
+    std::fill(depth.begin(), depth.end(), 0.0f);
+    Opal::DynamicArray<i32> tiles(in_out_buffer.tile_triangles.GetSize());
+    for (size_t i = 0; i < tiles.GetSize(); ++i)
+    {
+        tiles[i] = static_cast<i32>(i);
+    }
+    std::for_each(std::execution::par, tiles.begin(), tiles.end(), [&in_out_buffer](i32 tile) { RasterizeTile(in_out_buffer, tile); });
+    BuildHierarchy(in_out_buffer);
+
+    in_out_buffer.stats.rasterized_triangle_count = in_out_buffer.triangles.GetSize();
+    in_out_buffer.stats.rasterize_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+}
+
+bool Culling::IsOccluded(const OcclusionBuffer& buffer, const Rndr::Matrix4x4f& clip_from_world, const f32 center[3], const f32 extent[3])
+{
+    const f32 width = static_cast<f32>(buffer.desc.width);
+    const f32 height = static_cast<f32>(buffer.desc.height);
+    f32 min_x = std::numeric_limits<f32>::max();
+    f32 min_y = std::numeric_limits<f32>::max();
+    f32 max_x = std::numeric_limits<f32>::lowest();
+    f32 max_y = std::numeric_limits<f32>::lowest();
+    f32 max_inv_w = 0.0f;
+    for (i32 corner = 0; corner < 8; ++corner)
+    {
+        const Rndr::Point3f point(center[0] + ((corner & 1) != 0 ? extent[0] : -extent[0]),
+                                  center[1] + ((corner & 2) != 0 ? extent[1] : -extent[1]),
+                                  center[2] + ((corner & 4) != 0 ? extent[2] : -extent[2]));
+        const ClipVertex clip = TransformPoint(clip_from_world, point);
+        if (clip.w < k_near_w)
+        {
+            // The box crosses the camera plane so it can't be hidden.
+            return false;
+        }
+        const f32 inv_w = 1.0f / clip.w;
+        const f32 x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+        const f32 y = (0.5f - clip.y * inv_w * 0.5f) * height;
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        max_inv_w = std::max(max_inv_w, inv_w);
+    }
+
+    const i32 pixel_min_x = std::max(0, static_cast<i32>(std::floor(min_x)));
+    const i32 pixel_min_y = std::max(0, static_cast<i32>(std::floor(min_y)));
+    const i32 pixel_max_x = std::min(buffer.desc.width - 1, static_cast<i32>(std::floor(max_x)));
+    const i32 pixel_max_y = std::min(buffer.desc.height - 1, static_cast<i32>(std::floor(max_y)));
+    if (pixel_min_x > pixel_max_x || pixel_min_y > pixel_max_y)
+    {
+        // Off screen boxes are left to the frustum culling.
+        return false;
+    }
+
+    // Pick the level where the rectangle covers at most a few texels.
+    const i32 size = std::max(pixel_max_x - pixel_min_x, pixel_max_y - pixel_min_y) + 1;
+    i32 level = 0;
+    while ((size >> level) > 2 && level + 1 < static_cast<i32>(buffer.levels.GetSize()))
+    {
+        ++level;
+    }
+
+    const i32 level_width = buffer.level_widths[level];
+    const i32 level_height = buffer.level_heights[level];
+    const f32* depth = buffer.levels[level].GetData();
+    const i32 texel_max_x = std::min(level_width - 1, pixel_max_x >> level);
+    const i32 texel_max_y = std::min(level_height - 1, pixel_max_y >> level);
+    for (i32 y = std::min(level_height - 1, pixel_min_y >> level); y <= texel_max_y; ++y)
+    {
+        for (i32 x = std::min(level_width - 1, pixel_min_x >> level); x <= texel_max_x; ++x)
+        {
+            if (max_inv_w >= depth[static_cast<size_t>(y) * level_width + x])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Culling::CullOccluded(CullingResult& in_out_result, OcclusionBuffer& buffer, const Rndr::Matrix4x4f& clip_from_world,
+                           const ShapeBounds& bounds)
+{
+    const f64 start_time = Opal::GetSeconds();
+
+    const size_t visible_count = in_out_result.model_indices.GetSize();
+    size_t kept_count = 0;
+    for (size_t i = 0; i < visible_count; ++i)
+    {
+        const u32 shape_index = in_out_result.model_indices[i];
+        const f32 center[3] = {bounds.center_x[shape_index], bounds.center_y[shape_index], bounds.center_z[shape_index]};
+        const f32 extent[3] = {bounds.extent_x[shape_index], bounds.extent_y[shape_index], bounds.extent_z[shape_index]};
+        if (IsOccluded(buffer, clip_from_world, center, extent))
+        {
+            if (shape_index < in_out_result.visibility.GetSize())
+            {
+                in_out_result.visibility[shape_index] = 0;
+            }
+            continue;
+        }
+        in_out_result.draw_commands[kept_count] = in_out_result.draw_commands[i];
+        in_out_result.model_indices[kept_count] = shape_index;
+        ++kept_count;
+    }
+    in_out_result.draw_commands.Resize(kept_count);
+    in_out_result.model_indices.Resize(kept_count);
+
+    buffer.stats.tested_count = visible_count;
+    buffer.stats.occluded_count = visible_count - kept_count;
+    buffer.stats.test_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    in_out_result.stats.visible_count = kept_count;
+    in_out_result.stats.culled_count = in_out_result.stats.total_count - kept_count;
+}
+
+bool Culling::WriteOcclusionDebugImage(const OcclusionBuffer& buffer, const Opal::StringUtf8& file_path)
+{
+    const Opal::DynamicArray<f32>& depth = buffer.levels[0];
+    f32 max_depth = 0.0f;
+    for (const f32 value : depth)
+    {
+        max_depth = std::max(max_depth, value);
+    }
+
+    // Inverse w falls off quickly with the distance so square root is used to spread out the far values.
+    Opal::DynamicArray<u8> pixels(depth.GetSize());
+    const f32 scale = max_depth > 0.0f ? 1.0f / max_depth : 0.0f;
+    for (size_t i = 0; i < depth.GetSize(); ++i)
+    {
+        pixels[i] = static_cast<u8>(std::sqrt(depth[i] * scale) * 255.0f + 0.5f);
+    }
+
+    if (stbi_write_png(file_path.GetData(), buffer.desc.width, buffer.desc.height, 1, pixels.GetData(), buffer.desc.width) == 0)
+    {
+        RNDR_LOG_ERROR("WriteOcclusionDebugImage: Failed to write [%s]!", file_path.GetData());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "opal/container/dynamic-array.h"
+#include "opal/container/string.h"
+
+#include "rndr/math.h"
+
+#include "culling.h"
+
+/**
+ * Configuration of the software occlusion culling.
+ */
+struct OcclusionBufferDesc
+{
+    /** Width of the depth buffer in pixels. Rounded up to a multiple of OcclusionBuffer::k_tile_width. */
+    i32 width = 256;
+
+    /** Height of the depth buffer in pixels. Rounded up to a multiple of OcclusionBuffer::k_tile_height. */
+    i32 height = 128;
+
+    /** Maximum number of shapes used as occluders. */
+    i32 max_occluder_count = 64;
+
+    /** Maximum number of triangles of all occluders combined. */
+    u64 max_occluder_triangle_count = 100'000;
+};
+
+/**
+ * Per frame occlusion culling counters.
+ */
+struct OcclusionStats
+{
+    u64 occluder_count = 0;
+    u64 occluder_triangle_count = 0;
+    /** Number of occluder triangles that ended up on the screen in the last frame. */
+    u64 rasterized_triangle_count = 0;
+    u64 tested_count = 0;
+    u64 occluded_count = 0;
+    f64 rasterize_time_ms = 0.0;
+    f64 test_time_ms = 0.0;
+};
+
+/**
+ * Shape used as an occluder. Its triangles are stored in object space in OcclusionBuffer::occluder_positions.
+ */
+struct Occluder
+{
+    i64 transform_index = 0;
+    u32 first_triangle = 0;
+    u32 triangle_count = 0;
+};
+
+/**
+ * Triangle prepared for rasterization. Edge functions are positive inside of the triangle and inverse w is interpolated
+ * linearly in screen space.
+ */
+struct OccluderTriangle
+{
+    f32 edge_a[3];
+    f32 edge_b[3];
+    f32 edge_c[3];
+    f32 inv_w_a;
+    f32 inv_w_b;
+    f32 inv_w_c;
+    i32 min_x;
+    i32 min_y;
+    i32 max_x;
+    i32 max_y;
+};
+
+/**
+ * Low resolution depth buffer, and a hierarchy built from it, filled on the CPU with occluder triangles. Depth is stored as
+ * 1 / w so closer surfaces have larger values and the cleared value of 0 is infinitely far away. Each level of the
+ * hierarchy stores the smallest value, that is the farthest occluder, of the 2x2 pixels below it.
+ */
+struct OcclusionBuffer
+{
+    static constexpr i32 k_tile_width = 32;
+    static constexpr i32 k_tile_height = 16;
+
+    OcclusionBufferDesc desc;
+
+    /** Level 0 is the full resolution depth buffer. */
+    Opal::DynamicArray<Opal::DynamicArray<f32>> levels;
+    Opal::DynamicArray<i32> level_widths;
+    Opal::DynamicArray<i32> level_heights;
+
+    Opal::DynamicArray<Occluder> occluders;
+
+    /** Object space positions of occluder triangles, three points per triangle. */
+    Opal::DynamicArray<Rndr::Point3f> occluder_positions;
+
+    /** Scratch arrays used during rasterization. */
+    Opal::DynamicArray<OccluderTriangle> triangles;
+    Opal::DynamicArray<Opal::DynamicArray<u32>> tile_triangles;
+
+    OcclusionStats stats;
+};
+
+namespace Culling
+{
+
+/**
+ * Prepares the depth buffer and its hierarchy.
+ * @param out_buffer The occlusion buffer to set up.
+ * @param desc The configuration.
+ * @return True if the configuration is valid, false otherwise.
+ */
+bool SetupOcclusionBuffer(OcclusionBuffer& out_buffer, const OcclusionBufferDesc& desc);
+
+/**
+ * Picks occluders among the static, opaque shapes with the largest world bounds and copies the triangles of their most
+ * detailed LOD. Should be called again if the static shapes change.
+ * @param in_out_buffer The occlusion buffer to store the occluders in.
+ * @param scene The scene to pick the occluders from. Mesh data must contain vertex positions at the start of each vertex.
+ * @param bounds World space bounds of the shapes.
+ * @return True if occluders were picked, false if the scene data is not valid.
+ */
+bool SelectOccluders(OcclusionBuffer& in_out_buffer, const SceneDrawData& scene, const ShapeBounds& bounds);
+
+/**
+ * Clears the depth buffer, rasterizes all occluders and builds the depth hierarchy. Screen is split into tiles which are
+ * rasterized in parallel, four pixels at a time.
+ * @param in_out_buffer The occlusion buffer.
+ * @param scene The scene description with up to date world transforms.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space.
+ */
+void RasterizeOccluders(OcclusionBuffer& in_out_buffer, const SceneDescription& scene, const Rndr::Matrix4x4f& clip_from_world);
+
+/**
+ * Tests if a world space box is hidden behind the occluders.
+ * @param buffer The occlusion buffer with rasterized occluders.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space.
+ * @param center World space center of the box.
+ * @param extent World space half extent of the box.
+ * @return True if the box is fully hidden, false otherwise.
+ */
+bool IsOccluded(const OcclusionBuffer& buffer, const Rndr::Matrix4x4f& clip_from_world, const f32 center[3], const f32 extent[3]);
+
+/**
+ * Removes occluded shapes from the result of the frustum culling.
+ * @param in_out_result Result of the frustum culling. Draw commands, model indices and stats are updated.
+ * @param buffer The occlusion buffer with rasterized occluders. Stats are updated.
+ * @param clip_from_world Matrix that transforms world space positions to the clip space.
+ * @param bounds World space bounds of the shapes.
+ */
+void CullOccluded(CullingResult& in_out_result, OcclusionBuffer& buffer, const Rndr::Matrix4x4f& clip_from_world, const ShapeBounds& bounds);
+
+/**
+ * Writes the depth buffer to a grayscale PNG image. Closer surfaces are brighter.
+ * @param buffer The occlusion buffer.
+ * @param file_path Path to the output image.
+ * @return True if the image was written, false otherwise.
+ */
+bool WriteOcclusionDebugImage(const OcclusionBuffer& buffer, const Opal::StringUtf8& file_path);
+
+}  // namespace Culling
@@ -0,0 +1,232 @@
+#include "render-backend.h"
+
+#include <algorithm>
+
+#include "glad/glad.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+constexpr GLbitfield k_map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+/** How long a single wait on a fence can block before it is retried, in nanoseconds. */
+constexpr GLuint64 k_fence_wait_timeout = 1'000'000;
+
+GLenum ToGLPrimitive(Rndr::PrimitiveTopology topology)
+{
+    switch (topology)
+    {
+        case Rndr::PrimitiveTopology::Triangle:
+            return GL_TRIANGLES;
+        default:
+            return 0;
+    }
+}
+
+GLenum ToGLQueryTarget(QueryType type)
+{
+    switch (type)
+    {
+        case QueryType::FragmentShaderInvocations:
+            return GL_FRAGMENT_SHADER_INVOCATIONS;
+    }
+    return 0;
+}
+}  // namespace
+
+bool RenderBackend::IsDrawCountSupported([[maybe_unused]] const Rndr::GraphicsContext& graphics_context)
+{
+    return GLAD_GL_VERSION_4_6 != 0;
+}
+
+bool RenderBackend::ClearBuffer([[maybe_unused]] Rndr::GraphicsContext& graphics_context, const Rndr::Buffer& buffer)
+{
+    if (!buffer.IsValid())
+    {
+        RNDR_LOG_ERROR("ClearBuffer: Buffer is not valid!");
+        return false;
+    }
+    glClearNamedBufferData(buffer.GetNativeBuffer(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    return true;
+}
+
+void RenderBackend::InsertBarrier([[maybe_unused]] Rndr::GraphicsContext& graphics_context, BarrierFlags flags)
+{
+    GLbitfield barriers = 0;
+    if (!!(flags & BarrierFlags::ShaderStorage))
+    {
+        barriers |= GL_SHADER_STORAGE_BARRIER_BIT;
+    }
+    if (!!(flags & BarrierFlags::IndirectCommands))
+    {
+        barriers |= GL_COMMAND_BARRIER_BIT;
+    }
+    if (barriers != 0)
+    {
+        glMemoryBarrier(barriers);
+    }
+}
+
+bool RenderBackend::DrawIndicesIndirect(Rndr::GraphicsContext& graphics_context, Rndr::PrimitiveTopology topology,
+                                        const Rndr::Buffer& draw_commands, u32 max_draw_count, const Rndr::Buffer* draw_count)
+{
+    if (max_draw_count == 0)
+    {
+        return false;
+    }
+    const GLenum primitive = ToGLPrimitive(topology);
+    if (primitive == 0)
+    {
+        RNDR_LOG_ERROR("DrawIndicesIndirect: Unsupported primitive topology!");
+        return false;
+    }
+    if (draw_count != nullptr && !IsDrawCountSupported(graphics_context))
+    {
+        RNDR_LOG_ERROR("DrawIndicesIndirect: Draw count buffers require OpenGL 4.6!");
+        return false;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_commands.GetNativeBuffer());
+    if (draw_count != nullptr)
+    {
+        glBindBuffer(GL_PARAMETER_BUFFER, draw_count->GetNativeBuffer());
+        glMultiDrawElementsIndirectCount(primitive, GL_UNSIGNED_INT, nullptr, 0, static_cast<GLsizei>(max_draw_count), 0);
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    }
+    else
+    {
+        glMultiDrawElementsIndirect(primitive, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(max_draw_count), 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return true;
+}
+
+bool RenderBackend::IsQuerySupported([[maybe_unused]] const Rndr::GraphicsContext& graphics_context, QueryType type)
+{
+    switch (type)
+    {
+        case QueryType::FragmentShaderInvocations:
+            return GLAD_GL_VERSION_4_6 != 0;
+    }
+    return false;
+}
+
+bool RenderBackend::CreateQueries(Rndr::GraphicsContext& graphics_context, QueryType type, Opal::ArrayView<u32> out_queries)
+{
+    if (!IsQuerySupported(graphics_context, type))
+    {
+        return false;
+    }
+    glCreateQueries(ToGLQueryTarget(type), static_cast<GLsizei>(out_queries.GetSize()), out_queries.GetData());
+    return true;
+}
+
+void RenderBackend::DestroyQueries([[maybe_unused]] Rndr::GraphicsContext& graphics_context, const Opal::ArrayView<const u32>& queries)
+{
+    glDeleteQueries(static_cast<GLsizei>(queries.GetSize()), queries.GetData());
+}
+
+void RenderBackend::BeginQuery([[maybe_unused]] Rndr::GraphicsContext& graphics_context, QueryType type, u32 query)
+{
+    glBeginQuery(ToGLQueryTarget(type), query);
+}
+
+void RenderBackend::EndQuery([[maybe_unused]] Rndr::GraphicsContext& graphics_context, QueryType type)
+{
+    glEndQuery(ToGLQueryTarget(type));
+}
+
+bool RenderBackend::IsQueryResultAvailable([[maybe_unused]] Rndr::GraphicsContext& graphics_context, u32 query)
+{
+    GLint is_available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &is_available);
+    return is_available != 0;
+}
+
+u64 RenderBackend::ReadQueryResult([[maybe_unused]] Rndr::GraphicsContext& graphics_context, u32 query)
+{
+    GLuint64 result = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result);
+    return static_cast<u64>(result);
+}
+
+size_t RenderBackend::GetBufferOffsetAlignment([[maybe_unused]] const Rndr::GraphicsContext& graphics_context)
+{
+    GLint uniform_alignment = 0;
+    GLint storage_alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+    return static_cast<size_t>(std::max({uniform_alignment, storage_alignment, 16}));
+}
+
+u8* RenderBackend::CreateMappedBuffer([[maybe_unused]] Rndr::GraphicsContext& graphics_context, size_t size, u32& out_buffer)
+{
+    out_buffer = 0;
+    if (GLAD_GL_VERSION_4_5 == 0)
+    {
+        RNDR_LOG_ERROR("CreateMappedBuffer: Persistently mapped buffers with direct state access require OpenGL 4.5!");
+        return nullptr;
+    }
+    glCreateBuffers(1, &out_buffer);
+    glNamedBufferStorage(out_buffer, static_cast<GLsizeiptr>(size), nullptr, k_map_flags);
+    u8* mapped_data = static_cast<u8*>(glMapNamedBufferRange(out_buffer, 0, static_cast<GLsizeiptr>(size), k_map_flags));
+    if (mapped_data == nullptr)
+    {
+        RNDR_LOG_ERROR("CreateMappedBuffer: Failed to map the buffer!");
+        glDeleteBuffers(1, &out_buffer);
+        out_buffer = 0;
+    }
+    return mapped_data;
+}
+
+void RenderBackend::DestroyMappedBuffer([[maybe_unused]] Rndr::GraphicsContext& graphics_context, u32 buffer)
+{
+    if (buffer == 0)
+    {
+        return;
+    }
+    glUnmapNamedBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+}
+
+bool RenderBackend::BindBufferRange([[maybe_unused]] Rndr::GraphicsContext& graphics_context, Rndr::BufferType type, u32 buffer, u32 slot,
+                                    size_t offset, size_t size)
+{
+    GLenum target = 0;
+    switch (type)
+    {
+        case Rndr::BufferType::Constant:
+            target = GL_UNIFORM_BUFFER;
+            break;
+        case Rndr::BufferType::ShaderStorage:
+            target = GL_SHADER_STORAGE_BUFFER;
+            break;
+        default:
+            RNDR_LOG_ERROR("BindBufferRange: Only constant and shader storage buffers can be bound by range!");
+            return false;
+    }
+    glBindBufferRange(target, slot, buffer, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size));
+    return true;
+}
+
+void* RenderBackend::InsertFence([[maybe_unused]] Rndr::GraphicsContext& graphics_context)
+{
+    return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool RenderBackend::WaitAndDestroyFence([[maybe_unused]] Rndr::GraphicsContext& graphics_context, void* fence)
+{
+    GLsync sync = static_cast<GLsync>(fence);
+    GLenum status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    const bool has_waited = status == GL_TIMEOUT_EXPIRED;
+    while (status == GL_TIMEOUT_EXPIRED)
+    {
+        status = glClientWaitSync(sync, 0, k_fence_wait_timeout);
+    }
+    if (status == GL_WAIT_FAILED)
+    {
+        RNDR_LOG_ERROR("WaitAndDestroyFence: Waiting on the fence failed!");
+    }
+    glDeleteSync(sync);
+    return has_waited;
+}
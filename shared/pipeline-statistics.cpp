@@ -0,0 +1,69 @@
+#include "pipeline-statistics.h"
+
+#include "rndr/log.h"
+
+#include "render-backend.h"
+
+bool PipelineStatistics::SetupFragmentInvocationQuery(FragmentInvocationQuery& out_query, Rndr::GraphicsContext& graphics_context)
+{
+    out_query = {};
+    if (!RenderBackend::CreateQueries(graphics_context, QueryType::FragmentShaderInvocations,
+                                      Opal::ArrayView<u32>(out_query.queries, FragmentInvocationQuery::k_query_count)))
+    {
+        RNDR_LOG_WARNING("Pipeline statistics queries require OpenGL 4.6, fragment shader invocations won't be reported!");
+        return false;
+    }
+    out_query.is_supported = true;
+    return true;
+}
+
+void PipelineStatistics::DestroyFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context)
+{
+    if (in_out_query.is_supported)
+    {
+        RenderBackend::DestroyQueries(graphics_context,
+                                      Opal::ArrayView<const u32>(in_out_query.queries, FragmentInvocationQuery::k_query_count));
+    }
+    in_out_query = {};
+}
+
+void PipelineStatistics::BeginFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context)
+{
+    if (!in_out_query.is_supported)
+    {
+        return;
+    }
+    const u32 slot = static_cast<u32>(in_out_query.frame_index % FragmentInvocationQuery::k_query_count);
+    if (in_out_query.issued_frames[slot] >= 0)
+    {
+        // GPU is more than k_query_count frames behind, the result has to be read before the query can be reused
+        in_out_query.fragment_invocations = RenderBackend::ReadQueryResult(graphics_context, in_out_query.queries[slot]);
+        in_out_query.result_frame_index = in_out_query.issued_frames[slot];
+        in_out_query.issued_frames[slot] = -1;
+    }
+    RenderBackend::BeginQuery(graphics_context, QueryType::FragmentShaderInvocations, in_out_query.queries[slot]);
+}
+
+bool PipelineStatistics::EndFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context)
+{
+    if (!in_out_query.is_supported)
+    {
+        return false;
+    }
+    RenderBackend::EndQuery(graphics_context, QueryType::FragmentShaderInvocations);
+    const u32 slot = static_cast<u32>(in_out_query.frame_index % FragmentInvocationQuery::k_query_count);
+    in_out_query.issued_frames[slot] = in_out_query.frame_index;
+    in_out_query.frame_index++;
+
+    // The slot that is reused next holds the oldest query in flight
+    const u32 oldest_slot = static_cast<u32>(in_out_query.frame_index % FragmentInvocationQuery::k_query_count);
+    if (in_out_query.issued_frames[oldest_slot] < 0 ||
+        !RenderBackend::IsQueryResultAvailable(graphics_context, in_out_query.queries[oldest_slot]))
+    {
+        return false;
+    }
+    in_out_query.fragment_invocations = RenderBackend::ReadQueryResult(graphics_context, in_out_query.queries[oldest_slot]);
+    in_out_query.result_frame_index = in_out_query.issued_frames[oldest_slot];
+    in_out_query.issued_frames[oldest_slot] = -1;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "rndr/render-api.h"
+
+#include "types.h"
+
+/**
+ * Counts fragment shader invocations of the GPU work submitted between the begin and the end of the query. Queries are kept
+ * in a small ring and read a few frames later so that the CPU never waits for the GPU.
+ */
+struct FragmentInvocationQuery
+{
+    static constexpr u32 k_query_count = 4;
+
+    u32 queries[k_query_count] = {};
+    /** Frame in which each query was issued, or -1 if its result was already read. */
+    i64 issued_frames[k_query_count] = {-1, -1, -1, -1};
+    i64 frame_index = 0;
+    bool is_supported = false;
+
+    /** Fragment shader invocations of the latest frame whose result came back from the GPU. */
+    u64 fragment_invocations = 0;
+    /** Frame the fragment invocation count belongs to, -1 if there is no result yet. */
+    i64 result_frame_index = -1;
+};
+
+namespace PipelineStatistics
+{
+
+/**
+ * Creates the queries. Pipeline statistics queries are core since OpenGL 4.6.
+ * @param out_query Query to set up.
+ * @param graphics_context Graphics context used to create the queries.
+ * @return True if the queries are supported and were created, false otherwise.
+ */
+bool SetupFragmentInvocationQuery(FragmentInvocationQuery& out_query, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Deletes the queries.
+ */
+void DestroyFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Starts counting fragment shader invocations for this frame. Does nothing if the queries are not supported.
+ */
+void BeginFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Stops counting fragment shader invocations for this frame and reads back the oldest result that is ready.
+ * @param in_out_query Query to end.
+ * @param graphics_context Graphics context the frame was submitted to.
+ * @return True if a new result is available in fragment_invocations, false otherwise.
+ */
+bool EndFragmentInvocationQuery(FragmentInvocationQuery& in_out_query, Rndr::GraphicsContext& graphics_context);
+
+}  // namespace PipelineStatistics
@@ -0,0 +1,638 @@
+#include "raycast.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+
+#include <emmintrin.h>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Depth of the traversal stacks. Depth first traversal keeps at most one pending sibling per level plus both children of
+ * the deepest node, and Culling::BuildBvh never goes deeper than k_max_bvh_depth. */
+constexpr u32 k_stack_size = Culling::k_max_bvh_depth + 1;
+
+/** Number of ray packets traced by a single task in a batch. */
+constexpr size_t k_packets_per_task = 64;
+
+constexpr f32 k_determinant_epsilon = 1e-12f;
+
+constexpr i32 k_packet_size = 4;
+
+struct SingleRay
+{
+    f32 origin[3];
+    f32 direction[3];
+    f32 inv_direction[3];
+};
+
+SingleRay MakeRay(const f32 origin[3], const f32 direction[3])
+{
+    SingleRay ray;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        ray.origin[axis] = origin[axis];
+        ray.direction[axis] = direction[axis];
+        ray.inv_direction[axis] = 1.0f / direction[axis];
+    }
+    return ray;
+}
+
+SingleRay TransformRay(const Rndr::Matrix4x4f& m, const SingleRay& ray)
+{
+    f32 origin[3];
+    f32 direction[3];
+    for (i32 r = 0; r < 3; ++r)
+    {
+        origin[r] = m.elements[r][0] * ray.origin[0] + m.elements[r][1] * ray.origin[1] + m.elements[r][2] * ray.origin[2] + m.elements[r][3];
+        // Direction is not normalized after the transform so the hit distances stay the same as in the world space.
+        direction[r] = m.elements[r][0] * ray.direction[0] + m.elements[r][1] * ray.direction[1] + m.elements[r][2] * ray.direction[2];
+    }
+    return MakeRay(origin, direction);
+}
+
+bool IntersectBox(const f32 box_min[3], const f32 box_max[3], const SingleRay& ray, f32 max_distance, f32& out_entry)
+{
+    f32 entry = 0.0f;
+    f32 exit = max_distance;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        const f32 t0 = (box_min[axis] - ray.origin[axis]) * ray.inv_direction[axis];
+        const f32 t1 = (box_max[axis] - ray.origin[axis]) * ray.inv_direction[axis];
+        entry = std::max(entry, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+    }
+    out_entry = entry;
+    return entry <= exit;
+}
+
+bool IntersectShapeBounds(const ShapeBounds& bounds, u32 shape, const SingleRay& ray, f32 max_distance)
+{
+    const f32 box_min[3] = {bounds.center_x[shape] - bounds.extent_x[shape], bounds.center_y[shape] - bounds.extent_y[shape],
+                            bounds.center_z[shape] - bounds.extent_z[shape]};
+    const f32 box_max[3] = {bounds.center_x[shape] + bounds.extent_x[shape], bounds.center_y[shape] + bounds.extent_y[shape],
+                            bounds.center_z[shape] + bounds.extent_z[shape]};
+    f32 entry = 0.0f;
+    return IntersectBox(box_min, box_max, ray, max_distance, entry);
+}
+
+/**
+ * Moller-Trumbore ray triangle intersection.
+ */
+bool IntersectTriangle(const MeshBvh& mesh, u32 triangle, const SingleRay& ray, f32 max_distance, f32& out_distance, f32& out_u, f32& out_v)
+{
+    const Rndr::Point3f& v0 = mesh.vertices[triangle];
+    const Rndr::Vector3f& e1 = mesh.edges1[triangle];
+    const Rndr::Vector3f& e2 = mesh.edges2[triangle];
+    const f32* d = ray.direction;
+
+    const f32 p[3] = {d[1] * e2.z - d[2] * e2.y, d[2] * e2.x - d[0] * e2.z, d[0] * e2.y - d[1] * e2.x};
+    const f32 determinant = e1.x * p[0] + e1.y * p[1] + e1.z * p[2];
+    if (std::abs(determinant) < k_determinant_epsilon)
+    {
+        return false;
+    }
+    const f32 inv_determinant = 1.0f / determinant;
+    const f32 s[3] = {ray.origin[0] - v0.x, ray.origin[1] - v0.y, ray.origin[2] - v0.z};
+    const f32 u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_determinant;
+    if (u < 0.0f || u > 1.0f)
+    {
+        return false;
+    }
+    const f32 q[3] = {s[1] * e1.z - s[2] * e1.y, s[2] * e1.x - s[0] * e1.z, s[0] * e1.y - s[1] * e1.x};
+    const f32 v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_determinant;
+    if (v < 0.0f || u + v > 1.0f)
+    {
+        return false;
+    }
+    const f32 distance = (e2.x * q[0] + e2.y * q[1] + e2.z * q[2]) * inv_determinant;
+    if (distance < 0.0f || distance >= max_distance)
+    {
+        return false;
+    }
+    out_distance = distance;
+    out_u = u;
+    out_v = v;
+    return true;
+}
+
+/**
+ * Walks the BVH front to back and calls the leaf function for each leaf the ray enters. Leaf function returns true to stop
+ * the traversal.
+ */
+template <typename LeafFunction>
+void TraverseBvh(const Bvh& bvh, const SingleRay& ray, const f32& max_distance, const LeafFunction& leaf_function)
+{
+    if (bvh.nodes.IsEmpty())
+    {
+        return;
+    }
+    u32 stack[k_stack_size];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const BvhNode& node = bvh.nodes[stack[--stack_size]];
+        f32 entry = 0.0f;
+        if (!IntersectBox(node.min, node.max, ray, max_distance, entry))
+        {
+            continue;
+        }
+        if (node.left_child == Bvh::k_invalid_node)
+        {
+            if (leaf_function(node))
+            {
+                return;
+            }
+            continue;
+        }
+        // Push the farther child first so that the closer one is visited first and shrinks max distance sooner.
+        f32 left_entry = 0.0f;
+        f32 right_entry = 0.0f;
+        const bool is_left_hit = IntersectBox(bvh.nodes[node.left_child].min, bvh.nodes[node.left_child].max, ray, max_distance, left_entry);
+        const bool is_right_hit =
+            IntersectBox(bvh.nodes[node.left_child + 1].min, bvh.nodes[node.left_child + 1].max, ray, max_distance, right_entry);
+        RNDR_ASSERT(stack_size + 2 <= k_stack_size, "BVH is deeper than the traversal stack");
+        if (is_left_hit && is_right_hit)
+        {
+            const bool is_left_closer = left_entry <= right_entry;
+            stack[stack_size++] = is_left_closer ? node.left_child + 1 : node.left_child;
+            stack[stack_size++] = is_left_closer ? node.left_child : node.left_child + 1;
+        }
+        else if (is_left_hit)
+        {
+            stack[stack_size++] = node.left_child;
+        }
+        else if (is_right_hit)
+        {
+            stack[stack_size++] = node.left_child + 1;
+        }
+    }
+}
+
+template <bool k_any_hit>
+bool TraceRay(RaycastHit& in_out_hit, const RaycastScene& scene, const SingleRay& ray)
+{
+    bool is_hit = false;
+    TraverseBvh(scene.shape_bvh, ray, in_out_hit.distance,
+                [&](const BvhNode& shape_leaf)
+                {
+                    for (u32 i = shape_leaf.first_shape; i < shape_leaf.first_shape + shape_leaf.shape_count; ++i)
+                    {
+                        const u32 shape = scene.shape_bvh.shape_indices[i];
+                        if (!IntersectShapeBounds(scene.shape_bounds, shape, ray, in_out_hit.distance))
+                        {
+                            continue;
+                        }
+                        const MeshBvh& mesh = scene.mesh_bvhs[scene.shape_meshes[shape]];
+                        const SingleRay object_ray = TransformRay(scene.object_from_world[shape], ray);
+                        TraverseBvh(mesh.bvh, object_ray, in_out_hit.distance,
+                                    [&](const BvhNode& triangle_leaf)
+                                    {
+                                        for (u32 t = triangle_leaf.first_shape; t < triangle_leaf.first_shape + triangle_leaf.shape_count; ++t)
+                                        {
+                                            f32 distance = 0.0f;
+                                            f32 u = 0.0f;
+                                            f32 v = 0.0f;
+                                            if (IntersectTriangle(mesh, t, object_ray, in_out_hit.distance, distance, u, v))
+                                            {
+                                                in_out_hit = {.distance = distance,
+                                                              .shape_index = shape,
+                                                              .triangle_index = mesh.triangle_indices[t],
+                                                              .u = u,
+                                                              .v = v};
+                                                is_hit = true;
+                                                if constexpr (k_any_hit)
+                                                {
+                                                    return true;
+                                                }
+                                            }
+                                        }
+                                        return false;
+                                    });
+                        if (k_any_hit && is_hit)
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+    return is_hit;
+}
+
+/**
+ * Four rays traced together. Each lane holds one ray, lanes without a ray have a negative max distance so they never hit.
+ */
+struct RayPacket
+{
+    __m128 origin[3];
+    __m128 direction[3];
+    __m128 inv_direction[3];
+};
+
+struct PacketHits
+{
+    __m128 distance;
+    __m128 u;
+    __m128 v;
+    __m128i shape_index;
+    __m128i triangle_index;
+};
+
+__m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+__m128i Select(__m128 mask, __m128i a, __m128i b)
+{
+    const __m128i int_mask = _mm_castps_si128(mask);
+    return _mm_or_si128(_mm_and_si128(int_mask, a), _mm_andnot_si128(int_mask, b));
+}
+
+void SetInverseDirection(RayPacket& packet)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        packet.inv_direction[axis] = _mm_div_ps(one, packet.direction[axis]);
+    }
+}
+
+RayPacket TransformPacket(const Rndr::Matrix4x4f& m, const RayPacket& packet)
+{
+    RayPacket out;
+    for (i32 r = 0; r < 3; ++r)
+    {
+        const __m128 m0 = _mm_set1_ps(m.elements[r][0]);
+        const __m128 m1 = _mm_set1_ps(m.elements[r][1]);
+        const __m128 m2 = _mm_set1_ps(m.elements[r][2]);
+        out.origin[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, packet.origin[0]), _mm_mul_ps(m1, packet.origin[1])),
+                                   _mm_add_ps(_mm_mul_ps(m2, packet.origin[2]), _mm_set1_ps(m.elements[r][3])));
+        out.direction[r] =
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, packet.direction[0]), _mm_mul_ps(m1, packet.direction[1])), _mm_mul_ps(m2, packet.direction[2]));
+    }
+    SetInverseDirection(out);
+    return out;
+}
+
+__m128 IntersectBoxPacket(const f32 box_min[3], const f32 box_max[3], const RayPacket& packet, __m128 max_distance)
+{
+    __m128 entry = _mm_setzero_ps();
+    __m128 exit = max_distance;
+    for (i32 axis = 0; axis < 3; ++axis)
+    {
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_min[axis]), packet.origin[axis]), packet.inv_direction[axis]);
+        const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_max[axis]), packet.origin[axis]), packet.inv_direction[axis]);
+        entry = _mm_max_ps(entry, _mm_min_ps(t0, t1));
+        exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+    }
+    return _mm_cmple_ps(entry, exit);
+}
+
+void IntersectTrianglePacket(PacketHits& in_out_hits, const MeshBvh& mesh, u32 triangle, const RayPacket& packet, u32 shape)
+{
+    const Rndr::Point3f& v0 = mesh.vertices[triangle];
+    const Rndr::Vector3f& edge1 = mesh.edges1[triangle];
+    const Rndr::Vector3f& edge2 = mesh.edges2[triangle];
+    const __m128 e1[3] = {_mm_set1_ps(edge1.x), _mm_set1_ps(edge1.y), _mm_set1_ps(edge1.z)};
+    const __m128 e2[3] = {_mm_set1_ps(edge2.x), _mm_set1_ps(edge2.y), _mm_set1_ps(edge2.z)};
+    const __m128* d = packet.direction;
+
+    const __m128 p[3] = {_mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])), _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+                         _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]))};
+    const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+    const __m128 abs_determinant = _mm_andnot_ps(_mm_set1_ps(-0.0f), determinant);
+    const __m128 inv_determinant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+    const __m128 s[3] = {_mm_sub_ps(packet.origin[0], _mm_set1_ps(v0.x)), _mm_sub_ps(packet.origin[1], _mm_set1_ps(v0.y)),
+                         _mm_sub_ps(packet.origin[2], _mm_set1_ps(v0.z))};
+    const __m128 u =
+        _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), inv_determinant);
+    const __m128 q[3] = {_mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])), _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+                         _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]))};
+    const __m128 v =
+        _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])), _mm_mul_ps(d[2], q[2])), inv_determinant);
+    const __m128 distance =
+        _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), inv_determinant);
+
+    const __m128 zero = _mm_setzero_ps();
+    __m128 is_hit = _mm_cmpge_ps(abs_determinant, _mm_set1_ps(k_determinant_epsilon));
+    is_hit = _mm_and_ps(is_hit, _mm_cmpge_ps(u, zero));
+    is_hit = _mm_and_ps(is_hit, _mm_cmpge_ps(v, zero));
+    is_hit = _mm_and_ps(is_hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    is_hit = _mm_and_ps(is_hit, _mm_cmpge_ps(distance, zero));
+    is_hit = _mm_and_ps(is_hit, _mm_cmplt_ps(distance, in_out_hits.distance));
+    if (_mm_movemask_ps(is_hit) == 0)
+    {
+        return;
+    }
+    in_out_hits.distance = Select(is_hit, distance, in_out_hits.distance);
+    in_out_hits.u = Select(is_hit, u, in_out_hits.u);
+    in_out_hits.v = Select(is_hit, v, in_out_hits.v);
+    in_out_hits.shape_index = Select(is_hit, _mm_set1_epi32(static_cast<i32>(shape)), in_out_hits.shape_index);
+    in_out_hits.triangle_index = Select(is_hit, _mm_set1_epi32(static_cast<i32>(mesh.triangle_indices[triangle])), in_out_hits.triangle_index);
+}
+
+/**
+ * Same as TraverseBvh but a node is entered if any of the rays in the packet hits it.
+ */
+template <typename LeafFunction>
+void TraverseBvhPacket(const Bvh& bvh, const RayPacket& packet, const __m128& max_distance, const LeafFunction& leaf_function)
+{
+    if (bvh.nodes.IsEmpty())
+    {
+        return;
+    }
+    u32 stack[k_stack_size];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const BvhNode& node = bvh.nodes[stack[--stack_size]];
+        if (_mm_movemask_ps(IntersectBoxPacket(node.min, node.max, packet, max_distance)) == 0)
+        {
+            continue;
+        }
+        if (node.left_child == Bvh::k_invalid_node)
+        {
+            leaf_function(node);
+            continue;
+        }
+        RNDR_ASSERT(stack_size + 2 <= k_stack_size, "BVH is deeper than the traversal stack");
+        stack[stack_size++] = node.left_child + 1;
+        stack[stack_size++] = node.left_child;
+    }
+}
+
+void TracePacket(PacketHits& in_out_hits, const RaycastScene& scene, const RayPacket& packet)
+{
+    TraverseBvhPacket(
+        scene.shape_bvh, packet, in_out_hits.distance,
+        [&](const BvhNode& shape_leaf)
+        {
+            for (u32 i = shape_leaf.first_shape; i < shape_leaf.first_shape + shape_leaf.shape_count; ++i)
+            {
+                const u32 shape = scene.shape_bvh.shape_indices[i];
+                const ShapeBounds& bounds = scene.shape_bounds;
+                const f32 box_min[3] = {bounds.center_x[shape] - bounds.extent_x[shape], bounds.center_y[shape] - bounds.extent_y[shape],
+                                        bounds.center_z[shape] - bounds.extent_z[shape]};
+                const f32 box_max[3] = {bounds.center_x[shape] + bounds.extent_x[shape], bounds.center_y[shape] + bounds.extent_y[shape],
+                                        bounds.center_z[shape] + bounds.extent_z[shape]};
+                if (_mm_movemask_ps(IntersectBoxPacket(box_min, box_max, packet, in_out_hits.distance)) == 0)
+                {
+                    continue;
+                }
+                const MeshBvh& mesh = scene.mesh_bvhs[scene.shape_meshes[shape]];
+                const RayPacket object_packet = TransformPacket(scene.object_from_world[shape], packet);
+                TraverseBvhPacket(mesh.bvh, object_packet, in_out_hits.distance,
+                                  [&](const BvhNode& triangle_leaf)
+                                  {
+                                      for (u32 t = triangle_leaf.first_shape; t < triangle_leaf.first_shape + triangle_leaf.shape_count; ++t)
+                                      {
+                                          IntersectTrianglePacket(in_out_hits, mesh, t, object_packet, shape);
+                                      }
+                                  });
+            }
+        });
+}
+
+void TracePackets(Opal::ArrayView<RaycastHit>& out_hits, const RaycastScene& scene, const Opal::ArrayView<const Ray>& rays, size_t first_ray,
+                  size_t end_ray)
+{
+    for (size_t packet_start = first_ray; packet_start < end_ray; packet_start += k_packet_size)
+    {
+        alignas(16) f32 origin[3][k_packet_size] = {};
+        alignas(16) f32 direction[3][k_packet_size] = {};
+        alignas(16) f32 max_distance[k_packet_size];
+        for (i32 lane = 0; lane < k_packet_size; ++lane)
+        {
+            const size_t ray_index = packet_start + lane;
+            if (ray_index >= end_ray)
+            {
+                direction[0][lane] = direction[1][lane] = direction[2][lane] = 1.0f;
+                max_distance[lane] = -1.0f;
+                continue;
+            }
+            const Ray& ray = rays[ray_index];
+            origin[0][lane] = ray.origin.x;
+            origin[1][lane] = ray.origin.y;
+            origin[2][lane] = ray.origin.z;
+            direction[0][lane] = ray.direction.x;
+            direction[1][lane] = ray.direction.y;
+            direction[2][lane] = ray.direction.z;
+            max_distance[lane] = ray.max_distance;
+        }
+
+        RayPacket packet;
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            packet.origin[axis] = _mm_load_ps(origin[axis]);
+            packet.direction[axis] = _mm_load_ps(direction[axis]);
+        }
+        SetInverseDirection(packet);
+        PacketHits hits{.distance = _mm_load_ps(max_distance),
+                        .u = _mm_setzero_ps(),
+                        .v = _mm_setzero_ps(),
+                        .shape_index = _mm_set1_epi32(static_cast<i32>(RaycastHit::k_invalid_index)),
+                        .triangle_index = _mm_set1_epi32(static_cast<i32>(RaycastHit::k_invalid_index))};
+        TracePacket(hits, scene, packet);
+
+        alignas(16) f32 hit_distance[k_packet_size];
+        alignas(16) f32 hit_u[k_packet_size];
+        alignas(16) f32 hit_v[k_packet_size];
+        alignas(16) u32 hit_shape[k_packet_size];
+        alignas(16) u32 hit_triangle[k_packet_size];
+        _mm_store_ps(hit_distance, hits.distance);
+        _mm_store_ps(hit_u, hits.u);
+        _mm_store_ps(hit_v, hits.v);
+        _mm_store_si128(reinterpret_cast<__m128i*>(hit_shape), hits.shape_index);
+        _mm_store_si128(reinterpret_cast<__m128i*>(hit_triangle), hits.triangle_index);
+        for (i32 lane = 0; lane < k_packet_size && packet_start + lane < end_ray; ++lane)
+        {
+            RaycastHit& hit = out_hits[packet_start + lane];
+            hit = {};
+            if (hit_shape[lane] != RaycastHit::k_invalid_index)
+            {
+                hit = {.distance = hit_distance[lane],
+                       .shape_index = hit_shape[lane],
+                       .triangle_index = hit_triangle[lane],
+                       .u = hit_u[lane],
+                       .v = hit_v[lane]};
+            }
+        }
+    }
+}
+
+bool BuildMeshBvh(MeshBvh& out_mesh_bvh, const MeshData& mesh_data, const MeshDescription& mesh)
+{
+    out_mesh_bvh = {};
+    if (mesh.lod_count <= 0)
+    {
+        return false;
+    }
+    const u32* indices = reinterpret_cast<const u32*>(mesh_data.index_buffer_data.GetData()) + mesh.index_offset + mesh.lod_offsets[0];
+    const u8* vertices = mesh_data.vertex_buffer_data.GetData();
+    const u32 triangle_count = static_cast<u32>(mesh.GetLodIndicesCount(0) / 3);
+    if (triangle_count == 0)
+    {
+        return false;
+    }
+
+    const auto get_position = [&](u32 index)
+    {
+        const f32* position = reinterpret_cast<const f32*>(vertices + (mesh.vertex_offset + index) * mesh.vertex_size);
+        return Rndr::Point3f(position[0], position[1], position[2]);
+    };
+
+    // Triangle bounds in the same form as shape bounds so that the shape BVH builder can be used.
+    ShapeBounds triangle_bounds;
+    Opal::DynamicArray<f32>* const bounds_arrays[6] = {&triangle_bounds.center_x, &triangle_bounds.center_y, &triangle_bounds.center_z,
+                                                       &triangle_bounds.extent_x, &triangle_bounds.extent_y, &triangle_bounds.extent_z};
+    for (Opal::DynamicArray<f32>* array : bounds_arrays)
+    {
+        array->Resize(triangle_count);
+    }
+    Opal::DynamicArray<Rndr::Point3f> positions(static_cast<size_t>(triangle_count) * 3);
+    for (u32 t = 0; t < triangle_count; ++t)
+    {
+        f32 min[3] = {1e30f, 1e30f, 1e30f};
+        f32 max[3] = {-1e30f, -1e30f, -1e30f};
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const Rndr::Point3f p = get_position(indices[3 * t + k]);
+            positions[3 * t + k] = p;
+            for (i32 axis = 0; axis < 3; ++axis)
+            {
+                min[axis] = std::min(min[axis], p[axis]);
+                max[axis] = std::max(max[axis], p[axis]);
+            }
+        }
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            (*bounds_arrays[axis])[t] = 0.5f * (min[axis] + max[axis]);
+            (*bounds_arrays[axis + 3])[t] = 0.5f * (max[axis] - min[axis]);
+        }
+    }
+    if (!Culling::BuildBvh(out_mesh_bvh.bvh, triangle_bounds))
+    {
+        return false;
+    }
+
+    // Store triangles in the leaf order so that each leaf reads a contiguous range.
+    out_mesh_bvh.vertices.Resize(triangle_count);
+    out_mesh_bvh.edges1.Resize(triangle_count);
+    out_mesh_bvh.edges2.Resize(triangle_count);
+    out_mesh_bvh.triangle_indices.Resize(triangle_count);
+    for (u32 i = 0; i < triangle_count; ++i)
+    {
+        const u32 t = out_mesh_bvh.bvh.shape_indices[i];
+        const Rndr::Point3f& p0 = positions[3 * t];
+        const Rndr::Point3f& p1 = positions[3 * t + 1];
+        const Rndr::Point3f& p2 = positions[3 * t + 2];
+        out_mesh_bvh.vertices[i] = p0;
+        out_mesh_bvh.edges1[i] = Rndr::Vector3f(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+        out_mesh_bvh.edges2[i] = Rndr::Vector3f(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+        out_mesh_bvh.triangle_indices[i] = t;
+    }
+    // Leaves now index the reordered triangles directly.
+    for (u32 i = 0; i < triangle_count; ++i)
+    {
+        out_mesh_bvh.bvh.shape_indices[i] = i;
+    }
+    out_mesh_bvh.bvh.shape_to_leaf.Clear();
+    return true;
+}
+
+}  // namespace
+
+bool Scene::BuildRaycastScene(RaycastScene& out_scene, const SceneDrawData& scene)
+{
+    const f64 start_time = Opal::GetSeconds();
+
+    out_scene = {};
+    const size_t mesh_count = scene.mesh_data.meshes.GetSize();
+    out_scene.mesh_bvhs.Resize(mesh_count);
+    Opal::DynamicArray<u32> meshes(mesh_count);
+    for (size_t i = 0; i < mesh_count; ++i)
+    {
+        meshes[i] = static_cast<u32>(i);
+    }
+    std::for_each(std::execution::par, meshes.begin(), meshes.end(),
+                  [&](u32 mesh) { BuildMeshBvh(out_scene.mesh_bvhs[mesh], scene.mesh_data, scene.mesh_data.meshes[mesh]); });
+
+    if (!Culling::SetupShapeBounds(out_scene.shape_bounds, scene) || !Culling::BuildBvh(out_scene.shape_bvh, out_scene.shape_bounds))
+    {
+        RNDR_LOG_ERROR("BuildRaycastScene: Failed to build the shape BVH!");
+        return false;
+    }
+
+    const size_t shape_count = scene.shapes.GetSize();
+    out_scene.shape_meshes.Resize(shape_count);
+    out_scene.object_from_world.Resize(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        out_scene.shape_meshes[i] = scene.shapes[i].mesh_index;
+        out_scene.object_from_world[i] = Opal::Inverse(scene.scene_description.world_transforms[scene.shapes[i].transform_index]);
+    }
+
+    RNDR_LOG_INFO("BuildRaycastScene: Built BVHs for %zu meshes and %zu shapes in %.3f ms", mesh_count, shape_count,
+                  (Opal::GetSeconds() - start_time) * 1000.0);
+    return true;
+}
+
+void Scene::UpdateRaycastScene(RaycastScene& in_out_scene, const SceneDrawData& scene, const Opal::ArrayView<const u32>& changed_shapes)
+{
+    if (changed_shapes.GetSize() == 0)
+    {
+        return;
+    }
+    for (const u32 shape : changed_shapes)
+    {
+        in_out_scene.object_from_world[shape] = Opal::Inverse(scene.scene_description.world_transforms[scene.shapes[shape].transform_index]);
+    }
+    Culling::UpdateShapeBounds(in_out_scene.shape_bounds, scene, changed_shapes);
+    Culling::RefitBvh(in_out_scene.shape_bvh, in_out_scene.shape_bounds, changed_shapes);
+}
+
+bool Scene::Raycast(RaycastHit& out_hit, const RaycastScene& scene, const Ray& ray)
+{
+    out_hit = {.distance = ray.max_distance};
+    const f32 origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    const f32 direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    const bool is_hit = TraceRay<false>(out_hit, scene, MakeRay(origin, direction));
+    if (!is_hit)
+    {
+        out_hit = {};
+    }
+    return is_hit;
+}
+
+void Scene::RaycastBatch(Opal::ArrayView<RaycastHit> out_hits, const RaycastScene& scene, const Opal::ArrayView<const Ray>& rays)
+{
+    RNDR_ASSERT(out_hits.GetSize() >= rays.GetSize(), "Not enough space for the hits");
+
+    const size_t ray_count = rays.GetSize();
+    const size_t rays_per_task = k_packets_per_task * k_packet_size;
+    Opal::DynamicArray<size_t> task_starts;
+    task_starts.Reserve(ray_count / rays_per_task + 1);
+    for (size_t start = 0; start < ray_count; start += rays_per_task)
+    {
+        task_starts.PushBack(start);
+    }
+    std::for_each(std::execution::par, task_starts.begin(), task_starts.end(),
+                  [&](size_t start) { TracePackets(out_hits, scene, rays, start, std::min(start + rays_per_task, ray_count)); });
+}
+
+bool Scene::HasLineOfSight(const RaycastScene& scene, const Rndr::Point3f& from, const Rndr::Point3f& to)
+{
+    // Direction spans the whole segment so the hit distance is in [0, 1].
+    RaycastHit hit{.distance = 1.0f};
+    const f32 origin[3] = {from.x, from.y, from.z};
+    const f32 direction[3] = {to.x - from.x, to.y - from.y, to.z - from.z};
+    return !TraceRay<true>(hit, scene, MakeRay(origin, direction));
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/math.h"
+
+#include "bvh.h"
+#include "culling.h"
+#include "scene.h"
+
+/**
+ * Ray with a direction that doesn't have to be normalized. Hit distances are measured in multiples of the direction.
+ */
+struct Ray
+{
+    Rndr::Point3f origin;
+    Rndr::Vector3f direction;
+    f32 max_distance = 1e30f;
+};
+
+/**
+ * Closest intersection of a ray with the scene.
+ */
+struct RaycastHit
+{
+    static constexpr u32 k_invalid_index = 0xFFFFFFFF;
+
+    /** Distance along the ray in multiples of the ray direction. */
+    f32 distance = 1e30f;
+    /** Index of the shape that was hit or k_invalid_index if nothing was hit. */
+    u32 shape_index = k_invalid_index;
+    /** Index of the triangle in the most detailed LOD of the shape's mesh. */
+    u32 triangle_index = k_invalid_index;
+    /** Barycentric coordinates of the hit point relative to the second and third vertex of the triangle. */
+    f32 u = 0.0f;
+    f32 v = 0.0f;
+
+    [[nodiscard]] bool IsHit() const { return shape_index != k_invalid_index; }
+};
+
+/**
+ * Bottom level of the raycast acceleration structure. Triangles of the most detailed LOD of a mesh in object space, ordered
+ * so that each BVH leaf covers a contiguous range. Shared by all shapes that use the mesh.
+ */
+struct MeshBvh
+{
+    Bvh bvh;
+
+    /** First vertex of each triangle. */
+    Opal::DynamicArray<Rndr::Point3f> vertices;
+    /** Second vertex minus the first one. */
+    Opal::DynamicArray<Rndr::Vector3f> edges1;
+    /** Third vertex minus the first one. */
+    Opal::DynamicArray<Rndr::Vector3f> edges2;
+    /** Index of each triangle in the mesh. */
+    Opal::DynamicArray<u32> triangle_indices;
+};
+
+/**
+ * Two level acceleration structure for ray queries. Top level is a BVH over world bounds of the shapes and each shape
+ * points to the bottom level BVH of its mesh together with the transform into the mesh space.
+ */
+struct RaycastScene
+{
+    /** Bottom level BVH of each mesh, indexed the same way as MeshData::meshes. */
+    Opal::DynamicArray<MeshBvh> mesh_bvhs;
+
+    /** World space bounds of the shapes and the top level BVH over them. */
+    ShapeBounds shape_bounds;
+    Bvh shape_bvh;
+
+    /** For each shape, mesh index and the transform from world to the mesh space. */
+    Opal::DynamicArray<i64> shape_meshes;
+    Opal::DynamicArray<Rndr::Matrix4x4f> object_from_world;
+};
+
+namespace Scene
+{
+
+/**
+ * Builds bottom level BVHs of all meshes, in parallel, and the top level BVH over the shapes.
+ * @param out_scene The acceleration structure to build.
+ * @param scene The scene with up to date world transforms. Mesh data must contain vertex positions at the start of each vertex.
+ * @return True if the acceleration structure was built, false if the scene has no shapes.
+ */
+bool BuildRaycastScene(RaycastScene& out_scene, const SceneDrawData& scene);
+
+/**
+ * Updates transforms and bounds of the moved shapes and refits the top level BVH. Meshes don't change so the bottom level
+ * BVHs are kept.
+ * @param in_out_scene The acceleration structure.
+ * @param scene The scene with up to date world transforms.
+ * @param changed_shapes Shapes whose world transforms changed.
+ */
+void UpdateRaycastScene(RaycastScene& in_out_scene, const SceneDrawData& scene, const Opal::ArrayView<const u32>& changed_shapes);
+
+/**
+ * Finds the closest intersection of the ray with the scene triangles.
+ * @param out_hit The closest hit. Left as a miss if nothing was hit.
+ * @param scene The acceleration structure.
+ * @param ray The ray in world space.
+ * @return True if something was hit, false otherwise.
+ */
+bool Raycast(RaycastHit& out_hit, const RaycastScene& scene, const Ray& ray);
+
+/**
+ * Finds the closest intersections of many rays. Rays are traced in packets of four with SSE, and packets are distributed
+ * over multiple threads. Works best if neighbouring rays are coherent.
+ * @param out_hits One hit per ray.
+ * @param scene The acceleration structure.
+ * @param rays Rays in world space.
+ */
+void RaycastBatch(Opal::ArrayView<RaycastHit> out_hits, const RaycastScene& scene, const Opal::ArrayView<const Ray>& rays);
+
+/**
+ * Checks if the segment between two points is free of scene triangles. Stops at the first hit.
+ * @param scene The acceleration structure.
+ * @param from Start of the segment.
+ * @param to End of the segment.
+ * @return True if nothing blocks the segment, false otherwise.
+ */
+bool HasLineOfSight(const RaycastScene& scene, const Rndr::Point3f& from, const Rndr::Point3f& to);
+
+}  // namespace Scene
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+
+#include "rndr/enum-flags.h"
+#include "rndr/graphics-types.h"
+#include "rndr/render-api.h"
+
+#include "types.h"
+
+/**
+ * Synchronization between GPU writes from shaders and the reads that follow them.
+ */
+enum class BarrierFlags : u8
+{
+    None = 0,
+    /** Shader storage writes are visible to shader storage reads of later commands. */
+    ShaderStorage = 1 << 0,
+    /** Shader storage writes are visible to indirect draws sourcing their commands or draw count from the buffer. */
+    IndirectCommands = 1 << 1,
+};
+RNDR_ENUM_CLASS_FLAGS(BarrierFlags)
+
+/**
+ * What a GPU query counts between its begin and end.
+ */
+enum class QueryType : u8
+{
+    FragmentShaderInvocations,
+};
+
+/**
+ * Commands used by the GPU driven paths that Rndr doesn't expose. They work with Rndr resources and the immediate graphics
+ * context, and are implemented per graphics API, the OpenGL one in opengl/opengl-render-backend.cpp.
+ */
+namespace RenderBackend
+{
+
+/**
+ * Checks if indirect draws can read the draw count from a buffer. Requires OpenGL 4.6.
+ * @param graphics_context Graphics context to check.
+ * @return True if the draw count buffer of DrawIndicesIndirect is supported, false otherwise.
+ */
+bool IsDrawCountSupported(const Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Fills the whole buffer with zeros on the GPU, so the buffer doesn't need to be writable from the CPU.
+ * @param graphics_context Graphics context used to clear the buffer.
+ * @param buffer Buffer to clear. Size has to be a multiple of four bytes.
+ * @return True if the buffer was cleared, false otherwise.
+ */
+bool ClearBuffer(Rndr::GraphicsContext& graphics_context, const Rndr::Buffer& buffer);
+
+/**
+ * Makes shader writes issued so far visible to the commands issued after the barrier.
+ * @param graphics_context Graphics context to insert the barrier into.
+ * @param flags How the written data is read afterwards.
+ */
+void InsertBarrier(Rndr::GraphicsContext& graphics_context, BarrierFlags flags);
+
+/**
+ * Issues a multi draw with 32-bit indices using commands stored in a GPU buffer. Pipeline with all the resources used by
+ * the shaders needs to be bound.
+ * @param graphics_context Graphics context used to draw.
+ * @param topology Primitive topology of the draws.
+ * @param draw_commands Buffer with Rndr::DrawIndicesData commands.
+ * @param max_draw_count Maximum number of commands to draw.
+ * @param draw_count Buffer with a single u32 holding the number of commands to draw. If null, max_draw_count commands are
+ * drawn. Requires IsDrawCountSupported.
+ * @return True if the draw was issued, false otherwise.
+ */
+bool DrawIndicesIndirect(Rndr::GraphicsContext& graphics_context, Rndr::PrimitiveTopology topology, const Rndr::Buffer& draw_commands,
+                         u32 max_draw_count, const Rndr::Buffer* draw_count = nullptr);
+
+/**
+ * Checks if queries of the given type can be created. Pipeline statistics queries require OpenGL 4.6.
+ * @param graphics_context Graphics context to check.
+ * @param type Type of the queries.
+ * @return True if the queries are supported, false otherwise.
+ */
+bool IsQuerySupported(const Rndr::GraphicsContext& graphics_context, QueryType type);
+
+/**
+ * Creates queries of one type.
+ * @param graphics_context Graphics context used to create the queries.
+ * @param type Type of the queries.
+ * @param out_queries Receives one handle per element.
+ * @return True if the queries were created, false if they are not supported.
+ */
+bool CreateQueries(Rndr::GraphicsContext& graphics_context, QueryType type, Opal::ArrayView<u32> out_queries);
+
+/**
+ * Deletes queries created with CreateQueries.
+ * @param graphics_context Graphics context used to create the queries.
+ * @param queries Handles of the queries to delete.
+ */
+void DestroyQueries(Rndr::GraphicsContext& graphics_context, const Opal::ArrayView<const u32>& queries);
+
+/**
+ * Starts counting. Only one query of a type can be active at a time.
+ * @param graphics_context Graphics context the counted work is submitted to.
+ * @param type Type of the query.
+ * @param query Handle of the query.
+ */
+void BeginQuery(Rndr::GraphicsContext& graphics_context, QueryType type, u32 query);
+
+/**
+ * Stops counting for the active query of the given type.
+ * @param graphics_context Graphics context the counted work was submitted to.
+ * @param type Type of the query.
+ */
+void EndQuery(Rndr::GraphicsContext& graphics_context, QueryType type);
+
+/**
+ * Checks if the result of an ended query can be read without waiting for the GPU.
+ * @param graphics_context Graphics context the query was issued on.
+ * @param query Handle of the query.
+ * @return True if the result is ready, false otherwise.
+ */
+bool IsQueryResultAvailable(Rndr::GraphicsContext& graphics_context, u32 query);
+
+/**
+ * Reads the result of an ended query, waiting for the GPU if it is not ready yet.
+ * @param graphics_context Graphics context the query was issued on.
+ * @param query Handle of the query.
+ * @return The counted value.
+ */
+u64 ReadQueryResult(Rndr::GraphicsContext& graphics_context, u32 query);
+
+/**
+ * Returns the alignment that buffer offsets bound to both constant and shader storage slots have to respect.
+ * @param graphics_context Graphics context to query.
+ * @return Alignment in bytes, a power of two.
+ */
+size_t GetBufferOffsetAlignment(const Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Creates a buffer that stays mapped for writing for its whole lifetime. Writes through the mapping are visible to the GPU
+ * without flushing, so they only need to be guarded with fences. Requires OpenGL 4.5.
+ * @param graphics_context Graphics context used to create the buffer.
+ * @param size Size of the buffer in bytes.
+ * @param out_buffer Receives the handle of the buffer, zero on failure.
+ * @return Pointer to the mapped memory, or null if the buffer could not be created or mapped.
+ */
+u8* CreateMappedBuffer(Rndr::GraphicsContext& graphics_context, size_t size, u32& out_buffer);
+
+/**
+ * Unmaps and deletes a buffer created with CreateMappedBuffer. The GPU has to be done reading it.
+ * @param graphics_context Graphics context used to create the buffer.
+ * @param buffer Handle of the buffer.
+ */
+void DestroyMappedBuffer(Rndr::GraphicsContext& graphics_context, u32 buffer);
+
+/**
+ * Binds a range of a buffer created with CreateMappedBuffer to a shader slot.
+ * @param graphics_context Graphics context used to draw.
+ * @param type Either BufferType::Constant or BufferType::ShaderStorage.
+ * @param buffer Handle of the buffer.
+ * @param slot Binding slot in the shader.
+ * @param offset Offset of the range in bytes, a multiple of GetBufferOffsetAlignment.
+ * @param size Size of the range in bytes.
+ * @return True if the range was bound, false if the buffer type can't be bound by range.
+ */
+bool BindBufferRange(Rndr::GraphicsContext& graphics_context, Rndr::BufferType type, u32 buffer, u32 slot, size_t offset, size_t size);
+
+/**
+ * Inserts a fence that is signaled once the GPU finishes all commands issued before it.
+ * @param graphics_context Graphics context to insert the fence into.
+ * @return Handle of the fence.
+ */
+void* InsertFence(Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Blocks until the fence is signaled and deletes it.
+ * @param graphics_context Graphics context the fence was inserted into.
+ * @param fence Handle of the fence.
+ * @return True if the CPU had to wait, false if the fence was already signaled.
+ */
+bool WaitAndDestroyFence(Rndr::GraphicsContext& graphics_context, void* fence);
+
+}  // namespace RenderBackend
@@ -0,0 +1,141 @@
+#include "ring-buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+#include "render-backend.h"
+
+namespace
+{
+size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Waits until the GPU signals the fence and deletes it.
+ * @return True if the CPU had to wait.
+ */
+bool WaitAndDeleteFence(Rndr::GraphicsContext& graphics_context, void*& in_out_fence)
+{
+    if (in_out_fence == nullptr)
+    {
+        return false;
+    }
+    const bool has_waited = RenderBackend::WaitAndDestroyFence(graphics_context, in_out_fence);
+    in_out_fence = nullptr;
+    return has_waited;
+}
+}  // namespace
+
+bool GpuMemory::SetupRingBuffer(RingBuffer& out_ring_buffer, Rndr::GraphicsContext& graphics_context, const RingBufferDesc& desc)
+{
+    out_ring_buffer = {};
+    if (desc.frame_size == 0 || desc.frames_in_flight == 0 || desc.frames_in_flight > RingBuffer::k_max_frames_in_flight)
+    {
+        RNDR_LOG_ERROR("SetupRingBuffer: Frame size must be positive and frames in flight in [1, %u] range!",
+                       RingBuffer::k_max_frames_in_flight);
+        return false;
+    }
+
+    // Offsets of all allocations have to work for both uniform and storage buffer bindings
+    out_ring_buffer.alignment = RenderBackend::GetBufferOffsetAlignment(graphics_context);
+    out_ring_buffer.desc = desc;
+    out_ring_buffer.region_size = AlignUp(desc.frame_size, out_ring_buffer.alignment);
+    const size_t buffer_size = out_ring_buffer.region_size * desc.frames_in_flight;
+    out_ring_buffer.mapped_data = RenderBackend::CreateMappedBuffer(graphics_context, buffer_size, out_ring_buffer.buffer);
+    if (out_ring_buffer.mapped_data == nullptr)
+    {
+        RNDR_LOG_ERROR("SetupRingBuffer: Failed to create the mapped buffer!");
+        out_ring_buffer = {};
+        return false;
+    }
+    // Start at the last region so that the first BeginFrame moves to the first one
+    out_ring_buffer.region_index = desc.frames_in_flight - 1;
+    return true;
+}
+
+void GpuMemory::DestroyRingBuffer(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context)
+{
+    for (void*& fence : in_out_ring_buffer.fences)
+    {
+        WaitAndDeleteFence(graphics_context, fence);
+    }
+    RenderBackend::DestroyMappedBuffer(graphics_context, in_out_ring_buffer.buffer);
+    in_out_ring_buffer = {};
+}
+
+void GpuMemory::BeginFrame(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context)
+{
+    if (in_out_ring_buffer.mapped_data == nullptr)
+    {
+        return;
+    }
+    RNDR_ASSERT(!in_out_ring_buffer.is_frame_started, "Ring buffer frame was started twice without EndFrame!");
+    in_out_ring_buffer.region_index = (in_out_ring_buffer.region_index + 1) % in_out_ring_buffer.desc.frames_in_flight;
+    in_out_ring_buffer.region_offset = 0;
+    in_out_ring_buffer.is_frame_started = true;
+
+    const f64 start_time = Opal::GetSeconds();
+    if (WaitAndDeleteFence(graphics_context, in_out_ring_buffer.fences[in_out_ring_buffer.region_index]))
+    {
+        in_out_ring_buffer.stats.wait_count++;
+        in_out_ring_buffer.stats.wait_time_ms += (Opal::GetSeconds() - start_time) * 1000.0;
+    }
+}
+
+void GpuMemory::EndFrame(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context)
+{
+    if (!in_out_ring_buffer.is_frame_started)
+    {
+        return;
+    }
+    in_out_ring_buffer.fences[in_out_ring_buffer.region_index] = RenderBackend::InsertFence(graphics_context);
+    in_out_ring_buffer.stats.allocated_size = in_out_ring_buffer.region_offset;
+    in_out_ring_buffer.is_frame_started = false;
+}
+
+RingBufferAllocation GpuMemory::Allocate(RingBuffer& in_out_ring_buffer, size_t size)
+{
+    if (!in_out_ring_buffer.is_frame_started)
+    {
+        RNDR_LOG_ERROR("Ring buffer: Allocating outside of a frame!");
+        return {};
+    }
+    const size_t aligned_size = AlignUp(std::max<size_t>(size, 1), in_out_ring_buffer.alignment);
+    const bool fits = in_out_ring_buffer.region_offset + aligned_size <= in_out_ring_buffer.region_size;
+    RNDR_ASSERT(fits, "Ring buffer frame region is full, increase RingBufferDesc::frame_size");
+    if (!fits)
+    {
+        RNDR_LOG_ERROR("Ring buffer: Frame region is full, %zu bytes requested with %zu of %zu bytes used!", size,
+                       in_out_ring_buffer.region_offset, in_out_ring_buffer.region_size);
+        return {};
+    }
+    const size_t offset = in_out_ring_buffer.region_index * in_out_ring_buffer.region_size + in_out_ring_buffer.region_offset;
+    in_out_ring_buffer.region_offset += aligned_size;
+    return {.data = in_out_ring_buffer.mapped_data + offset, .offset = offset, .size = size};
+}
+
+RingBufferAllocation GpuMemory::Write(RingBuffer& in_out_ring_buffer, const Opal::ArrayView<const u8>& data)
+{
+    RingBufferAllocation allocation = Allocate(in_out_ring_buffer, data.GetSize());
+    if (allocation.data != nullptr && data.GetSize() > 0)
+    {
+        std::memcpy(allocation.data, data.GetData(), data.GetSize());
+    }
+    return allocation;
+}
+
+bool GpuMemory::BindAllocation(const RingBuffer& ring_buffer, Rndr::GraphicsContext& graphics_context, const RingBufferAllocation& allocation,
+                               Rndr::BufferType type, u32 slot)
+{
+    if (allocation.data == nullptr || allocation.size == 0)
+    {
+        return false;
+    }
+    return RenderBackend::BindBufferRange(graphics_context, type, ring_buffer.buffer, slot, allocation.offset, allocation.size);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/render-api.h"
+
+#include "types.h"
+
+/**
+ * Configuration of the ring buffer.
+ */
+struct RingBufferDesc
+{
+    /** Bytes available to a single frame. Allocations are aligned to the uniform and storage buffer offset alignment, so
+     * leave some room for the padding. */
+    size_t frame_size = 256 * 1024;
+    /** Number of frames the CPU can write ahead of the GPU, at most RingBuffer::k_max_frames_in_flight. */
+    u32 frames_in_flight = 3;
+};
+
+/**
+ * Part of the ring buffer handed out for this frame. Data is written through the pointer and bound to a shader slot by
+ * its offset.
+ */
+struct RingBufferAllocation
+{
+    u8* data = nullptr;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+/**
+ * Per frame counters of the ring buffer.
+ */
+struct RingBufferStats
+{
+    /** Bytes allocated in the last frame, including the alignment padding. */
+    size_t allocated_size = 0;
+    /** Number of frames in which the CPU had to wait for the GPU to release a region. */
+    u64 wait_count = 0;
+    f64 wait_time_ms = 0.0;
+};
+
+/**
+ * Persistently mapped buffer split into one region per frame in flight. Each frame allocates from its own region, and a
+ * fence placed at the end of the frame guards the region until the GPU is done reading it. Replaces UpdateBuffer calls on
+ * small constant and storage buffers, which can stall when the GPU still reads the previous contents.
+ */
+struct RingBuffer
+{
+    static constexpr u32 k_max_frames_in_flight = 4;
+
+    RingBufferDesc desc;
+
+    u32 buffer = 0;
+    u8* mapped_data = nullptr;
+    /** Frame size rounded up to the alignment. */
+    size_t region_size = 0;
+    size_t alignment = 256;
+
+    /** Region used by the current frame and the offset of the next allocation inside of it. */
+    u32 region_index = 0;
+    size_t region_offset = 0;
+    bool is_frame_started = false;
+
+    /** Fences that guard each region, null if the region is not in use by the GPU. */
+    void* fences[k_max_frames_in_flight] = {};
+
+    RingBufferStats stats;
+};
+
+namespace GpuMemory
+{
+
+/**
+ * Creates and maps the ring buffer. Requires OpenGL 4.5 for persistent mapping with direct state access.
+ * @param out_ring_buffer Ring buffer to set up.
+ * @param graphics_context Graphics context used to create the buffer.
+ * @param desc Configuration of the ring buffer.
+ * @return True if the ring buffer was created, false otherwise.
+ */
+bool SetupRingBuffer(RingBuffer& out_ring_buffer, Rndr::GraphicsContext& graphics_context, const RingBufferDesc& desc);
+
+/**
+ * Waits for pending fences, unmaps and deletes the buffer.
+ */
+void DestroyRingBuffer(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Moves to the next region and waits until the GPU is done with the frame that last used it.
+ */
+void BeginFrame(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Places the fence that guards the current region. Call after all draws that read this frame's allocations are issued.
+ */
+void EndFrame(RingBuffer& in_out_ring_buffer, Rndr::GraphicsContext& graphics_context);
+
+/**
+ * Allocates memory from the current frame's region. Running out of the region is a sizing error of RingBufferDesc::frame_size
+ * and asserts, release builds get an empty allocation that the caller has to handle.
+ * @param in_out_ring_buffer Ring buffer to allocate from.
+ * @param size Size of the allocation in bytes.
+ * @return Allocation, with null data if the region is full or the frame was not started.
+ */
+[[nodiscard]] RingBufferAllocation Allocate(RingBuffer& in_out_ring_buffer, size_t size);
+
+/**
+ * Allocates memory from the current frame's region and copies the data to it.
+ * @return Allocation, with null data if the region is full or the frame was not started.
+ */
+[[nodiscard]] RingBufferAllocation Write(RingBuffer& in_out_ring_buffer, const Opal::ArrayView<const u8>& data);
+
+/**
+ * Binds the allocation to a shader slot.
+ * @param ring_buffer Ring buffer the allocation comes from.
+ * @param graphics_context Graphics context used to draw.
+ * @param allocation Allocation to bind.
+ * @param type Either BufferType::Constant or BufferType::ShaderStorage.
+ * @param slot Binding slot in the shader.
+ * @return True if the allocation was bound, false if it is empty or the type can't be bound.
+ */
+[[nodiscard]] bool BindAllocation(const RingBuffer& ring_buffer, Rndr::GraphicsContext& graphics_context, const RingBufferAllocation& allocation,
+                                  Rndr::BufferType type, u32 slot);
+
+}  // namespace GpuMemory
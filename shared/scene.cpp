@@ -1,11 +1,26 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stack>
+#include <string>
+
+#include "opal/container/string-hash.h"
 
 #include "rndr/file.h"
+#include "rndr/log.h"
 
 namespace
 {
+constexpr uint32_t k_scene_magic = 0x5343454E;
+/**
+ * Version 1 files have no header and store both local and world transforms as matrices. Version 2 files have no node
+ * flags. Version 3 files write the names only if there are any. Version 4 files always write the names, so that optional
+ * sections can follow them.
+ */
+constexpr uint32_t k_scene_version = 4;
+
 bool WriteMap(Rndr::FileHandler& file, const Opal::HashMap<Scene::NodeId, uint32_t>& map)
 {
     Opal::DynamicArray<uint32_t> flattened_map;
@@ -75,6 +90,66 @@ bool ReadStringList(Rndr::FileHandler& file, Opal::DynamicArray<Opal::StringUtf8
     return true;
 }
 
+bool IsSameVector(const Rndr::Vector4f& a, const Rndr::Vector4f& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+}
+
+bool IsSameMaterial(const MaterialDescription& a, const MaterialDescription& b)
+{
+    return IsSameVector(a.emissive_color, b.emissive_color) && IsSameVector(a.albedo_color, b.albedo_color) &&
+           IsSameVector(a.roughness, b.roughness) && a.transparency_factor == b.transparency_factor && a.alpha_test == b.alpha_test &&
+           a.metallic_factor == b.metallic_factor && a.flags == b.flags && a.ambient_occlusion_texture == b.ambient_occlusion_texture &&
+           a.emissive_texture == b.emissive_texture && a.albedo_texture == b.albedo_texture &&
+           a.metallic_roughness_texture == b.metallic_roughness_texture && a.normal_texture == b.normal_texture &&
+           a.opacity_texture == b.opacity_texture;
+}
+
+/** Adds the bits of a float to an FNV-1a hash. Negative zero is hashed as zero since the two compare equal. */
+u64 HashFloat(u64 hash, float value)
+{
+    const float normalized = value + 0.0f;
+    u32 bits = 0;
+    std::memcpy(&bits, &normalized, sizeof(bits));
+    return (hash ^ bits) * 0x100000001B3ull;
+}
+
+u64 HashValue(u64 hash, u64 value)
+{
+    return (hash ^ value) * 0x100000001B3ull;
+}
+
+/** Hash of everything IsSameMaterial compares, so that equal materials always end up with the same hash. */
+u64 HashMaterial(const MaterialDescription& material)
+{
+    u64 hash = 0xCBF29CE484222325ull;
+    for (const Rndr::Vector4f* vector : {&material.emissive_color, &material.albedo_color, &material.roughness})
+    {
+        hash = HashFloat(hash, vector->x);
+        hash = HashFloat(hash, vector->y);
+        hash = HashFloat(hash, vector->z);
+        hash = HashFloat(hash, vector->w);
+    }
+    hash = HashFloat(hash, material.transparency_factor);
+    hash = HashFloat(hash, material.alpha_test);
+    hash = HashFloat(hash, material.metallic_factor);
+    hash = HashValue(hash, static_cast<u64>(material.flags));
+    hash = HashValue(hash, material.ambient_occlusion_texture);
+    hash = HashValue(hash, material.emissive_texture);
+    hash = HashValue(hash, material.albedo_texture);
+    hash = HashValue(hash, material.metallic_roughness_texture);
+    hash = HashValue(hash, material.normal_texture);
+    return HashValue(hash, material.opacity_texture);
+}
+
+void RemapTexture(ImageId& in_out_texture, const Opal::DynamicArray<ImageId>& texture_remap)
+{
+    if (in_out_texture != k_invalid_image_id)
+    {
+        in_out_texture = texture_remap[static_cast<size_t>(in_out_texture)];
+    }
+}
+
 };  // namespace
 
 bool Scene::ReadSceneDescription(SceneDescription& out_scene_description, const Opal::StringUtf8& scene_file)
@@ -85,24 +160,64 @@ bool Scene::ReadSceneDescription(SceneDescription& out_scene_description, const
     {
         return false;
     }
+    return ReadSceneDescription(out_scene_description, file);
+}
 
+bool Scene::ReadSceneDescription(SceneDescription& out_scene_description, Rndr::FileHandler& file)
+{
+    // Version 1 files start with the node count instead of the magic and the version
+    uint64_t first_word = 0;
+    file.Read(&first_word, sizeof(first_word), 1);
+    const bool is_legacy_file = static_cast<uint32_t>(first_word) != k_scene_magic;
+    uint32_t version = 1;
     size_t node_count = 0;
-    file.Read(&node_count, sizeof(node_count), 1);
+    if (is_legacy_file)
+    {
+        node_count = static_cast<size_t>(first_word);
+    }
+    else
+    {
+        version = static_cast<uint32_t>(first_word >> 32);
+        if (version < 2 || version > k_scene_version)
+        {
+            RNDR_LOG_ERROR("Unsupported scene file version %u!", version);
+            return false;
+        }
+        file.Read(&node_count, sizeof(node_count), 1);
+    }
 
     if (node_count != 0)
     {
         out_scene_description.local_transforms.Resize(node_count);
-        out_scene_description.world_transforms.Resize(node_count);
+        out_scene_description.world_transforms.Resize(node_count, Rndr::Matrix4x4f(1.0f));
         out_scene_description.hierarchy.Resize(node_count);
-        file.Read(out_scene_description.local_transforms.GetData(), sizeof(out_scene_description.local_transforms[0]), node_count);
-        file.Read(out_scene_description.world_transforms.GetData(), sizeof(out_scene_description.world_transforms[0]), node_count);
+        out_scene_description.node_flags.Resize(node_count, NodeFlags::None);
+        if (is_legacy_file)
+        {
+            // World transforms are recalculated from the local ones so they are only skipped here
+            Opal::DynamicArray<Rndr::Matrix4x4f> matrices(node_count);
+            file.Read(matrices.GetData(), sizeof(matrices[0]), node_count);
+            for (size_t i = 0; i < node_count; ++i)
+            {
+                out_scene_description.local_transforms[i] = ToLocalTransform(matrices[i]);
+            }
+            file.Read(matrices.GetData(), sizeof(matrices[0]), node_count);
+        }
+        else
+        {
+            file.Read(out_scene_description.local_transforms.GetData(), sizeof(out_scene_description.local_transforms[0]), node_count);
+        }
         file.Read(out_scene_description.hierarchy.GetData(), sizeof(out_scene_description.hierarchy[0]), node_count);
+        if (version >= 3)
+        {
+            file.Read(out_scene_description.node_flags.GetData(), sizeof(out_scene_description.node_flags[0]), node_count);
+        }
     }
 
     ReadMap(file, out_scene_description.node_id_to_mesh_id);
     ReadMap(file, out_scene_description.node_id_to_material_id);
 
-    if (!file.IsEOF())
+    if (version >= 4 || !file.IsEOF())
     {
         ReadMap(file, out_scene_description.node_id_to_name);
         ReadStringList(file, out_scene_description.node_names);
@@ -120,6 +235,13 @@ bool Scene::WriteSceneDescription(const SceneDescription& scene_description, con
     {
         return false;
     }
+    return WriteSceneDescription(scene_description, file);
+}
+
+bool Scene::WriteSceneDescription(const SceneDescription& scene_description, Rndr::FileHandler& file)
+{
+    const uint64_t first_word = static_cast<uint64_t>(k_scene_magic) | (static_cast<uint64_t>(k_scene_version) << 32);
+    file.Write(&first_word, sizeof(first_word), 1);
 
     const size_t node_count = scene_description.hierarchy.GetSize();
     file.Write(&node_count, sizeof(node_count), 1);
@@ -127,23 +249,42 @@ bool Scene::WriteSceneDescription(const SceneDescription& scene_description, con
     if (node_count != 0)
     {
         file.Write(scene_description.local_transforms.GetData(), sizeof(scene_description.local_transforms[0]), node_count);
-        file.Write(scene_description.world_transforms.GetData(), sizeof(scene_description.world_transforms[0]), node_count);
         file.Write(scene_description.hierarchy.GetData(), sizeof(scene_description.hierarchy[0]), node_count);
+        file.Write(scene_description.node_flags.GetData(), sizeof(scene_description.node_flags[0]), node_count);
     }
 
     WriteMap(file, scene_description.node_id_to_mesh_id);
     WriteMap(file, scene_description.node_id_to_material_id);
 
-    if (!scene_description.node_id_to_name.empty() && !scene_description.node_names.IsEmpty())
-    {
-        WriteMap(file, scene_description.node_id_to_name);
-        WriteStringList(file, scene_description.node_names);
-        WriteStringList(file, scene_description.material_names);
-    }
+    WriteMap(file, scene_description.node_id_to_name);
+    WriteStringList(file, scene_description.node_names);
+    WriteStringList(file, scene_description.material_names);
 
     return true;
 }
 
+void Scene::BuildShapes(SceneDrawData& in_out_scene)
+{
+    in_out_scene.shapes.Clear();
+    for (const auto& node : in_out_scene.scene_description.node_id_to_mesh_id)
+    {
+        const Scene::NodeId node_id = node.first;
+        const uint32_t mesh_id = node.second;
+        const auto material_iter = in_out_scene.scene_description.node_id_to_material_id.find(node_id);
+        if (material_iter == in_out_scene.scene_description.node_id_to_material_id.end())
+        {
+            continue;
+        }
+        const uint32_t material_id = material_iter->second;
+        in_out_scene.shapes.PushBack({.mesh_index = mesh_id,
+                                      .material_index = material_id,
+                                      .lod = 0,
+                                      .vertex_buffer_offset = in_out_scene.mesh_data.meshes[mesh_id].vertex_offset,
+                                      .index_buffer_offset = in_out_scene.mesh_data.meshes[mesh_id].index_offset,
+                                      .transform_index = node_id});
+    }
+}
+
 bool Scene::ReadScene(SceneDrawData& out_scene, const Opal::StringUtf8& scene_file, const Opal::StringUtf8& mesh_file,
                             const Opal::StringUtf8& material_file, const Rndr::GraphicsContext& graphics_context)
 {
@@ -162,37 +303,198 @@ bool Scene::ReadScene(SceneDrawData& out_scene, const Opal::StringUtf8& scene_fi
         return false;
     }
 
-    for (const auto& node : out_scene.scene_description.node_id_to_mesh_id)
+    BuildShapes(out_scene);
+
+    // Mark roots as changed so that whole hierarchy is recalculated
+    Scene::MarkAllAsChanged(out_scene.scene_description);
+    Scene::RecalculateWorldTransforms(out_scene.scene_description);
+
+    return true;
+}
+
+bool Scene::MergeScenes(SceneDrawData& out_scene, const Opal::ArrayView<const SceneMergeInput>& inputs,
+                        const Rndr::GraphicsContext& graphics_context)
+{
+    if (inputs.IsEmpty())
     {
-        const Scene::NodeId node_id = node.first;
-        const uint32_t mesh_id = node.second;
-        const auto material_iter = out_scene.scene_description.node_id_to_material_id.find(node_id);
-        if (material_iter == out_scene.scene_description.node_id_to_material_id.end())
+        RNDR_LOG_ERROR("No scenes to merge!");
+        return false;
+    }
+
+    SceneDescription& out_description = out_scene.scene_description;
+    const NodeId root_node = AddNode(out_description, k_invalid_node_id, 0);
+    SetNodeName(out_description, root_node, "Root");
+
+    Opal::DynamicArray<MeshData> mesh_data(inputs.GetSize());
+    Opal::DynamicArray<Opal::StringUtf8> texture_paths;
+    Opal::HashMap<Opal::StringUtf8, ImageId, Opal::StringHash<Opal::StringUtf8>> texture_path_to_index;
+    // Materials of the merged scene by the hash of their contents, materials with colliding hashes share the entry
+    Opal::HashMap<u64, Opal::DynamicArray<uint32_t>> material_hash_to_ids;
+    uint32_t mesh_offset = 0;
+    for (size_t input_index = 0; input_index < inputs.GetSize(); ++input_index)
+    {
+        const SceneMergeInput& input = inputs[input_index];
+
+        SceneDescription description;
+        if (!ReadSceneDescription(description, input.scene_file))
         {
-            continue;
+            RNDR_LOG_ERROR("Failed to read scene description from %s!", input.scene_file.GetData());
+            return false;
         }
-        const uint32_t material_id = material_iter->second;
-        out_scene.shapes.PushBack({.mesh_index = mesh_id,
-                                   .material_index = material_id,
-                                   .lod = 0,
-                                   .vertex_buffer_offset = out_scene.mesh_data.meshes[mesh_id].vertex_offset,
-                                   .index_buffer_offset = out_scene.mesh_data.meshes[mesh_id].index_offset,
-                                   .transform_index = node_id});
+        if (!Mesh::ReadData(mesh_data[input_index], input.mesh_file))
+        {
+            return false;
+        }
+        Opal::DynamicArray<MaterialDescription> materials;
+        Opal::DynamicArray<Opal::StringUtf8> input_texture_paths;
+        if (!Material::ReadData(materials, input_texture_paths, input.material_file))
+        {
+            return false;
+        }
+
+        // Texture paths are absolute at this point so the same texture used by different inputs has the same path
+        Opal::DynamicArray<ImageId> texture_remap(input_texture_paths.GetSize());
+        for (size_t i = 0; i < input_texture_paths.GetSize(); ++i)
+        {
+            const auto texture_iter = texture_path_to_index.find(input_texture_paths[i]);
+            if (texture_iter != texture_path_to_index.end())
+            {
+                texture_remap[i] = texture_iter->second;
+                continue;
+            }
+            texture_remap[i] = texture_paths.GetSize();
+            texture_path_to_index[input_texture_paths[i]] = texture_remap[i];
+            texture_paths.PushBack(input_texture_paths[i]);
+        }
+
+        // Once texture ids point to the merged texture list, identical materials compare equal
+        Opal::DynamicArray<uint32_t> material_remap(materials.GetSize());
+        for (size_t i = 0; i < materials.GetSize(); ++i)
+        {
+            MaterialDescription& material = materials[i];
+            RemapTexture(material.ambient_occlusion_texture, texture_remap);
+            RemapTexture(material.emissive_texture, texture_remap);
+            RemapTexture(material.albedo_texture, texture_remap);
+            RemapTexture(material.metallic_roughness_texture, texture_remap);
+            RemapTexture(material.normal_texture, texture_remap);
+            RemapTexture(material.opacity_texture, texture_remap);
+
+            Opal::DynamicArray<uint32_t>& same_hash_ids = material_hash_to_ids[HashMaterial(material)];
+            uint32_t material_id = static_cast<uint32_t>(out_scene.materials.GetSize());
+            for (const uint32_t candidate_id : same_hash_ids)
+            {
+                if (IsSameMaterial(out_scene.materials[candidate_id], material))
+                {
+                    material_id = candidate_id;
+                    break;
+                }
+            }
+            if (material_id == out_scene.materials.GetSize())
+            {
+                same_hash_ids.PushBack(material_id);
+                out_scene.materials.PushBack(material);
+                out_description.material_names.PushBack(i < description.material_names.GetSize() ? description.material_names[i]
+                                                                                                 : Opal::StringUtf8());
+            }
+            material_remap[i] = material_id;
+        }
+
+        const NodeId input_root_node = AddNode(out_description, root_node, 1);
+        SetNodeName(out_description, input_root_node, Opal::StringUtf8("Scene_") + std::to_string(input_index).c_str());
+        out_description.local_transforms[input_root_node] = input.transform;
+
+        // Parents are always stored before their children so a single pass is enough to remap all the parents
+        Opal::DynamicArray<NodeId> node_remap(description.hierarchy.GetSize(), k_invalid_node_id);
+        for (NodeId node = 0; node < static_cast<NodeId>(description.hierarchy.GetSize()); ++node)
+        {
+            const HierarchyNode& hierarchy_node = description.hierarchy[node];
+            if (hierarchy_node.level == k_removed_node_level)
+            {
+                continue;
+            }
+            const int32_t new_level = hierarchy_node.level + 2;
+            if (new_level >= k_max_node_level)
+            {
+                RNDR_LOG_ERROR("Merged scene hierarchy is too deep, max level is %d!", k_max_node_level);
+                return false;
+            }
+            const NodeId parent = hierarchy_node.parent == k_invalid_node_id ? input_root_node : node_remap[hierarchy_node.parent];
+            if (parent == k_invalid_node_id)
+            {
+                RNDR_LOG_ERROR("Node %d in %s is stored before its parent %d, compact the scene before merging it!", node,
+                               input.scene_file.GetData(), hierarchy_node.parent);
+                return false;
+            }
+
+            const NodeId new_node = AddNode(out_description, parent, new_level);
+            node_remap[node] = new_node;
+            out_description.local_transforms[new_node] = description.local_transforms[node];
+            out_description.node_flags[new_node] = description.node_flags[node];
+
+            const auto mesh_iter = description.node_id_to_mesh_id.find(node);
+            if (mesh_iter != description.node_id_to_mesh_id.end())
+            {
+                SetNodeMeshId(out_description, new_node, mesh_iter->second + mesh_offset);
+            }
+            const auto material_iter = description.node_id_to_material_id.find(node);
+            if (material_iter != description.node_id_to_material_id.end())
+            {
+                SetNodeMaterialId(out_description, new_node, material_remap[material_iter->second]);
+            }
+            const auto name_iter = description.node_id_to_name.find(node);
+            if (name_iter != description.node_id_to_name.end())
+            {
+                SetNodeName(out_description, new_node, description.node_names[name_iter->second]);
+            }
+        }
+
+        mesh_offset += static_cast<uint32_t>(mesh_data[input_index].meshes.GetSize());
     }
 
-    // Mark root as changed so that whole hierarchy is recalculated
-    Scene::MarkAsChanged(out_scene.scene_description, 0);
-    Scene::RecalculateWorldTransforms(out_scene.scene_description);
+    if (!Mesh::Merge(out_scene.mesh_data, Opal::ArrayView<MeshData>(mesh_data)))
+    {
+        RNDR_LOG_ERROR("Failed to merge mesh data!");
+        return false;
+    }
+
+    if (!Material::LoadTextures(out_scene.materials, out_scene.textures, texture_paths, graphics_context))
+    {
+        return false;
+    }
+
+    BuildShapes(out_scene);
+
+    MarkAsChanged(out_description, root_node);
+    RecalculateWorldTransforms(out_description);
 
     return true;
 }
 
+i32 Scene::AddInstanceSet(SceneDrawData& scene, u32 mesh_index, u32 material_index,
+                          const Opal::ArrayView<const InstanceTransform>& transforms)
+{
+    if (mesh_index >= scene.mesh_data.meshes.GetSize() || material_index >= scene.materials.GetSize())
+    {
+        RNDR_LOG_ERROR("AddInstanceSet: Mesh %u or material %u doesn't exist!", mesh_index, material_index);
+        return -1;
+    }
+    InstanceSet set{.mesh_index = mesh_index, .material_index = material_index};
+    set.transforms.Resize(transforms.GetSize());
+    for (size_t i = 0; i < transforms.GetSize(); ++i)
+    {
+        set.transforms[i] = transforms[i];
+    }
+    scene.instance_sets.PushBack(Opal::Move(set));
+    return static_cast<i32>(scene.instance_sets.GetSize() - 1);
+}
+
 Scene::NodeId Scene::AddNode(SceneDescription& scene, int32_t parent, int32_t level)
 {
     const NodeId node_id = static_cast<NodeId>(scene.hierarchy.GetSize());
-    scene.local_transforms.PushBack(Matrix4x4f(1.0f));
+    scene.local_transforms.PushBack(LocalTransform{});
     scene.world_transforms.PushBack(Matrix4x4f(1.0f));
     scene.hierarchy.PushBack(HierarchyNode{.parent = parent, .last_sibling = -1, .level = level});
+    scene.node_flags.PushBack(NodeFlags::None);
 
     if (parent > -1)
     {
@@ -229,6 +531,104 @@ void Scene::SetNodeName(SceneDescription& scene, Scene::NodeId node, const Opal:
     scene.node_names.PushBack(name);
 }
 
+Rndr::Matrix4x4f Scene::ToMatrix(const LocalTransform& transform)
+{
+    const float x = transform.rotation.v.x;
+    const float y = transform.rotation.v.y;
+    const float z = transform.rotation.v.z;
+    const float w = transform.rotation.w;
+    const float rotation[3][3] = {{1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y - w * z), 2.0f * (x * z + w * y)},
+                                  {2.0f * (x * y + w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z - w * x)},
+                                  {2.0f * (x * z - w * y), 2.0f * (y * z + w * x), 1.0f - 2.0f * (x * x + y * y)}};
+    const float scale[3] = {transform.scale.x, transform.scale.y, transform.scale.z};
+    const float translation[3] = {transform.translation.x, transform.translation.y, transform.translation.z};
+
+    Rndr::Matrix4x4f matrix(1.0f);
+    for (int32_t row = 0; row < 3; ++row)
+    {
+        for (int32_t column = 0; column < 3; ++column)
+        {
+            matrix.elements[row][column] = rotation[row][column] * scale[column];
+        }
+        matrix.elements[row][3] = translation[row];
+    }
+    return matrix;
+}
+
+Scene::LocalTransform Scene::ToLocalTransform(const Rndr::Matrix4x4f& matrix)
+{
+    LocalTransform transform;
+    transform.translation = Rndr::Vector3f(matrix.elements[0][3], matrix.elements[1][3], matrix.elements[2][3]);
+
+    float rotation[3][3];
+    float scale[3];
+    for (int32_t column = 0; column < 3; ++column)
+    {
+        scale[column] = std::sqrt(matrix.elements[0][column] * matrix.elements[0][column] +
+                                  matrix.elements[1][column] * matrix.elements[1][column] +
+                                  matrix.elements[2][column] * matrix.elements[2][column]);
+    }
+    const float determinant = matrix.elements[0][0] * (matrix.elements[1][1] * matrix.elements[2][2] - matrix.elements[1][2] * matrix.elements[2][1]) -
+                              matrix.elements[0][1] * (matrix.elements[1][0] * matrix.elements[2][2] - matrix.elements[1][2] * matrix.elements[2][0]) +
+                              matrix.elements[0][2] * (matrix.elements[1][0] * matrix.elements[2][1] - matrix.elements[1][1] * matrix.elements[2][0]);
+    if (determinant < 0.0f)
+    {
+        // Mirroring is expressed as a negative scale on the X axis
+        scale[0] = -scale[0];
+    }
+    for (int32_t column = 0; column < 3; ++column)
+    {
+        const float inv_scale = scale[column] != 0.0f ? 1.0f / scale[column] : 0.0f;
+        for (int32_t row = 0; row < 3; ++row)
+        {
+            rotation[row][column] = matrix.elements[row][column] * inv_scale;
+        }
+    }
+    transform.scale = Rndr::Vector3f(scale[0], scale[1], scale[2]);
+
+    // Rotation matrix to quaternion, picking the largest diagonal term to keep the division stable
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+    float w = 0.0f;
+    const float trace = rotation[0][0] + rotation[1][1] + rotation[2][2];
+    if (trace > 0.0f)
+    {
+        const float s = 2.0f * std::sqrt(trace + 1.0f);
+        w = 0.25f * s;
+        x = (rotation[2][1] - rotation[1][2]) / s;
+        y = (rotation[0][2] - rotation[2][0]) / s;
+        z = (rotation[1][0] - rotation[0][1]) / s;
+    }
+    else if (rotation[0][0] > rotation[1][1] && rotation[0][0] > rotation[2][2])
+    {
+        const float s = 2.0f * std::sqrt(1.0f + rotation[0][0] - rotation[1][1] - rotation[2][2]);
+        w = (rotation[2][1] - rotation[1][2]) / s;
+        x = 0.25f * s;
+        y = (rotation[0][1] + rotation[1][0]) / s;
+        z = (rotation[0][2] + rotation[2][0]) / s;
+    }
+    else if (rotation[1][1] > rotation[2][2])
+    {
+        const float s = 2.0f * std::sqrt(1.0f + rotation[1][1] - rotation[0][0] - rotation[2][2]);
+        w = (rotation[0][2] - rotation[2][0]) / s;
+        x = (rotation[0][1] + rotation[1][0]) / s;
+        y = 0.25f * s;
+        z = (rotation[1][2] + rotation[2][1]) / s;
+    }
+    else
+    {
+        const float s = 2.0f * std::sqrt(1.0f + rotation[2][2] - rotation[0][0] - rotation[1][1]);
+        w = (rotation[1][0] - rotation[0][1]) / s;
+        x = (rotation[0][2] + rotation[2][0]) / s;
+        y = (rotation[1][2] + rotation[2][1]) / s;
+        z = 0.25f * s;
+    }
+    transform.rotation.v = Rndr::Vector3f(x, y, z);
+    transform.rotation.w = w;
+    return transform;
+}
+
 bool Scene::IsValidNodeId(const SceneDescription& scene, Scene::NodeId node)
 {
     return node < scene.hierarchy.GetSize();
@@ -246,6 +646,208 @@ void Scene::SetNodeMaterialId(SceneDescription& scene, Scene::NodeId node, uint3
     scene.node_id_to_material_id[node] = material_id;
 }
 
+void Scene::SetNodeFlags(SceneDescription& scene, Scene::NodeId node, NodeFlags flags)
+{
+    RNDR_ASSERT(IsValidNodeId(scene, node), "Node id is not valid");
+    scene.node_flags[node] = flags;
+}
+
+bool Scene::IsDynamicNode(const SceneDescription& scene, Scene::NodeId node)
+{
+    RNDR_ASSERT(IsValidNodeId(scene, node), "Node id is not valid");
+    return !!(scene.node_flags[node] & NodeFlags::Dynamic);
+}
+
+void Scene::RemoveNode(SceneDescription& scene, Scene::NodeId node)
+{
+    RNDR_ASSERT(IsValidNodeId(scene, node), "Node id is not valid");
+    RNDR_ASSERT(!IsRemovedNode(scene, node), "Node is already removed");
+
+    // Unlink the node from the list of children of its parent
+    const NodeId parent = scene.hierarchy[node].parent;
+    if (parent != k_invalid_node_id)
+    {
+        const NodeId first_child = scene.hierarchy[parent].first_child;
+        const NodeId next_sibling = scene.hierarchy[node].next_sibling;
+        if (first_child == node)
+        {
+            // First child also keeps track of the last sibling, so pass that info to the new first child
+            scene.hierarchy[parent].first_child = next_sibling;
+            if (next_sibling != k_invalid_node_id)
+            {
+                scene.hierarchy[next_sibling].last_sibling = scene.hierarchy[node].last_sibling;
+            }
+        }
+        else
+        {
+            NodeId prev_sibling = first_child;
+            while (scene.hierarchy[prev_sibling].next_sibling != node)
+            {
+                prev_sibling = scene.hierarchy[prev_sibling].next_sibling;
+            }
+            scene.hierarchy[prev_sibling].next_sibling = next_sibling;
+            if (scene.hierarchy[first_child].last_sibling == node)
+            {
+                scene.hierarchy[first_child].last_sibling = prev_sibling;
+            }
+        }
+    }
+
+    // Mark the whole subtree as removed. Links inside the subtree are kept since they are not reachable anymore.
+    std::stack<Scene::NodeId> stack;
+    stack.push(node);
+    while (!stack.empty())
+    {
+        const NodeId node_to_remove = stack.top();
+        stack.pop();
+
+        for (NodeId child = scene.hierarchy[node_to_remove].first_child; child != k_invalid_node_id;
+             child = scene.hierarchy[child].next_sibling)
+        {
+            stack.push(child);
+        }
+
+        scene.hierarchy[node_to_remove].level = k_removed_node_level;
+        scene.node_id_to_mesh_id.erase(node_to_remove);
+        scene.node_id_to_material_id.erase(node_to_remove);
+        scene.node_id_to_name.erase(node_to_remove);
+    }
+
+    scene.hierarchy[node].parent = k_invalid_node_id;
+    scene.hierarchy[node].next_sibling = k_invalid_node_id;
+    scene.hierarchy[node].last_sibling = k_invalid_node_id;
+}
+
+bool Scene::IsRemovedNode(const SceneDescription& scene, Scene::NodeId node)
+{
+    RNDR_ASSERT(IsValidNodeId(scene, node), "Node id is not valid");
+    return scene.hierarchy[node].level == k_removed_node_level;
+}
+
+void Scene::Compact(SceneDescription& scene, Opal::DynamicArray<NodeId>& out_old_to_new_node_ids)
+{
+    const size_t node_count = scene.hierarchy.GetSize();
+    out_old_to_new_node_ids.Clear();
+    out_old_to_new_node_ids.Resize(node_count, k_invalid_node_id);
+
+    // Breadth-first traversal starting from all the roots. Array of visited nodes doubles as the queue. Removed nodes are
+    // not reachable from any root so they are dropped here.
+    Opal::DynamicArray<NodeId> new_to_old_node_ids;
+    new_to_old_node_ids.Reserve(node_count);
+    for (NodeId node = 0; node < static_cast<NodeId>(node_count); ++node)
+    {
+        if (scene.hierarchy[node].parent == k_invalid_node_id && !IsRemovedNode(scene, node))
+        {
+            new_to_old_node_ids.PushBack(node);
+        }
+    }
+    for (size_t i = 0; i < new_to_old_node_ids.GetSize(); ++i)
+    {
+        const NodeId old_node = new_to_old_node_ids[i];
+        out_old_to_new_node_ids[old_node] = static_cast<NodeId>(i);
+        for (NodeId child = scene.hierarchy[old_node].first_child; child != k_invalid_node_id; child = scene.hierarchy[child].next_sibling)
+        {
+            new_to_old_node_ids.PushBack(child);
+        }
+    }
+
+    auto remap = [&out_old_to_new_node_ids](NodeId node)
+    { return node == k_invalid_node_id ? k_invalid_node_id : out_old_to_new_node_ids[node]; };
+
+    const size_t new_node_count = new_to_old_node_ids.GetSize();
+    Opal::DynamicArray<LocalTransform> local_transforms(new_node_count);
+    Opal::DynamicArray<Rndr::Matrix4x4f> world_transforms(new_node_count);
+    Opal::DynamicArray<HierarchyNode> hierarchy(new_node_count);
+    Opal::DynamicArray<NodeFlags> node_flags(new_node_count);
+    for (size_t i = 0; i < new_node_count; ++i)
+    {
+        const NodeId old_node = new_to_old_node_ids[i];
+        const HierarchyNode& old_hierarchy_node = scene.hierarchy[old_node];
+        local_transforms[i] = scene.local_transforms[old_node];
+        world_transforms[i] = scene.world_transforms[old_node];
+        node_flags[i] = scene.node_flags[old_node];
+        hierarchy[i] = HierarchyNode{.parent = remap(old_hierarchy_node.parent),
+                                     .first_child = remap(old_hierarchy_node.first_child),
+                                     .next_sibling = remap(old_hierarchy_node.next_sibling),
+                                     .last_sibling = remap(old_hierarchy_node.last_sibling),
+                                     .level = old_hierarchy_node.level};
+    }
+    scene.local_transforms = Opal::Move(local_transforms);
+    scene.world_transforms = Opal::Move(world_transforms);
+    scene.hierarchy = Opal::Move(hierarchy);
+    scene.node_flags = Opal::Move(node_flags);
+
+    auto remap_map = [&remap](Opal::HashMap<Scene::NodeId, uint32_t>& map)
+    {
+        Opal::HashMap<Scene::NodeId, uint32_t> new_map;
+        for (const auto& pair : map)
+        {
+            const NodeId new_node = remap(pair.first);
+            if (new_node != k_invalid_node_id)
+            {
+                new_map[new_node] = pair.second;
+            }
+        }
+        map = Opal::Move(new_map);
+    };
+    remap_map(scene.node_id_to_mesh_id);
+    remap_map(scene.node_id_to_material_id);
+
+    // Node names are stored in the new node order as well, names of the removed nodes are dropped
+    Opal::HashMap<Scene::NodeId, uint32_t> node_id_to_name;
+    Opal::DynamicArray<Opal::StringUtf8> node_names;
+    for (size_t i = 0; i < new_node_count; ++i)
+    {
+        const auto name_iter = scene.node_id_to_name.find(new_to_old_node_ids[i]);
+        if (name_iter != scene.node_id_to_name.end())
+        {
+            node_id_to_name[static_cast<NodeId>(i)] = static_cast<uint32_t>(node_names.GetSize());
+            node_names.PushBack(scene.node_names[name_iter->second]);
+        }
+    }
+    scene.node_id_to_name = Opal::Move(node_id_to_name);
+    scene.node_names = Opal::Move(node_names);
+
+    auto remap_list = [&remap](Opal::DynamicArray<Scene::NodeId>& nodes)
+    {
+        size_t kept_count = 0;
+        for (const NodeId node : nodes)
+        {
+            const NodeId new_node = remap(node);
+            if (new_node != k_invalid_node_id)
+            {
+                nodes[kept_count++] = new_node;
+            }
+        }
+        nodes.Resize(kept_count);
+    };
+    for (Opal::DynamicArray<Scene::NodeId>& dirty_nodes : scene.dirty_nodes)
+    {
+        remap_list(dirty_nodes);
+    }
+    remap_list(scene.changed_nodes);
+}
+
+void Scene::Compact(SceneDrawData& scene)
+{
+    Opal::DynamicArray<NodeId> old_to_new_node_ids;
+    Compact(scene.scene_description, old_to_new_node_ids);
+
+    size_t shape_count = 0;
+    for (const MeshDrawData& shape : scene.shapes)
+    {
+        const NodeId new_node = old_to_new_node_ids[static_cast<size_t>(shape.transform_index)];
+        if (new_node == k_invalid_node_id)
+        {
+            continue;
+        }
+        MeshDrawData& new_shape = scene.shapes[shape_count++];
+        new_shape = shape;
+        new_shape.transform_index = new_node;
+    }
+    scene.shapes.Resize(shape_count);
+}
+
 void Scene::MarkAsChanged(SceneDescription& scene, Scene::NodeId node)
 {
     std::stack<Scene::NodeId> stack;
@@ -256,6 +858,7 @@ void Scene::MarkAsChanged(SceneDescription& scene, Scene::NodeId node)
         const NodeId node_to_mark = stack.top();
         stack.pop();
         RNDR_ASSERT(IsValidNodeId(scene, node_to_mark), "Node id is not valid");
+        RNDR_ASSERT(!IsRemovedNode(scene, node_to_mark), "Node is removed");
 
         const int32_t level = scene.hierarchy[node_to_mark].level;
         scene.dirty_nodes[level].PushBack(node_to_mark);
@@ -268,23 +871,53 @@ void Scene::MarkAsChanged(SceneDescription& scene, Scene::NodeId node)
     }
 }
 
-void Scene::RecalculateWorldTransforms(SceneDescription& scene)
+void Scene::MarkAllAsChanged(SceneDescription& scene)
 {
-    // Process root level first
-    if (!scene.dirty_nodes[0].IsEmpty())
+    for (NodeId node = 0; node < static_cast<NodeId>(scene.hierarchy.GetSize()); ++node)
     {
-        const NodeId root_node = scene.dirty_nodes[0].Back().GetValue();
-        scene.world_transforms[root_node] = scene.local_transforms[root_node];
-        scene.dirty_nodes[0].Clear();
+        if (scene.hierarchy[node].parent == k_invalid_node_id && !IsRemovedNode(scene, node))
+        {
+            MarkAsChanged(scene, node);
+        }
     }
+}
 
-    for (int i = 1; i < k_max_node_level && !scene.dirty_nodes[i].IsEmpty(); ++i)
+void Scene::RecalculateWorldTransforms(SceneDescription& scene)
+{
+    for (int32_t level = 0; level < k_max_node_level; ++level)
     {
-        for (const NodeId node : scene.dirty_nodes[i])
+        Opal::DynamicArray<NodeId>& dirty_nodes = scene.dirty_nodes[level];
+        if (dirty_nodes.IsEmpty())
+        {
+            continue;
+        }
+
+        // Process nodes in id order so that the per-node arrays are walked front to back. This also makes it trivial to
+        // skip nodes that were marked as changed more than once.
+        std::sort(dirty_nodes.begin(), dirty_nodes.end());
+        NodeId prev_node = k_invalid_node_id;
+        for (const NodeId node : dirty_nodes)
         {
+            if (node == prev_node || IsRemovedNode(scene, node))
+            {
+                continue;
+            }
+            prev_node = node;
+
             const NodeId parent = scene.hierarchy[node].parent;
-            scene.world_transforms[node] = scene.world_transforms[parent] * scene.local_transforms[node];
+            if (parent == k_invalid_node_id)
+            {
+                scene.world_transforms[node] = ToMatrix(scene.local_transforms[node]);
+            }
+            else
+            {
+                scene.world_transforms[node] = scene.world_transforms[parent] * ToMatrix(scene.local_transforms[node]);
+            }
+            if (scene.track_changed_nodes)
+            {
+                scene.changed_nodes.PushBack(node);
+            }
         }
-        scene.dirty_nodes[i].Clear();
+        dirty_nodes.Clear();
     }
 }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "opal/container/array-view.h"
 #include "opal/container/dynamic-array.h"
 #include "opal/container/hash-map.h"
 #include "opal/container/in-place-array.h"
 #include "opal/container/string.h"
 
 #include "rndr/enum-flags.h"
+#include "rndr/file.h"
 #include "rndr/math.h"
 
 #include "material.h"
@@ -18,6 +20,9 @@ using NodeId = int32_t;
 constexpr int32_t k_max_node_level = 16;
 constexpr NodeId k_invalid_node_id = -1;
 
+/** Level assigned to nodes that were removed from the hierarchy but not yet compacted away. */
+constexpr int32_t k_removed_node_level = -1;
+
 struct HierarchyNode
 {
     /** Parent node id or -1 if this is a root node. */
@@ -31,10 +36,30 @@ struct HierarchyNode
 
     NodeId last_sibling = k_invalid_node_id;
 
-    /** Level of the node in the hierarchy. Root node is at level 0. */
+    /** Level of the node in the hierarchy. Root node is at level 0. Removed nodes are at k_removed_node_level. */
     int32_t level = 0;
 };
+
+enum class NodeFlags : u8
+{
+    None = 0,
+    /** Node is expected to move often so it should be placed in structures that are cheap to update. */
+    Dynamic = 1 << 0,
+};
+
+/**
+ * Transform of a node relative to its parent stored as translation, rotation and scale. Takes 40 bytes compared to 64
+ * bytes of a full matrix. Transform is applied in scale, rotation, translation order.
+ */
+struct LocalTransform
+{
+    Rndr::Vector3f translation = Rndr::Vector3f(0.0f, 0.0f, 0.0f);
+    /** Default constructed quaternion is an identity rotation. */
+    Rndr::Quatf rotation;
+    Rndr::Vector3f scale = Rndr::Vector3f(1.0f, 1.0f, 1.0f);
+};
 }  // namespace Scene
+RNDR_ENUM_CLASS_FLAGS(Scene::NodeFlags)
 
 /**
  * Describes the scene organization and the transforms of the nodes.
@@ -42,14 +67,17 @@ struct HierarchyNode
 struct SceneDescription
 {
     /** Transforms relative to the parent node. Transform of the root is relative to the world. */
-    Opal::DynamicArray<Rndr::Matrix4x4f> local_transforms;
+    Opal::DynamicArray<Scene::LocalTransform> local_transforms;
 
-    /** Transforms relative to the world. */
+    /** Transforms relative to the world. Built from local transforms in RecalculateWorldTransforms and not stored in the file. */
     Opal::DynamicArray<Rndr::Matrix4x4f> world_transforms;
 
     /** Hierarchy of the nodes. */
     Opal::DynamicArray<Scene::HierarchyNode> hierarchy;
 
+    /** Flags of the nodes. */
+    Opal::DynamicArray<Scene::NodeFlags> node_flags;
+
     /** Maps node id to mesh id. */
     Opal::HashMap<Scene::NodeId, uint32_t> node_id_to_mesh_id;
 
@@ -67,6 +95,43 @@ struct SceneDescription
 
     /** List of nodes that are dirty and that need to recalculate their world transform. */
     Opal::DynamicArray<Scene::NodeId> dirty_nodes[Scene::k_max_node_level];
+
+    /**
+     * List of nodes whose world transform was recalculated by RecalculateWorldTransforms. Only filled while
+     * track_changed_nodes is set. Consumers that mirror world transforms, like the GPU model data, are responsible for
+     * clearing it.
+     */
+    Opal::DynamicArray<Scene::NodeId> changed_nodes;
+
+    /** Set by the consumers of changed_nodes, like Scene::SetupModelDataSync. Without one the list would only grow. */
+    bool track_changed_nodes = false;
+};
+
+/**
+ * Compact transform of one instance in an instance set. Applies uniform scale, then rotation and then translation, in
+ * 32 bytes instead of the 128 bytes of the model and normal matrix of a shape.
+ */
+struct InstanceTransform
+{
+    Rndr::Vector3f position = Rndr::Vector3f(0.0f, 0.0f, 0.0f);
+    f32 scale = 1.0f;
+    /** Default constructed quaternion is an identity rotation. */
+    Rndr::Quatf rotation;
+};
+static_assert(sizeof(InstanceTransform) == 32, "InstanceTransform has to match the layout in material-pbr.vert");
+
+/**
+ * Many copies of one mesh with one material, like foliage or debris, that are not part of the scene hierarchy. The whole
+ * set is drawn with a single instanced draw.
+ */
+struct InstanceSet
+{
+    /** Mesh index in the meshes array in MeshData. */
+    u32 mesh_index = 0;
+    /** Material index in the materials array in SceneDrawData. */
+    u32 material_index = 0;
+    /** Transforms of the instances in world space. */
+    Opal::DynamicArray<InstanceTransform> transforms;
 };
 
 /**
@@ -84,6 +149,23 @@ struct SceneDrawData
     Opal::DynamicArray<Rndr::Texture> textures;
     /** Contains all the scene data, like hierarchy. */
     SceneDescription scene_description;
+    /** Sets of mesh instances drawn next to the shapes. Created at runtime and not stored in the scene file. */
+    Opal::DynamicArray<InstanceSet> instance_sets;
+};
+
+/**
+ * Describes one scene that should be merged into a bigger scene using Scene::MergeScenes.
+ */
+struct SceneMergeInput
+{
+    /** The file to load the scene description from. */
+    Opal::StringUtf8 scene_file;
+    /** The file to load the mesh data from. */
+    Opal::StringUtf8 mesh_file;
+    /** The file to load the material data from. */
+    Opal::StringUtf8 material_file;
+    /** Transform of the scene relative to the root of the merged scene. */
+    Scene::LocalTransform transform;
 };
 
 namespace Scene
@@ -97,6 +179,15 @@ namespace Scene
  */
 bool ReadSceneDescription(SceneDescription& out_scene_description, const Opal::StringUtf8& scene_file);
 
+/**
+ * Loads a scene description from an open file. The file is left right after the description, where optional sections of
+ * version 4 and later files start.
+ * @param out_scene_description The scene description to fill.
+ * @param file The file to read from, positioned at the start of the scene description.
+ * @return True if the scene description was successfully loaded, false otherwise.
+ */
+bool ReadSceneDescription(SceneDescription& out_scene_description, Rndr::FileHandler& file);
+
 /**
  * Writes a scene description to a file.
  * @param scene_description The scene description to write.
@@ -105,6 +196,21 @@ bool ReadSceneDescription(SceneDescription& out_scene_description, const Opal::S
  */
 bool WriteSceneDescription(const SceneDescription& scene_description, const Opal::StringUtf8& scene_file);
 
+/**
+ * Writes a scene description to an open file. Optional sections can be written to the file after it.
+ * @param scene_description The scene description to write.
+ * @param file The file to write to.
+ * @return True if the scene description was successfully written, false otherwise.
+ */
+bool WriteSceneDescription(const SceneDescription& scene_description, Rndr::FileHandler& file);
+
+/**
+ * Creates a shape for each node that has both a mesh and a material. Shapes are in the iteration order of the node to mesh
+ * map.
+ * @param in_out_scene The scene draw data with the scene description and the mesh data loaded. Its shapes are replaced.
+ */
+void BuildShapes(SceneDrawData& in_out_scene);
+
 /**
  * Loads a scene draw data from a file.
  * @param out_scene The scene draw data to fill.
@@ -116,6 +222,19 @@ bool WriteSceneDescription(const SceneDescription& scene_description, const Opal
 bool ReadScene(SceneDrawData& out_scene, const Opal::StringUtf8& scene_file, const Opal::StringUtf8& mesh_file,
                const Opal::StringUtf8& material_file, const Rndr::GraphicsContext& graphics_context);
 
+/**
+ * Loads multiple scenes and merges them into a single scene draw data. Each input hierarchy is attached to a new root
+ * through a node with the input's transform. Node, mesh and material ids are offset accordingly. Mesh data of all inputs
+ * is stored in a single vertex and index buffer, identical materials and textures used by multiple inputs are stored only
+ * once.
+ * @param out_scene The scene draw data to fill. Should be empty.
+ * @param inputs The scenes to merge.
+ * @param graphics_context Graphics context used to load the textures to the GPU.
+ * @return True if all scenes were successfully loaded and merged, false otherwise.
+ */
+bool MergeScenes(SceneDrawData& out_scene, const Opal::ArrayView<const SceneMergeInput>& inputs,
+                 const Rndr::GraphicsContext& graphics_context);
+
 /**
  * Writes a scene draw data to a file.
  * @param scene The scene draw data to write.
@@ -127,6 +246,16 @@ bool ReadScene(SceneDrawData& out_scene, const Opal::StringUtf8& scene_file, con
 bool WriteScene(const SceneDrawData& scene, const Opal::StringUtf8& scene_file, const Opal::StringUtf8& mesh_file,
                 const Opal::StringUtf8& material_file);
 
+/**
+ * Adds an instance set to the scene.
+ * @param scene The scene draw data to add the set to. Its mesh data and materials have to be loaded.
+ * @param mesh_index Mesh drawn by all the instances.
+ * @param material_index Material used by all the instances.
+ * @param transforms Transforms of the instances in world space.
+ * @return Index of the new set, or -1 if the mesh or the material doesn't exist.
+ */
+i32 AddInstanceSet(SceneDrawData& scene, u32 mesh_index, u32 material_index, const Opal::ArrayView<const InstanceTransform>& transforms);
+
 /******************************************************************************************************************************************/
 /** API for manipulating the scene description. *******************************************************************************************/
 /******************************************************************************************************************************************/
@@ -151,6 +280,67 @@ void SetNodeName(SceneDescription& scene, NodeId node, const Opal::StringUtf8& n
 void SetNodeMeshId(SceneDescription& scene, NodeId node, uint32_t mesh_id);
 void SetNodeMaterialId(SceneDescription& scene, NodeId node, uint32_t material_id);
 
+/**
+ * Set the flags of a node. Flags are not propagated to the children.
+ * @param scene The scene to set the node flags in.
+ * @param node The node id.
+ * @param flags The flags to set.
+ */
+void SetNodeFlags(SceneDescription& scene, NodeId node, NodeFlags flags);
+
+/**
+ * Check if a node is flagged as dynamic.
+ * @param scene The scene description to check the node in.
+ * @param node The node id to check.
+ * @return True if the node has the Dynamic flag set, false otherwise.
+ */
+bool IsDynamicNode(const SceneDescription& scene, NodeId node);
+
+/**
+ * Removes a node, together with all of its children, from the hierarchy. Removed nodes keep their ids and their slots in
+ * the per-node arrays until Compact is called.
+ * @param scene The scene description to remove the node from.
+ * @param node The node id to remove.
+ */
+void RemoveNode(SceneDescription& scene, NodeId node);
+
+/**
+ * Check if a node was removed from the hierarchy using RemoveNode.
+ * @param scene The scene description to check the node in.
+ * @param node The node id to check.
+ * @return True if the node is removed, false otherwise.
+ */
+bool IsRemovedNode(const SceneDescription& scene, NodeId node);
+
+/**
+ * Drops all removed nodes and re-sorts all per-node arrays so that the nodes are stored breadth-first, level by level,
+ * with children of the same parent stored next to each other. All node ids in the scene description are remapped.
+ * @param scene The scene description to compact.
+ * @param out_old_to_new_node_ids Maps old node ids to new node ids. Removed nodes map to k_invalid_node_id.
+ */
+void Compact(SceneDescription& scene, Opal::DynamicArray<NodeId>& out_old_to_new_node_ids);
+
+/**
+ * Compacts the scene description and remaps the transform indices of all shapes. Shapes attached to removed nodes are
+ * dropped.
+ * @param scene The scene draw data to compact.
+ */
+void Compact(SceneDrawData& scene);
+
+/**
+ * Builds a matrix from a local transform.
+ * @param transform The local transform.
+ * @return Matrix that applies scale, then rotation and then translation.
+ */
+Rndr::Matrix4x4f ToMatrix(const LocalTransform& transform);
+
+/**
+ * Decomposes an affine matrix into translation, rotation and scale. Shear can't be represented and is lost.
+ * @param matrix The matrix to decompose.
+ * @return The local transform.
+ */
+LocalTransform ToLocalTransform(const Rndr::Matrix4x4f& matrix);
+
 /**
  * Check if a node id is valid in the given scene description.
  * @param scene The scene description to check the node id in.
@@ -168,7 +358,16 @@ bool IsValidNodeId(const SceneDescription& scene, NodeId node);
 void MarkAsChanged(SceneDescription& scene, NodeId node);
 
 /**
- * Recalculates the world transforms of the nodes that are marked as dirty.
+ * Marks every root node, and with them the whole hierarchy, as dirty. Used after loading a scene, which can have more than
+ * one root, for example after merging scenes.
+ * @param scene The scene description to mark the nodes in.
+ */
+void MarkAllAsChanged(SceneDescription& scene);
+
+/**
+ * Recalculates the world transforms of the nodes that are marked as dirty. Nodes are processed level by level in
+ * increasing id order, so after Compact the memory is accessed sequentially within each level. Recalculated nodes are
+ * appended to the list of changed nodes if the scene tracks them.
  * @param scene The scene description to recalculate the world transforms in.
  */
 void RecalculateWorldTransforms(SceneDescription& scene);
@@ -0,0 +1,146 @@
+#include "shader-permutations.h"
+
+#include <cstring>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+bool HasTexture(ImageId texture)
+{
+    return texture != 0 && texture != k_invalid_image_id;
+}
+}  // namespace
+
+MaterialFeatures ShaderPermutations::GetMaterialFeatures(const MaterialDescription& material)
+{
+    MaterialFeatures features = MaterialFeatures::None;
+    if (HasTexture(material.albedo_texture))
+    {
+        features |= MaterialFeatures::AlbedoMap;
+    }
+    if (HasTexture(material.normal_texture))
+    {
+        features |= MaterialFeatures::NormalMap;
+    }
+    if (HasTexture(material.metallic_roughness_texture))
+    {
+        features |= MaterialFeatures::MetallicRoughnessMap;
+    }
+    if (HasTexture(material.ambient_occlusion_texture))
+    {
+        features |= MaterialFeatures::AmbientOcclusionMap;
+    }
+    if (HasTexture(material.emissive_texture))
+    {
+        features |= MaterialFeatures::EmissiveMap;
+    }
+    if (Material::IsAlphaTested(material))
+    {
+        features |= MaterialFeatures::AlphaTest;
+    }
+    return features;
+}
+
+void ShaderPermutations::AppendFeatureDefines(Opal::DynamicArray<Opal::StringUtf8>& out_defines, MaterialFeatures features)
+{
+    if (!!(features & MaterialFeatures::AlbedoMap))
+    {
+        out_defines.PushBack("HAS_ALBEDO_MAP");
+    }
+    if (!!(features & MaterialFeatures::NormalMap))
+    {
+        out_defines.PushBack("HAS_NORMAL_MAP");
+    }
+    if (!!(features & MaterialFeatures::MetallicRoughnessMap))
+    {
+        out_defines.PushBack("HAS_METALLIC_ROUGHNESS_MAP");
+    }
+    if (!!(features & MaterialFeatures::AmbientOcclusionMap))
+    {
+        out_defines.PushBack("HAS_AMBIENT_OCCLUSION_MAP");
+    }
+    if (!!(features & MaterialFeatures::EmissiveMap))
+    {
+        out_defines.PushBack("HAS_EMISSIVE_MAP");
+    }
+    if (!!(features & MaterialFeatures::AlphaTest))
+    {
+        out_defines.PushBack("HAS_ALPHA_TEST");
+    }
+}
+
+bool ShaderPermutations::SetupShaderPermutationCache(ShaderPermutationCache& out_cache, const ShaderPermutationCacheDesc& desc)
+{
+    if (desc.pipeline_desc.vertex_shader == nullptr || desc.fragment_source.IsEmpty())
+    {
+        RNDR_LOG_ERROR("SetupShaderPermutationCache: Vertex shader and fragment shader source are required!");
+        return false;
+    }
+
+    out_cache = {};
+    out_cache.desc = desc;
+    out_cache.permutations.Reserve(ShaderPermutationCache::k_feature_mask_count);
+    std::memset(out_cache.mask_to_permutation, ShaderPermutationCache::k_invalid_permutation, sizeof(out_cache.mask_to_permutation));
+    return true;
+}
+
+i32 ShaderPermutations::GetOrCreatePermutation(ShaderPermutationCache& in_out_cache, const Rndr::GraphicsContext& graphics_context,
+                                               MaterialFeatures features)
+{
+    const u32 mask = static_cast<u32>(features);
+    RNDR_ASSERT(mask < ShaderPermutationCache::k_feature_mask_count, "Feature mask is out of range");
+    if (in_out_cache.mask_to_permutation[mask] != ShaderPermutationCache::k_invalid_permutation)
+    {
+        in_out_cache.stats.cache_hit_count++;
+        return in_out_cache.mask_to_permutation[mask];
+    }
+    in_out_cache.stats.cache_miss_count++;
+
+    const f64 start_time = Opal::GetSeconds();
+    Rndr::ShaderDesc shader_desc{.type = Rndr::ShaderType::Fragment, .source = in_out_cache.desc.fragment_source};
+    shader_desc.defines = in_out_cache.desc.defines;
+    shader_desc.defines.PushBack("USE_MATERIAL_FEATURES");
+    AppendFeatureDefines(shader_desc.defines, features);
+
+    // Constructed in place since the pipeline refers to the shader
+    in_out_cache.permutations.PushBack({.features = features});
+    ShaderPermutation& permutation = in_out_cache.permutations[in_out_cache.permutations.GetSize() - 1];
+    permutation.pixel_shader = Rndr::Shader(graphics_context, shader_desc);
+    Rndr::PipelineDesc pipeline_desc = in_out_cache.desc.pipeline_desc;
+    pipeline_desc.pixel_shader = &permutation.pixel_shader;
+    if (permutation.pixel_shader.IsValid())
+    {
+        permutation.pipeline = Rndr::Pipeline(graphics_context, pipeline_desc);
+    }
+    in_out_cache.stats.compile_time_ms += (Opal::GetSeconds() - start_time) * 1000.0;
+    if (!permutation.pipeline.IsValid())
+    {
+        RNDR_LOG_ERROR("GetOrCreatePermutation: Failed to compile the permutation with feature mask 0x%x!", mask);
+        in_out_cache.permutations.PopBack();
+        return -1;
+    }
+
+    const u32 index = static_cast<u32>(in_out_cache.permutations.GetSize() - 1);
+    in_out_cache.mask_to_permutation[mask] = static_cast<u8>(index);
+    return static_cast<i32>(index);
+}
+
+bool ShaderPermutations::AssignMaterialPermutations(Opal::DynamicArray<u32>& out_material_permutations, ShaderPermutationCache& in_out_cache,
+                                                    const Rndr::GraphicsContext& graphics_context,
+                                                    const Opal::ArrayView<const MaterialDescription>& materials)
+{
+    out_material_permutations.Resize(materials.GetSize());
+    for (size_t i = 0; i < materials.GetSize(); ++i)
+    {
+        const i32 permutation = GetOrCreatePermutation(in_out_cache, graphics_context, GetMaterialFeatures(materials[i]));
+        if (permutation < 0)
+        {
+            return false;
+        }
+        out_material_permutations[i] = static_cast<u32>(permutation);
+    }
+    return true;
+}
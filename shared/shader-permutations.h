@@ -0,0 +1,128 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+#include "opal/container/string.h"
+
+#include "rndr/enum-flags.h"
+#include "rndr/render-api.h"
+
+#include "material.h"
+#include "types.h"
+
+/**
+ * Optional features of the material fragment shader. A program compiled for a feature mask only contains the code of its
+ * features, see USE_MATERIAL_FEATURES in material-pbr.frag.
+ */
+enum class MaterialFeatures : u8
+{
+    None = 0,
+    AlbedoMap = 1 << 0,
+    NormalMap = 1 << 1,
+    MetallicRoughnessMap = 1 << 2,
+    AmbientOcclusionMap = 1 << 3,
+    EmissiveMap = 1 << 4,
+    /** Fragments are discarded with the screen door alpha test, which also turns off early depth testing. */
+    AlphaTest = 1 << 5,
+};
+RNDR_ENUM_CLASS_FLAGS(MaterialFeatures)
+
+/**
+ * Fragment shader and pipeline compiled for one feature mask.
+ */
+struct ShaderPermutation
+{
+    MaterialFeatures features = MaterialFeatures::None;
+    Rndr::Shader pixel_shader;
+    Rndr::Pipeline pipeline;
+};
+
+/**
+ * Describes the programs created by the permutation cache.
+ */
+struct ShaderPermutationCacheDesc
+{
+    /** Source of the fragment shader, compiled with USE_MATERIAL_FEATURES and the defines of the feature mask. */
+    Opal::StringUtf8 fragment_source;
+    /** Defines added to every permutation, for example USE_PBR. */
+    Opal::DynamicArray<Opal::StringUtf8> defines;
+    /** Vertex shader and the fixed function state shared by all permutations. Pixel shader is replaced by the permutation's. */
+    Rndr::PipelineDesc pipeline_desc;
+};
+
+struct ShaderPermutationStats
+{
+    u64 cache_hit_count = 0;
+    u64 cache_miss_count = 0;
+    /** Time spent compiling and linking the permutations in milliseconds. */
+    f64 compile_time_ms = 0.0;
+};
+
+/**
+ * Programs compiled so far, one per feature mask. Programs are only compiled for masks that are requested, which in practice
+ * are a handful out of all possible masks.
+ */
+struct ShaderPermutationCache
+{
+    static constexpr u32 k_feature_mask_count = 1u << 6;
+    static constexpr u8 k_invalid_permutation = 0xFF;
+
+    ShaderPermutationCacheDesc desc;
+
+    /** Permutations in creation order. The index is used as the pipeline field of the draw keys. Capacity for all masks is
+     * reserved up front, so the permutations never move and pointers to their pipelines stay valid. */
+    Opal::DynamicArray<ShaderPermutation> permutations;
+
+    /** Index of the permutation of each feature mask, or k_invalid_permutation if it was not compiled yet. */
+    u8 mask_to_permutation[k_feature_mask_count];
+
+    ShaderPermutationStats stats;
+};
+
+namespace ShaderPermutations
+{
+
+/**
+ * Derives the features a material needs from its textures and alpha test threshold. Textures are missing if they are zero,
+ * like in the loaded materials, or k_invalid_image_id, like in the materials read without the textures.
+ * @param material Material to check.
+ * @return Feature mask of the material.
+ */
+MaterialFeatures GetMaterialFeatures(const MaterialDescription& material);
+
+/**
+ * Appends the shader defines enabling the given features.
+ * @param out_defines Array to append the defines to.
+ * @param features Feature mask.
+ */
+void AppendFeatureDefines(Opal::DynamicArray<Opal::StringUtf8>& out_defines, MaterialFeatures features);
+
+/**
+ * Sets up an empty cache.
+ * @param out_cache Cache to set up.
+ * @param desc Shader source, shared defines and pipeline state of the permutations.
+ * @return True if the cache was set up, false if the description has no vertex shader or fragment source.
+ */
+bool SetupShaderPermutationCache(ShaderPermutationCache& out_cache, const ShaderPermutationCacheDesc& desc);
+
+/**
+ * Returns the permutation for a feature mask, compiling it on the first request.
+ * @param in_out_cache Cache to look the permutation up in.
+ * @param graphics_context Graphics context used to compile the permutation.
+ * @param features Feature mask.
+ * @return Index of the permutation in the cache, or -1 if it failed to compile.
+ */
+i32 GetOrCreatePermutation(ShaderPermutationCache& in_out_cache, const Rndr::GraphicsContext& graphics_context, MaterialFeatures features);
+
+/**
+ * Picks the permutation of every material, compiling the ones that are missing.
+ * @param out_material_permutations Permutation index of each material, in the material order.
+ * @param in_out_cache Cache to take the permutations from.
+ * @param graphics_context Graphics context used to compile the permutations.
+ * @param materials Materials of the scene.
+ * @return True if all permutations were compiled, false otherwise.
+ */
+bool AssignMaterialPermutations(Opal::DynamicArray<u32>& out_material_permutations, ShaderPermutationCache& in_out_cache,
+                                const Rndr::GraphicsContext& graphics_context, const Opal::ArrayView<const MaterialDescription>& materials);
+
+}  // namespace ShaderPermutations
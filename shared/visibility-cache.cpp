@@ -0,0 +1,255 @@
+#include "visibility-cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <limits>
+
+#include "opal/time.h"
+
+#include "rndr/log.h"
+
+namespace
+{
+/** Number of shapes processed by a single task when the cache is updated on multiple threads. */
+constexpr size_t k_shapes_per_task = 2048;
+
+constexpr u64 k_never_visible = std::numeric_limits<u64>::max();
+
+Rndr::Vector4f NormalizePlane(const Rndr::Vector4f& plane)
+{
+    const f32 length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+    const f32 inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+    return {plane.x * inv_length, plane.y * inv_length, plane.z * inv_length, plane.w * inv_length};
+}
+
+/**
+ * Upper bound of how much the signed distance of any box inside the scene sphere to any plane changed between the two
+ * frustums. Distance of a box is center distance plus projected extent, and both terms can change when the plane rotates.
+ */
+f64 CalculatePlaneMotion(const Rndr::Vector4f (&previous_planes)[Frustum::k_plane_count], const Rndr::Vector4f (&planes)[Frustum::k_plane_count],
+                         const Rndr::Point3f& scene_center, f32 scene_radius)
+{
+    f64 motion = 0.0;
+    for (i32 i = 0; i < Frustum::k_plane_count; ++i)
+    {
+        const f64 dx = planes[i].x - previous_planes[i].x;
+        const f64 dy = planes[i].y - previous_planes[i].y;
+        const f64 dz = planes[i].z - previous_planes[i].z;
+        const f64 dw = planes[i].w - previous_planes[i].w;
+        const f64 center_motion = std::abs(dx * scene_center.x + dy * scene_center.y + dz * scene_center.z + dw);
+        const f64 normal_motion = std::sqrt(dx * dx + dy * dy + dz * dz);
+        motion = std::max(motion, center_motion + 2.0 * normal_motion * scene_radius);
+    }
+    return motion;
+}
+
+/**
+ * Tests the shape against normalized planes and stores its classification, visibility and the accumulated motion at which
+ * its visibility might change.
+ */
+void TestShape(VisibilityCache& cache, const Rndr::Vector4f (&planes)[Frustum::k_plane_count], const ShapeBounds& bounds, size_t i)
+{
+    u16 classification = 0;
+    f32 min_visible_margin = std::numeric_limits<f32>::max();
+    f32 max_outside_margin = 0.0f;
+    bool is_visible = true;
+    for (i32 p = 0; p < Frustum::k_plane_count; ++p)
+    {
+        const Rndr::Vector4f& plane = planes[p];
+        const f32 distance = plane.x * bounds.center_x[i] + plane.y * bounds.center_y[i] + plane.z * bounds.center_z[i] + plane.w;
+        const f32 radius = std::abs(plane.x) * bounds.extent_x[i] + std::abs(plane.y) * bounds.extent_y[i] + std::abs(plane.z) * bounds.extent_z[i];
+        PlaneClassification plane_classification = PlaneClassification::Intersecting;
+        if (distance + radius < 0.0f)
+        {
+            plane_classification = PlaneClassification::Outside;
+            is_visible = false;
+            max_outside_margin = std::max(max_outside_margin, -(distance + radius));
+        }
+        else if (distance - radius >= 0.0f)
+        {
+            plane_classification = PlaneClassification::Inside;
+        }
+        min_visible_margin = std::min(min_visible_margin, distance + radius);
+        classification |= static_cast<u16>(static_cast<u16>(plane_classification) << (2 * p));
+    }
+
+    cache.classifications[i] = classification;
+    // Visible shape stays visible until some plane moves past it, culled one stays culled while its farthest separating
+    // plane keeps it out.
+    cache.retest_motion[i] = cache.accumulated_motion + (is_visible ? min_visible_margin : max_outside_margin);
+    if (is_visible)
+    {
+        cache.last_visible_frame[i] = cache.frame_index;
+    }
+}
+
+void GrowSphere(Rndr::Point3f& center, f32& radius, const ShapeBounds& bounds, size_t i)
+{
+    const f32 dx = bounds.center_x[i] - center.x;
+    const f32 dy = bounds.center_y[i] - center.y;
+    const f32 dz = bounds.center_z[i] - center.z;
+    const f32 extent = std::sqrt(bounds.extent_x[i] * bounds.extent_x[i] + bounds.extent_y[i] * bounds.extent_y[i] +
+                                 bounds.extent_z[i] * bounds.extent_z[i]);
+    radius = std::max(radius, std::sqrt(dx * dx + dy * dy + dz * dz) + extent);
+}
+
+void CalculateSceneSphere(VisibilityCache& cache, const ShapeBounds& bounds)
+{
+    const size_t shape_count = bounds.center_x.GetSize();
+    f32 min[3] = {std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max()};
+    f32 max[3] = {std::numeric_limits<f32>::lowest(), std::numeric_limits<f32>::lowest(), std::numeric_limits<f32>::lowest()};
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        min[0] = std::min(min[0], bounds.center_x[i] - bounds.extent_x[i]);
+        min[1] = std::min(min[1], bounds.center_y[i] - bounds.extent_y[i]);
+        min[2] = std::min(min[2], bounds.center_z[i] - bounds.extent_z[i]);
+        max[0] = std::max(max[0], bounds.center_x[i] + bounds.extent_x[i]);
+        max[1] = std::max(max[1], bounds.center_y[i] + bounds.extent_y[i]);
+        max[2] = std::max(max[2], bounds.center_z[i] + bounds.extent_z[i]);
+    }
+    cache.scene_center = Rndr::Point3f(0.5f * (min[0] + max[0]), 0.5f * (min[1] + max[1]), 0.5f * (min[2] + max[2]));
+    cache.scene_radius = 0.0f;
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        GrowSphere(cache.scene_center, cache.scene_radius, bounds, i);
+    }
+}
+
+template <typename Function>
+void ForEachShapeRange(size_t shape_count, const Function& function)
+{
+    if (shape_count <= Culling::k_parallel_shape_count)
+    {
+        function(0, shape_count);
+        return;
+    }
+    Opal::DynamicArray<size_t> task_starts;
+    task_starts.Reserve(shape_count / k_shapes_per_task + 1);
+    for (size_t start = 0; start < shape_count; start += k_shapes_per_task)
+    {
+        task_starts.PushBack(start);
+    }
+    std::for_each(std::execution::par, task_starts.begin(), task_starts.end(),
+                  [&](size_t start) { function(start, std::min(start + k_shapes_per_task, shape_count)); });
+}
+
+}  // namespace
+
+void Culling::SetupVisibilityCache(VisibilityCache& out_cache, const VisibilityCacheDesc& desc)
+{
+    out_cache = {};
+    out_cache.desc = desc;
+    out_cache.desc.revalidation_interval = std::max(desc.revalidation_interval, 1u);
+}
+
+bool Culling::CullShapesCached(CullingResult& out_result, VisibilityCache& cache, const Frustum& frustum, const ShapeBounds& bounds,
+                               const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands,
+                               const Opal::ArrayView<const u32>& changed_shapes)
+{
+    const size_t shape_count = draw_commands.GetSize();
+    if (bounds.center_x.GetSize() != shape_count)
+    {
+        RNDR_LOG_ERROR("CullShapesCached: Shape bounds and draw commands are out of sync!");
+        return false;
+    }
+
+    const f64 start_time = Opal::GetSeconds();
+
+    Rndr::Vector4f planes[Frustum::k_plane_count];
+    for (i32 i = 0; i < Frustum::k_plane_count; ++i)
+    {
+        planes[i] = NormalizePlane(frustum.planes[i]);
+    }
+
+    ++cache.frame_index;
+    const bool is_full_revalidation = !cache.is_valid || cache.last_visible_frame.GetSize() != shape_count ||
+                                      cache.frame_index - cache.last_revalidation_frame >= cache.desc.revalidation_interval;
+    if (is_full_revalidation)
+    {
+        cache.last_visible_frame.Resize(shape_count);
+        cache.classifications.Resize(shape_count);
+        cache.retest_motion.Resize(shape_count);
+        cache.needs_test.Resize(shape_count);
+        std::fill(cache.last_visible_frame.begin(), cache.last_visible_frame.end(), k_never_visible);
+        std::fill(cache.needs_test.begin(), cache.needs_test.end(), static_cast<u8>(1));
+        CalculateSceneSphere(cache, bounds);
+        cache.accumulated_motion = 0.0;
+        cache.last_revalidation_frame = cache.frame_index;
+        cache.is_valid = true;
+    }
+    else
+    {
+        cache.accumulated_motion += CalculatePlaneMotion(cache.previous_planes, planes, cache.scene_center, cache.scene_radius);
+        for (const u32 shape : changed_shapes)
+        {
+            GrowSphere(cache.scene_center, cache.scene_radius, bounds, shape);
+            cache.needs_test[shape] = 1;
+        }
+    }
+    std::copy(std::begin(planes), std::end(planes), std::begin(cache.previous_planes));
+
+    // Shapes that are not tested keep the visibility from the previous frame.
+    const u64 previous_frame = cache.frame_index - 1;
+    ForEachShapeRange(shape_count,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t i = begin; i < end; ++i)
+                          {
+                              if (cache.needs_test[i] != 0 || cache.accumulated_motion >= cache.retest_motion[i])
+                              {
+                                  cache.needs_test[i] = 1;
+                                  TestShape(cache, planes, bounds, i);
+                              }
+                              else if (cache.last_visible_frame[i] == previous_frame)
+                              {
+                                  cache.last_visible_frame[i] = cache.frame_index;
+                              }
+                          }
+                      });
+
+    u64 tested_count = 0;
+    out_result.visibility.Resize(shape_count);
+    out_result.draw_commands.Clear();
+    out_result.model_indices.Clear();
+    out_result.draw_commands.Reserve(shape_count);
+    out_result.model_indices.Reserve(shape_count);
+    for (size_t i = 0; i < shape_count; ++i)
+    {
+        tested_count += cache.needs_test[i];
+        cache.needs_test[i] = 0;
+        const bool is_visible = cache.last_visible_frame[i] == cache.frame_index;
+        out_result.visibility[i] = static_cast<u8>(is_visible);
+        if (is_visible)
+        {
+            out_result.draw_commands.PushBack(draw_commands[i]);
+            out_result.model_indices.PushBack(static_cast<u32>(i));
+        }
+    }
+
+    const f64 cull_time_ms = (Opal::GetSeconds() - start_time) * 1000.0;
+    if (is_full_revalidation && shape_count > 0)
+    {
+        cache.test_time_per_shape_ms = cull_time_ms / static_cast<f64>(shape_count);
+    }
+
+    out_result.stats.total_count = shape_count;
+    out_result.stats.visible_count = out_result.draw_commands.GetSize();
+    out_result.stats.culled_count = shape_count - out_result.draw_commands.GetSize();
+    out_result.stats.cull_time_ms = cull_time_ms;
+
+    cache.stats.tested_count = tested_count;
+    cache.stats.reused_count = shape_count - tested_count;
+    cache.stats.hit_rate = shape_count > 0 ? static_cast<f64>(cache.stats.reused_count) / static_cast<f64>(shape_count) : 0.0;
+    cache.stats.was_full_revalidation = is_full_revalidation;
+    cache.stats.cull_time_ms = cull_time_ms;
+    cache.stats.saved_time_ms = static_cast<f64>(cache.stats.reused_count) * cache.test_time_per_shape_ms;
+    return true;
+}
+
+PlaneClassification Culling::GetCachedClassification(const VisibilityCache& cache, u32 shape_index, i32 plane_index)
+{
+    RNDR_ASSERT(shape_index < cache.classifications.GetSize(), "Shape index out of range");
+    RNDR_ASSERT(plane_index >= 0 && plane_index < Frustum::k_plane_count, "Plane index out of range");
+    return static_cast<PlaneClassification>((cache.classifications[shape_index] >> (2 * plane_index)) & 0x3);
+}
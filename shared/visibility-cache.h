@@ -0,0 +1,122 @@
+#pragma once
+
+#include "opal/container/array-view.h"
+#include "opal/container/dynamic-array.h"
+
+#include "rndr/graphics-types.h"
+#include "rndr/math.h"
+
+#include "culling.h"
+
+/**
+ * Classification of a shape against a single frustum plane.
+ */
+enum class PlaneClassification : u8
+{
+    Inside = 0,
+    Intersecting = 1,
+    Outside = 2
+};
+
+/**
+ * Configuration of the visibility cache.
+ */
+struct VisibilityCacheDesc
+{
+    /** Every this many frames all shapes are tested regardless of the cached state. */
+    u32 revalidation_interval = 60;
+};
+
+/**
+ * Per frame counters of the visibility cache.
+ */
+struct VisibilityCacheStats
+{
+    /** Number of shapes that were tested against the frustum this frame. */
+    u64 tested_count = 0;
+    /** Number of shapes whose cached visibility was reused. */
+    u64 reused_count = 0;
+    /** Ratio of reused shapes to all shapes. */
+    f64 hit_rate = 0.0;
+    /** True if all shapes were tested because of the periodic revalidation or a reset. */
+    bool was_full_revalidation = false;
+    /** Time spent in culling this frame in milliseconds. */
+    f64 cull_time_ms = 0.0;
+    /** Estimated time that testing the reused shapes would take, based on the cost measured in full revalidations. */
+    f64 saved_time_ms = 0.0;
+};
+
+/**
+ * Keeps the frustum test results of all shapes between frames. Each shape stores how far the frustum planes can move before
+ * its visibility can change. Camera motion is accumulated every frame as the largest distance any plane moved within the
+ * scene bounds, and only shapes whose margin is used up, or whose transform changed, are tested again.
+ */
+struct VisibilityCache
+{
+    VisibilityCacheDesc desc;
+
+    /** Frame in which each shape was last visible, or UINT64_MAX if it was never visible. */
+    Opal::DynamicArray<u64> last_visible_frame;
+
+    /** Two bits per frustum plane holding the PlaneClassification from the last test of each shape. */
+    Opal::DynamicArray<u16> classifications;
+
+    /** Accumulated camera motion after which each shape needs to be tested again. */
+    Opal::DynamicArray<f64> retest_motion;
+
+    /** Scratch array with one entry per shape set if the shape needs a test this frame. */
+    Opal::DynamicArray<u8> needs_test;
+
+    /** Normalized planes of the previous frame. */
+    Rndr::Vector4f previous_planes[Frustum::k_plane_count];
+
+    /** Sphere containing all shape bounds, used to bound the movement of the planes. */
+    Rndr::Point3f scene_center;
+    f32 scene_radius = 0.0f;
+
+    /** Sum of the largest plane movements of all frames since the last revalidation. */
+    f64 accumulated_motion = 0.0;
+
+    /** Cost of testing one shape measured in the last full revalidation. */
+    f64 test_time_per_shape_ms = 0.0;
+
+    u64 frame_index = 0;
+    u64 last_revalidation_frame = 0;
+    bool is_valid = false;
+
+    VisibilityCacheStats stats;
+};
+
+namespace Culling
+{
+
+/**
+ * Sets up an empty cache. First call to CullShapesCached tests all shapes.
+ * @param out_cache The cache to set up.
+ * @param desc The configuration.
+ */
+void SetupVisibilityCache(VisibilityCache& out_cache, const VisibilityCacheDesc& desc = {});
+
+/**
+ * Frustum culls the shapes reusing the results of the previous frames for the shapes far enough from the plane boundaries.
+ * @param out_result The result in the same form as Culling::CullShapes.
+ * @param cache The visibility cache.
+ * @param frustum The camera frustum in world space.
+ * @param bounds World space bounds of the shapes.
+ * @param draw_commands Draw commands of all shapes, in the shape order.
+ * @param changed_shapes Shapes whose bounds changed since the last call. They are always tested.
+ * @return True if culling was successful, false if the input arrays are out of sync.
+ */
+bool CullShapesCached(CullingResult& out_result, VisibilityCache& cache, const Frustum& frustum, const ShapeBounds& bounds,
+                      const Opal::ArrayView<const Rndr::DrawIndicesData>& draw_commands, const Opal::ArrayView<const u32>& changed_shapes);
+
+/**
+ * Returns the classification of a shape against a frustum plane from its last test.
+ * @param cache The visibility cache.
+ * @param shape_index Index of the shape.
+ * @param plane_index Index of the plane in the Frustum::planes.
+ * @return The classification.
+ */
+PlaneClassification GetCachedClassification(const VisibilityCache& cache, u32 shape_index, i32 plane_index);
+
+}  // namespace Culling